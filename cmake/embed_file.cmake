@@ -0,0 +1,23 @@
+# Write the bytes of INPUT into OUTPUT as a C++ array
+#   cmake -DINPUT=<file> -DOUTPUT=<file.cpp> -DSYMBOL=<name> -P embed_file.cmake
+# Defines `const unsigned char SYMBOL[]` and `const size_t SYMBOL_size`.
+
+file(READ "${INPUT}" content HEX)
+string(LENGTH "${content}" hex_length)
+math(EXPR byte_count "${hex_length} / 2")
+
+# 0x.. per byte, 16 bytes per line
+string(REGEX REPLACE "([0-9a-f][0-9a-f])" "0x\\1," bytes "${content}")
+string(REPEAT "0x[0-9a-f][0-9a-f]," 16 line_pattern)
+string(REGEX REPLACE "(${line_pattern})" "\\1\n    " bytes "${bytes}")
+
+get_filename_component(input_name "${INPUT}" NAME)
+file(WRITE "${OUTPUT}"
+"// Generated from ${input_name} by cmake/embed_file.cmake - do not edit
+#include <cstddef>
+
+extern const unsigned char ${SYMBOL}[] = {
+    ${bytes}
+};
+extern const size_t ${SYMBOL}_size = ${byte_count};
+")
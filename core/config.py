@@ -16,6 +16,17 @@ DEFAULT_CONFIG = {
     "jobs_dir": str(PROJECT_ROOT / "jobs"),
     "server": {"host": "127.0.0.1", "port": 8000},
     "logging": {"level": "INFO"},
+    "gpu": {"devices": [0]},
+    "sun_path": {"native": True},
+    "gas_cache": {"vram_budget_mb": 1024, "disk": True},
+    "memory_pool": {"enabled": True, "release_threshold_mb": 1024},
+    "lod": {"enabled": False, "min_distance_m": 100.0, "max_angle_deg": 1.0, "cache_entries": 1024},
+    "adaptive": {"enabled": False, "tolerance_deg": 10.0},
+    "optix_cache": {"dir": None},
+    "scheduler": {"queue_size": 64, "prefetch": 2, "merge_max_faces": 200000},
+    "progressive": {"passes": 4, "min_rays": 1e9},
+    "uploads": {"max_mb": 4096},
+    "results": {"write_usd": True, "write_csv": True},
 }
 
 
@@ -47,6 +58,77 @@ SERVER_PORT = config["server"]["port"]
 
 LOG_LEVEL = config["logging"]["level"]
 
+# CUDA devices to trace on; more than one splits target faces across them
+GPU_DEVICES = [int(d) for d in config.get("gpu", {}).get("devices", [0])]
+
+# Generate sun vectors on the GPU (solar_engine_optix.sun_path) instead of ladybug
+NATIVE_SUN_PATH = bool(config.get("sun_path", {}).get("native", True))
+
+# Compacted context GAS kept per device after their meshes go away (LRU within
+# the budget), and relocatable copies on disk under jobs/gas_cache shared by
+# every worker. A budget of 0 with disk off disables the cache.
+_gas_cache = config.get("gas_cache", {})
+GAS_CACHE_VRAM_BUDGET = int(float(_gas_cache.get("vram_budget_mb", 1024)) * 2**20)
+GAS_CACHE_DIR = JOBS_DIR / "gas_cache" if _gas_cache.get("disk", True) else None
+
+# Per-GPU pool for per-job buffers (trace inputs / results, GAS and IAS build
+# scratch), reused across jobs. Up to release_threshold_mb of idle VRAM stays
+# reserved between jobs; disabled = cudaMalloc / cudaFree per buffer.
+_memory_pool = config.get("memory_pool", {})
+MEMORY_POOL_ENABLED = bool(_memory_pool.get("enabled", True))
+MEMORY_POOL_RELEASE_THRESHOLD = int(float(_memory_pool.get("release_threshold_mb", 1024)) * 2**20)
+
+# Far-field level of detail: context farther than min_distance_m from the
+# target bounds is traced against vertex-clustered proxies whose vertices move
+# by at most max_angle_deg as seen from the target, so only suns within that
+# angle of a shadow edge can change. Proxies of up to cache_entries
+# (mesh, detail level) pairs are kept between jobs.
+_lod = config.get("lod", {})
+LOD_ENABLED = bool(_lod.get("enabled", False))
+LOD_MIN_DISTANCE = float(_lod.get("min_distance_m", 100.0))
+LOD_MAX_ANGLE_DEG = float(_lod.get("max_angle_deg", 1.0))
+LOD_CACHE_ENTRIES = int(_lod.get("cache_entries", 1024))
+
+# Adaptive sun sampling of sun-hour / direct radiation runs: suns tolerance_deg
+# apart along the path are traced first, and only faces whose visibility flips
+# between two of them are traced against the suns in between. A shadow that
+# comes and goes within tolerance_deg of sun travel (~4 min per degree) can be
+# missed. Traces with visibility output or supersampling trace every sun.
+_adaptive = config.get("adaptive", {})
+ADAPTIVE_ENABLED = bool(_adaptive.get("enabled", False))
+ADAPTIVE_TOLERANCE_DEG = float(_adaptive.get("tolerance_deg", 10.0))
+
+# OptiX's compiled-module disk cache, shared by every worker (default jobs/optix_cache)
+_optix_cache_dir = config.get("optix_cache", {}).get("dir")
+OPTIX_CACHE_DIR = Path(_optix_cache_dir) if _optix_cache_dir else JOBS_DIR / "optix_cache"
+OPTIX_CACHE_DIR.mkdir(exist_ok=True, parents=True)
+
+# Server job scheduler: submissions beyond queue_size are refused (503), up to
+# prefetch parsed jobs per GPU wait ready while the GPU traces, and ready jobs
+# on the same scene are merged into one launch up to merge_max_faces faces
+_scheduler = config.get("scheduler", {})
+SCHEDULER_QUEUE_SIZE = int(_scheduler.get("queue_size", 64))
+SCHEDULER_PREFETCH = int(_scheduler.get("prefetch", 2))
+SCHEDULER_MERGE_MAX_FACES = int(_scheduler.get("merge_max_faces", 200000))
+
+# Server jobs of at least min_rays (faces x suns) trace in passes over
+# interleaved sun subsets; after each pass a scaled-up preview of the results
+# is published (GET /events/{job_id}, /preview/{job_id}). passes 1 = one launch.
+_progressive = config.get("progressive", {})
+PROGRESSIVE_PASSES = int(_progressive.get("passes", 4))
+PROGRESSIVE_MIN_RAYS = float(_progressive.get("min_rays", 1e9))
+
+# Content-addressed uploads (jobs/blobs); max_mb caps one decoded upload
+_uploads = config.get("uploads", {})
+BLOBS_DIR = JOBS_DIR / "blobs"
+UPLOAD_MAX_BYTES = int(float(_uploads.get("max_mb", 4096)) * 2**20)
+
+# Every job stores its results as compact SOBR (results_codec); the colored
+# results USD and the CSV are extra, and a job can override write_usd
+_results = config.get("results", {})
+RESULTS_WRITE_USD = bool(_results.get("write_usd", True))
+RESULTS_WRITE_CSV = bool(_results.get("write_csv", True))
+
 # Project structure
 CORE_DIR = PROJECT_ROOT / "core"
 INTEGRATIONS_DIR = PROJECT_ROOT / "integrations"
@@ -88,6 +170,26 @@ if __name__ == "__main__":
     print(f"CUDA binary: {CUDA_BIN}")
     print(f"Jobs directory: {JOBS_DIR}")
     print(f"Server: {SERVER_HOST}:{SERVER_PORT}")
+    print(f"GPU devices: {GPU_DEVICES}")
+    print(f"Native sun path: {NATIVE_SUN_PATH}")
+    print(f"GAS cache: {GAS_CACHE_VRAM_BUDGET // 2**20} MB VRAM, disk {GAS_CACHE_DIR}")
+    print(
+        f"Memory pool: {'on' if MEMORY_POOL_ENABLED else 'off'}, "
+        f"keeps {MEMORY_POOL_RELEASE_THRESHOLD // 2**20} MB"
+    )
+    print(
+        f"LOD: {'on' if LOD_ENABLED else 'off'}, beyond {LOD_MIN_DISTANCE:g} m, "
+        f"<= {LOD_MAX_ANGLE_DEG:g} deg"
+    )
+    print(f"Adaptive suns: {'on' if ADAPTIVE_ENABLED else 'off'}, every {ADAPTIVE_TOLERANCE_DEG:g} deg")
+    print(f"OptiX cache: {OPTIX_CACHE_DIR}")
+    print(
+        f"Scheduler: queue {SCHEDULER_QUEUE_SIZE}, prefetch {SCHEDULER_PREFETCH}/GPU, "
+        f"merge up to {SCHEDULER_MERGE_MAX_FACES} faces"
+    )
+    print(f"Progressive: {PROGRESSIVE_PASSES} passes from {PROGRESSIVE_MIN_RAYS:g} rays")
+    print(f"Uploads: {BLOBS_DIR}, up to {UPLOAD_MAX_BYTES // 2**20} MB each")
+    print(f"Results: SOBR, USD {RESULTS_WRITE_USD}, CSV {RESULTS_WRITE_CSV}")
     print("=" * 60)
     print()
     validate_config()
@@ -0,0 +1,205 @@
+#include "adaptive.h"
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+double3 unit(float3 d)
+{
+    const double len = std::sqrt(double(d.x) * d.x + double(d.y) * d.y + double(d.z) * d.z);
+    if (!(len > 0.0))
+        return make_double3(0.0, 0.0, 0.0);
+    return make_double3(d.x / len, d.y / len, d.z / len);
+}
+
+bool lit(const uint32_t *row, size_t sun)
+{
+    return (row[sun >> 5] >> (sun & 31)) & 1u;
+}
+
+double dot(const double3 &a, const double3 &b)
+{
+    return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+// A face's -normal . direction: cos(incidence) times the normal's length
+double facing(const float3 &n, const double3 &d)
+{
+    return -(n.x * d.x + n.y * d.y + n.z * d.z);
+}
+
+// cos(incidence) above which the solar raygen traces a sun (optix_programs.cu);
+// at or below it a sun counts as back-facing, lit or not
+constexpr double MIN_FACING_COS = 0.001;
+
+// How fill_coarse_intervals handles one face's interior of an interval
+enum InteriorFill
+{
+    INTERIOR_NONE,  // Adds nothing: shadowed, or no interior sun faces the face
+    INTERIOR_SUMS,  // Lit and every interior sun facing: the interval's sums
+    INTERIOR_SUNS,  // Lit but grazing: the facing interior suns one by one
+    INTERIOR_REFINE // Traced again over the interior
+};
+} // namespace
+
+std::vector<uint32_t> plan_coarse_suns(const float3 *sun_directions, size_t count, float tolerance)
+{
+    std::vector<uint32_t> coarse;
+    if (count == 0)
+        return coarse;
+
+    const double min_cos = std::cos(static_cast<double>(tolerance));
+    size_t begin = 0;
+    coarse.push_back(0);
+    while (begin + 1 < count)
+    {
+        // Grow the interval while its far end stays within tolerance of its first sun
+        const double3 first = unit(sun_directions[begin]);
+        size_t end = begin + 1;
+        while (end + 1 < count)
+        {
+            const double3 next = unit(sun_directions[end + 1]);
+            if (dot(first, next) < min_cos)
+                break;
+            end++;
+        }
+        coarse.push_back(static_cast<uint32_t>(end));
+        begin = end;
+    }
+    return coarse;
+}
+
+void fill_coarse_intervals(const float3 *normals, size_t face_count, const float3 *sun_directions,
+                           const float *sun_weights, const std::vector<uint32_t> &coarse,
+                           const uint32_t *visibility, float *results, AdaptiveRefinement &refine)
+{
+    refine.intervals.clear();
+    refine.offsets.clear();
+    refine.faces.clear();
+    if (coarse.size() < 2)
+        return;
+
+    // Per interval: the unit coarse suns at its ends, the widest angle between
+    // its first sun and an interior one (cos, sin), and the interior sums (sun
+    // count, or the weighted direction sum whose dot product with a normal is
+    // the interior's weighted cos(incidence))
+    const size_t intervals = coarse.size() - 1;
+    std::vector<double3> ends(coarse.size());
+    for (size_t k = 0; k < coarse.size(); k++)
+        ends[k] = unit(sun_directions[coarse[k]]);
+    std::vector<double3> weighted(sun_weights ? intervals : 0, make_double3(0.0, 0.0, 0.0));
+    std::vector<double2> spread(intervals, make_double2(1.0, 0.0));
+    for (size_t i = 0; i < intervals; i++)
+    {
+        const double3 first = ends[i];
+        for (uint32_t s = coarse[i] + 1; s < coarse[i + 1]; s++)
+        {
+            const double3 d = unit(sun_directions[s]);
+            spread[i].x = std::min(spread[i].x, dot(first, d));
+            if (sun_weights)
+            {
+                weighted[i].x += sun_weights[s] * d.x;
+                weighted[i].y += sun_weights[s] * d.y;
+                weighted[i].z += sun_weights[s] * d.z;
+            }
+        }
+        spread[i].x = std::max(spread[i].x, -1.0);
+        spread[i].y = std::sqrt(1.0 - spread[i].x * spread[i].x);
+    }
+
+    // What one face's interior in interval i gets. The raygen only traces suns
+    // past its facing threshold, so the spread bounds the face's cos(incidence)
+    // over the interior: all facing suns fill from the sums, a grazing face sun
+    // by sun, none facing adds nothing. An end unlit because it faces away says
+    // nothing about shadows in between, so facing interiors there are traced;
+    // an interior between two shadowed ends is taken as shadowed.
+    const auto classify = [&](const uint32_t *row, const float3 &n, size_t i)
+    {
+        if (coarse[i + 1] - coarse[i] <= 1)
+            return INTERIOR_NONE;
+        const bool a = lit(row, i), b = lit(row, i + 1);
+        if (a != b)
+            return INTERIOR_REFINE;
+        const double length = std::sqrt(double(n.x) * n.x + double(n.y) * n.y + double(n.z) * n.z);
+        if (!(length > 0.0))
+            return INTERIOR_NONE; // Never facing a sun
+        const double cos_first = facing(n, ends[i]) / length;
+        const double sin_first = std::sqrt(std::max(0.0, 1.0 - cos_first * cos_first));
+        if (a)
+        {
+            const double lowest = cos_first * spread[i].x - sin_first * spread[i].y;
+            return length * lowest > MIN_FACING_COS ? INTERIOR_SUMS : INTERIOR_SUNS;
+        }
+        const double highest = cos_first >= spread[i].x ? 1.0 : cos_first * spread[i].x + sin_first * spread[i].y;
+        if (length * highest <= MIN_FACING_COS)
+            return INTERIOR_NONE;
+        if (facing(n, ends[i]) > MIN_FACING_COS && facing(n, ends[i + 1]) > MIN_FACING_COS)
+            return INTERIOR_NONE; // Shadowed at both ends
+        for (uint32_t s = coarse[i] + 1; s < coarse[i + 1]; s++)
+            if (facing(n, unit(sun_directions[s])) > MIN_FACING_COS)
+                return INTERIOR_REFINE;
+        return INTERIOR_NONE;
+    };
+
+    // Pass 1 fills intervals and counts faces to refine per interval, pass 2
+    // places the faces (rows are read in order both times)
+    const size_t words = (coarse.size() + 31) / 32;
+    std::vector<size_t> starts(intervals + 1, 0);
+    for (size_t f = 0; f < face_count; f++)
+    {
+        const uint32_t *row = visibility + f * words;
+        const float3 n = normals[f];
+        for (size_t i = 0; i < intervals; i++)
+        {
+            switch (classify(row, n, i))
+            {
+            case INTERIOR_NONE:
+                break;
+            case INTERIOR_REFINE:
+                starts[i + 1]++;
+                break;
+            case INTERIOR_SUMS:
+                if (sun_weights)
+                    results[f] += static_cast<float>(std::max(0.0, facing(n, weighted[i])));
+                else
+                    results[f] += static_cast<float>(coarse[i + 1] - coarse[i] - 1);
+                break;
+            case INTERIOR_SUNS:
+            {
+                double sum = 0.0;
+                for (uint32_t s = coarse[i] + 1; s < coarse[i + 1]; s++)
+                {
+                    const double cos_sun = facing(n, unit(sun_directions[s]));
+                    if (cos_sun > MIN_FACING_COS)
+                        sum += sun_weights ? sun_weights[s] * cos_sun : 1.0;
+                }
+                results[f] += static_cast<float>(sum);
+                break;
+            }
+            }
+        }
+    }
+    for (size_t i = 0; i < intervals; i++)
+        starts[i + 1] += starts[i];
+
+    refine.faces.resize(starts[intervals]);
+    std::vector<size_t> next(starts.begin(), starts.end() - 1);
+    for (size_t f = 0; f < face_count; f++)
+    {
+        const uint32_t *row = visibility + f * words;
+        for (size_t i = 0; i < intervals; i++)
+        {
+            if (classify(row, normals[f], i) == INTERIOR_REFINE)
+                refine.faces[next[i]++] = static_cast<uint32_t>(f);
+        }
+    }
+
+    for (size_t i = 0; i < intervals; i++)
+    {
+        if (starts[i + 1] == starts[i])
+            continue;
+        refine.intervals.push_back(static_cast<uint32_t>(i));
+        refine.offsets.push_back(starts[i]);
+    }
+    refine.offsets.push_back(starts[intervals]);
+}
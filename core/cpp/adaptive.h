@@ -0,0 +1,39 @@
+#pragma once
+#include <cuda_runtime.h>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Adaptive sun sampling of time-ordered suns (TraceOptions::adaptive_tolerance).
+// A coarse subset of the suns is traced first, with visibility. Between two
+// neighbouring coarse suns (an interval) a face whose visibility agrees at
+// both ends is assumed to keep it for the suns in between (the interior),
+// which are filled in without rays; faces whose visibility flips are traced
+// again against the interior suns. Interior suns lie within the tolerance angle
+// of the interval's first sun, so only shadow features narrower than the
+// tolerance can fall between two coarse samples unseen.
+
+// Indices of the coarse suns: the first, the last, and every sun at which the
+// path has moved more than tolerance (radians) from the previous coarse sun.
+// Steps longer than tolerance (e.g. overnight) make intervals without interior.
+std::vector<uint32_t> plan_coarse_suns(const float3 *sun_directions, size_t count, float tolerance);
+
+// Faces to trace again, grouped by interval: interval intervals[k] (between
+// coarse suns k' = intervals[k] and k' + 1) refines faces[offsets[k] .. offsets[k + 1])
+struct AdaptiveRefinement
+{
+    std::vector<uint32_t> intervals;
+    std::vector<size_t> offsets;
+    std::vector<uint32_t> faces;
+};
+
+// Fill the interiors of a coarse trace. visibility holds face_count rows of
+// visibility_words(coarse.size()) words, bit i for coarse sun i. Where both
+// ends of an interval are lit, results gains what the raygen would give for
+// its interior if unshadowed: the suns (or weight * cos(incidence)) past its
+// 0.001 cos(incidence) facing threshold. Faces that flip go to refine, as do
+// faces unlit at an end only because it faces away while some interior sun
+// faces them.
+void fill_coarse_intervals(const float3 *normals, size_t face_count, const float3 *sun_directions,
+                           const float *sun_weights, const std::vector<uint32_t> &coarse,
+                           const uint32_t *visibility, float *results, AdaptiveRefinement &refine);
@@ -0,0 +1,185 @@
+#include "culling.h"
+#include <algorithm>
+#include <cmath>
+
+// Octahedral bins per axis: 16 x 16 bins of roughly 11 degrees
+constexpr int DIRECTION_BINS = 16;
+
+// Cone test slack for float error in the per-pair dot product (radians)
+constexpr double CONE_MARGIN = 1e-3;
+
+constexpr double HALF_PI = 1.57079632679489661923;
+
+static uint32_t direction_bin(float3 d)
+{
+    const float l1 = std::fabs(d.x) + std::fabs(d.y) + std::fabs(d.z);
+    if (!(l1 > 0.0f))
+        return 0;
+
+    // Octahedral projection, the lower hemisphere folded over the diagonals
+    float u = d.x / l1, v = d.y / l1;
+    if (d.z < 0.0f)
+    {
+        const float fu = (1.0f - std::fabs(v)) * (u < 0.0f ? -1.0f : 1.0f);
+        const float fv = (1.0f - std::fabs(u)) * (v < 0.0f ? -1.0f : 1.0f);
+        u = fu;
+        v = fv;
+    }
+    const int iu = std::min(DIRECTION_BINS - 1, static_cast<int>((u * 0.5f + 0.5f) * DIRECTION_BINS));
+    const int iv = std::min(DIRECTION_BINS - 1, static_cast<int>((v * 0.5f + 0.5f) * DIRECTION_BINS));
+    return static_cast<uint32_t>(std::max(iv, 0) * DIRECTION_BINS + std::max(iu, 0));
+}
+
+// Counting sort by bin, stable so faces of one bin keep their (spatial) order
+static std::vector<uint32_t> sort_by_bin(const float3 *directions, const std::vector<uint32_t> &indices)
+{
+    constexpr int bin_count = DIRECTION_BINS * DIRECTION_BINS;
+    std::vector<uint32_t> bins(indices.size());
+    std::vector<size_t> starts(bin_count + 1, 0);
+    for (size_t i = 0; i < indices.size(); i++)
+    {
+        bins[i] = direction_bin(directions[indices[i]]);
+        starts[bins[i] + 1]++;
+    }
+    for (int b = 0; b < bin_count; b++)
+        starts[b + 1] += starts[b];
+
+    std::vector<uint32_t> order(indices.size());
+    for (size_t i = 0; i < indices.size(); i++)
+        order[starts[bins[i]]++] = indices[i];
+    return order;
+}
+
+std::vector<uint32_t> cluster_directions(const float3 *directions, size_t count)
+{
+    std::vector<uint32_t> indices(count);
+    for (size_t i = 0; i < count; i++)
+        indices[i] = static_cast<uint32_t>(i);
+    return sort_by_bin(directions, indices);
+}
+
+std::vector<uint32_t> order_suns(const float3 *sun_directions, size_t count)
+{
+    std::vector<uint32_t> daylit;
+    daylit.reserve(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        if (sun_directions[i].z < 0.0f)
+            daylit.push_back(static_cast<uint32_t>(i));
+    }
+    return sort_by_bin(sun_directions, daylit);
+}
+
+namespace
+{
+// Unit axis and half angle around it of a set of directions. empty when every
+// direction is a zero vector (a zero normal or ray never counts as front-facing)
+struct Cone
+{
+    double x = 0.0, y = 0.0, z = 0.0;
+    double half_angle = 0.0;
+    bool empty = true;
+};
+
+Cone bounding_cone(const float3 *directions, int count, double sign)
+{
+    Cone cone;
+    double sx = 0.0, sy = 0.0, sz = 0.0;
+    for (int i = 0; i < count; i++)
+    {
+        const float3 d = directions[i];
+        const double len = std::sqrt(double(d.x) * d.x + double(d.y) * d.y + double(d.z) * d.z);
+        if (len > 0.0)
+        {
+            sx += sign * d.x / len;
+            sy += sign * d.y / len;
+            sz += sign * d.z / len;
+            cone.empty = false;
+        }
+    }
+    if (cone.empty)
+        return cone;
+
+    const double len = std::sqrt(sx * sx + sy * sy + sz * sz);
+    if (len < 1e-6)
+    {
+        // Directions cancel out: could point anywhere
+        cone.half_angle = 2.0 * HALF_PI;
+        return cone;
+    }
+    cone.x = sx / len;
+    cone.y = sy / len;
+    cone.z = sz / len;
+
+    double min_cos = 1.0;
+    for (int i = 0; i < count; i++)
+    {
+        const float3 d = directions[i];
+        const double len_i = std::sqrt(double(d.x) * d.x + double(d.y) * d.y + double(d.z) * d.z);
+        if (len_i > 0.0)
+            min_cos = std::min(min_cos, sign * (cone.x * d.x + cone.y * d.y + cone.z * d.z) / len_i);
+    }
+    cone.half_angle = std::acos(std::max(-1.0, std::min(1.0, min_cos)));
+    return cone;
+}
+
+// True when some normal of a may have a positive dot product with some ray of b
+bool may_face(const Cone &normals, const Cone &rays)
+{
+    if (normals.empty || rays.empty)
+        return false;
+    const double cos_axes = normals.x * rays.x + normals.y * rays.y + normals.z * rays.z;
+    const double axis_angle = std::acos(std::max(-1.0, std::min(1.0, cos_axes)));
+    return axis_angle - normals.half_angle - rays.half_angle < HALF_PI + CONE_MARGIN;
+}
+} // namespace
+
+std::vector<uint2> build_work_items(const float3 *normals, int face_count, const float3 *sun_directions,
+                                    int sun_count, int suns_per_thread)
+{
+    const int groups = (face_count + CULL_GROUP_FACES - 1) / CULL_GROUP_FACES;
+    const int slices = (sun_count + suns_per_thread - 1) / suns_per_thread;
+
+    std::vector<Cone> group_cones(groups);
+    for (int g = 0; g < groups; g++)
+    {
+        const int begin = g * CULL_GROUP_FACES;
+        group_cones[g] = bounding_cone(normals + begin, std::min(CULL_GROUP_FACES, face_count - begin), 1.0);
+    }
+
+    // Rays run against the sun vectors
+    std::vector<uint2> items;
+    for (int s = 0; s < slices; s++)
+    {
+        const int begin = s * suns_per_thread;
+        const Cone rays = bounding_cone(sun_directions + begin, std::min(suns_per_thread, sun_count - begin), -1.0);
+        for (int g = 0; g < groups; g++)
+        {
+            if (may_face(group_cones[g], rays))
+                items.push_back(make_uint2(static_cast<unsigned>(g), static_cast<unsigned>(s)));
+        }
+    }
+    return items;
+}
+
+void scatter_visibility(const uint32_t *visibility, const std::vector<uint32_t> &face_order,
+                        const std::vector<uint32_t> &sun_order, uint32_t *out, size_t out_words)
+{
+    const size_t words = (sun_order.size() + 31) / 32;
+    for (size_t f = 0; f < face_order.size(); f++)
+    {
+        const uint32_t *row = visibility + f * words;
+        uint32_t *out_row = out + static_cast<size_t>(face_order[f]) * out_words;
+        for (size_t w = 0; w < words; w++)
+        {
+            for (uint32_t bits = row[w]; bits; bits &= bits - 1)
+            {
+                int bit = 0;
+                while (!(bits & (1u << bit)))
+                    bit++;
+                const uint32_t sun = sun_order[w * 32 + bit];
+                out_row[sun >> 5] |= 1u << (sun & 31);
+            }
+        }
+    }
+}
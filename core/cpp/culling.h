@@ -0,0 +1,41 @@
+#pragma once
+#include <cuda_runtime.h>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "launch_params.h" // CULL_GROUP_FACES
+
+// Coherence pre-pass of RAYGEN_SOLAR traces (TraceOptions::cull). Faces are
+// clustered by normal and suns by direction, so the 32 neighbouring faces of a
+// warp agree on which suns face them, and (face group, sun slice) work items
+// in which no face can see any sun are dropped before the launch.
+
+// Stable order of count directions by octahedral direction bin: entry i is the
+// original index of the i-th direction (zero vectors share the first bin)
+std::vector<uint32_t> cluster_directions(const float3 *directions, size_t count);
+
+// Order of the suns traced: those at or below the horizon (z >= 0, the vector
+// points from the sun to the ground) are dropped, the rest clustered by direction
+std::vector<uint32_t> order_suns(const float3 *sun_directions, size_t count);
+
+// Work items of one tile over clustered faces and suns: (face group, sun
+// slice) pairs, slice-major, for which some face of the group may face some
+// sun of the slice. Conservative normal / direction cone test, so every
+// front-facing pair is kept.
+std::vector<uint2> build_work_items(const float3 *normals, int face_count, const float3 *sun_directions,
+                                    int sun_count, int suns_per_thread);
+
+// dst[i] = src[order[i]], stride elements per entry
+template <typename T>
+void gather(const T *src, const std::vector<uint32_t> &order, size_t stride, std::vector<T> &dst)
+{
+    dst.resize(order.size() * stride);
+    for (size_t i = 0; i < order.size(); i++)
+        for (size_t k = 0; k < stride; k++)
+            dst[i * stride + k] = src[order[i] * stride + k];
+}
+
+// OR a visibility matrix traced over reordered faces / suns into out, indexed
+// by the original face and sun (out_words words per row, already cleared)
+void scatter_visibility(const uint32_t *visibility, const std::vector<uint32_t> &face_order,
+                        const std::vector<uint32_t> &sun_order, uint32_t *out, size_t out_words);
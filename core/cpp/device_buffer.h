@@ -0,0 +1,169 @@
+#pragma once
+#include <cuda.h>
+#include <cuda_runtime.h>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include "error_check.h"
+
+// Stream-ordered memory pool of one device, owned by an engine so per-job
+// buffers (trace inputs / results, GAS and IAS build scratch) reuse the same
+// VRAM across jobs instead of a cudaMalloc / cudaFree pair each time. Freed
+// blocks stay reserved up to release_threshold_bytes between jobs.
+//
+// Allocations and frees are ordered on the legacy default stream, which the
+// engine's blocking streams and synchronous copies already serialize with.
+class DevicePool
+{
+public:
+    DevicePool(int device, size_t release_threshold_bytes)
+    {
+        cudaMemPoolProps props = {};
+        props.allocType = cudaMemAllocationTypePinned;
+        props.handleTypes = cudaMemHandleTypeNone;
+        props.location.type = cudaMemLocationTypeDevice;
+        props.location.id = device;
+        CUDA_CHECK(cudaMemPoolCreate(&pool_, &props));
+
+        uint64_t threshold = release_threshold_bytes;
+        cudaError_t err = cudaMemPoolSetAttribute(pool_, cudaMemPoolAttrReleaseThreshold, &threshold);
+        if (err != cudaSuccess)
+        {
+            cudaMemPoolDestroy(pool_);
+            throw_cuda_error(err, __FILE__, __LINE__);
+        }
+    }
+
+    ~DevicePool()
+    {
+        CUDA_WARN(cudaStreamSynchronize(0));
+        CUDA_WARN(cudaMemPoolDestroy(pool_));
+    }
+
+    DevicePool(const DevicePool &) = delete;
+    DevicePool &operator=(const DevicePool &) = delete;
+
+    // Stream-ordered pools need CUDA 11.2+ and driver support
+    static bool supported(int device)
+    {
+        int value = 0;
+        return cudaDeviceGetAttribute(&value, cudaDevAttrMemoryPoolsSupported, device) == cudaSuccess && value;
+    }
+
+    void *allocate(size_t bytes)
+    {
+        void *ptr = nullptr;
+        CUDA_CHECK(cudaMallocFromPoolAsync(&ptr, bytes, pool_, 0));
+        return ptr;
+    }
+
+    void free(void *ptr) { CUDA_WARN(cudaFreeAsync(ptr, 0)); }
+
+    // Hand every unused block back to the driver (OOM recovery); returns the bytes released
+    size_t trim()
+    {
+        const size_t before = reserved_bytes();
+        CUDA_WARN(cudaStreamSynchronize(0));
+        CUDA_WARN(cudaMemPoolTrimTo(pool_, 0));
+        const size_t after = reserved_bytes();
+        return before > after ? before - after : 0;
+    }
+
+    size_t reserved_bytes() const { return attribute(cudaMemPoolAttrReservedMemCurrent); }
+    size_t used_bytes() const { return attribute(cudaMemPoolAttrUsedMemCurrent); }
+    size_t peak_reserved_bytes() const { return attribute(cudaMemPoolAttrReservedMemHigh); }
+
+private:
+    size_t attribute(cudaMemPoolAttr attr) const
+    {
+        uint64_t value = 0;
+        if (cudaMemPoolGetAttribute(pool_, attr, &value) != cudaSuccess)
+        {
+            cudaGetLastError();
+            return 0;
+        }
+        return static_cast<size_t>(value);
+    }
+
+    cudaMemPool_t pool_ = nullptr;
+};
+
+// Owning device allocation of count T's, freed when it goes out of scope
+// (also when unwinding from a CudaError / OptixError). Drawn from pool when one
+// is given, otherwise a plain cudaMalloc.
+template <typename T>
+class DeviceBuffer
+{
+public:
+    DeviceBuffer() = default;
+    explicit DeviceBuffer(size_t count, DevicePool *pool = nullptr) { allocate(count, pool); }
+    ~DeviceBuffer() { reset(); }
+
+    DeviceBuffer(const DeviceBuffer &) = delete;
+    DeviceBuffer &operator=(const DeviceBuffer &) = delete;
+
+    DeviceBuffer(DeviceBuffer &&other) noexcept
+        : ptr_(std::exchange(other.ptr_, nullptr)), count_(std::exchange(other.count_, 0)),
+          pool_(std::exchange(other.pool_, nullptr)) {}
+
+    DeviceBuffer &operator=(DeviceBuffer &&other) noexcept
+    {
+        if (this != &other)
+        {
+            reset();
+            ptr_ = std::exchange(other.ptr_, nullptr);
+            count_ = std::exchange(other.count_, 0);
+            pool_ = std::exchange(other.pool_, nullptr);
+        }
+        return *this;
+    }
+
+    // Replace the contents with count uninitialized elements (none for 0)
+    void allocate(size_t count, DevicePool *pool = nullptr)
+    {
+        reset();
+        if (count)
+        {
+            if (pool)
+                ptr_ = static_cast<T *>(pool->allocate(count * sizeof(T)));
+            else
+                CUDA_CHECK(cudaMalloc((void **)&ptr_, count * sizeof(T)));
+        }
+        count_ = count;
+        pool_ = pool;
+    }
+
+    void reset()
+    {
+        if (ptr_)
+        {
+            if (pool_)
+                pool_->free(ptr_);
+            else
+                CUDA_WARN(cudaFree(ptr_));
+        }
+        ptr_ = nullptr;
+        count_ = 0;
+        pool_ = nullptr;
+    }
+
+    // Hand the allocation to a raw owner (e.g. a MeshGAS) that frees it with
+    // cudaFree; the buffer becomes empty. Not for pooled buffers.
+    T *release()
+    {
+        count_ = 0;
+        pool_ = nullptr;
+        return std::exchange(ptr_, nullptr);
+    }
+
+    T *get() const { return ptr_; }
+    CUdeviceptr ptr() const { return reinterpret_cast<CUdeviceptr>(ptr_); }
+    size_t size() const { return count_; }
+    size_t bytes() const { return count_ * sizeof(T); }
+    explicit operator bool() const { return ptr_ != nullptr; }
+
+private:
+    T *ptr_ = nullptr;
+    size_t count_ = 0;
+    DevicePool *pool_ = nullptr;
+};
@@ -0,0 +1,81 @@
+#pragma once
+#include <cuda_runtime.h>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+// Failed CUDA runtime call. Out-of-memory is its own type: the context stays
+// usable and the caller can retry with less (see SolarEngine::trace)
+class CudaError : public std::runtime_error
+{
+public:
+    CudaError(cudaError_t code, const char *file, int line)
+        : std::runtime_error(std::string("CUDA error ") + file + ":" + std::to_string(line) + " - " +
+                             cudaGetErrorString(code)),
+          code_(code) {}
+
+    cudaError_t code() const { return code_; }
+
+private:
+    cudaError_t code_;
+};
+
+class CudaOutOfMemory : public CudaError
+{
+public:
+    using CudaError::CudaError;
+};
+
+// Failed OptiX call; code is the OptixResult (kept as int so this header needs no OptiX)
+class OptixError : public std::runtime_error
+{
+public:
+    OptixError(int code, const char *message, const char *file, int line)
+        : std::runtime_error(std::string("OptiX error ") + file + ":" + std::to_string(line) + " - " + message),
+          code_(code) {}
+
+    int code() const { return code_; }
+
+private:
+    int code_;
+};
+
+[[noreturn]] inline void throw_cuda_error(cudaError_t err, const char *file, int line)
+{
+    // Clear the (non-sticky) error so the next call on this thread does not report it again
+    cudaGetLastError();
+    if (err == cudaErrorMemoryAllocation)
+        throw CudaOutOfMemory(err, file, line);
+    throw CudaError(err, file, line);
+}
+
+// Throw OptixError / CudaError (OPTIX_CHECK needs optix_stubs.h in the including file)
+#define OPTIX_CHECK(call)                                                          \
+    do                                                                             \
+    {                                                                              \
+        OptixResult res = call;                                                    \
+        if (res != OPTIX_SUCCESS)                                                  \
+            throw OptixError(res, optixGetErrorString(res), __FILE__, __LINE__);   \
+    } while (0)
+
+#define CUDA_CHECK(call)                                     \
+    do                                                       \
+    {                                                        \
+        cudaError_t err = call;                              \
+        if (err != cudaSuccess)                              \
+            throw_cuda_error(err, __FILE__, __LINE__);       \
+    } while (0)
+
+// Release paths (frees, destroys): report and carry on, safe in destructors
+// and while unwinding from an earlier error
+#define CUDA_WARN(call)                                                        \
+    do                                                                         \
+    {                                                                          \
+        cudaError_t err = call;                                                \
+        if (err != cudaSuccess)                                                \
+        {                                                                      \
+            std::cerr << "CUDA error " << __FILE__ << ":" << __LINE__ << " - " \
+                      << cudaGetErrorString(err) << std::endl;                 \
+            cudaGetLastError();                                                \
+        }                                                                      \
+    } while (0)
@@ -0,0 +1,533 @@
+#include "optix_solar.h"
+#include "error_check.h"
+#include "device_buffer.h"
+#include "log.h"
+#include <optix_stubs.h>
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <vector>
+
+// On-disk layout: header, then buffer_size bytes of relocatable GAS
+struct GasFileHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t flags; // bit 0 indexed, bit 1 allow_update
+    uint8_t digest[32]; // MeshDigest
+    uint64_t buffer_size;
+    uint64_t uncompacted_size;
+    uint64_t vertex_count;
+    uint64_t triangle_count;
+    OptixRelocationInfo relocation;
+};
+
+static const char GAS_FILE_MAGIC[8] = {'S', 'O', 'B', 'A', 'G', 'A', 'S', '\0'};
+constexpr uint32_t GAS_FILE_VERSION = 2;
+
+static std::mutex defaults_mutex;
+static size_t default_budget_bytes = 0;
+static std::string default_disk_dir;
+
+void set_gas_cache_defaults(size_t vram_budget_bytes, const std::string &disk_dir)
+{
+    std::lock_guard<std::mutex> lock(defaults_mutex);
+    default_budget_bytes = vram_budget_bytes;
+    default_disk_dir = disk_dir;
+}
+
+void init_gas_cache(OptiXSolar &optix)
+{
+    std::lock_guard<std::mutex> lock(defaults_mutex);
+    if (default_budget_bytes == 0 && default_disk_dir.empty())
+        return;
+    optix.gas_cache = std::make_unique<GasCache>(optix.device, default_budget_bytes, default_disk_dir);
+}
+
+// Incremental SHA-256 (FIPS 180-4)
+class Sha256
+{
+public:
+    void update(const void *data, size_t bytes)
+    {
+        const unsigned char *p = static_cast<const unsigned char *>(data);
+        total_ += bytes;
+        while (bytes)
+        {
+            const size_t n = std::min(bytes, sizeof(block_) - used_);
+            std::memcpy(block_ + used_, p, n);
+            used_ += n;
+            p += n;
+            bytes -= n;
+            if (used_ == sizeof(block_))
+            {
+                compress();
+                used_ = 0;
+            }
+        }
+    }
+
+    MeshDigest finish()
+    {
+        const uint64_t bits = total_ * 8;
+        const unsigned char pad = 0x80, zero = 0;
+        update(&pad, 1);
+        while (used_ != 56)
+            update(&zero, 1);
+        unsigned char length[8];
+        for (int i = 0; i < 8; i++)
+            length[i] = static_cast<unsigned char>(bits >> (56 - 8 * i));
+        update(length, 8);
+
+        MeshDigest digest;
+        for (int i = 0; i < 32; i++)
+            digest.bytes[i] = static_cast<uint8_t>(h_[i / 4] >> (24 - 8 * (i % 4)));
+        return digest;
+    }
+
+private:
+    static uint32_t rotr(uint32_t x, int n) { return (x >> n) | (x << (32 - n)); }
+
+    void compress()
+    {
+        static const uint32_t k[64] = {
+            0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+            0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+            0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+            0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+            0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+            0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+            0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+            0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+        uint32_t w[64];
+        for (int i = 0; i < 16; i++)
+            w[i] = (uint32_t(block_[4 * i]) << 24) | (uint32_t(block_[4 * i + 1]) << 16) |
+                   (uint32_t(block_[4 * i + 2]) << 8) | uint32_t(block_[4 * i + 3]);
+        for (int i = 16; i < 64; i++)
+        {
+            const uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            const uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+
+        uint32_t a = h_[0], b = h_[1], c = h_[2], d = h_[3], e = h_[4], f = h_[5], g = h_[6], h = h_[7];
+        for (int i = 0; i < 64; i++)
+        {
+            const uint32_t t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + k[i] + w[i];
+            const uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            h = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+        h_[0] += a;
+        h_[1] += b;
+        h_[2] += c;
+        h_[3] += d;
+        h_[4] += e;
+        h_[5] += f;
+        h_[6] += g;
+        h_[7] += h;
+    }
+
+    uint32_t h_[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+    unsigned char block_[64];
+    size_t used_ = 0;
+    uint64_t total_ = 0;
+};
+
+MeshDigest GasCache::mesh_digest(const MeshView &mesh, bool allow_update)
+{
+    const uint64_t shape[3] = {mesh.vertex_count, mesh.triangle_count,
+                               (mesh.indices ? 1ull : 0ull) | (allow_update ? 2ull : 0ull)};
+    Sha256 sha;
+    sha.update(shape, sizeof(shape));
+    sha.update(mesh.vertices, mesh.vertex_count * sizeof(float3));
+    if (mesh.indices)
+        sha.update(mesh.indices, mesh.triangle_count * sizeof(uint3));
+    return sha.finish();
+}
+
+GasCache::GasCache(int device, size_t vram_budget_bytes, const std::string &disk_dir)
+    : device_(device), budget_bytes_(vram_budget_bytes), disk_dir_(disk_dir)
+{
+    cudaDeviceProp prop;
+    CUDA_CHECK(cudaGetDeviceProperties(&prop, device));
+    static const char hex[] = "0123456789abcdef";
+    for (int i = 0; i < 16; i++)
+    {
+        const unsigned char b = static_cast<unsigned char>(prop.uuid.bytes[i]);
+        device_uuid_ += hex[b >> 4];
+        device_uuid_ += hex[b & 15];
+    }
+
+    if (!disk_dir_.empty())
+    {
+        std::error_code ec;
+        std::filesystem::create_directories(disk_dir_, ec);
+        if (ec)
+        {
+            std::cerr << "GasCache: cannot create " << disk_dir_ << " (" << ec.message()
+                      << "), disk cache off\n";
+            disk_dir_.clear();
+        }
+    }
+    if (!disk_dir_.empty())
+        writer_ = std::thread(&GasCache::write_files, this);
+    SOBA_LOG(LOG_INFO) << "GasCache: device " << device << ", " << budget_bytes_ / (1024 * 1024) << " MB budget"
+              << (disk_dir_.empty() ? "" : ", disk " + disk_dir_) << "\n";
+}
+
+GasCache::~GasCache()
+{
+    // Finish the queued files first
+    if (writer_.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock(write_mutex_);
+            stop_writer_ = true;
+        }
+        write_cv_.notify_one();
+        writer_.join();
+    }
+
+    try
+    {
+        DeviceScope scope(device_);
+        for (auto &kv : entries_)
+            CUDA_WARN(cudaFree((void *)kv.second.d_buffer));
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "GasCache: cleanup failed: " << e.what() << std::endl;
+    }
+}
+
+void GasCache::lend(uint64_t key, Entry &entry, MeshGAS &gas)
+{
+    entry.users++;
+    entry.last_use = ++clock_;
+
+    gas = MeshGAS{};
+    gas.d_buffer = entry.d_buffer;
+    gas.buffer_size = entry.buffer_size;
+    gas.uncompacted_size = entry.uncompacted_size;
+    gas.handle = entry.handle;
+    gas.vertex_count = entry.vertex_count;
+    gas.triangle_count = entry.triangle_count;
+    gas.indexed = entry.indexed;
+    gas.allow_update = entry.allow_update;
+    gas.alive = true;
+    gas.cache = this;
+    gas.cache_key = key;
+}
+
+bool GasCache::acquire(OptiXSolar &optix, const MeshDigest &digest, const MeshView &mesh, bool allow_update,
+                       MeshGAS &gas)
+{
+    auto matches = [&](const Entry &e)
+    {
+        return e.digest == digest && e.vertex_count == mesh.vertex_count && e.triangle_count == mesh.triangle_count &&
+               e.indexed == (mesh.indices != nullptr) && e.allow_update == allow_update;
+    };
+
+    const uint64_t key = digest.key();
+    auto it = entries_.find(key);
+    if (it != entries_.end() && matches(it->second))
+    {
+        stats_.hits++;
+        lend(key, it->second, gas);
+        return true;
+    }
+
+    Entry entry;
+    if (it == entries_.end() && !disk_dir_.empty() && load_from_disk(optix, digest, entry))
+    {
+        if (matches(entry))
+        {
+            stats_.disk_hits++;
+            lend(key, entries_[key] = entry, gas);
+            evict();
+            return true;
+        }
+        CUDA_WARN(cudaFree((void *)entry.d_buffer));
+    }
+
+    stats_.misses++;
+    return false;
+}
+
+void GasCache::insert(OptiXSolar &optix, const MeshDigest &digest, MeshGAS &gas)
+{
+    // Another mesh whose digest shares this id: leave gas privately owned
+    const uint64_t key = digest.key();
+    if (entries_.count(key))
+        return;
+
+    // Before taking over gas.d_buffer: on failure the caller keeps owning it
+    OptixRelocationInfo relocation = {};
+    const OptixResult res = optixAccelGetRelocationInfo(optix.context, gas.handle, &relocation);
+    if (res != OPTIX_SUCCESS)
+    {
+        std::cerr << "GasCache: not caching GAS (" << optixGetErrorString(res) << ")\n";
+        return;
+    }
+
+    Entry entry;
+    entry.d_buffer = gas.d_buffer;
+    entry.buffer_size = gas.buffer_size;
+    entry.uncompacted_size = gas.uncompacted_size;
+    entry.vertex_count = gas.vertex_count;
+    entry.triangle_count = gas.triangle_count;
+    entry.indexed = gas.indexed;
+    entry.allow_update = gas.allow_update;
+    entry.handle = gas.handle;
+    entry.digest = digest;
+    entry.relocation = relocation;
+
+    Entry &stored = entries_[key] = entry;
+    lend(key, stored, gas);
+    if (!disk_dir_.empty())
+        save_to_disk(stored);
+    evict();
+}
+
+void GasCache::release(uint64_t key)
+{
+    auto it = entries_.find(key);
+    if (it == entries_.end())
+        return;
+    it->second.users--;
+    it->second.last_use = ++clock_;
+    evict();
+}
+
+void GasCache::detach(OptiXSolar &optix, MeshGAS &gas)
+{
+    if (gas.cache != this)
+        return;
+    const Entry &entry = entries_.at(gas.cache_key);
+
+    DeviceBuffer<char> d_copy(entry.buffer_size);
+    CUDA_CHECK(cudaMemcpy(d_copy.get(), (void *)entry.d_buffer, entry.buffer_size, cudaMemcpyDeviceToDevice));
+    OptixTraversableHandle handle = 0;
+    OPTIX_CHECK(optixAccelRelocate(optix.context, 0, &entry.relocation, nullptr, 0,
+                                   d_copy.ptr(), entry.buffer_size, &handle));
+
+    const uint64_t key = gas.cache_key;
+    gas.handle = handle;
+    gas.d_buffer = reinterpret_cast<CUdeviceptr>(d_copy.release());
+    gas.cache = nullptr;
+    gas.cache_key = 0;
+    release(key);
+}
+
+void GasCache::set_budget(size_t vram_budget_bytes)
+{
+    budget_bytes_ = vram_budget_bytes;
+    evict();
+}
+
+size_t GasCache::trim()
+{
+    return evict_to(0);
+}
+
+// Drop unused entries, least recently used first, until under budget; returns the bytes freed
+size_t GasCache::evict_to(size_t budget_bytes)
+{
+    size_t total = 0;
+    for (const auto &kv : entries_)
+        total += kv.second.buffer_size;
+
+    size_t freed = 0;
+    while (total > budget_bytes)
+    {
+        auto victim = entries_.end();
+        for (auto it = entries_.begin(); it != entries_.end(); ++it)
+        {
+            if (it->second.users == 0 && (victim == entries_.end() || it->second.last_use < victim->second.last_use))
+                victim = it;
+        }
+        if (victim == entries_.end())
+            break; // Everything left is in use
+
+        DeviceScope scope(device_);
+        CUDA_WARN(cudaFree((void *)victim->second.d_buffer));
+        total -= victim->second.buffer_size;
+        freed += victim->second.buffer_size;
+        entries_.erase(victim);
+        stats_.evictions++;
+    }
+    return freed;
+}
+
+GasCacheStats GasCache::stats() const
+{
+    GasCacheStats s = stats_;
+    s.disk_writes = disk_writes_.load();
+    s.entries = entries_.size();
+    for (const auto &kv : entries_)
+        s.bytes += kv.second.buffer_size;
+    s.budget_bytes = budget_bytes_;
+    return s;
+}
+
+std::string GasCache::disk_path(const MeshDigest &digest) const
+{
+    static const char hex[] = "0123456789abcdef";
+    std::string name;
+    for (uint8_t b : digest.bytes)
+    {
+        name += hex[b >> 4];
+        name += hex[b & 15];
+    }
+    return (std::filesystem::path(disk_dir_) / (name + "_" + device_uuid_ + ".gas")).string();
+}
+
+bool GasCache::load_from_disk(OptiXSolar &optix, const MeshDigest &digest, Entry &entry)
+{
+    const std::string path = disk_path(digest);
+    std::error_code ec;
+    const uintmax_t file_size = std::filesystem::file_size(path, ec);
+    if (ec || file_size < sizeof(GasFileHeader))
+        return false;
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+        return false;
+
+    GasFileHeader header;
+    if (!file.read(reinterpret_cast<char *>(&header), sizeof(header)) ||
+        std::memcmp(header.magic, GAS_FILE_MAGIC, sizeof(GAS_FILE_MAGIC)) != 0 ||
+        header.version != GAS_FILE_VERSION ||
+        std::memcmp(header.digest, digest.bytes, sizeof(header.digest)) != 0)
+        return false;
+
+    // Truncated or padded (e.g. a foreign or damaged file): never trust buffer_size alone
+    if (header.buffer_size == 0 || header.buffer_size != file_size - sizeof(GasFileHeader))
+    {
+        std::cerr << "GasCache: ignoring " << path << ", size does not match its header\n";
+        return false;
+    }
+
+    // Written by another driver / OptiX version: rebuild (and overwrite below)
+    int compatible = 0;
+    OPTIX_CHECK(optixCheckRelocationCompatibility(optix.context, &header.relocation, &compatible));
+    if (!compatible)
+        return false;
+
+    std::vector<char> data(header.buffer_size);
+    if (!file.read(data.data(), data.size()))
+        return false;
+
+    entry = Entry{};
+    DeviceBuffer<char> d_buffer(header.buffer_size);
+    CUDA_CHECK(cudaMemcpy(d_buffer.get(), data.data(), header.buffer_size, cudaMemcpyHostToDevice));
+    OPTIX_CHECK(optixAccelRelocate(optix.context, 0, &header.relocation, nullptr, 0,
+                                   d_buffer.ptr(), header.buffer_size, &entry.handle));
+    entry.d_buffer = reinterpret_cast<CUdeviceptr>(d_buffer.release());
+
+    entry.buffer_size = header.buffer_size;
+    entry.uncompacted_size = header.uncompacted_size;
+    entry.vertex_count = header.vertex_count;
+    entry.triangle_count = header.triangle_count;
+    entry.indexed = (header.flags & 1u) != 0;
+    entry.allow_update = (header.flags & 2u) != 0;
+    entry.relocation = header.relocation;
+    entry.digest = digest;
+    return true;
+}
+
+// Host bytes queued for the writer beyond this are dropped (rebuilt next time)
+constexpr size_t MAX_PENDING_WRITE_BYTES = size_t(1) << 30;
+
+// Best effort: a failed copy or write only costs a rebuild next time. The
+// buffer is copied to the host here, since the entry may be evicted before
+// the writer thread gets to it; the file itself is written off this thread.
+void GasCache::save_to_disk(const Entry &entry)
+{
+    {
+        std::lock_guard<std::mutex> lock(write_mutex_);
+        if (pending_write_bytes_ + entry.buffer_size > MAX_PENDING_WRITE_BYTES)
+            return;
+    }
+
+    GasFileHeader header = {};
+    std::memcpy(header.magic, GAS_FILE_MAGIC, sizeof(GAS_FILE_MAGIC));
+    header.version = GAS_FILE_VERSION;
+    header.flags = (entry.indexed ? 1u : 0u) | (entry.allow_update ? 2u : 0u);
+    std::memcpy(header.digest, entry.digest.bytes, sizeof(header.digest));
+    header.buffer_size = entry.buffer_size;
+    header.uncompacted_size = entry.uncompacted_size;
+    header.vertex_count = entry.vertex_count;
+    header.triangle_count = entry.triangle_count;
+    header.relocation = entry.relocation;
+
+    DiskWrite write;
+    write.path = disk_path(entry.digest);
+    write.bytes.resize(sizeof(header) + entry.buffer_size);
+    std::memcpy(write.bytes.data(), &header, sizeof(header));
+    const cudaError_t err = cudaMemcpy(write.bytes.data() + sizeof(header), (void *)entry.d_buffer,
+                                       entry.buffer_size, cudaMemcpyDeviceToHost);
+    if (err != cudaSuccess)
+    {
+        std::cerr << "GasCache: not saving " << write.path << " (" << cudaGetErrorString(err) << ")\n";
+        cudaGetLastError();
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(write_mutex_);
+        pending_write_bytes_ += write.bytes.size();
+        writes_.push_back(std::move(write));
+    }
+    write_cv_.notify_one();
+}
+
+// Writer thread: drains writes_ until the cache is destroyed
+void GasCache::write_files()
+{
+    std::unique_lock<std::mutex> lock(write_mutex_);
+    for (;;)
+    {
+        write_cv_.wait(lock, [&] { return stop_writer_ || !writes_.empty(); });
+        if (writes_.empty())
+            return;
+        DiskWrite write = std::move(writes_.front());
+        writes_.pop_front();
+        lock.unlock();
+
+        // Write under a unique name and rename, so concurrent workers never read a partial file
+        const std::string tmp = write.path + "." + std::to_string(std::random_device{}()) + ".tmp";
+        bool written;
+        {
+            std::ofstream file(tmp, std::ios::binary);
+            file.write(write.bytes.data(), static_cast<std::streamsize>(write.bytes.size()));
+            written = static_cast<bool>(file);
+        }
+        std::error_code ec;
+        if (written)
+            std::filesystem::rename(tmp, write.path, ec);
+        if (!written || ec)
+        {
+            std::cerr << "GasCache: failed to write " << write.path << "\n";
+            std::filesystem::remove(tmp, ec);
+        }
+        else
+        {
+            disk_writes_++;
+        }
+
+        lock.lock();
+        pending_write_bytes_ -= write.bytes.size();
+    }
+}
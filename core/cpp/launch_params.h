@@ -0,0 +1,107 @@
+#pragma once
+// Launch parameter layout shared by the host (optix_solar.cu) and the OptiX
+// programs (optix_programs.cu): both include this one definition, and the
+// static_asserts below pin every offset so nvcc and the host compiler cannot
+// lay it out differently. New fields go in the group of their alignment
+// (pointers, 64-bit, 32-bit) and get an offset check.
+#include <cuda_runtime.h>
+#include <optix_types.h>
+#include <cstddef>
+#include <cstdint>
+
+// Faces per culled work item, one warp
+constexpr int CULL_GROUP_FACES = 32;
+
+// Raygen feature bits. Every supported combination of a mode is its own entry
+// point, __raygen__<mode>_<bits> (optix_programs.cu), so a launch never
+// branches on them
+enum RaygenFeature
+{
+    RAYGEN_WEIGHTED = 1,   // sun_weights * cos(incidence) instead of lit counts
+    RAYGEN_SAMPLED = 2,    // samples_per_face stratified origins per face
+    RAYGEN_VISIBILITY = 4, // Bit-packed visibility output
+    RAYGEN_CULLED = 8,     // 1D launch over culled work items
+    RAYGEN_VARIANTS = 16
+};
+
+// One scenario of a batched trace (RAYGEN_BATCH): a target's faces against a
+// sun set. Offsets index the concatenated targets, suns and results; the
+// scenario's work items (face x sun slice) start at work_offset.
+struct BatchScenario
+{
+    unsigned long long work_offset;
+    unsigned long long face_offset;
+    unsigned long long sun_offset;
+    unsigned long long result_offset;
+    int face_count;
+    int sun_count;
+    int suns_per_thread;
+    int weighted; // Lit rays add sun_weights[sun] * cos(incidence) instead of 1
+};
+
+// Per-face and per-sun inputs are float4 (xyz, w unused) so each is one
+// aligned 16-byte load; triangle corners are three planes of vertex_plane_stride
+// entries (corner k of face f at face_vertices[k * vertex_plane_stride + f]),
+// so a warp reading one corner of neighbouring faces reads contiguous memory.
+struct LaunchParams
+{
+    // Tile-local: the host offsets these to the tile's first face / sun
+    float4 *face_centroids;
+    float4 *face_normals;
+    // Optional triangle corner planes (tile-local): each ray is traced from
+    // samples_per_face stratified points and counts with the lit fraction
+    float4 *face_vertices;
+    float4 *sun_directions;
+    float *sun_weights; // Optional: lit rays add weight * cos(incidence) instead of 1
+    float *results;
+    // Optional bit-packed visibility (null = off): bit s of row[s / 32] is set when
+    // sun s lights the face. Tile-local like the inputs, rows visibility_words apart.
+    uint32_t *visibility;
+    // Batched raygen: scenarios sorted by work_offset, the launch covers work
+    // items work_begin onwards. Inputs / results are the concatenated buffers.
+    BatchScenario *scenarios;
+    // Optional culled work list of __raygen__solar (null = 2D face x slice grid):
+    // the launch is 1D, CULL_GROUP_FACES threads per (face group, sun slice) item
+    uint2 *work_items;
+    OptixTraversableHandle scene_handle; // IAS over all context meshes
+    unsigned long long visibility_words;
+    unsigned long long vertex_plane_stride;
+    unsigned long long work_begin;
+    int face_count;
+    int sun_count;
+    int suns_per_thread; // Sun directions looped over by one thread (launch height = sun slices)
+    int samples_per_face;
+    int scenario_count;
+    float ray_offset;
+    // Shadow ray extent from the (offset) origin
+    float ray_tmin;
+    float ray_tmax;
+};
+
+static_assert(sizeof(BatchScenario) == 48, "BatchScenario layout changed");
+static_assert(offsetof(BatchScenario, face_count) == 32, "BatchScenario layout changed");
+static_assert(offsetof(BatchScenario, weighted) == 44, "BatchScenario layout changed");
+
+static_assert(sizeof(OptixTraversableHandle) == 8, "LaunchParams expects a 64-bit traversable handle");
+static_assert(offsetof(LaunchParams, face_centroids) == 0, "LaunchParams layout changed");
+static_assert(offsetof(LaunchParams, face_normals) == 8, "LaunchParams layout changed");
+static_assert(offsetof(LaunchParams, face_vertices) == 16, "LaunchParams layout changed");
+static_assert(offsetof(LaunchParams, sun_directions) == 24, "LaunchParams layout changed");
+static_assert(offsetof(LaunchParams, sun_weights) == 32, "LaunchParams layout changed");
+static_assert(offsetof(LaunchParams, results) == 40, "LaunchParams layout changed");
+static_assert(offsetof(LaunchParams, visibility) == 48, "LaunchParams layout changed");
+static_assert(offsetof(LaunchParams, scenarios) == 56, "LaunchParams layout changed");
+static_assert(offsetof(LaunchParams, work_items) == 64, "LaunchParams layout changed");
+static_assert(offsetof(LaunchParams, scene_handle) == 72, "LaunchParams layout changed");
+static_assert(offsetof(LaunchParams, visibility_words) == 80, "LaunchParams layout changed");
+static_assert(offsetof(LaunchParams, vertex_plane_stride) == 88, "LaunchParams layout changed");
+static_assert(offsetof(LaunchParams, work_begin) == 96, "LaunchParams layout changed");
+static_assert(offsetof(LaunchParams, face_count) == 104, "LaunchParams layout changed");
+static_assert(offsetof(LaunchParams, sun_count) == 108, "LaunchParams layout changed");
+static_assert(offsetof(LaunchParams, suns_per_thread) == 112, "LaunchParams layout changed");
+static_assert(offsetof(LaunchParams, samples_per_face) == 116, "LaunchParams layout changed");
+static_assert(offsetof(LaunchParams, scenario_count) == 120, "LaunchParams layout changed");
+static_assert(offsetof(LaunchParams, ray_offset) == 124, "LaunchParams layout changed");
+static_assert(offsetof(LaunchParams, ray_tmin) == 128, "LaunchParams layout changed");
+static_assert(offsetof(LaunchParams, ray_tmax) == 132, "LaunchParams layout changed");
+static_assert(sizeof(LaunchParams) == 136, "LaunchParams layout changed");
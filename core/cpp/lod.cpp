@@ -0,0 +1,302 @@
+#include "lod.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <unordered_map>
+#include <unordered_set>
+
+// Half the diagonal of a unit cube: largest move of a vertex snapped to its cell centre
+constexpr double HALF_DIAGONAL = 0.86602540378443864676;
+
+// Cells below this many scene units are not worth clustering
+constexpr float MIN_CELL = 1e-3f;
+
+namespace
+{
+// Grid cell of a vertex; level tells apart the grids of different cell sizes
+// (exponent of the power-of-two cell) in one far-field pass
+struct CellKey
+{
+    long long x, y, z;
+    int level;
+
+    bool operator==(const CellKey &o) const { return x == o.x && y == o.y && z == o.z && level == o.level; }
+};
+
+struct CellHash
+{
+    size_t operator()(const CellKey &k) const
+    {
+        uint64_t h = static_cast<uint64_t>(k.x) * 0x9e3779b97f4a7c15ull;
+        h ^= static_cast<uint64_t>(k.y) * 0xc2b2ae3d27d4eb4full + (h << 6) + (h >> 2);
+        h ^= static_cast<uint64_t>(k.z) * 0x165667b19e3779f9ull + (h << 6) + (h >> 2);
+        h ^= static_cast<uint64_t>(k.level) + (h << 6) + (h >> 2);
+        return static_cast<size_t>(h);
+    }
+};
+
+// Unordered vertex triple, so the same triangle in either winding is one key
+struct TriangleKey
+{
+    uint32_t a, b, c;
+
+    bool operator==(const TriangleKey &o) const { return a == o.a && b == o.b && c == o.c; }
+};
+
+struct TriangleHash
+{
+    size_t operator()(const TriangleKey &k) const
+    {
+        uint64_t h = (static_cast<uint64_t>(k.a) << 32 | k.b) * 0x9e3779b97f4a7c15ull;
+        return static_cast<size_t>(h ^ (static_cast<uint64_t>(k.c) * 0xc2b2ae3d27d4eb4full));
+    }
+};
+
+// Output of one simplification: clustered vertices shared through their
+// cell, triangles deduplicated
+class ProxyBuilder
+{
+public:
+    explicit ProxyBuilder(LodMesh &out) : out_(out)
+    {
+        out_.vertices.clear();
+        out_.indices.clear();
+    }
+
+    uint32_t clustered(float3 v, float cell, int level)
+    {
+        const CellKey key = {static_cast<long long>(std::floor(v.x / cell)),
+                             static_cast<long long>(std::floor(v.y / cell)),
+                             static_cast<long long>(std::floor(v.z / cell)), level};
+        auto it = cells_.find(key);
+        if (it != cells_.end())
+            return it->second;
+        const uint32_t index = static_cast<uint32_t>(out_.vertices.size());
+        out_.vertices.push_back(make_float3(static_cast<float>((key.x + 0.5) * cell),
+                                            static_cast<float>((key.y + 0.5) * cell),
+                                            static_cast<float>((key.z + 0.5) * cell)));
+        cells_.emplace(key, index);
+        return index;
+    }
+
+    uint32_t kept(float3 v)
+    {
+        out_.vertices.push_back(v);
+        return static_cast<uint32_t>(out_.vertices.size() - 1);
+    }
+
+    // Only clustered triangles can collapse or coincide; kept ones skip the checks
+    void triangle(uint32_t a, uint32_t b, uint32_t c, bool clustered = true)
+    {
+        if (clustered)
+        {
+            if (a == b || b == c || a == c)
+                return;
+            uint32_t s[3] = {a, b, c};
+            std::sort(s, s + 3);
+            if (!triangles_.insert({s[0], s[1], s[2]}).second)
+                return;
+        }
+        out_.indices.push_back(make_uint3(a, b, c));
+    }
+
+private:
+    LodMesh &out_;
+    std::unordered_map<CellKey, uint32_t, CellHash> cells_;
+    std::unordered_set<TriangleKey, TriangleHash> triangles_;
+};
+
+void grow(Aabb &box, float3 p)
+{
+    box.lo = make_float3(std::min(box.lo.x, p.x), std::min(box.lo.y, p.y), std::min(box.lo.z, p.z));
+    box.hi = make_float3(std::max(box.hi.x, p.x), std::max(box.hi.y, p.y), std::max(box.hi.z, p.z));
+}
+
+Aabb empty_bounds()
+{
+    const float inf = std::numeric_limits<float>::infinity();
+    Aabb box;
+    box.lo = make_float3(inf, inf, inf);
+    box.hi = make_float3(-inf, -inf, -inf);
+    return box;
+}
+
+float3 transform_point(const float *t, float3 p)
+{
+    return make_float3(t[0] * p.x + t[1] * p.y + t[2] * p.z + t[3],
+                       t[4] * p.x + t[5] * p.y + t[6] * p.z + t[7],
+                       t[8] * p.x + t[9] * p.y + t[10] * p.z + t[11]);
+}
+} // namespace
+
+Aabb point_bounds(const float3 *points, size_t count, float pad)
+{
+    Aabb box = empty_bounds();
+    for (size_t i = 0; i < count; i++)
+        grow(box, points[i]);
+    box.lo = make_float3(box.lo.x - pad, box.lo.y - pad, box.lo.z - pad);
+    box.hi = make_float3(box.hi.x + pad, box.hi.y + pad, box.hi.z + pad);
+    return box;
+}
+
+Aabb mesh_bounds(const MeshView &mesh, const float *transform)
+{
+    Aabb box = empty_bounds();
+    for (size_t i = 0; i < mesh.vertex_count; i++)
+        grow(box, transform ? transform_point(transform, mesh.vertices[i]) : mesh.vertices[i]);
+    return box;
+}
+
+float bounds_distance(const Aabb &a, const Aabb &b)
+{
+    const float dx = std::max({0.0f, a.lo.x - b.hi.x, b.lo.x - a.hi.x});
+    const float dy = std::max({0.0f, a.lo.y - b.hi.y, b.lo.y - a.hi.y});
+    const float dz = std::max({0.0f, a.lo.z - b.hi.z, b.lo.z - a.hi.z});
+    return std::sqrt(dx * dx + dy * dy + dz * dz);
+}
+
+float lod_cell_size(float distance, const LodSettings &settings)
+{
+    if (!(settings.max_angle > 0.0f) || !(distance >= settings.min_distance) || !(distance > 0.0f) ||
+        !std::isfinite(distance))
+        return 0.0f;
+    const double largest = distance * std::tan(static_cast<double>(settings.max_angle)) / HALF_DIAGONAL;
+    const float cell = static_cast<float>(std::exp2(std::floor(std::log2(largest))));
+    return cell >= MIN_CELL ? cell : 0.0f;
+}
+
+float lod_max_displacement(float cell)
+{
+    return static_cast<float>(HALF_DIAGONAL * cell);
+}
+
+float lod_instance_cell(const MeshView &mesh, const float *transform, const Aabb &target,
+                        const LodSettings &settings)
+{
+    const float cell = lod_cell_size(bounds_distance(mesh_bounds(mesh, transform), target), settings);
+    if (cell == 0.0f || !transform)
+        return cell;
+
+    // Columns of the 3x3 part are the local axes in world space
+    float scale = 0.0f;
+    for (int c = 0; c < 3; c++)
+        scale = std::max(scale, std::sqrt(transform[c] * transform[c] + transform[4 + c] * transform[4 + c] +
+                                          transform[8 + c] * transform[8 + c]));
+    return scale > 0.0f ? cell / scale : 0.0f;
+}
+
+void cluster_mesh(const MeshView &mesh, float cell, LodMesh &out, LodStats *stats)
+{
+    ProxyBuilder proxy(out);
+    if (mesh.indices)
+    {
+        std::vector<uint32_t> remap(mesh.vertex_count);
+        for (size_t i = 0; i < mesh.vertex_count; i++)
+            remap[i] = proxy.clustered(mesh.vertices[i], cell, 0);
+        for (size_t t = 0; t < mesh.triangle_count; t++)
+            proxy.triangle(remap[mesh.indices[t].x], remap[mesh.indices[t].y], remap[mesh.indices[t].z]);
+    }
+    else
+    {
+        for (size_t t = 0; t < mesh.triangle_count; t++)
+            proxy.triangle(proxy.clustered(mesh.vertices[t * 3], cell, 0),
+                           proxy.clustered(mesh.vertices[t * 3 + 1], cell, 0),
+                           proxy.clustered(mesh.vertices[t * 3 + 2], cell, 0));
+    }
+
+    if (stats)
+    {
+        stats->triangles_in += mesh.triangle_count;
+        stats->triangles_out += out.indices.size();
+        stats->max_displacement = std::max(stats->max_displacement, lod_max_displacement(cell));
+    }
+}
+
+void simplify_far_field(const MeshView &mesh, const Aabb &target, const LodSettings &settings, LodMesh &out,
+                        LodStats *stats)
+{
+    // One id per distinct vertex: indices as given, de-indexed corners welded
+    // by exact position, so a vertex shared by triangles at different
+    // distances still snaps to one place and closed far-field shells stay closed
+    std::vector<uint32_t> corner_vertex;
+    std::vector<float3> positions;
+    if (!mesh.indices)
+    {
+        std::unordered_map<CellKey, uint32_t, CellHash> welded;
+        corner_vertex.resize(mesh.triangle_count * 3);
+        for (size_t i = 0; i < corner_vertex.size(); i++)
+        {
+            // + 0.0f folds -0 into +0, the only equal floats with different bits
+            const float3 v = make_float3(mesh.vertices[i].x + 0.0f, mesh.vertices[i].y + 0.0f,
+                                         mesh.vertices[i].z + 0.0f);
+            CellKey key = {0, 0, 0, 0};
+            std::memcpy(&key.x, &v.x, sizeof(float));
+            std::memcpy(&key.y, &v.y, sizeof(float));
+            std::memcpy(&key.z, &v.z, sizeof(float));
+            auto it = welded.emplace(key, static_cast<uint32_t>(positions.size())).first;
+            if (it->second == positions.size())
+                positions.push_back(v);
+            corner_vertex[i] = it->second;
+        }
+    }
+    const size_t vertex_count = mesh.indices ? mesh.vertex_count : positions.size();
+    auto vertex_of = [&](size_t t, int c) -> uint32_t
+    {
+        if (!mesh.indices)
+            return corner_vertex[t * 3 + c];
+        const uint3 tri = mesh.indices[t];
+        return c == 0 ? tri.x : c == 1 ? tri.y : tri.z;
+    };
+    auto position = [&](uint32_t v) { return mesh.indices ? mesh.vertices[v] : positions[v]; };
+
+    // Each vertex takes the distance of the nearest triangle using it, so it
+    // moves no more than any of its triangles allows
+    std::vector<float> distance(vertex_count, std::numeric_limits<float>::infinity());
+    for (size_t t = 0; t < mesh.triangle_count; t++)
+    {
+        Aabb box = empty_bounds();
+        for (int c = 0; c < 3; c++)
+            grow(box, position(vertex_of(t, c)));
+        const float d = bounds_distance(box, target);
+        for (int c = 0; c < 3; c++)
+        {
+            float &vd = distance[vertex_of(t, c)];
+            vd = std::min(vd, d);
+        }
+    }
+
+    ProxyBuilder proxy(out);
+    std::vector<uint32_t> emitted(vertex_count, UINT32_MAX);
+    std::vector<bool> clustered(vertex_count, false);
+    float max_displacement = 0.0f, max_angle = 0.0f;
+    for (size_t v = 0; v < vertex_count; v++)
+    {
+        const float cell = lod_cell_size(distance[v], settings);
+        if (cell > 0.0f)
+        {
+            emitted[v] = proxy.clustered(position(static_cast<uint32_t>(v)), cell, std::ilogb(cell));
+            clustered[v] = true;
+            max_displacement = std::max(max_displacement, lod_max_displacement(cell));
+            max_angle = std::max(max_angle, std::atan(lod_max_displacement(cell) / distance[v]));
+        }
+        else if (distance[v] != std::numeric_limits<float>::infinity())
+        {
+            emitted[v] = proxy.kept(position(static_cast<uint32_t>(v)));
+        }
+    }
+
+    for (size_t t = 0; t < mesh.triangle_count; t++)
+    {
+        const uint32_t a = vertex_of(t, 0), b = vertex_of(t, 1), c = vertex_of(t, 2);
+        proxy.triangle(emitted[a], emitted[b], emitted[c], clustered[a] || clustered[b] || clustered[c]);
+    }
+
+    if (stats)
+    {
+        stats->triangles_in += mesh.triangle_count;
+        stats->triangles_out += out.indices.size();
+        stats->max_displacement = std::max(stats->max_displacement, max_displacement);
+        stats->max_angle = std::max(stats->max_angle, max_angle);
+    }
+}
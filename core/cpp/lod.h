@@ -0,0 +1,79 @@
+#pragma once
+#include <cuda_runtime.h>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "optix_solar.h" // MeshView
+
+// Far-field level of detail of context geometry. Context far from the target
+// only matters through the shadows it casts at low sun angles, so it is
+// replaced by a vertex-clustered proxy: vertices snap to the centre of their
+// cell of a grid whose cell grows with the distance from the target bounds.
+// A vertex d away moves by at most d * tan(max_angle), so seen from anywhere
+// inside the target bounds no shadow edge shifts by more than max_angle: only
+// suns within max_angle of a shadow boundary can change lit / shadowed.
+
+struct LodSettings
+{
+    float min_distance = 100.0f; // Context closer than this to the target bounds keeps full resolution
+    float max_angle = 0.0f;      // Radians a moved vertex may subtend from the target bounds (0 = off)
+};
+
+struct Aabb
+{
+    float3 lo = make_float3(0.0f, 0.0f, 0.0f);
+    float3 hi = make_float3(0.0f, 0.0f, 0.0f);
+};
+
+// What a simplification changed; max_angle is the bound actually reached
+struct LodStats
+{
+    size_t triangles_in = 0;
+    size_t triangles_out = 0;
+    float max_displacement = 0.0f; // Largest vertex move, scene units
+    float max_angle = 0.0f;       // Radians, largest max_displacement / distance over the proxies
+};
+
+// Indexed simplified mesh; view() is only valid while the mesh is alive
+struct LodMesh
+{
+    std::vector<float3> vertices;
+    std::vector<uint3> indices;
+
+    MeshView view() const { return MeshView(vertices.data(), vertices.size(), indices.data(), indices.size()); }
+};
+
+// Bounds of count points grown by pad on every side (target faces, padded by
+// the ray offset)
+Aabb point_bounds(const float3 *points, size_t count, float pad = 0.0f);
+
+// Bounds of a mesh placed by transform (row-major 3x4 as SceneInstance, null = identity)
+Aabb mesh_bounds(const MeshView &mesh, const float *transform = nullptr);
+
+// Shortest distance between two boxes (0 when they overlap)
+float bounds_distance(const Aabb &a, const Aabb &b);
+
+// Cell of geometry at distance from the target bounds: the largest power of
+// two whose half diagonal stays within distance * tan(max_angle). Powers of
+// two make nearby distances share a cell, so the proxies of a scene barely
+// change when the target moves (and stay GAS cache hits). 0 = full resolution.
+float lod_cell_size(float distance, const LodSettings &settings);
+
+// Largest vertex move of clustering at cell: half the cell diagonal
+float lod_max_displacement(float cell);
+
+// Local-space cell for one instance of mesh: the world cell of its distance
+// from target divided by the transform's largest axis scale (0 = full resolution)
+float lod_instance_cell(const MeshView &mesh, const float *transform, const Aabb &target,
+                        const LodSettings &settings);
+
+// Cluster every vertex of mesh (indexed or de-indexed) at cell. Triangles that
+// collapse to a line or a point, and duplicates, are dropped.
+void cluster_mesh(const MeshView &mesh, float cell, LodMesh &out, LodStats *stats = nullptr);
+
+// Identity-placed scene (set_scene): each vertex is clustered at the cell of
+// the nearest triangle using it (vertices nearer than min_distance are kept as
+// they are), so shared vertices stay welded across cell sizes. De-indexed
+// corners at the same position count as one vertex.
+void simplify_far_field(const MeshView &mesh, const Aabb &target, const LodSettings &settings, LodMesh &out,
+                        LodStats *stats = nullptr);
@@ -0,0 +1,22 @@
+#pragma once
+#include <atomic>
+#include <iostream>
+
+// Engine stdout logging. Errors and warnings keep going to std::cerr.
+enum LogLevel
+{
+    LOG_QUIET = 0,
+    LOG_INFO = 1, // Per-call summaries (default)
+    LOG_DEBUG = 2 // Per-tile / per-mesh detail
+};
+
+extern std::atomic<int> soba_log_level;
+void set_log_level(int level);
+
+// SOBA_LOG(LOG_INFO) << ...; the stream expression is skipped below the level
+#define SOBA_LOG(level)                                                   \
+    if (soba_log_level.load(std::memory_order_relaxed) < (level))         \
+    {                                                                     \
+    }                                                                     \
+    else                                                                  \
+        std::cout
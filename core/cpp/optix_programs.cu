@@ -2,18 +2,8 @@
 #include <optix.h>
 #include <cuda_runtime.h>
 
-// Launch parameters - must match host side exactly
-struct LaunchParams
-{
-    float3 *face_centroids;
-    float3 *face_normals;
-    float3 *sun_directions;
-    float *results;
-    int face_count;
-    int sun_count;
-    OptixTraversableHandle gas_handle;
-    float ray_offset;
-};
+// LaunchParams, BatchScenario, CULL_GROUP_FACES and the raygen feature bits
+#include "launch_params.h"
 
 // OptiX: constant memory for launch params
 extern "C"
@@ -21,72 +11,330 @@ extern "C"
     __constant__ LaunchParams params;
 }
 
-// Raygen program - your main solar analysis logic
-extern "C" __global__ void __raygen__solar()
+// Shadow ray: true when nothing blocks origin -> direction. The payload
+// starts occluded and only the miss program clears it, so the first hit ends
+// the trace without running any hit program.
+static __forceinline__ __device__ bool unoccluded(float3 ray_origin, float3 ray_dir)
+{
+    uint32_t shadow_hit = 1;
+    optixTrace(
+        params.scene_handle,                   // Scene
+        ray_origin,                            // Ray origin
+        ray_dir,                               // Ray direction
+        params.ray_tmin,                       // tmin
+        params.ray_tmax,                       // tmax
+        0.0f,                                  // ray time
+        OptixVisibilityMask(255),              // Visibility mask
+        OPTIX_RAY_FLAG_TERMINATE_ON_FIRST_HIT | OPTIX_RAY_FLAG_DISABLE_ANYHIT |
+            OPTIX_RAY_FLAG_DISABLE_CLOSESTHIT, // Stop at first hit, no hit programs
+        0,                                     // SBT offset
+        1,                                     // SBT stride
+        0,                                     // miss SBT index
+        shadow_hit                             // Payload: 0 = no shadow, 1 = shadow
+    );
+    return shadow_hit == 0;
+}
+
+// xyz of a float4 input (the load itself is a single 16-byte vector load)
+static __forceinline__ __device__ float3 xyz(float4 v)
+{
+    return make_float3(v.x, v.y, v.z);
+}
+
+// Integer hash for per-sample jitter (deterministic, no RNG state)
+static __forceinline__ __device__ uint32_t hash_u32(uint32_t x)
+{
+    x ^= x >> 16;
+    x *= 0x7feb352dU;
+    x ^= x >> 15;
+    x *= 0x846ca68bU;
+    x ^= x >> 16;
+    return x;
+}
+
+// Sample point of a k x k stratification of the face's triangle: jittered
+// stratum on the unit square, mapped with the area-preserving sqrt warp
+static __forceinline__ __device__ float3 sample_origin(int face_idx, int sample, int strata, float3 face_normal)
+{
+    // Corner planes: neighbouring faces read neighbouring entries
+    const float4 v0 = params.face_vertices[face_idx];
+    const float4 v1 = params.face_vertices[params.vertex_plane_stride + face_idx];
+    const float4 v2 = params.face_vertices[2 * params.vertex_plane_stride + face_idx];
+    const uint32_t h = hash_u32(static_cast<uint32_t>(face_idx) * 9781u + static_cast<uint32_t>(sample) * 6271u + 1u);
+
+    const float su = ((sample % strata) + (h & 0xffffu) * (1.0f / 65536.0f)) / strata;
+    const float sv = ((sample / strata) + (h >> 16) * (1.0f / 65536.0f)) / strata;
+    const float r = sqrtf(su);
+    const float b0 = 1.0f - r, b1 = r * (1.0f - sv), b2 = r * sv;
+
+    return make_float3(
+        b0 * v0.x + b1 * v1.x + b2 * v2.x + face_normal.x * params.ray_offset,
+        b0 * v0.y + b1 * v1.y + b2 * v2.y + face_normal.y * params.ray_offset,
+        b0 * v0.z + b1 * v1.z + b2 * v2.z + face_normal.z * params.ray_offset);
+}
+
+// Lit fraction of a face towards ray_dir: 0 or 1 from the centroid origin, or
+// (SAMPLED) the share of its sample points that see along ray_dir
+template <bool SAMPLED>
+static __forceinline__ __device__ float lit_fraction(int face_idx, float3 centroid_origin,
+                                                     float3 face_normal, float3 ray_dir)
+{
+    if (!SAMPLED)
+        return unoccluded(centroid_origin, ray_dir) ? 1.0f : 0.0f;
+
+    const int samples = params.samples_per_face;
+
+    const int strata = static_cast<int>(sqrtf(static_cast<float>(samples)) + 0.5f);
+    int lit = 0;
+    for (int sample = 0; sample < samples; sample++)
+    {
+        if (unoccluded(sample_origin(face_idx, sample, strata, face_normal), ray_dir))
+            lit++;
+    }
+    return static_cast<float>(lit) / samples;
+}
+
+// Lit-sun sum of one face over suns [sun_begin, sun_end): counts, or
+// (RAYGEN_WEIGHTED) weight * cos(incidence). With RAYGEN_VISIBILITY,
+// visibility_row gets the slice's visibility words.
+template <int FEATURES>
+static __forceinline__ __device__ float trace_sun_slice(int face_idx, float3 face_centroid, float3 face_normal,
+                                                        const float4 *sun_directions, const float *sun_weights,
+                                                        int sun_begin, int sun_end, uint32_t *visibility_row)
+{
+    // Setup shadow ray origin, offset to avoid self-intersection
+    float3 ray_origin = make_float3(
+        face_centroid.x + face_normal.x * params.ray_offset,
+        face_centroid.y + face_normal.y * params.ray_offset,
+        face_centroid.z + face_normal.z * params.ray_offset);
+
+    uint32_t visibility_word = 0;
+
+    float hits = 0.0f;
+    for (int sun_idx = sun_begin; sun_idx < sun_end; sun_idx++)
+    {
+        float3 sun_dir = xyz(sun_directions[sun_idx]);
+        float3 ray_dir = make_float3(-sun_dir.x, -sun_dir.y, -sun_dir.z);
+
+        // Skip back-facing surfaces (dot product check)
+        float dot_product = face_normal.x * ray_dir.x +
+                            face_normal.y * ray_dir.y +
+                            face_normal.z * ray_dir.z;
+
+        // Trace shadow ray(s) (back-facing counts as shadowed)
+        float lit = 0.0f;
+        if (dot_product > 0.001f)
+            lit = lit_fraction<(FEATURES & RAYGEN_SAMPLED) != 0>(face_idx, ray_origin, face_normal, ray_dir);
+
+        // Add the unshadowed share to sun hours
+        if (FEATURES & RAYGEN_WEIGHTED)
+            hits += lit * sun_weights[sun_idx] * dot_product;
+        else
+            hits += lit;
+
+        // Visibility marks a majority lit face; flush a full word (or the slice's last partial one)
+        if (FEATURES & RAYGEN_VISIBILITY)
+        {
+            if (lit >= 0.5f)
+                visibility_word |= 1u << (sun_idx & 31);
+            if ((sun_idx & 31) == 31 || sun_idx + 1 == sun_end)
+            {
+                visibility_row[sun_idx >> 5] = visibility_word;
+                visibility_word = 0;
+            }
+        }
+    }
+    return hits;
+}
+
+// Solar raygen body, one entry point per feature set below
+// Launch is 2D: x = face, y = slice of suns_per_thread consecutive sun directions.
+// Each thread accumulates its slice locally and issues a single atomicAdd, so
+// contention on params.results drops by suns_per_thread compared to one
+// atomic per ray (and neighbouring threads in x hit different faces).
+// RAYGEN_CULLED launches 1D over params.work_items instead: a warp covers one
+// group of normal-clustered faces against one sun slice.
+template <int FEATURES>
+static __forceinline__ __device__ void trace_solar()
 {
     // Get thread index
     const uint3 idx = optixGetLaunchIndex();
-    const int ray_idx = idx.x;
-
-    // Decode which face and sun direction
-    const int face_idx = ray_idx / params.sun_count;
-    const int sun_idx = ray_idx % params.sun_count;
+    int face_idx = idx.x;
+    int slice = idx.y;
+    if (FEATURES & RAYGEN_CULLED)
+    {
+        const uint2 item = params.work_items[idx.x / CULL_GROUP_FACES];
+        face_idx = item.x * CULL_GROUP_FACES + idx.x % CULL_GROUP_FACES;
+        slice = item.y;
+        // The tile's last face group may be partial
+        if (face_idx >= params.face_count)
+            return;
+    }
+    const int sun_begin = slice * params.suns_per_thread;
+    const int sun_end = min(sun_begin + params.suns_per_thread, params.sun_count);
 
-    // Verify face id & sun id integrity
+#ifdef SOBA_DEBUG_BOUNDS
+    // Verify face id & sun id integrity (debug builds, -DSOBA_DEBUG_BOUNDS=ON)
     if (face_idx >= params.face_count)
     {
         printf("ERROR: face_idx %d >= face_count %d\n", face_idx, params.face_count);
         return;
     }
-    if (sun_idx >= params.sun_count)
+    if (sun_begin >= params.sun_count)
     {
-        printf("ERROR: sun_idx %d >= sun_count %d\n", sun_idx, params.sun_count);
+        printf("ERROR: sun_idx %d >= sun_count %d\n", sun_begin, params.sun_count);
         return;
     }
+#endif
 
-    // Get data for this ray
-    float3 face_centroid = params.face_centroids[face_idx];
-    float3 face_normal = params.face_normals[face_idx];
-    float3 sun_dir = params.sun_directions[sun_idx];
+    // Slices start on a multiple of 32, so each thread owns whole visibility
+    // words and writes them without atomics
+    uint32_t *visibility_row = nullptr;
+    if (FEATURES & RAYGEN_VISIBILITY)
+        visibility_row = params.visibility + face_idx * params.visibility_words;
 
-    float3 ray_dir = make_float3(-sun_dir.x, -sun_dir.y, -sun_dir.z);
+    float hits = trace_sun_slice<FEATURES>(face_idx, xyz(params.face_centroids[face_idx]),
+                                           xyz(params.face_normals[face_idx]),
+                                           params.sun_directions, params.sun_weights, sun_begin, sun_end,
+                                           visibility_row);
 
-    // Skip back-facing surfaces (dot product check)
-    float dot_product = face_normal.x * ray_dir.x +
-                        face_normal.y * ray_dir.y +
-                        face_normal.z * ray_dir.z;
+    // One write per (face, slice) instead of one per ray
+    if (hits > 0.0f)
+    {
+        atomicAdd(&params.results[face_idx], hits);
+    }
+}
+
+#define SOLAR_RAYGEN(FEATURES)                               \
+    extern "C" __global__ void __raygen__solar_##FEATURES() \
+    {                                                        \
+        trace_solar<FEATURES>();                             \
+    }
+
+SOLAR_RAYGEN(0)
+SOLAR_RAYGEN(1)
+SOLAR_RAYGEN(2)
+SOLAR_RAYGEN(3)
+SOLAR_RAYGEN(4)
+SOLAR_RAYGEN(5)
+SOLAR_RAYGEN(6)
+SOLAR_RAYGEN(7)
+SOLAR_RAYGEN(8)
+SOLAR_RAYGEN(9)
+SOLAR_RAYGEN(10)
+SOLAR_RAYGEN(11)
+SOLAR_RAYGEN(12)
+SOLAR_RAYGEN(13)
+SOLAR_RAYGEN(14)
+SOLAR_RAYGEN(15)
+
+// Batched raygen - launch is 1D over the work items of every scenario. A
+// scenario's items run face-fastest over its sun slices, like the (x, y) grid
+// of the solar raygens, so neighbouring threads still share a sun slice.
+// Weighting is per scenario; no sampling or visibility.
+extern "C" __global__ void __raygen__batch_0()
+{
+    const unsigned long long item = params.work_begin + optixGetLaunchIndex().x;
+
+    // Last scenario starting at or before item (the table holds no empty scenarios)
+    int lo = 0, hi = params.scenario_count - 1;
+    while (lo < hi)
+    {
+        const int mid = (lo + hi + 1) / 2;
+        if (params.scenarios[mid].work_offset <= item)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    const BatchScenario &scenario = params.scenarios[lo];
+
+    const unsigned long long local = item - scenario.work_offset;
+    const int face = static_cast<int>(local % scenario.face_count);
+    const int sun_begin = static_cast<int>(local / scenario.face_count) * scenario.suns_per_thread;
+    if (sun_begin >= scenario.sun_count)
+        return;
+    const int sun_end = min(sun_begin + scenario.suns_per_thread, scenario.sun_count);
 
-    if (dot_product <= 0.001f)
+    const unsigned long long face_idx = scenario.face_offset + face;
+    const float4 *suns = params.sun_directions + scenario.sun_offset;
+    const float3 face_centroid = xyz(params.face_centroids[face_idx]);
+    const float3 face_normal = xyz(params.face_normals[face_idx]);
+    float hits = scenario.weighted
+                     ? trace_sun_slice<RAYGEN_WEIGHTED>(static_cast<int>(face_idx), face_centroid, face_normal, suns,
+                                                        params.sun_weights + scenario.sun_offset, sun_begin,
+                                                        sun_end, nullptr)
+                     : trace_sun_slice<0>(static_cast<int>(face_idx), face_centroid, face_normal, suns, nullptr,
+                                          sun_begin, sun_end, nullptr);
+
+    if (hits > 0.0f)
+    {
+        atomicAdd(&params.results[scenario.result_offset + face], hits);
+    }
+}
+
+// Sky-patch raygens - launch is 1D over faces, each thread traces every patch.
+// Patch counts are fixed (Tregenza 145, Reinhart 577), so the loop bound is a
+// compile-time constant. sun_directions / sun_weights hold the patch directions
+// (pointing down, like sun vectors) and cumulative sky matrix values; the
+// only feature is RAYGEN_SAMPLED.
+template <int PATCH_COUNT, int FEATURES>
+static __forceinline__ __device__ void trace_sky_patches()
+{
+    const int face_idx = optixGetLaunchIndex().x;
+#ifdef SOBA_DEBUG_BOUNDS
+    if (face_idx >= params.face_count)
+    {
+        printf("ERROR: face_idx %d >= face_count %d\n", face_idx, params.face_count);
         return;
+    }
+#endif
 
-    // Setup shadow ray from face toward sun
+    float3 face_centroid = xyz(params.face_centroids[face_idx]);
+    float3 face_normal = xyz(params.face_normals[face_idx]);
     float3 ray_origin = make_float3(
-        face_centroid.x + face_normal.x * params.ray_offset, // Offset to avoid self-intersection
+        face_centroid.x + face_normal.x * params.ray_offset,
         face_centroid.y + face_normal.y * params.ray_offset,
         face_centroid.z + face_normal.z * params.ray_offset);
 
-    // Trace shadow ray
-    uint32_t shadow_hit = 0;
-    optixTrace(
-        params.gas_handle,                     // Scene
-        ray_origin,                            // Ray origin
-        ray_dir,                               // Ray direction
-        0.0001f,                               // tmin
-        1e16f,                                 // tmax (very far)
-        0.0f,                                  // ray time
-        OptixVisibilityMask(255),              // Visibility mask
-        OPTIX_RAY_FLAG_TERMINATE_ON_FIRST_HIT, // Stop at first hit
-        0,                                     // SBT offset
-        1,                                     // SBT stride
-        0,                                     // miss SBT index
-        shadow_hit                             // Payload: 0 = no shadow, 1 = shadow
-    );
-
-    // If no shadow (shadow_hit == 0), add to sun hours
-    if (shadow_hit == 0)
+    float radiation = 0.0f;
+#pragma unroll 4
+    for (int patch = 0; patch < PATCH_COUNT; patch++)
     {
-        atomicAdd(&params.results[face_idx], 1.0f);
+        float3 patch_dir = xyz(params.sun_directions[patch]);
+        float3 ray_dir = make_float3(-patch_dir.x, -patch_dir.y, -patch_dir.z);
+
+        float dot_product = face_normal.x * ray_dir.x +
+                            face_normal.y * ray_dir.y +
+                            face_normal.z * ray_dir.z;
+        if (dot_product <= 0.001f)
+            continue;
+
+        radiation += lit_fraction<(FEATURES & RAYGEN_SAMPLED) != 0>(face_idx, ray_origin, face_normal, ray_dir) *
+                     params.sun_weights[patch] * dot_product;
     }
+
+    // One thread per face, no atomics needed
+    params.results[face_idx] = radiation;
+}
+
+extern "C" __global__ void __raygen__sky145_0()
+{
+    trace_sky_patches<145, 0>();
+}
+
+extern "C" __global__ void __raygen__sky145_2()
+{
+    trace_sky_patches<145, RAYGEN_SAMPLED>();
+}
+
+extern "C" __global__ void __raygen__sky577_0()
+{
+    trace_sky_patches<577, 0>();
+}
+
+extern "C" __global__ void __raygen__sky577_2()
+{
+    trace_sky_patches<577, RAYGEN_SAMPLED>();
 }
 
 // Miss program - ray didn't hit anything (no shadow)
@@ -96,7 +344,8 @@ extern "C" __global__ void __miss__shadow()
     optixSetPayload_0(0); // No shadow
 }
 
-// Closest hit program - ray hit something (shadow)
+// Closest hit program - ray hit something (shadow). Shadow rays disable it;
+// kept so a hit group exists for the SBT
 extern "C" __global__ void __closesthit__shadow()
 {
     optixSetPayload_0(1); // Shadow found
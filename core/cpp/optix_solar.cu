@@ -1,367 +1,2348 @@
 #include "optix_solar.h"
+#include "error_check.h"
+#include "device_buffer.h"
+#include "culling.h"
+#include "adaptive.h"
+#include "log.h"
 #include <optix_stubs.h>
 #include <optix_function_table_definition.h>
 #include <cuda.h>
-#include <fstream>
 #include <iostream>
 #include <vector>
 #include <chrono>
+#include <stdexcept>
+#include <algorithm>
+#include <string>
+#include <cstring>
+#include <cmath>
+#include <thread>
+#include <exception>
+#include <mutex>
+#include <limits>
 
-/////////// MACROS ///////////
-#define OPTIX_CHECK(call)                                                       \
-    do                                                                          \
-    {                                                                           \
-        OptixResult res = call;                                                 \
-        if (res != OPTIX_SUCCESS)                                               \
-        {                                                                       \
-            std::cerr << "OptiX error " << __FILE__ << ":" << __LINE__ << " - " \
-                      << optixGetErrorString(res) << std::endl;                 \
-            exit(1);                                                            \
-        }                                                                       \
-    } while (0)
-
-#define CUDA_CHECK(call)                                                       \
-    do                                                                         \
-    {                                                                          \
-        cudaError_t err = call;                                                \
-        if (err != cudaSuccess)                                                \
-        {                                                                      \
-            std::cerr << "CUDA error " << __FILE__ << ":" << __LINE__ << " - " \
-                      << cudaGetErrorString(err) << std::endl;                 \
-            exit(1);                                                           \
-        }                                                                      \
-    } while (0)
-
-// Load PTX file
-static std::string load_ptx()
-{
-    std::ifstream file("optix_programs.ptx");
-    if (!file)
-    {
-        std::cerr << "Error: optix_programs.ptx not found!\n";
-        std::cerr << "Generate with: nvcc --ptx -O3 -I/path/to/optix/include optix_programs.cu\n";
-        exit(1);
-    }
-    return std::string((std::istreambuf_iterator<char>(file)),
-                       std::istreambuf_iterator<char>());
+// optix_programs.cu as OptiX-IR (or PTX), embedded at build time (cmake/embed_file.cmake)
+extern const unsigned char optix_programs_code[];
+extern const size_t optix_programs_code_size;
+
+std::atomic<int> soba_log_level{LOG_INFO};
+
+void set_log_level(int level)
+{
+    soba_log_level = level;
 }
 
-// Initializing optix
-bool init_optix(OptiXSolar &optix, const std::vector<Triangle_GPU> &triangles)
+// OptiX disk cache directory for contexts created afterwards (empty = OptiX default)
+static std::mutex optix_cache_mutex;
+static std::string optix_cache_dir;
+
+void set_optix_cache_dir(const std::string &dir)
 {
-    std::cout << "Initializing OptiX for " << triangles.size() << " triangles...\n";
+    std::lock_guard<std::mutex> lock(optix_cache_mutex);
+    optix_cache_dir = dir;
+}
 
-    // 1. Initialize OptiX
-    OPTIX_CHECK(optixInit());
+static std::mutex pool_defaults_mutex;
+static bool default_pool_enabled = true;
+static size_t default_pool_release_threshold = size_t(1) << 30;
 
-    // 2. Create context - simplified approach
-    OptixDeviceContextOptions ctx_options = {};
-    ctx_options.logCallbackFunction = nullptr;
-    OPTIX_CHECK(optixDeviceContextCreate(0, &ctx_options, &optix.context));
+void set_memory_pool_defaults(bool enabled, size_t release_threshold_bytes)
+{
+    std::lock_guard<std::mutex> lock(pool_defaults_mutex);
+    default_pool_enabled = enabled;
+    default_pool_release_threshold = release_threshold_bytes;
+}
 
-    // 3. Build GAS (Geometry Acceleration Structure)
-    // Convert triangles to flat vertex array
-    std::vector<float3> vertices;
-    vertices.reserve(triangles.size() * 3);
-    for (const auto &tri : triangles)
+void init_memory_pool(OptiXSolar &optix)
+{
+    std::lock_guard<std::mutex> lock(pool_defaults_mutex);
+    if (!default_pool_enabled)
+        return;
+    if (!DevicePool::supported(optix.device))
     {
-        vertices.push_back(tri.v0);
-        vertices.push_back(tri.v1);
-        vertices.push_back(tri.v2);
+        std::cerr << "SolarEngine: device " << optix.device
+                  << " has no stream-ordered memory pools, using cudaMalloc per buffer" << std::endl;
+        return;
     }
+    optix.pool = std::make_unique<DevicePool>(optix.device, default_pool_release_threshold);
+}
 
-    // Upload vertices to GPU
-    CUdeviceptr d_vertices;
-    CUDA_CHECK(cudaMalloc((void **)&d_vertices, vertices.size() * sizeof(float3)));
-    CUDA_CHECK(cudaMemcpy((void *)d_vertices, vertices.data(),
-                          vertices.size() * sizeof(float3), cudaMemcpyHostToDevice));
+// Each SBT record is just the program header (no data)
+struct SbtRecord
+{
+    char header[OPTIX_SBT_RECORD_HEADER_SIZE];
+};
 
-    // Setup build input
-    OptixBuildInput build_input = {};
-    build_input.type = OPTIX_BUILD_INPUT_TYPE_TRIANGLES;
-    build_input.triangleArray.vertexBuffers = &d_vertices;
-    build_input.triangleArray.numVertices = static_cast<unsigned int>(triangles.size() * 3);
-    build_input.triangleArray.vertexFormat = OPTIX_VERTEX_FORMAT_FLOAT3;
-    build_input.triangleArray.vertexStrideInBytes = sizeof(float3);
-    build_input.triangleArray.numIndexTriplets = 0;
-    build_input.triangleArray.indexFormat = OPTIX_INDICES_FORMAT_NONE;
-    build_input.triangleArray.indexBuffer = 0;
+// Feature bits each mode has specialized raygens for, and their entry point
+// prefix (optix_programs.cu)
+static const int RAYGEN_MODE_FEATURES[RAYGEN_COUNT] = {
+    RAYGEN_WEIGHTED | RAYGEN_SAMPLED | RAYGEN_VISIBILITY | RAYGEN_CULLED, // RAYGEN_SOLAR
+    RAYGEN_SAMPLED,                                                       // RAYGEN_SKY145
+    RAYGEN_SAMPLED,                                                       // RAYGEN_SKY577
+    0,                                                                    // RAYGEN_BATCH
+};
+static const char *const RAYGEN_ENTRY_PREFIXES[RAYGEN_COUNT] = {"__raygen__solar_", "__raygen__sky145_",
+                                                                "__raygen__sky577_", "__raygen__batch_"};
 
-    uint32_t build_flags[] = {OPTIX_GEOMETRY_FLAG_NONE};
-    build_input.triangleArray.flags = build_flags;
-    build_input.triangleArray.numSbtRecords = 1;
-    build_input.triangleArray.sbtIndexOffsetBuffer = 0;
-    build_input.triangleArray.sbtIndexOffsetSizeInBytes = 0;
-    build_input.triangleArray.sbtIndexOffsetStrideInBytes = 0;
+static void free_mode_pipeline(OptiXSolar &optix, RaygenMode mode)
+{
+    if (optix.pipelines[mode])
+        optixPipelineDestroy(optix.pipelines[mode]);
+    optix.pipelines[mode] = nullptr;
+    for (int features = 0; features < RAYGEN_VARIANTS; features++)
+    {
+        if (optix.raygen_records[mode][features])
+            CUDA_WARN(cudaFree((void *)optix.raygen_records[mode][features]));
+        if (optix.raygen_pgs[mode][features])
+            optixProgramGroupDestroy(optix.raygen_pgs[mode][features]);
+        optix.raygen_records[mode][features] = 0;
+        optix.raygen_pgs[mode][features] = nullptr;
+    }
+}
 
-    // Build options
-    OptixAccelBuildOptions build_options = {};
-    build_options.buildFlags = OPTIX_BUILD_FLAG_PREFER_FAST_TRACE;
-    build_options.operation = OPTIX_BUILD_OPERATION_BUILD;
+// Pipeline cache entry of mode: a program group and SBT record per
+// specialized raygen, linked into one pipeline with the miss / hit programs
+static void create_mode_pipeline(OptiXSolar &optix, RaygenMode mode)
+{
+    auto start = std::chrono::high_resolution_clock::now();
+    OptixProgramGroupOptions pg_options = {};
+    char log[2048];
+    size_t log_size = sizeof(log);
 
-    std::cout << "Triangles: " << triangles.size() << ", Vertices: " << vertices.size() << std::endl;
+    try
+    {
+        std::vector<OptixProgramGroup> program_groups = {optix.miss_pg, optix.hit_pg};
+        for (int features = 0; features < RAYGEN_VARIANTS; features++)
+        {
+            if (features & ~RAYGEN_MODE_FEATURES[mode])
+                continue;
+            const std::string entry = RAYGEN_ENTRY_PREFIXES[mode] + std::to_string(features);
+            OptixProgramGroupDesc raygen_desc = {};
+            raygen_desc.kind = OPTIX_PROGRAM_GROUP_KIND_RAYGEN;
+            raygen_desc.raygen.module = optix.module;
+            raygen_desc.raygen.entryFunctionName = entry.c_str();
+            log_size = sizeof(log);
+            OPTIX_CHECK(optixProgramGroupCreate(optix.context, &raygen_desc, 1, &pg_options,
+                                                log, &log_size, &optix.raygen_pgs[mode][features]));
+            program_groups.push_back(optix.raygen_pgs[mode][features]);
 
-    // Get memory requirements
-    OptixAccelBufferSizes buffer_sizes;
-    OPTIX_CHECK(optixAccelComputeMemoryUsage(optix.context, &build_options,
-                                             &build_input, 1, &buffer_sizes));
+            SbtRecord raygen_record;
+            OPTIX_CHECK(optixSbtRecordPackHeader(optix.raygen_pgs[mode][features], &raygen_record));
+            CUDA_CHECK(cudaMalloc((void **)&optix.raygen_records[mode][features], sizeof(SbtRecord)));
+            CUDA_CHECK(cudaMemcpy((void *)optix.raygen_records[mode][features], &raygen_record, sizeof(SbtRecord),
+                                  cudaMemcpyHostToDevice));
+        }
+
+        OptixPipelineLinkOptions link_options = {};
+        link_options.maxTraceDepth = 1; // Only shadow rays
+        log_size = sizeof(log);
+        OPTIX_CHECK(optixPipelineCreate(optix.context, &optix.pipeline_options, &link_options,
+                                        program_groups.data(), static_cast<unsigned int>(program_groups.size()),
+                                        log, &log_size, &optix.pipelines[mode]));
+        SOBA_LOG(LOG_DEBUG) << "Pipeline for raygen mode " << mode << ": " << program_groups.size() - 2
+                            << " specialized raygens\n";
+    }
+    catch (...)
+    {
+        free_mode_pipeline(optix, mode);
+        throw;
+    }
 
-    // Allocate and build
-    CUdeviceptr d_temp_buffer;
-    CUDA_CHECK(cudaMalloc((void **)&d_temp_buffer, buffer_sizes.tempSizeInBytes));
-    CUDA_CHECK(cudaMalloc((void **)&optix.d_gas_buffer, buffer_sizes.outputSizeInBytes));
+    auto end = std::chrono::high_resolution_clock::now();
+    optix.metrics.module_ms += std::chrono::duration<double, std::milli>(end - start).count();
+}
 
-    OPTIX_CHECK(optixAccelBuild(optix.context, 0, &build_options, &build_input, 1,
-                                d_temp_buffer, buffer_sizes.tempSizeInBytes,
-                                optix.d_gas_buffer, buffer_sizes.outputSizeInBytes,
-                                &optix.gas_handle, nullptr, 0));
+// Point optix.sbt at the raygen of mode specialized for features and return
+// the pipeline to launch, creating the mode's pipeline on first use
+static OptixPipeline select_raygen(OptiXSolar &optix, RaygenMode mode, int features)
+{
+    if (features & ~RAYGEN_MODE_FEATURES[mode])
+        throw std::logic_error("select_raygen: raygen mode " + std::to_string(mode) + " has no variant for features " +
+                               std::to_string(features));
+    if (!optix.pipelines[mode])
+        create_mode_pipeline(optix, mode);
+    optix.sbt.raygenRecord = optix.raygen_records[mode][features];
+    return optix.pipelines[mode];
+}
 
-    // Cleanup temp data
-    CUDA_CHECK(cudaFree((void *)d_temp_buffer));
-    CUDA_CHECK(cudaFree((void *)d_vertices));
+// Create context, module, miss / hit program groups and SBT (no geometry, no
+// raygens: each mode's pipeline is created on its first launch)
+void create_optix_pipeline(OptiXSolar &optix)
+{
+    auto start = std::chrono::high_resolution_clock::now();
+
+    // 1. Initialize OptiX (make sure the CUDA runtime context exists first)
+    CUDA_CHECK(cudaSetDevice(optix.device));
+    CUDA_CHECK(cudaFree(0));
+    OPTIX_CHECK(optixInit());
+
+    // 2. Create context on the current (optix.device) CUDA context
+    OptixDeviceContextOptions ctx_options = {};
+    ctx_options.logCallbackFunction = nullptr;
+    OPTIX_CHECK(optixDeviceContextCreate(0, &ctx_options, &optix.context));
 
-    std::cout << "GAS built successfully\n";
+    // Compiled modules are cached on disk, so only the first worker pays the compile
+    {
+        std::lock_guard<std::mutex> lock(optix_cache_mutex);
+        if (!optix_cache_dir.empty())
+            OPTIX_CHECK(optixDeviceContextSetCacheLocation(optix.context, optix_cache_dir.c_str()));
+    }
+    OPTIX_CHECK(optixDeviceContextSetCacheEnabled(optix.context, 1));
 
-    // 4. Create module from PTX
-    std::string ptx = load_ptx();
+    // 3. Create module from the embedded device code
 
     OptixModuleCompileOptions module_options = {};
     module_options.maxRegisterCount = 50;
     module_options.optLevel = OPTIX_COMPILE_OPTIMIZATION_DEFAULT;
 
-    OptixPipelineCompileOptions pipeline_options = {};
-    pipeline_options.traversableGraphFlags = OPTIX_TRAVERSABLE_GRAPH_FLAG_ALLOW_SINGLE_GAS;
+    OptixPipelineCompileOptions &pipeline_options = optix.pipeline_options;
+    pipeline_options = {};
+    pipeline_options.traversableGraphFlags = OPTIX_TRAVERSABLE_GRAPH_FLAG_ALLOW_SINGLE_LEVEL_INSTANCING;
     pipeline_options.numPayloadValues = 1;   // Just shadow flag
     pipeline_options.numAttributeValues = 0; // No hit attributes needed
     pipeline_options.pipelineLaunchParamsVariableName = "params";
 
-    OptixModule module;
     char log[2048];
     size_t log_size = sizeof(log);
     OPTIX_CHECK(optixModuleCreate(optix.context, &module_options, &pipeline_options,
-                                  ptx.c_str(), ptx.size(), log, &log_size, &module));
+                                  reinterpret_cast<const char *>(optix_programs_code), optix_programs_code_size,
+                                  log, &log_size, &optix.module));
 
-    // 5. Create program groups
+    // 4. Create the miss / hit program groups shared by every pipeline; each
+    // mode's raygens and pipeline follow on its first launch (select_raygen)
     OptixProgramGroupOptions pg_options = {};
 
-    // Raygen program
-    OptixProgramGroup raygen_pg;
-    OptixProgramGroupDesc raygen_desc = {};
-    raygen_desc.kind = OPTIX_PROGRAM_GROUP_KIND_RAYGEN;
-    raygen_desc.raygen.module = module;
-    raygen_desc.raygen.entryFunctionName = "__raygen__solar";
-    OPTIX_CHECK(optixProgramGroupCreate(optix.context, &raygen_desc, 1, &pg_options,
-                                        log, &log_size, &raygen_pg));
-
     // Miss program (no shadow)
-    OptixProgramGroup miss_pg;
     OptixProgramGroupDesc miss_desc = {};
     miss_desc.kind = OPTIX_PROGRAM_GROUP_KIND_MISS;
-    miss_desc.miss.module = module;
+    miss_desc.miss.module = optix.module;
     miss_desc.miss.entryFunctionName = "__miss__shadow";
+    log_size = sizeof(log);
     OPTIX_CHECK(optixProgramGroupCreate(optix.context, &miss_desc, 1, &pg_options,
-                                        log, &log_size, &miss_pg));
+                                        log, &log_size, &optix.miss_pg));
 
     // Hit program (shadow found)
-    OptixProgramGroup hit_pg;
     OptixProgramGroupDesc hit_desc = {};
     hit_desc.kind = OPTIX_PROGRAM_GROUP_KIND_HITGROUP;
-    hit_desc.hitgroup.moduleCH = module;
+    hit_desc.hitgroup.moduleCH = optix.module;
     hit_desc.hitgroup.entryFunctionNameCH = "__closesthit__shadow";
+    log_size = sizeof(log);
     OPTIX_CHECK(optixProgramGroupCreate(optix.context, &hit_desc, 1, &pg_options,
-                                        log, &log_size, &hit_pg));
-
-    // 6. Create pipeline
-    OptixProgramGroup program_groups[] = {raygen_pg, miss_pg, hit_pg};
-    OptixPipelineLinkOptions link_options = {};
-    link_options.maxTraceDepth = 1; // Only shadow rays
-    OPTIX_CHECK(optixPipelineCreate(optix.context, &pipeline_options, &link_options,
-                                    program_groups, 3, log, &log_size, &optix.pipeline));
-
-    // 7. Setup Shader Binding Table (SBT)
-    CUdeviceptr d_raygen_sbt, d_miss_sbt, d_hit_sbt;
+                                        log, &log_size, &optix.hit_pg));
 
-    // Each SBT record is just the program header (no data)
-    struct SbtRecord
-    {
-        char header[OPTIX_SBT_RECORD_HEADER_SIZE];
-    };
+    // 5. Setup Shader Binding Table (SBT); the raygen record is picked per launch
+    CUdeviceptr d_miss_sbt, d_hit_sbt;
 
-    SbtRecord raygen_record, miss_record, hit_record;
-    OPTIX_CHECK(optixSbtRecordPackHeader(raygen_pg, &raygen_record));
-    OPTIX_CHECK(optixSbtRecordPackHeader(miss_pg, &miss_record));
-    OPTIX_CHECK(optixSbtRecordPackHeader(hit_pg, &hit_record));
+    SbtRecord miss_record, hit_record;
+    OPTIX_CHECK(optixSbtRecordPackHeader(optix.miss_pg, &miss_record));
+    OPTIX_CHECK(optixSbtRecordPackHeader(optix.hit_pg, &hit_record));
 
-    CUDA_CHECK(cudaMalloc((void **)&d_raygen_sbt, sizeof(SbtRecord)));
     CUDA_CHECK(cudaMalloc((void **)&d_miss_sbt, sizeof(SbtRecord)));
+    optix.sbt.missRecordBase = d_miss_sbt;
     CUDA_CHECK(cudaMalloc((void **)&d_hit_sbt, sizeof(SbtRecord)));
-
-    CUDA_CHECK(cudaMemcpy((void *)d_raygen_sbt, &raygen_record, sizeof(SbtRecord),
-                          cudaMemcpyHostToDevice));
+    optix.sbt.hitgroupRecordBase = d_hit_sbt;
     CUDA_CHECK(cudaMemcpy((void *)d_miss_sbt, &miss_record, sizeof(SbtRecord),
                           cudaMemcpyHostToDevice));
     CUDA_CHECK(cudaMemcpy((void *)d_hit_sbt, &hit_record, sizeof(SbtRecord),
                           cudaMemcpyHostToDevice));
 
-    optix.sbt.raygenRecord = d_raygen_sbt;
-    optix.sbt.missRecordBase = d_miss_sbt;
     optix.sbt.missRecordStrideInBytes = sizeof(SbtRecord);
     optix.sbt.missRecordCount = 1;
-    optix.sbt.hitgroupRecordBase = d_hit_sbt;
     optix.sbt.hitgroupRecordStrideInBytes = sizeof(SbtRecord);
     optix.sbt.hitgroupRecordCount = 1;
 
-    // 8. Allocate launch parameters
+    // 6. Allocate launch parameters (grown per trace) and the tile streams
     CUDA_CHECK(cudaMalloc((void **)&optix.d_params, sizeof(LaunchParams)));
+    optix.params_capacity = 1;
+    for (cudaStream_t &stream : optix.streams)
+        CUDA_CHECK(cudaStreamCreate(&stream));
 
-    std::cout << "OptiX initialization complete!\n";
-    return true;
+    auto end = std::chrono::high_resolution_clock::now();
+    optix.metrics.module_ms += std::chrono::duration<double, std::milli>(end - start).count();
 }
 
-// Launch Optix
-void launch_solar_rays(OptiXSolar &optix, float3 *centroids, float3 *normals,
-                       float3 *suns, float *results, int face_count, int sun_count, float ray_offset)
-{
-
-    // Setup launch parameters
-    LaunchParams params;
-    params.face_centroids = centroids;
-    params.face_normals = normals;
-    params.sun_directions = suns;
-    params.results = results;
-    params.face_count = face_count;
-    params.sun_count = sun_count;
-    params.gas_handle = optix.gas_handle;
-    params.ray_offset = ray_offset;
-
-    // Copy to GPU
-    CUDA_CHECK(cudaMemcpy((void *)optix.d_params, &params, sizeof(params),
-                          cudaMemcpyHostToDevice));
+// Fill a triangle build input from device vertex (and optional index) buffers
+static void setup_triangle_input(OptixBuildInput &build_input, const MeshView &mesh,
+                                 const CUdeviceptr &d_vertices, CUdeviceptr d_indices,
+                                 const uint32_t *geometry_flags)
+{
+    build_input = {};
+    build_input.type = OPTIX_BUILD_INPUT_TYPE_TRIANGLES;
+    build_input.triangleArray.vertexBuffers = &d_vertices;
+    build_input.triangleArray.numVertices = static_cast<unsigned int>(mesh.vertex_count);
+    build_input.triangleArray.vertexFormat = OPTIX_VERTEX_FORMAT_FLOAT3;
+    build_input.triangleArray.vertexStrideInBytes = sizeof(float3);
 
-    // Launch rays - one thread per (face, sun) pair
-    int total_rays = face_count * sun_count;
-    OPTIX_CHECK(optixLaunch(optix.pipeline, 0, optix.d_params, sizeof(params),
-                            &optix.sbt, total_rays, 1, 1));
+    if (mesh.indices)
+    {
+        build_input.triangleArray.indexBuffer = d_indices;
+        build_input.triangleArray.numIndexTriplets = static_cast<unsigned int>(mesh.triangle_count);
+        build_input.triangleArray.indexFormat = OPTIX_INDICES_FORMAT_UNSIGNED_INT3;
+        build_input.triangleArray.indexStrideInBytes = sizeof(uint3);
+    }
+    else
+    {
+        build_input.triangleArray.numIndexTriplets = 0;
+        build_input.triangleArray.indexFormat = OPTIX_INDICES_FORMAT_NONE;
+        build_input.triangleArray.indexBuffer = 0;
+    }
 
-    // Wait for completion
-    CUDA_CHECK(cudaDeviceSynchronize());
+    build_input.triangleArray.flags = geometry_flags;
+    build_input.triangleArray.numSbtRecords = 1;
+    build_input.triangleArray.sbtIndexOffsetBuffer = 0;
+    build_input.triangleArray.sbtIndexOffsetSizeInBytes = 0;
+    build_input.triangleArray.sbtIndexOffsetStrideInBytes = 0;
 }
 
-// Cleanup function
-void cleanup_optix(OptiXSolar &optix)
+/////////// Host -> device uploads ///////////
+PinnedStaging::PinnedStaging(size_t chunk_bytes) : chunk_bytes_(chunk_bytes)
 {
-    if (optix.d_gas_buffer)
-        CUDA_CHECK(cudaFree((void *)optix.d_gas_buffer));
-    if (optix.d_params)
-        CUDA_CHECK(cudaFree((void *)optix.d_params));
-    if (optix.sbt.raygenRecord)
-        CUDA_CHECK(cudaFree((void *)optix.sbt.raygenRecord));
-    if (optix.sbt.missRecordBase)
-        CUDA_CHECK(cudaFree((void *)optix.sbt.missRecordBase));
-    if (optix.sbt.hitgroupRecordBase)
-        CUDA_CHECK(cudaFree((void *)optix.sbt.hitgroupRecordBase));
-    if (optix.context)
-        optixDeviceContextDestroy(optix.context);
+    for (int i = 0; i < 2; i++)
+    {
+        CUDA_CHECK(cudaMallocHost(&buffers_[i], chunk_bytes_));
+        CUDA_CHECK(cudaEventCreateWithFlags(&done_[i], cudaEventDisableTiming));
+    }
 }
 
-// Main wrapper function
-void gpu_solar_analysis_series_optix(
-    const std::vector<point3> &face_centroids,
-    const std::vector<vec3> &face_normals,
-    const std::vector<Triangle> &scene_tris,
-    const std::vector<vec3> &sun_directions,
-    std::vector<float> &results,
-    float ray_offset)
+PinnedStaging::~PinnedStaging()
+{
+    for (int i = 0; i < 2; i++)
+    {
+        if (done_[i])
+            cudaEventDestroy(done_[i]);
+        if (buffers_[i])
+            cudaFreeHost(buffers_[i]);
+    }
+}
+
+void PinnedStaging::upload(void *d_dst, const void *h_src, size_t bytes, cudaStream_t stream)
 {
+    const char *src = static_cast<const char *>(h_src);
+    char *dst = static_cast<char *>(d_dst);
 
-    std::cout << "GPU OptiX: Processing " << face_centroids.size() << " faces...\n";
+    for (size_t offset = 0, chunk = 0; offset < bytes; offset += chunk_bytes_, chunk++)
+    {
+        const int buf = chunk % 2;
+        const size_t n = std::min(chunk_bytes_, bytes - offset);
 
-    const int face_count = static_cast<int>(face_centroids.size());
-    const int scene_tris_count = static_cast<int>(scene_tris.size());
-    const int sun_count = static_cast<int>(sun_directions.size());
+        // Wait until the DMA that last read this buffer has finished
+        CUDA_CHECK(cudaEventSynchronize(done_[buf]));
+        std::memcpy(buffers_[buf], src + offset, n);
+        CUDA_CHECK(cudaMemcpyAsync(dst + offset, buffers_[buf], n, cudaMemcpyHostToDevice, stream));
+        CUDA_CHECK(cudaEventRecord(done_[buf], stream));
+    }
+    CUDA_CHECK(cudaStreamSynchronize(stream));
+}
 
-    // Convert to GPU format
-    std::vector<Triangle_GPU> gpu_scene_tris(scene_tris_count);
-    for (int i = 0; i < scene_tris_count; i++)
+void upload_to_device(OptiXSolar &optix, void *d_dst, const void *h_src, size_t bytes)
+{
+    if (bytes == 0)
+        return;
+    if (optix.staging)
+        optix.staging->upload(d_dst, h_src, bytes);
+    else
+        CUDA_CHECK(cudaMemcpy(d_dst, h_src, bytes, cudaMemcpyHostToDevice));
+}
+
+// Device inputs are float4 (launch_params.h) while the host hands over float3:
+// thread i moves source element i, row i / planes, into plane i % planes
+constexpr int EXPAND_BLOCK = 256;
+
+__global__ void expand_float4_kernel(const float3 *src, float4 *dst, size_t count, int planes)
+{
+    const size_t i = static_cast<size_t>(blockIdx.x) * blockDim.x + threadIdx.x;
+    if (i >= count * planes)
+        return;
+    const float3 v = src[i];
+    dst[(i % planes) * count + i / planes] = make_float4(v.x, v.y, v.z, 0.0f);
+}
+
+// count rows of planes float3's on the device into planes planes of count
+// float4's (planes = 1: a plain float3 -> float4 copy), on the legacy stream
+static void expand_float4(const float3 *d_src, float4 *d_dst, size_t count, int planes)
+{
+    const size_t n = count * planes;
+    if (n == 0)
+        return;
+    const unsigned blocks = static_cast<unsigned>((n + EXPAND_BLOCK - 1) / EXPAND_BLOCK);
+    expand_float4_kernel<<<blocks, EXPAND_BLOCK>>>(d_src, d_dst, count, planes);
+    CUDA_CHECK(cudaGetLastError());
+}
+
+__global__ void gather_suns_kernel(const float4 *src, const float *src_weights, const uint32_t *order,
+                                   float4 *dst, float *dst_weights, size_t count)
+{
+    const size_t i = static_cast<size_t>(blockIdx.x) * blockDim.x + threadIdx.x;
+    if (i >= count)
+        return;
+    dst[i] = src[order[i]];
+    if (src_weights)
+        dst_weights[i] = src_weights[order[i]];
+}
+
+// dst[i] = src[order[i]] on the device (and the weights, when given), on the
+// legacy stream: resident suns in a culled order without a host round trip
+static void gather_suns(const float4 *d_src, const float *d_src_weights, const uint32_t *d_order,
+                        float4 *d_dst, float *d_dst_weights, size_t count)
+{
+    if (count == 0)
+        return;
+    const unsigned blocks = static_cast<unsigned>((count + EXPAND_BLOCK - 1) / EXPAND_BLOCK);
+    gather_suns_kernel<<<blocks, EXPAND_BLOCK>>>(d_src, d_src_weights, d_order, d_dst, d_dst_weights, count);
+    CUDA_CHECK(cudaGetLastError());
+}
+
+void upload_float4(OptiXSolar &optix, float4 *d_dst, const float3 *h_src, size_t count, int planes)
+{
+    DeviceBuffer<float3> scratch(count * planes, optix.pool.get());
+    upload_to_device(optix, scratch.get(), h_src, scratch.bytes());
+    expand_float4(scratch.get(), d_dst, count, planes);
+}
+
+StageTimer::StageTimer(double &total_ms, cudaStream_t stream)
+    : total_ms_(total_ms), stream_(stream)
+{
+    CUDA_CHECK(cudaEventCreate(&start_));
+    cudaError_t err = cudaEventCreate(&stop_);
+    if (err == cudaSuccess)
+        err = cudaEventRecord(start_, stream_);
+    if (err != cudaSuccess)
     {
-        const auto &tri = scene_tris[i];
-        gpu_scene_tris[i] = Triangle_GPU(
-            make_float3(tri.v0.x(), tri.v0.y(), tri.v0.z()),
-            make_float3(tri.v1.x(), tri.v1.y(), tri.v1.z()),
-            make_float3(tri.v2.x(), tri.v2.y(), tri.v2.z()));
+        // The destructor will not run
+        cudaEventDestroy(start_);
+        if (stop_)
+            cudaEventDestroy(stop_);
+        throw_cuda_error(err, __FILE__, __LINE__);
     }
+}
 
-    // Allocate GPU memory
-    float3 *d_centroids, *d_normals, *d_sun_dirs;
-    float *d_results;
+StageTimer::~StageTimer()
+{
+    // Errors here are reported but never thrown out of a destructor
+    float ms = 0.0f;
+    if (cudaEventRecord(stop_, stream_) == cudaSuccess && cudaEventSynchronize(stop_) == cudaSuccess &&
+        cudaEventElapsedTime(&ms, start_, stop_) == cudaSuccess)
+        total_ms_ += ms;
+    cudaEventDestroy(start_);
+    cudaEventDestroy(stop_);
+}
 
-    CUDA_CHECK(cudaMalloc(&d_centroids, face_count * sizeof(float3)));
-    CUDA_CHECK(cudaMalloc(&d_normals, face_count * sizeof(float3)));
-    CUDA_CHECK(cudaMalloc(&d_sun_dirs, sun_count * sizeof(float3)));
-    CUDA_CHECK(cudaMalloc(&d_results, face_count * sizeof(float)));
+void sample_device_memory(OptiXSolar &optix)
+{
+    size_t free_bytes = 0, total_bytes = 0;
+    CUDA_CHECK(cudaMemGetInfo(&free_bytes, &total_bytes));
+    optix.metrics.peak_device_bytes = std::max(optix.metrics.peak_device_bytes, total_bytes - free_bytes);
+}
 
-    // Convert and transfer data
-    std::vector<float3> gpu_centroids(face_count), gpu_normals(face_count), gpu_sun_dirs(sun_count);
+// Out-of-memory recovery: drop every cached GAS no mesh uses and hand the
+// pool's idle blocks back to the driver. Returns the bytes freed
+static size_t reclaim_device_memory(OptiXSolar &optix)
+{
+    size_t freed = 0;
+    if (optix.gas_cache)
+        freed += optix.gas_cache->trim();
+    if (optix.pool)
+        freed += optix.pool->trim();
+    return freed;
+}
 
-    for (int i = 0; i < face_count; i++)
+// Upload vertex and index arrays of a mesh to the GPU
+static void upload_mesh(OptiXSolar &optix, const MeshView &mesh, DeviceBuffer<float3> &d_vertices,
+                        DeviceBuffer<uint3> &d_indices)
+{
+    if (!mesh.indices && mesh.vertex_count != mesh.triangle_count * 3)
+        throw std::runtime_error("De-indexed mesh needs exactly 3 vertices per triangle");
+
+    d_vertices.allocate(mesh.vertex_count, optix.pool.get());
+    upload_to_device(optix, d_vertices.get(), mesh.vertices, d_vertices.bytes());
+
+    d_indices.reset();
+    if (mesh.indices)
     {
-        gpu_centroids[i] = make_float3(face_centroids[i].x(), face_centroids[i].y(), face_centroids[i].z());
-        gpu_normals[i] = make_float3(face_normals[i].x(), face_normals[i].y(), face_normals[i].z());
+        d_indices.allocate(mesh.triangle_count, optix.pool.get());
+        upload_to_device(optix, d_indices.get(), mesh.indices, d_indices.bytes());
     }
+}
 
-    for (int i = 0; i < sun_count; i++)
+// Upload, build and compact: gas gets the buffer, handle and sizes
+static void build_gas_buffer(OptiXSolar &optix, const MeshView &mesh, bool allow_update, MeshGAS &gas)
+{
+    DeviceBuffer<float3> d_vertices;
+    DeviceBuffer<uint3> d_indices;
+    upload_mesh(optix, mesh, d_vertices, d_indices);
+
+    // Setup build input
+    OptixBuildInput build_input;
+    uint32_t build_flags[] = {OPTIX_GEOMETRY_FLAG_NONE};
+    const CUdeviceptr vertex_buffer = d_vertices.ptr();
+    setup_triangle_input(build_input, mesh, vertex_buffer, d_indices.ptr(), build_flags);
+
+    // Build options
+    OptixAccelBuildOptions build_options = {};
+    build_options.buildFlags = OPTIX_BUILD_FLAG_PREFER_FAST_TRACE | OPTIX_BUILD_FLAG_ALLOW_COMPACTION;
+    if (allow_update)
+        build_options.buildFlags |= OPTIX_BUILD_FLAG_ALLOW_UPDATE;
+    build_options.operation = OPTIX_BUILD_OPERATION_BUILD;
+
+    // Get memory requirements
+    OptixAccelBufferSizes buffer_sizes;
+    OPTIX_CHECK(optixAccelComputeMemoryUsage(optix.context, &build_options,
+                                             &build_input, 1, &buffer_sizes));
+
+    // Allocate and build; the compacted size is emitted into d_compacted_size.
+    // Scratch comes from the pool, the output outlives the job and does not
+    DeviceBuffer<char> d_temp_buffer(buffer_sizes.tempSizeInBytes, optix.pool.get());
+    DeviceBuffer<char> d_output(buffer_sizes.outputSizeInBytes);
+    DeviceBuffer<size_t> d_compacted_size(1, optix.pool.get());
+
+    OptixAccelEmitDesc emit_desc = {};
+    emit_desc.type = OPTIX_PROPERTY_TYPE_COMPACTED_SIZE;
+    emit_desc.result = d_compacted_size.ptr();
+
+    OptixTraversableHandle handle = 0;
+    OPTIX_CHECK(optixAccelBuild(optix.context, 0, &build_options, &build_input, 1,
+                                d_temp_buffer.ptr(), buffer_sizes.tempSizeInBytes,
+                                d_output.ptr(), buffer_sizes.outputSizeInBytes,
+                                &handle, &emit_desc, 1));
+
+    // Cleanup temp data
+    d_temp_buffer.reset();
+    d_vertices.reset();
+    d_indices.reset();
+
+    size_t compacted_size = 0;
+    CUDA_CHECK(cudaMemcpy(&compacted_size, d_compacted_size.get(), sizeof(size_t), cudaMemcpyDeviceToHost));
+
+    // gas only takes ownership once nothing below can throw
+    if (compacted_size < buffer_sizes.outputSizeInBytes)
     {
-        gpu_sun_dirs[i] = make_float3(sun_directions[i].x(), sun_directions[i].y(), sun_directions[i].z());
+        DeviceBuffer<char> d_compacted(compacted_size);
+        OPTIX_CHECK(optixAccelCompact(optix.context, 0, handle, d_compacted.ptr(), compacted_size, &gas.handle));
+        gas.buffer_size = compacted_size;
+        gas.d_buffer = reinterpret_cast<CUdeviceptr>(d_compacted.release());
     }
+    else
+    {
+        gas.handle = handle;
+        gas.buffer_size = buffer_sizes.outputSizeInBytes;
+        gas.d_buffer = reinterpret_cast<CUdeviceptr>(d_output.release());
+    }
+    gas.uncompacted_size = buffer_sizes.outputSizeInBytes;
+}
 
-    CUDA_CHECK(cudaMemcpy(d_centroids, gpu_centroids.data(), face_count * sizeof(float3), cudaMemcpyHostToDevice));
-    CUDA_CHECK(cudaMemcpy(d_normals, gpu_normals.data(), face_count * sizeof(float3), cudaMemcpyHostToDevice));
-    CUDA_CHECK(cudaMemcpy(d_sun_dirs, gpu_sun_dirs.data(), sun_count * sizeof(float3), cudaMemcpyHostToDevice));
-    CUDA_CHECK(cudaMemset(d_results, 0, face_count * sizeof(float)));
+// Build a compacted GAS (Geometry Acceleration Structure) for one mesh
+// (or borrow an identical one from optix.gas_cache)
+void build_mesh_gas(OptiXSolar &optix, const MeshView &mesh, bool allow_update, MeshGAS &gas)
+{
+    free_mesh_gas(gas);
+    StageTimer timer(optix.metrics.gas_build_ms);
 
-    std::cout << "OptiX triangle count: " << gpu_scene_tris.size() << std::endl;
+    MeshDigest digest;
+    if (optix.gas_cache)
+    {
+        digest = GasCache::mesh_digest(mesh, allow_update);
+        if (optix.gas_cache->acquire(optix, digest, mesh, allow_update, gas))
+        {
+            SOBA_LOG(LOG_DEBUG) << "GAS: " << mesh.triangle_count << " triangles from cache ("
+                      << gas.buffer_size / 1024 << " KB)\n";
+            return;
+        }
+    }
 
-    // Initialize OptiX
-    auto start = std::chrono::high_resolution_clock::now();
-    OptiXSolar optix;
-    if (!init_optix(optix, gpu_scene_tris))
+    // Out of device memory: retry once unused cached GAS and pooled memory are freed
+    bool retry = false;
+    try
+    {
+        build_gas_buffer(optix, mesh, allow_update, gas);
+    }
+    catch (const CudaOutOfMemory &)
     {
-        std::cerr << "OptiX initialization failed!\n";
+        const size_t freed = reclaim_device_memory(optix);
+        if (freed == 0)
+            throw;
+        std::cerr << "GAS: out of device memory building " << mesh.triangle_count << " triangles, retrying after "
+                  << "freeing " << (freed >> 20) << " MB of cached GAS / pooled memory" << std::endl;
+        retry = true;
+    }
+    if (retry)
+        build_gas_buffer(optix, mesh, allow_update, gas);
+
+    SOBA_LOG(LOG_DEBUG) << "GAS: " << mesh.triangle_count << " triangles"
+              << (mesh.indices ? " (indexed)" : "") << ", "
+              << gas.uncompacted_size / 1024 << " KB -> " << gas.buffer_size / 1024
+              << " KB compacted\n";
+
+    gas.vertex_count = mesh.vertex_count;
+    gas.triangle_count = mesh.triangle_count;
+    gas.indexed = mesh.indices != nullptr;
+    gas.allow_update = allow_update;
+    gas.alive = true;
+
+    if (optix.gas_cache)
+        optix.gas_cache->insert(optix, digest, gas);
+}
+
+// Refit an existing GAS to moved vertices (same topology)
+void refit_mesh_gas(OptiXSolar &optix, const MeshView &mesh, MeshGAS &gas)
+{
+    if (!gas.allow_update || mesh.triangle_count != gas.triangle_count ||
+        mesh.vertex_count != gas.vertex_count || (mesh.indices != nullptr) != gas.indexed)
+        throw std::runtime_error("refit_mesh_gas: mesh is not refittable with this input");
+    StageTimer timer(optix.metrics.gas_build_ms);
+
+    // The cached buffer still matches the old vertices, refit a private copy
+    if (gas.cache)
+        gas.cache->detach(optix, gas);
+
+    DeviceBuffer<float3> d_vertices;
+    DeviceBuffer<uint3> d_indices;
+    upload_mesh(optix, mesh, d_vertices, d_indices);
+
+    OptixBuildInput build_input;
+    uint32_t build_flags[] = {OPTIX_GEOMETRY_FLAG_NONE};
+    const CUdeviceptr vertex_buffer = d_vertices.ptr();
+    setup_triangle_input(build_input, mesh, vertex_buffer, d_indices.ptr(), build_flags);
+
+    // Update must use the same flags as the original build
+    OptixAccelBuildOptions build_options = {};
+    build_options.buildFlags = OPTIX_BUILD_FLAG_PREFER_FAST_TRACE | OPTIX_BUILD_FLAG_ALLOW_COMPACTION |
+                               OPTIX_BUILD_FLAG_ALLOW_UPDATE;
+    build_options.operation = OPTIX_BUILD_OPERATION_UPDATE;
+
+    OptixAccelBufferSizes buffer_sizes;
+    OPTIX_CHECK(optixAccelComputeMemoryUsage(optix.context, &build_options,
+                                             &build_input, 1, &buffer_sizes));
+
+    DeviceBuffer<char> d_temp_buffer(buffer_sizes.tempUpdateSizeInBytes, optix.pool.get());
+    OPTIX_CHECK(optixAccelBuild(optix.context, 0, &build_options, &build_input, 1,
+                                d_temp_buffer.ptr(), buffer_sizes.tempUpdateSizeInBytes,
+                                gas.d_buffer, gas.buffer_size,
+                                &gas.handle, nullptr, 0));
+}
+
+void free_mesh_gas(MeshGAS &gas)
+{
+    if (gas.cache)
+        gas.cache->release(gas.cache_key);
+    else if (gas.d_buffer)
+        CUDA_WARN(cudaFree((void *)gas.d_buffer));
+    gas = MeshGAS{};
+}
+
+void identity_transform(float transform[12])
+{
+    const float identity[12] = {1, 0, 0, 0,
+                                0, 1, 0, 0,
+                                0, 0, 1, 0};
+    std::copy(identity, identity + 12, transform);
+}
+
+// Build (or refit, when only transforms changed) the IAS over all live instances
+void build_ias(OptiXSolar &optix)
+{
+    if (!optix.ias_rebuild && !optix.ias_refit)
         return;
+    StageTimer timer(optix.metrics.gas_build_ms);
+
+    std::vector<OptixInstance> optix_instances;
+    for (size_t i = 0; i < optix.instances.size(); i++)
+    {
+        const SceneInstance &inst = optix.instances[i];
+        if (!inst.alive)
+            continue;
+
+        OptixInstance oi = {};
+        std::copy(inst.transform, inst.transform + 12, oi.transform);
+        oi.instanceId = static_cast<unsigned int>(i);
+        oi.sbtOffset = 0;
+        oi.visibilityMask = 255;
+        oi.flags = OPTIX_INSTANCE_FLAG_NONE;
+        oi.traversableHandle = optix.meshes[inst.mesh_id].handle;
+        optix_instances.push_back(oi);
     }
 
-    std::cout << "Launching " << face_count * sun_count << " total rays" << std::endl;
-    std::cout << "Face count: " << face_count << ", Sun count: " << sun_count << std::endl;
+    // An update needs the same instance count as the original build
+    const bool refit = !optix.ias_rebuild && optix.d_ias_buffer &&
+                       optix_instances.size() == optix.ias_instance_count;
 
-    auto init_end = std::chrono::high_resolution_clock::now();
-    auto init_time = std::chrono::duration_cast<std::chrono::milliseconds>(init_end - start).count();
-    std::cout << "OptiX init: " << init_time << "ms\n";
+    if (!refit)
+    {
+        if (optix.d_instances)
+            CUDA_WARN(cudaFree((void *)optix.d_instances));
+        if (optix.d_ias_buffer)
+            CUDA_WARN(cudaFree((void *)optix.d_ias_buffer));
+        optix.d_instances = 0;
+        optix.d_ias_buffer = 0;
+        optix.ias_handle = 0;
+        optix.ias_instance_count = 0;
+    }
 
-    // Launch rays
-    auto ray_start = std::chrono::high_resolution_clock::now();
-    launch_solar_rays(optix, d_centroids, d_normals, d_sun_dirs, d_results, face_count, sun_count, ray_offset);
+    if (optix_instances.empty())
+    {
+        optix.ias_rebuild = false;
+        optix.ias_refit = false;
+        return;
+    }
 
-    auto ray_end = std::chrono::high_resolution_clock::now();
-    auto ray_time = std::chrono::duration_cast<std::chrono::microseconds>(ray_end - ray_start).count();
-    std::cout << "OptiX tracing: " << ray_time << "μs (" << ray_time / 1000.0f << "ms)\n";
+    const size_t instances_bytes = optix_instances.size() * sizeof(OptixInstance);
+    if (!optix.d_instances)
+        CUDA_CHECK(cudaMalloc((void **)&optix.d_instances, instances_bytes));
+    CUDA_CHECK(cudaMemcpy((void *)optix.d_instances, optix_instances.data(),
+                          instances_bytes, cudaMemcpyHostToDevice));
 
-    // Get results
-    results.resize(face_count);
-    CUDA_CHECK(cudaMemcpy(results.data(), d_results, face_count * sizeof(float), cudaMemcpyDeviceToHost));
+    OptixBuildInput build_input = {};
+    build_input.type = OPTIX_BUILD_INPUT_TYPE_INSTANCES;
+    build_input.instanceArray.instances = optix.d_instances;
+    build_input.instanceArray.numInstances = static_cast<unsigned int>(optix_instances.size());
+
+    OptixAccelBuildOptions build_options = {};
+    build_options.buildFlags = OPTIX_BUILD_FLAG_PREFER_FAST_TRACE | OPTIX_BUILD_FLAG_ALLOW_UPDATE;
+    build_options.operation = refit ? OPTIX_BUILD_OPERATION_UPDATE : OPTIX_BUILD_OPERATION_BUILD;
+
+    OptixAccelBufferSizes buffer_sizes;
+    OPTIX_CHECK(optixAccelComputeMemoryUsage(optix.context, &build_options,
+                                             &build_input, 1, &buffer_sizes));
 
-    std::cout << "DEBUG: After memcpy, first 5 results: ";
-    for (int i = 0; i < std::min(5, face_count); i++)
+    const size_t temp_size = refit ? buffer_sizes.tempUpdateSizeInBytes : buffer_sizes.tempSizeInBytes;
+    DeviceBuffer<char> d_temp_buffer(temp_size, optix.pool.get());
+    if (!refit)
     {
-        std::cout << results[i] << " ";
+        CUDA_CHECK(cudaMalloc((void **)&optix.d_ias_buffer, buffer_sizes.outputSizeInBytes));
+        optix.ias_buffer_size = buffer_sizes.outputSizeInBytes;
     }
-    std::cout << std::endl;
 
-    // Cleanup
-    cleanup_optix(optix);
-    CUDA_CHECK(cudaFree(d_centroids));
-    CUDA_CHECK(cudaFree(d_normals));
-    CUDA_CHECK(cudaFree(d_sun_dirs));
-    CUDA_CHECK(cudaFree(d_results));
+    OPTIX_CHECK(optixAccelBuild(optix.context, 0, &build_options, &build_input, 1,
+                                d_temp_buffer.ptr(), temp_size,
+                                optix.d_ias_buffer, optix.ias_buffer_size,
+                                &optix.ias_handle, nullptr, 0));
+
+    // Only now: a failed build leaves the flags set, so the next trace rebuilds
+    optix.ias_instance_count = optix_instances.size();
+    optix.ias_rebuild = false;
+    optix.ias_refit = false;
+}
+
+// Release every GAS, instance and the IAS, keeping the pipeline alive
+void free_scene(OptiXSolar &optix)
+{
+    for (auto &gas : optix.meshes)
+        free_mesh_gas(gas);
+    optix.meshes.clear();
+    optix.instances.clear();
 
-    std::cout << "OptiX complete!\n";
-}
\ No newline at end of file
+    if (optix.d_instances)
+        CUDA_WARN(cudaFree((void *)optix.d_instances));
+    if (optix.d_ias_buffer)
+        CUDA_WARN(cudaFree((void *)optix.d_ias_buffer));
+    optix.d_instances = 0;
+    optix.d_ias_buffer = 0;
+    optix.ias_buffer_size = 0;
+    optix.ias_handle = 0;
+    optix.ias_instance_count = 0;
+    optix.ias_rebuild = false;
+    optix.ias_refit = false;
+}
+
+// Initializing optix
+bool init_optix(OptiXSolar &optix, const std::vector<Triangle_GPU> &triangles)
+{
+    SOBA_LOG(LOG_INFO) << "Initializing OptiX for " << triangles.size() << " triangles...\n";
+
+    create_optix_pipeline(optix);
+    init_gas_cache(optix);
+    init_memory_pool(optix);
+
+    // Single mesh placed once
+    SceneInstance inst;
+    inst.mesh_id = 0;
+    inst.alive = true;
+    identity_transform(inst.transform);
+
+    optix.meshes.emplace_back();
+    build_mesh_gas(optix, MeshView(triangles), false, optix.meshes.back());
+    optix.instances.push_back(inst);
+    optix.ias_rebuild = true;
+    build_ias(optix);
+
+    SOBA_LOG(LOG_INFO) << "OptiX initialization complete!\n";
+    return true;
+}
+
+RaygenMode sky_raygen_mode(size_t patch_count)
+{
+    switch (patch_count)
+    {
+    case 145:
+        return RAYGEN_SKY145;
+    case 577:
+        return RAYGEN_SKY577;
+    default:
+        return RAYGEN_COUNT;
+    }
+}
+
+// Suns per thread: at least MIN_SUNS_PER_THREAD, longer slices once the launch
+// would exceed TARGET_LAUNCH_THREADS, at most MAX_SUNS_PER_THREAD.
+// Always a multiple of 32.
+static int suns_per_thread(size_t face_count, size_t sun_count)
+{
+    long long total_rays = static_cast<long long>(face_count) * static_cast<long long>(sun_count);
+    long long per_thread = (total_rays + TARGET_LAUNCH_THREADS - 1) / TARGET_LAUNCH_THREADS;
+    per_thread = std::max<long long>(per_thread, MIN_SUNS_PER_THREAD);
+    per_thread = std::min<long long>(per_thread, static_cast<long long>(sun_count));
+    per_thread = std::min<long long>(per_thread, MAX_SUNS_PER_THREAD);
+    return static_cast<int>((per_thread + 31) / 32 * 32);
+}
+
+std::vector<TraceTile> plan_trace_tiles(size_t face_count, size_t sun_count, bool whole_sun_set)
+{
+    std::vector<TraceTile> tiles;
+    if (face_count == 0 || sun_count == 0)
+        return tiles;
+
+    const size_t tile_faces = std::min(face_count, MAX_TILE_FACES);
+    const int per_thread = whole_sun_set ? static_cast<int>(sun_count) : suns_per_thread(tile_faces, sun_count);
+
+    // Sun tiles are whole slices: at most TARGET_LAUNCH_THREADS threads per launch
+    const size_t slices = whole_sun_set ? 1 : std::max<size_t>(1, TARGET_LAUNCH_THREADS / tile_faces);
+    const size_t tile_suns = std::min(sun_count, slices * per_thread);
+
+    for (size_t f = 0; f < face_count; f += tile_faces)
+    {
+        for (size_t s = 0; s < sun_count; s += tile_suns)
+        {
+            TraceTile tile;
+            tile.face_offset = f;
+            tile.sun_offset = s;
+            tile.face_count = static_cast<int>(std::min(tile_faces, face_count - f));
+            tile.sun_count = static_cast<int>(std::min(tile_suns, sun_count - s));
+            tile.suns_per_thread = per_thread;
+            tiles.push_back(tile);
+        }
+    }
+    return tiles;
+}
+
+// Copy one LaunchParams slot per launch to the GPU, growing optix.d_params as needed
+static void upload_launch_params(OptiXSolar &optix, const std::vector<LaunchParams> &params)
+{
+    if (optix.params_capacity < params.size())
+    {
+        CUDA_WARN(cudaFree((void *)optix.d_params));
+        optix.d_params = 0;
+        optix.params_capacity = 0;
+        CUDA_CHECK(cudaMalloc((void **)&optix.d_params, params.size() * sizeof(LaunchParams)));
+        optix.params_capacity = params.size();
+    }
+    CUDA_CHECK(cudaMemcpy((void *)optix.d_params, params.data(), params.size() * sizeof(LaunchParams),
+                          cudaMemcpyHostToDevice));
+}
+
+void build_trace_work_items(OptiXSolar &optix, const TraceBuffers &d, const std::vector<TraceTile> &tiles,
+                            TraceWorkItems &out)
+{
+    // Per tile, the (face group, sun slice) items where some face of the group
+    // may see some sun of the slice, in one buffer
+    out.offsets.assign(tiles.size() + 1, 0);
+    std::vector<uint2> items;
+    size_t full_items = 0;
+    for (size_t i = 0; i < tiles.size(); i++)
+    {
+        const TraceTile &tile = tiles[i];
+        const std::vector<uint2> tile_items =
+            build_work_items(d.cull_normals + tile.face_offset, tile.face_count, d.cull_suns + tile.sun_offset,
+                             tile.sun_count, tile.suns_per_thread);
+        items.insert(items.end(), tile_items.begin(), tile_items.end());
+        out.offsets[i + 1] = items.size();
+        full_items += static_cast<size_t>((tile.face_count + CULL_GROUP_FACES - 1) / CULL_GROUP_FACES) *
+                      ((tile.sun_count + tile.suns_per_thread - 1) / tile.suns_per_thread);
+    }
+    SOBA_LOG(LOG_DEBUG) << "Culling: " << items.size() << " of " << full_items << " work items kept\n";
+
+    out.items.allocate(items.size(), optix.pool.get());
+    if (out.items)
+    {
+        StageTimer timer(optix.metrics.upload_ms);
+        CUDA_CHECK(cudaMemcpy(out.items.get(), items.data(), out.items.bytes(), cudaMemcpyHostToDevice));
+    }
+}
+
+// Launch Optix
+void launch_solar_rays(OptiXSolar &optix, const TraceBuffers &d, size_t face_count, size_t sun_count,
+                       float ray_offset, int samples_per_face, float *h_results, uint32_t *h_visibility,
+                       RaygenMode mode)
+{
+    float *d_results = d.results;
+    uint32_t *d_visibility = d.visibility;
+
+    const std::vector<TraceTile> tiles = plan_trace_tiles(face_count, sun_count, mode != RAYGEN_SOLAR);
+    if (tiles.empty())
+        return;
+
+    // Culled solar traces launch over work items, prebuilt or built here
+    const bool culled = mode == RAYGEN_SOLAR && (d.work_items || (d.cull_normals && d.cull_suns));
+    TraceWorkItems built;
+    const TraceWorkItems *work = d.work_items;
+    if (culled && !work)
+    {
+        build_trace_work_items(optix, d, tiles, built);
+        work = &built;
+    }
+    if (culled && work->offsets.size() != tiles.size() + 1)
+        throw std::logic_error("launch_solar_rays: work items were built for other tiles");
+
+    // Raygen specialized for this trace's features; shared SBT, launches copy it at call time
+    const bool sampled = d.face_vertices && samples_per_face > 1;
+    int features = sampled ? RAYGEN_SAMPLED : 0;
+    if (mode == RAYGEN_SOLAR)
+    {
+        if (d.sun_weights)
+            features |= RAYGEN_WEIGHTED;
+        if (d_visibility)
+            features |= RAYGEN_VISIBILITY;
+        if (culled)
+            features |= RAYGEN_CULLED;
+    }
+    const OptixPipeline pipeline = select_raygen(optix, mode, features);
+
+    // Setup launch parameters, one slot per tile; the kernel sees tile-local
+    // pointers so its indices stay within 32 bits
+    std::vector<LaunchParams> params(tiles.size());
+    for (size_t i = 0; i < tiles.size(); i++)
+    {
+        const TraceTile &tile = tiles[i];
+        LaunchParams &p = params[i];
+        p.face_centroids = const_cast<float4 *>(d.centroids + tile.face_offset);
+        p.face_normals = const_cast<float4 *>(d.normals + tile.face_offset);
+        p.face_vertices = sampled ? const_cast<float4 *>(d.face_vertices + tile.face_offset) : nullptr;
+        p.vertex_plane_stride = sampled ? face_count : 0;
+        p.samples_per_face = sampled ? samples_per_face : 1;
+        p.sun_directions = const_cast<float4 *>(d.suns + tile.sun_offset);
+        p.sun_weights = d.sun_weights ? const_cast<float *>(d.sun_weights + tile.sun_offset) : nullptr;
+        p.results = d_results + tile.face_offset;
+        p.face_count = tile.face_count;
+        p.sun_count = tile.sun_count;
+        p.suns_per_thread = tile.suns_per_thread;
+        p.scene_handle = optix.ias_handle;
+        p.ray_offset = ray_offset;
+        p.ray_tmin = SHADOW_RAY_TMIN;
+        p.ray_tmax = SHADOW_RAY_TMAX;
+        // Sun tiles start on a multiple of 32 (whole slices), so whole words
+        p.visibility_words = visibility_words(sun_count);
+        p.visibility = d_visibility
+                           ? d_visibility + tile.face_offset * p.visibility_words + tile.sun_offset / 32
+                           : nullptr;
+        p.work_items = culled ? work->items.get() + work->offsets[i] : nullptr;
+    }
+
+    upload_launch_params(optix, params);
+
+    // Face tiles alternate between the streams; all sun tiles of a face tile
+    // share a stream, so its results are complete once that stream reaches the
+    // copy. The copy of face tile N is issued after the launches of tile N+1:
+    // with pageable h_results the copy blocks the host, and N+1 is already queued.
+    const int stream_count = sizeof(optix.streams) / sizeof(optix.streams[0]);
+    int face_tile = -1;
+    size_t pending_offset = 0, pending_count = 0;
+    cudaStream_t pending_stream = nullptr;
+
+    // Event pairs around every launch and copy, summed once the streams are done
+    struct TimedSpan
+    {
+        cudaEvent_t start, stop;
+        double *total_ms;
+    };
+    struct SpanList
+    {
+        std::vector<TimedSpan> spans;
+        ~SpanList()
+        {
+            for (const TimedSpan &span : spans)
+            {
+                CUDA_WARN(cudaEventDestroy(span.start));
+                if (span.stop)
+                    CUDA_WARN(cudaEventDestroy(span.stop));
+            }
+        }
+    } timed;
+    auto begin_span = [&](double &total_ms, cudaStream_t stream)
+    {
+        TimedSpan span = {nullptr, nullptr, &total_ms};
+        CUDA_CHECK(cudaEventCreate(&span.start));
+        timed.spans.push_back(span);
+        CUDA_CHECK(cudaEventCreate(&timed.spans.back().stop));
+        CUDA_CHECK(cudaEventRecord(span.start, stream));
+    };
+    auto end_span = [&](cudaStream_t stream)
+    {
+        CUDA_CHECK(cudaEventRecord(timed.spans.back().stop, stream));
+    };
+
+    auto copy_pending = [&]()
+    {
+        if (pending_count == 0 || (!h_results && !(d_visibility && h_visibility)))
+        {
+            pending_count = 0;
+            return;
+        }
+        begin_span(optix.metrics.readback_ms, pending_stream);
+        if (h_results)
+            CUDA_CHECK(cudaMemcpyAsync(h_results + pending_offset, d_results + pending_offset,
+                                       pending_count * sizeof(float), cudaMemcpyDeviceToHost,
+                                       pending_stream));
+        if (d_visibility && h_visibility)
+        {
+            const size_t words = visibility_words(sun_count);
+            CUDA_CHECK(cudaMemcpyAsync(h_visibility + pending_offset * words, d_visibility + pending_offset * words,
+                                       pending_count * words * sizeof(uint32_t), cudaMemcpyDeviceToHost,
+                                       pending_stream));
+        }
+        end_span(pending_stream);
+        pending_count = 0;
+    };
+
+    for (size_t i = 0; i < tiles.size(); i++)
+    {
+        const TraceTile &tile = tiles[i];
+        const bool new_face_tile = (i == 0 || tile.face_offset != tiles[i - 1].face_offset);
+        if (new_face_tile)
+            face_tile++;
+        cudaStream_t stream = optix.streams[face_tile % stream_count];
+
+        // Launch rays - one thread per (face, sun slice), or per face of each
+        // culled item (none left: every pair of the tile is back-facing)
+        const int sun_slices = (tile.sun_count + tile.suns_per_thread - 1) / tile.suns_per_thread;
+        const size_t tile_items = culled ? work->offsets[i + 1] - work->offsets[i] : 0;
+        if (!culled || tile_items)
+        {
+            begin_span(optix.metrics.trace_ms, stream);
+            if (culled)
+                OPTIX_CHECK(optixLaunch(pipeline, stream, optix.d_params + i * sizeof(LaunchParams),
+                                        sizeof(LaunchParams), &optix.sbt,
+                                        static_cast<unsigned>(tile_items * CULL_GROUP_FACES), 1, 1));
+            else
+                OPTIX_CHECK(optixLaunch(pipeline, stream, optix.d_params + i * sizeof(LaunchParams),
+                                        sizeof(LaunchParams), &optix.sbt, tile.face_count, sun_slices, 1));
+            end_span(stream);
+        }
+
+        // Face tile fully queued: read back the previous one, defer this one
+        const bool last_of_face_tile = (i + 1 == tiles.size() || tiles[i + 1].face_offset != tile.face_offset);
+        if (last_of_face_tile)
+        {
+            copy_pending();
+            pending_offset = tile.face_offset;
+            pending_count = tile.face_count;
+            pending_stream = stream;
+        }
+    }
+    copy_pending();
+
+    // Wait for completion
+    for (cudaStream_t stream : optix.streams)
+        CUDA_CHECK(cudaStreamSynchronize(stream));
+
+    for (const TimedSpan &span : timed.spans)
+    {
+        float ms = 0.0f;
+        CUDA_CHECK(cudaEventElapsedTime(&ms, span.start, span.stop));
+        *span.total_ms += ms;
+    }
+}
+
+void launch_batch_rays(OptiXSolar &optix, const TraceBuffers &d, BatchScenario *d_scenarios, int scenario_count,
+                       unsigned long long work_count, float ray_offset)
+{
+    if (work_count == 0)
+        return;
+    const OptixPipeline pipeline = select_raygen(optix, RAYGEN_BATCH, 0);
+
+    // Whole buffers: scenarios carry their own offsets into them
+    const size_t launch_count = static_cast<size_t>((work_count + MAX_LAUNCH_ITEMS - 1) / MAX_LAUNCH_ITEMS);
+    std::vector<LaunchParams> params(launch_count);
+    for (size_t i = 0; i < launch_count; i++)
+    {
+        LaunchParams &p = params[i];
+        p.face_centroids = const_cast<float4 *>(d.centroids);
+        p.face_normals = const_cast<float4 *>(d.normals);
+        p.sun_directions = const_cast<float4 *>(d.suns);
+        p.sun_weights = const_cast<float *>(d.sun_weights);
+        p.results = d.results;
+        p.scene_handle = optix.ias_handle;
+        p.ray_offset = ray_offset;
+        p.ray_tmin = SHADOW_RAY_TMIN;
+        p.ray_tmax = SHADOW_RAY_TMAX;
+        p.samples_per_face = 1;
+        p.scenarios = d_scenarios;
+        p.scenario_count = scenario_count;
+        p.work_begin = i * MAX_LAUNCH_ITEMS;
+    }
+    upload_launch_params(optix, params);
+
+    // One stream: launches (if ever more than one) accumulate into the same results
+    StageTimer timer(optix.metrics.trace_ms, optix.streams[0]);
+    for (size_t i = 0; i < launch_count; i++)
+    {
+        const unsigned long long items = std::min(MAX_LAUNCH_ITEMS, work_count - params[i].work_begin);
+        OPTIX_CHECK(optixLaunch(pipeline, optix.streams[0], optix.d_params + i * sizeof(LaunchParams),
+                                sizeof(LaunchParams), &optix.sbt, static_cast<unsigned int>(items), 1, 1));
+    }
+    CUDA_CHECK(cudaStreamSynchronize(optix.streams[0]));
+}
+
+static void free_sun_path(OptiXSolar &optix)
+{
+    if (optix.d_sun_path)
+        CUDA_WARN(cudaFree(optix.d_sun_path));
+    if (optix.d_sun_path_weights)
+        CUDA_WARN(cudaFree(optix.d_sun_path_weights));
+    optix.d_sun_path = nullptr;
+    optix.d_sun_path_weights = nullptr;
+    optix.sun_path_count = 0;
+    optix.sun_path_host.clear();
+    optix.sun_path_weights_host.clear();
+}
+
+// Cleanup function
+void cleanup_optix(OptiXSolar &optix)
+{
+    free_scene(optix);
+    free_sun_path(optix);
+    optix.gas_cache.reset();
+    optix.pool.reset();
+    if (optix.d_params)
+        CUDA_WARN(cudaFree((void *)optix.d_params));
+    for (cudaStream_t stream : optix.streams)
+        if (stream)
+            CUDA_WARN(cudaStreamDestroy(stream));
+    for (int mode = 0; mode < RAYGEN_COUNT; mode++)
+        free_mode_pipeline(optix, static_cast<RaygenMode>(mode));
+    if (optix.sbt.missRecordBase)
+        CUDA_WARN(cudaFree((void *)optix.sbt.missRecordBase));
+    if (optix.sbt.hitgroupRecordBase)
+        CUDA_WARN(cudaFree((void *)optix.sbt.hitgroupRecordBase));
+    if (optix.miss_pg)
+        optixProgramGroupDestroy(optix.miss_pg);
+    if (optix.hit_pg)
+        optixProgramGroupDestroy(optix.hit_pg);
+    if (optix.module)
+        optixModuleDestroy(optix.module);
+    if (optix.context)
+        optixDeviceContextDestroy(optix.context);
+    optix = OptiXSolar{};
+}
+
+DeviceScope::DeviceScope(int device)
+{
+    CUDA_CHECK(cudaGetDevice(&previous_));
+    if (previous_ != device)
+        CUDA_CHECK(cudaSetDevice(device));
+}
+
+DeviceScope::~DeviceScope()
+{
+    cudaSetDevice(previous_);
+}
+
+int cuda_device_count()
+{
+    int count = 0;
+    if (cudaGetDeviceCount(&count) != cudaSuccess)
+        return 0;
+    return count;
+}
+
+/////////// SolarEngine ///////////
+SolarEngine::SolarEngine(int device_id, bool pinned_staging)
+{
+    if (device_id < 0 || device_id >= cuda_device_count())
+        throw std::out_of_range("SolarEngine: invalid CUDA device " + std::to_string(device_id));
+
+    auto start = std::chrono::high_resolution_clock::now();
+    optix_.device = device_id;
+    DeviceScope scope(device_id);
+    try
+    {
+        create_optix_pipeline(optix_);
+        init_gas_cache(optix_);
+        init_memory_pool(optix_);
+        if (pinned_staging)
+            optix_.staging = std::make_unique<PinnedStaging>();
+    }
+    catch (...)
+    {
+        // No destructor runs for a half-constructed engine
+        optix_.staging.reset();
+        cleanup_optix(optix_);
+        throw;
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    SOBA_LOG(LOG_INFO) << "SolarEngine: pipeline ready on device " << device_id << " in "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count() << "ms\n";
+}
+
+SolarEngine::~SolarEngine()
+{
+    try
+    {
+        DeviceScope scope(optix_.device);
+        optix_.staging.reset();
+        cleanup_optix(optix_);
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "SolarEngine: cleanup failed: " << e.what() << std::endl;
+    }
+}
+
+void SolarEngine::set_scene(const MeshView &mesh)
+{
+    DeviceScope scope(optix_.device);
+    auto start = std::chrono::high_resolution_clock::now();
+    clear_scene();
+
+    float transform[12];
+    identity_transform(transform);
+    add_instance(add_mesh(mesh, false), transform);
+    build_ias(optix_);
+
+    auto end = std::chrono::high_resolution_clock::now();
+    SOBA_LOG(LOG_INFO) << "SolarEngine: scene set (" << mesh.triangle_count << " triangles) in "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count() << "ms\n";
+}
+
+void SolarEngine::clear_scene()
+{
+    DeviceScope scope(optix_.device);
+    free_scene(optix_);
+}
+
+MeshGAS &SolarEngine::mesh(int mesh_id)
+{
+    if (mesh_id < 0 || mesh_id >= static_cast<int>(optix_.meshes.size()) || !optix_.meshes[mesh_id].alive)
+        throw std::out_of_range("SolarEngine: invalid mesh id " + std::to_string(mesh_id));
+    return optix_.meshes[mesh_id];
+}
+
+SceneInstance &SolarEngine::instance(int instance_id)
+{
+    if (instance_id < 0 || instance_id >= static_cast<int>(optix_.instances.size()) ||
+        !optix_.instances[instance_id].alive)
+        throw std::out_of_range("SolarEngine: invalid instance id " + std::to_string(instance_id));
+    return optix_.instances[instance_id];
+}
+
+int SolarEngine::add_mesh(const MeshView &mesh, bool allow_update)
+{
+    DeviceScope scope(optix_.device);
+    if (mesh.triangle_count == 0)
+        throw std::runtime_error("SolarEngine::add_mesh: mesh has no triangles");
+
+    MeshGAS gas;
+    build_mesh_gas(optix_, mesh, allow_update, gas);
+    optix_.meshes.push_back(gas);
+    return static_cast<int>(optix_.meshes.size() - 1);
+}
+
+void SolarEngine::update_mesh(int mesh_id, const MeshView &new_mesh)
+{
+    DeviceScope scope(optix_.device);
+    MeshGAS &gas = mesh(mesh_id);
+    if (gas.allow_update && gas.triangle_count == new_mesh.triangle_count &&
+        gas.vertex_count == new_mesh.vertex_count && gas.indexed == (new_mesh.indices != nullptr))
+    {
+        // Refit keeps the handle, and the IAS bounds only need a refit
+        refit_mesh_gas(optix_, new_mesh, gas);
+        optix_.ias_refit = true;
+        return;
+    }
+
+    build_mesh_gas(optix_, new_mesh, gas.allow_update, gas);
+    optix_.ias_rebuild = true;
+}
+
+void SolarEngine::remove_mesh(int mesh_id)
+{
+    DeviceScope scope(optix_.device);
+    MeshGAS &gas = mesh(mesh_id);
+    for (auto &inst : optix_.instances)
+    {
+        if (inst.alive && inst.mesh_id == mesh_id)
+            inst.alive = false;
+    }
+    free_mesh_gas(gas);
+    optix_.ias_rebuild = true;
+}
+
+int SolarEngine::add_instance(int mesh_id, const float transform[12])
+{
+    mesh(mesh_id); // validate
+
+    SceneInstance inst;
+    inst.mesh_id = mesh_id;
+    inst.alive = true;
+    std::copy(transform, transform + 12, inst.transform);
+    optix_.instances.push_back(inst);
+    optix_.ias_rebuild = true;
+    return static_cast<int>(optix_.instances.size() - 1);
+}
+
+void SolarEngine::set_instance_transform(int instance_id, const float transform[12])
+{
+    SceneInstance &inst = instance(instance_id);
+    std::copy(transform, transform + 12, inst.transform);
+    optix_.ias_refit = true;
+}
+
+void SolarEngine::remove_instance(int instance_id)
+{
+    instance(instance_id).alive = false;
+    optix_.ias_rebuild = true;
+}
+
+bool SolarEngine::has_scene() const
+{
+    for (const auto &inst : optix_.instances)
+    {
+        if (inst.alive)
+            return true;
+    }
+    return false;
+}
+
+size_t SolarEngine::triangle_count() const
+{
+    size_t count = 0;
+    for (const auto &inst : optix_.instances)
+    {
+        if (inst.alive)
+            count += optix_.meshes[inst.mesh_id].triangle_count;
+    }
+    return count;
+}
+
+size_t SolarEngine::gas_bytes() const
+{
+    size_t bytes = 0;
+    for (const auto &gas : optix_.meshes)
+        bytes += gas.alive ? gas.buffer_size : 0;
+    return bytes;
+}
+
+size_t SolarEngine::gas_uncompacted_bytes() const
+{
+    size_t bytes = 0;
+    for (const auto &gas : optix_.meshes)
+        bytes += gas.alive ? gas.uncompacted_size : 0;
+    return bytes;
+}
+
+GasCacheStats SolarEngine::gas_cache_stats() const
+{
+    return optix_.gas_cache ? optix_.gas_cache->stats() : GasCacheStats{};
+}
+
+EngineMetrics SolarEngine::metrics() const
+{
+    EngineMetrics m = optix_.metrics;
+    m.gas_bytes = gas_bytes();
+    m.pool_reserved_bytes = optix_.pool ? optix_.pool->reserved_bytes() : 0;
+    return m;
+}
+
+void SolarEngine::reset_metrics()
+{
+    optix_.metrics = EngineMetrics{};
+}
+
+size_t SolarEngine::mesh_count() const
+{
+    return std::count_if(optix_.meshes.begin(), optix_.meshes.end(),
+                         [](const MeshGAS &gas)
+                         { return gas.alive; });
+}
+
+size_t SolarEngine::instance_count() const
+{
+    return std::count_if(optix_.instances.begin(), optix_.instances.end(),
+                         [](const SceneInstance &inst)
+                         { return inst.alive; });
+}
+
+void SolarEngine::trace(const float3 *centroids, const float3 *normals, size_t face_count,
+                        const float3 *sun_directions, size_t sun_count,
+                        float ray_offset, float *results, const TraceOptions &options)
+{
+    if (options.adaptive_tolerance > 0.0f)
+    {
+        trace_adaptive(centroids, normals, face_count, sun_directions, options.sun_weights, sun_count, ray_offset,
+                       results, options);
+        return;
+    }
+    run_trace(RAYGEN_SOLAR, centroids, normals, face_count, sun_directions, sun_count, ray_offset,
+              results, options);
+}
+
+void SolarEngine::trace_sky(const float3 *centroids, const float3 *normals, size_t face_count,
+                            const float3 *patch_directions, const float *patch_weights, size_t patch_count,
+                            float ray_offset, float *results, const TraceOptions &options)
+{
+    const RaygenMode mode = sky_raygen_mode(patch_count);
+    if (mode == RAYGEN_COUNT)
+        throw std::runtime_error("SolarEngine::trace_sky: expected 145 or 577 sky patches, got " +
+                                 std::to_string(patch_count));
+    if (options.visibility)
+        throw std::runtime_error("SolarEngine::trace_sky: visibility output is not supported");
+
+    TraceOptions sky_options = options;
+    sky_options.sun_weights = patch_weights;
+    run_trace(mode, centroids, normals, face_count, patch_directions, patch_count, ray_offset,
+              results, sky_options);
+}
+
+size_t SolarEngine::set_sun_path(const SunPathSpec &spec, const float *hourly_dni)
+{
+    DeviceScope scope(optix_.device);
+    auto start = std::chrono::high_resolution_clock::now();
+    const size_t steps = sun_path_step_count(spec);
+
+    free_sun_path(optix_);
+    DeviceBuffer<float3> d_suns(steps, optix_.pool.get());
+    CUDA_CHECK(cudaMalloc(&optix_.d_sun_path, steps * sizeof(float4)));
+
+    DeviceBuffer<float> d_dni;
+    if (hourly_dni)
+    {
+        CUDA_CHECK(cudaMalloc(&optix_.d_sun_path_weights, steps * sizeof(float)));
+        d_dni.allocate(SUN_PATH_HOURS_PER_YEAR, optix_.pool.get());
+        StageTimer timer(optix_.metrics.upload_ms);
+        upload_to_device(optix_, d_dni.get(), hourly_dni, d_dni.bytes());
+    }
+
+    optix_.sun_path_count = generate_sun_path(spec, d_dni.get(), d_suns.get(), optix_.d_sun_path_weights,
+                                              optix_.streams[0]);
+    expand_float4(d_suns.get(), optix_.d_sun_path, optix_.sun_path_count, 1);
+
+    // Culled traces cluster the suns on the host
+    optix_.sun_path_host.resize(optix_.sun_path_count);
+    CUDA_CHECK(cudaMemcpy(optix_.sun_path_host.data(), d_suns.get(), optix_.sun_path_count * sizeof(float3),
+                          cudaMemcpyDeviceToHost));
+    if (optix_.d_sun_path_weights)
+    {
+        optix_.sun_path_weights_host.resize(optix_.sun_path_count);
+        CUDA_CHECK(cudaMemcpy(optix_.sun_path_weights_host.data(), optix_.d_sun_path_weights,
+                              optix_.sun_path_count * sizeof(float), cudaMemcpyDeviceToHost));
+    }
+
+    auto end = std::chrono::high_resolution_clock::now();
+    SOBA_LOG(LOG_INFO) << "SolarEngine: " << optix_.sun_path_count << " daylit suns of " << steps << " steps generated in "
+              << std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() << "μs\n";
+    return optix_.sun_path_count;
+}
+
+void SolarEngine::clear_sun_path()
+{
+    DeviceScope scope(optix_.device);
+    free_sun_path(optix_);
+}
+
+void SolarEngine::trace_sun_path(const float3 *centroids, const float3 *normals, size_t face_count,
+                                 float ray_offset, bool weighted, float *results, const TraceOptions &options)
+{
+    if (!optix_.d_sun_path)
+        throw std::runtime_error("SolarEngine::trace_sun_path called before set_sun_path");
+    if (weighted && !optix_.d_sun_path_weights)
+        throw std::runtime_error("SolarEngine::trace_sun_path: sun path was generated without DNI");
+
+    // Adaptive traces work from the host copy, in time order like the device one
+    if (options.adaptive_tolerance > 0.0f)
+    {
+        trace_adaptive(centroids, normals, face_count, optix_.sun_path_host.data(),
+                       weighted ? optix_.sun_path_weights_host.data() : nullptr, optix_.sun_path_count, ray_offset,
+                       results, options);
+        return;
+    }
+
+    TraceOptions path_options = options;
+    path_options.sun_weights = nullptr;
+    run_trace(RAYGEN_SOLAR, centroids, normals, face_count, nullptr, optix_.sun_path_count, ray_offset,
+              results, path_options, optix_.d_sun_path, weighted ? optix_.d_sun_path_weights : nullptr);
+}
+
+// Scenario indices and result buffers of a batch, shared by both engines
+static void check_batch(const std::vector<BatchTarget> &targets, const std::vector<BatchSunSet> &sun_sets,
+                        const std::vector<BatchPair> &scenarios, const std::vector<float *> &results)
+{
+    if (results.size() != scenarios.size())
+        throw std::runtime_error("trace_batch: expected one result buffer per scenario");
+    for (const BatchPair &pair : scenarios)
+    {
+        if (pair.target < 0 || static_cast<size_t>(pair.target) >= targets.size() || pair.sun_set < 0 ||
+            static_cast<size_t>(pair.sun_set) >= sun_sets.size())
+            throw std::runtime_error("trace_batch: scenario refers to a missing target or sun set");
+    }
+    for (const BatchTarget &target : targets)
+        if (target.face_count > static_cast<size_t>(std::numeric_limits<int>::max()))
+            throw std::runtime_error("trace_batch: too many faces in one target");
+    for (const BatchSunSet &sun_set : sun_sets)
+        if (sun_set.sun_count > static_cast<size_t>(std::numeric_limits<int>::max()))
+            throw std::runtime_error("trace_batch: too many suns in one sun set");
+}
+
+void SolarEngine::trace_batch(const std::vector<BatchTarget> &targets, const std::vector<BatchSunSet> &sun_sets,
+                              const std::vector<BatchPair> &scenarios, float ray_offset,
+                              const std::vector<float *> &results)
+{
+    if (!has_scene())
+        throw std::runtime_error("SolarEngine::trace_batch called before set_scene");
+    check_batch(targets, sun_sets, scenarios, results);
+
+    DeviceScope scope(optix_.device);
+
+    // Apply pending mesh/instance edits
+    build_ias(optix_);
+
+    // Offsets of every target / sun set in the concatenated device buffers
+    std::vector<size_t> face_offsets(targets.size()), sun_offsets(sun_sets.size());
+    size_t total_faces = 0, total_suns = 0;
+    bool any_weights = false;
+    for (size_t t = 0; t < targets.size(); t++)
+    {
+        face_offsets[t] = total_faces;
+        total_faces += targets[t].face_count;
+    }
+    for (size_t s = 0; s < sun_sets.size(); s++)
+    {
+        sun_offsets[s] = total_suns;
+        total_suns += sun_sets[s].sun_count;
+        any_weights = any_weights || sun_sets[s].weights;
+    }
+
+    // Offset table: empty scenarios get zeroed results and no table entry
+    std::vector<BatchScenario> table;
+    std::vector<size_t> result_offsets(scenarios.size());
+    size_t total_results = 0;
+    unsigned long long work_count = 0, ray_count = 0;
+    for (size_t i = 0; i < scenarios.size(); i++)
+    {
+        const BatchTarget &target = targets[scenarios[i].target];
+        const BatchSunSet &sun_set = sun_sets[scenarios[i].sun_set];
+        std::fill(results[i], results[i] + target.face_count, 0.0f);
+        result_offsets[i] = total_results;
+        total_results += target.face_count;
+        if (target.face_count == 0 || sun_set.sun_count == 0)
+            continue;
+
+        BatchScenario scenario = {};
+        scenario.work_offset = work_count;
+        scenario.face_offset = face_offsets[scenarios[i].target];
+        scenario.sun_offset = sun_offsets[scenarios[i].sun_set];
+        scenario.result_offset = result_offsets[i];
+        scenario.face_count = static_cast<int>(target.face_count);
+        scenario.sun_count = static_cast<int>(sun_set.sun_count);
+        scenario.suns_per_thread = suns_per_thread(target.face_count, sun_set.sun_count);
+        scenario.weighted = sun_set.weights ? 1 : 0;
+        table.push_back(scenario);
+
+        const unsigned long long slices = (sun_set.sun_count + scenario.suns_per_thread - 1) / scenario.suns_per_thread;
+        work_count += target.face_count * slices;
+        ray_count += static_cast<unsigned long long>(target.face_count) * sun_set.sun_count;
+    }
+    if (table.empty())
+        return;
+
+    // Allocate GPU memory, each target and sun set uploaded once however many scenarios use it.
+    // Buffers are freed when this returns (or throws)
+    auto run_batch = [&]()
+    {
+        DevicePool *pool = optix_.pool.get();
+        DeviceBuffer<float4> d_centroids(total_faces, pool), d_normals(total_faces, pool), d_suns(total_suns, pool);
+        DeviceBuffer<float> d_results(total_results, pool), d_weights(any_weights ? total_suns : 0, pool);
+        DeviceBuffer<BatchScenario> d_table(table.size(), pool);
+
+        {
+            StageTimer timer(optix_.metrics.upload_ms);
+            for (size_t t = 0; t < targets.size(); t++)
+            {
+                upload_float4(optix_, d_centroids.get() + face_offsets[t], targets[t].centroids,
+                              targets[t].face_count);
+                upload_float4(optix_, d_normals.get() + face_offsets[t], targets[t].normals, targets[t].face_count);
+            }
+            for (size_t s = 0; s < sun_sets.size(); s++)
+            {
+                upload_float4(optix_, d_suns.get() + sun_offsets[s], sun_sets[s].directions, sun_sets[s].sun_count);
+                // Unweighted sets leave their weight range untouched, the raygen never reads it
+                if (sun_sets[s].weights)
+                    upload_to_device(optix_, d_weights.get() + sun_offsets[s], sun_sets[s].weights,
+                                     sun_sets[s].sun_count * sizeof(float));
+            }
+            CUDA_CHECK(cudaMemcpy(d_table.get(), table.data(), d_table.bytes(), cudaMemcpyHostToDevice));
+            CUDA_CHECK(cudaMemset(d_results.get(), 0, d_results.bytes()));
+        }
+
+        TraceBuffers buffers;
+        buffers.centroids = d_centroids.get();
+        buffers.normals = d_normals.get();
+        buffers.suns = d_suns.get();
+        buffers.sun_weights = d_weights.get();
+        buffers.results = d_results.get();
+
+        SOBA_LOG(LOG_INFO) << "Launching " << ray_count << " total rays for " << table.size() << " scenarios ("
+                  << targets.size() << " targets, " << sun_sets.size() << " sun sets) in "
+                  << (work_count + MAX_LAUNCH_ITEMS - 1) / MAX_LAUNCH_ITEMS << " launch(es)" << std::endl;
+
+        sample_device_memory(optix_);
+
+        auto ray_start = std::chrono::high_resolution_clock::now();
+        launch_batch_rays(optix_, buffers, d_table.get(), static_cast<int>(table.size()), work_count, ray_offset);
+
+        auto ray_end = std::chrono::high_resolution_clock::now();
+        auto ray_time = std::chrono::duration_cast<std::chrono::microseconds>(ray_end - ray_start).count();
+        SOBA_LOG(LOG_INFO) << "OptiX batch tracing: " << ray_time << "μs (" << ray_time / 1000.0f << "ms)\n";
+
+        optix_.metrics.rays += ray_count;
+        optix_.metrics.traces++;
+
+        StageTimer timer(optix_.metrics.readback_ms);
+        for (size_t i = 0; i < scenarios.size(); i++)
+        {
+            const size_t count = targets[scenarios[i].target].face_count;
+            if (count)
+                CUDA_CHECK(cudaMemcpy(results[i], d_results.get() + result_offsets[i], count * sizeof(float),
+                                      cudaMemcpyDeviceToHost));
+        }
+    };
+
+    // Out of device memory: retry once unused cached GAS and pooled memory are
+    // freed, then trace the scenarios one by one (each may split further)
+    bool reclaimed = false;
+    try
+    {
+        run_batch();
+        return;
+    }
+    catch (const CudaOutOfMemory &)
+    {
+        const size_t freed = reclaim_device_memory(optix_);
+        reclaimed = freed > 0;
+        std::cerr << "SolarEngine: out of device memory tracing " << table.size() << " scenarios, retrying "
+                  << (reclaimed ? "after freeing " + std::to_string(freed >> 20) + " MB of cached GAS / pooled memory"
+                                : "one scenario at a time")
+                  << std::endl;
+    }
+
+    if (reclaimed)
+    {
+        try
+        {
+            run_batch();
+            return;
+        }
+        catch (const CudaOutOfMemory &)
+        {
+            std::cerr << "SolarEngine: still out of device memory, retrying one scenario at a time" << std::endl;
+        }
+    }
+
+    for (size_t i = 0; i < scenarios.size(); i++)
+    {
+        const BatchTarget &target = targets[scenarios[i].target];
+        const BatchSunSet &sun_set = sun_sets[scenarios[i].sun_set];
+        TraceOptions options;
+        options.sun_weights = sun_set.weights;
+        run_trace(RAYGEN_SOLAR, target.centroids, target.normals, target.face_count, sun_set.directions,
+                  sun_set.sun_count, ray_offset, results[i], options);
+    }
+}
+
+// Per-face option buffers offset to a face range
+static TraceOptions slice_options(const TraceOptions &options, size_t face_offset, size_t words)
+{
+    TraceOptions sliced = options;
+    if (options.visibility)
+        sliced.visibility = options.visibility + face_offset * words;
+    if (options.face_vertices)
+        sliced.face_vertices = options.face_vertices + face_offset * 3;
+    return sliced;
+}
+
+// Upload one face range, trace it and read it back; every buffer is freed on
+// the way out, also when a launch throws
+static void trace_face_range(OptiXSolar &optix, RaygenMode mode, const float3 *centroids, const float3 *normals,
+                             size_t face_count, const float3 *sun_directions, size_t sun_count, float ray_offset,
+                             float *results, const TraceOptions &options, const float4 *d_resident_suns,
+                             const float *d_resident_weights, bool cull)
+{
+    const int samples = options.samples_per_face;
+    const size_t words = visibility_words(sun_count);
+
+    // Allocate GPU memory (from the engine's pool, reused by the next trace)
+    DevicePool *pool = optix.pool.get();
+    DeviceBuffer<float4> d_centroids(face_count, pool), d_normals(face_count, pool), d_sun_dirs, d_face_vertices;
+    DeviceBuffer<float> d_results(face_count, pool), d_sun_weights;
+    {
+        StageTimer timer(optix.metrics.upload_ms);
+        upload_float4(optix, d_centroids.get(), centroids, face_count);
+        upload_float4(optix, d_normals.get(), normals, face_count);
+        CUDA_CHECK(cudaMemset(d_results.get(), 0, d_results.bytes()));
+
+        // Resident suns are borrowed, everything else is uploaded for this trace only
+        if (!d_resident_suns)
+        {
+            d_sun_dirs.allocate(sun_count, pool);
+            upload_float4(optix, d_sun_dirs.get(), sun_directions, sun_count);
+        }
+
+        if (options.sun_weights && !d_resident_suns)
+        {
+            d_sun_weights.allocate(sun_count, pool);
+            upload_to_device(optix, d_sun_weights.get(), options.sun_weights, d_sun_weights.bytes());
+        }
+
+        // Triangle corners as 3 planes, only needed when sample points are generated
+        if (samples > 1)
+        {
+            d_face_vertices.allocate(face_count * 3, pool);
+            upload_float4(optix, d_face_vertices.get(), options.face_vertices, face_count, 3);
+        }
+    }
+
+    // Every word is written by exactly one thread, no clear needed unless
+    // culled items leave some unwritten
+    DeviceBuffer<uint32_t> d_visibility(options.visibility ? face_count * words : 0, pool);
+    if (cull && d_visibility)
+        CUDA_CHECK(cudaMemset(d_visibility.get(), 0, d_visibility.bytes()));
+
+    TraceBuffers buffers;
+    buffers.centroids = d_centroids.get();
+    buffers.normals = d_normals.get();
+    buffers.face_vertices = d_face_vertices.get();
+    buffers.suns = d_resident_suns ? d_resident_suns : d_sun_dirs.get();
+    buffers.sun_weights = d_resident_suns ? d_resident_weights : d_sun_weights.get();
+    buffers.results = d_results.get();
+    buffers.visibility = d_visibility.get();
+    if (cull)
+    {
+        buffers.cull_normals = normals;
+        buffers.cull_suns = sun_directions;
+    }
+
+    SOBA_LOG(LOG_INFO) << "Launching " << static_cast<unsigned long long>(face_count) * sun_count * samples
+              << " total rays in " << plan_trace_tiles(face_count, sun_count, mode != RAYGEN_SOLAR).size()
+              << " tiles" << std::endl;
+    SOBA_LOG(LOG_DEBUG) << "Face count: " << face_count << ", " << (mode == RAYGEN_SOLAR ? "Sun" : "Sky patch")
+              << " count: " << sun_count << ", Samples per face: " << samples << std::endl;
+
+    sample_device_memory(optix);
+
+    // Launch rays; results are read back tile by tile
+    auto ray_start = std::chrono::high_resolution_clock::now();
+    launch_solar_rays(optix, buffers, face_count, sun_count, ray_offset, samples,
+                      results, options.visibility, mode);
+
+    auto ray_end = std::chrono::high_resolution_clock::now();
+    auto ray_time = std::chrono::duration_cast<std::chrono::microseconds>(ray_end - ray_start).count();
+    SOBA_LOG(LOG_INFO) << "OptiX tracing: " << ray_time << "μs (" << ray_time / 1000.0f << "ms)\n";
+
+    optix.metrics.rays += static_cast<unsigned long long>(face_count) * sun_count * samples;
+    optix.metrics.traces++;
+}
+
+// Out of device memory: first retry once every cached GAS no mesh uses and the
+// pool's idle blocks are freed, then keep halving the face range (faces are independent, so
+// the results are the same). Ranges below this many faces are not split further
+constexpr size_t MIN_OOM_SPLIT_FACES = 4096;
+
+static void trace_faces(OptiXSolar &optix, RaygenMode mode, const float3 *centroids, const float3 *normals,
+                        size_t face_count, const float3 *sun_directions, size_t sun_count, float ray_offset,
+                        float *results, const TraceOptions &options, const float4 *d_resident_suns,
+                        const float *d_resident_weights, bool cull, bool reclaimed)
+{
+    bool split = false;
+    try
+    {
+        trace_face_range(optix, mode, centroids, normals, face_count, sun_directions, sun_count, ray_offset,
+                         results, options, d_resident_suns, d_resident_weights, cull);
+        return;
+    }
+    catch (const CudaOutOfMemory &)
+    {
+        const size_t freed = reclaimed ? 0 : reclaim_device_memory(optix);
+        if (freed == 0 && face_count < 2 * MIN_OOM_SPLIT_FACES)
+            throw;
+        split = freed == 0;
+        std::cerr << "SolarEngine: out of device memory tracing " << face_count << " faces, retrying "
+                  << (split ? "in two halves" : "after freeing " + std::to_string(freed >> 20) + " MB of cached GAS / pooled memory")
+                  << std::endl;
+    }
+
+    if (!split)
+    {
+        trace_faces(optix, mode, centroids, normals, face_count, sun_directions, sun_count, ray_offset, results,
+                    options, d_resident_suns, d_resident_weights, cull, true);
+        return;
+    }
+    const size_t words = visibility_words(sun_count);
+    const size_t half = face_count / 2;
+    trace_faces(optix, mode, centroids, normals, half, sun_directions, sun_count, ray_offset, results,
+                options, d_resident_suns, d_resident_weights, cull, true);
+    trace_faces(optix, mode, centroids + half, normals + half, face_count - half, sun_directions, sun_count,
+                ray_offset, results + half, slice_options(options, half, words), d_resident_suns,
+                d_resident_weights, cull, true);
+}
+
+// Culled solar trace: faces clustered by normal, suns above the horizon
+// clustered by direction, traced, and results / visibility scattered back to
+// the caller's order. A resident sun path is ordered from its host copy but
+// gathered on the device, so only the sun order is uploaded.
+static void trace_culled(OptiXSolar &optix, const float3 *centroids, const float3 *normals, size_t face_count,
+                         const float3 *sun_directions, size_t sun_count, float ray_offset, float *results,
+                         const TraceOptions &options, const float4 *d_resident_suns, const float *d_resident_weights)
+{
+    const bool resident = d_resident_suns != nullptr;
+    const bool resident_weighted = d_resident_weights != nullptr;
+    const float3 *host_suns = resident ? optix.sun_path_host.data() : sun_directions;
+    const float *host_weights = resident ? nullptr : options.sun_weights;
+
+    const std::vector<uint32_t> face_order = cluster_directions(normals, face_count);
+    const std::vector<uint32_t> sun_order = order_suns(host_suns, sun_count);
+    if (sun_order.empty())
+        return; // Every sun below the horizon, results stay zero
+
+    std::vector<float3> sorted_centroids, sorted_normals, sorted_vertices, sorted_suns;
+    std::vector<float> sorted_weights;
+    gather(centroids, face_order, 1, sorted_centroids);
+    gather(normals, face_order, 1, sorted_normals);
+    gather(host_suns, sun_order, 1, sorted_suns);
+
+    TraceOptions sorted_options = options;
+    sorted_options.sun_weights = nullptr;
+    DeviceBuffer<float4> d_sorted_suns;
+    DeviceBuffer<float> d_sorted_weights;
+    if (resident)
+    {
+        // Host suns above only bound the sun slices (TraceBuffers::cull_suns)
+        DevicePool *pool = optix.pool.get();
+        DeviceBuffer<uint32_t> d_order(sun_order.size(), pool);
+        d_sorted_suns.allocate(sun_order.size(), pool);
+        if (resident_weighted)
+            d_sorted_weights.allocate(sun_order.size(), pool);
+        {
+            StageTimer timer(optix.metrics.upload_ms);
+            upload_to_device(optix, d_order.get(), sun_order.data(), d_order.bytes());
+            gather_suns(d_resident_suns, d_resident_weights, d_order.get(), d_sorted_suns.get(),
+                        d_sorted_weights.get(), sun_order.size());
+        }
+    }
+    else if (host_weights)
+    {
+        gather(host_weights, sun_order, 1, sorted_weights);
+        sorted_options.sun_weights = sorted_weights.data();
+    }
+    if (options.face_vertices)
+    {
+        gather(options.face_vertices, face_order, 3, sorted_vertices);
+        sorted_options.face_vertices = sorted_vertices.data();
+    }
+
+    std::vector<float> sorted_results(face_count, 0.0f);
+    std::vector<uint32_t> sorted_visibility;
+    if (options.visibility)
+    {
+        sorted_visibility.assign(face_count * visibility_words(sun_order.size()), 0u);
+        sorted_options.visibility = sorted_visibility.data();
+    }
+
+    trace_faces(optix, RAYGEN_SOLAR, sorted_centroids.data(), sorted_normals.data(), face_count, sorted_suns.data(),
+                sun_order.size(), ray_offset, sorted_results.data(), sorted_options, d_sorted_suns.get(),
+                d_sorted_weights.get(), true, false);
+
+    for (size_t i = 0; i < face_count; i++)
+        results[face_order[i]] = sorted_results[i];
+    if (options.visibility)
+        scatter_visibility(sorted_visibility.data(), face_order, sun_order, options.visibility,
+                           visibility_words(sun_count));
+}
+
+void SolarEngine::run_trace(RaygenMode mode, const float3 *centroids, const float3 *normals, size_t face_count,
+                            const float3 *sun_directions, size_t sun_count,
+                            float ray_offset, float *results, const TraceOptions &options,
+                            const float4 *d_resident_suns, const float *d_resident_weights)
+{
+    if (!has_scene())
+        throw std::runtime_error("SolarEngine::trace called before set_scene");
+
+    const int samples = options.samples_per_face;
+    const int strata = static_cast<int>(std::lround(std::sqrt(static_cast<double>(samples))));
+    if (samples < 1 || strata * strata != samples)
+        throw std::runtime_error("SolarEngine::trace: samples_per_face must be a square (1, 4, 9, ...)");
+    if (samples > 1 && !options.face_vertices)
+        throw std::runtime_error("SolarEngine::trace: samples_per_face > 1 needs face_vertices");
+
+    DeviceScope scope(optix_.device);
+
+    // Apply pending mesh/instance edits
+    build_ias(optix_);
+
+    const size_t words = visibility_words(sun_count);
+    std::fill(results, results + face_count, 0.0f);
+    if (options.visibility)
+        std::fill(options.visibility, options.visibility + face_count * words, 0u);
+    if (face_count == 0 || sun_count == 0)
+        return;
+
+    if (mode == RAYGEN_SOLAR && options.cull)
+    {
+        trace_culled(optix_, centroids, normals, face_count, sun_directions, sun_count, ray_offset, results,
+                     options, d_resident_suns, d_resident_weights);
+        return;
+    }
+    trace_faces(optix_, mode, centroids, normals, face_count, sun_directions, sun_count, ray_offset, results,
+                options, d_resident_suns, d_resident_weights, false, false);
+}
+
+// Faces per coarse pass of an adaptive trace, bounds its host visibility matrix
+constexpr size_t ADAPTIVE_CHUNK_FACES = 1u << 16;
+
+void SolarEngine::trace_adaptive(const float3 *centroids, const float3 *normals, size_t face_count,
+                                 const float3 *sun_directions, const float *sun_weights, size_t sun_count,
+                                 float ray_offset, float *results, const TraceOptions &options)
+{
+    if (options.visibility || options.samples_per_face != 1)
+        throw std::runtime_error("SolarEngine: adaptive traces support neither visibility output nor sampling");
+    if (!has_scene())
+        throw std::runtime_error("SolarEngine::trace called before set_scene");
+
+    std::fill(results, results + face_count, 0.0f);
+    if (face_count == 0 || sun_count == 0)
+        return;
+
+    const std::vector<uint32_t> coarse = plan_coarse_suns(sun_directions, sun_count, options.adaptive_tolerance);
+    std::vector<float3> coarse_suns;
+    std::vector<float> coarse_weights;
+    gather(sun_directions, coarse, 1, coarse_suns);
+    TraceOptions coarse_options;
+    coarse_options.cull = options.cull;
+    if (sun_weights)
+    {
+        gather(sun_weights, coarse, 1, coarse_weights);
+        coarse_options.sun_weights = coarse_weights.data();
+    }
+
+    const size_t words = visibility_words(coarse.size());
+    std::vector<uint32_t> visibility;
+    AdaptiveRefinement refine;
+    std::vector<float3> refine_centroids, refine_normals;
+    std::vector<float> refined;
+    unsigned long long refined_rays = 0, refined_pairs = 0;
+
+    for (size_t begin = 0; begin < face_count; begin += ADAPTIVE_CHUNK_FACES)
+    {
+        const size_t count = std::min(ADAPTIVE_CHUNK_FACES, face_count - begin);
+        visibility.resize(count * words);
+        coarse_options.visibility = visibility.data();
+        run_trace(RAYGEN_SOLAR, centroids + begin, normals + begin, count, coarse_suns.data(), coarse.size(),
+                  ray_offset, results + begin, coarse_options);
+
+        fill_coarse_intervals(normals + begin, count, sun_directions, sun_weights, coarse, visibility.data(),
+                              results + begin, refine);
+        if (refine.faces.empty())
+            continue;
+
+        // One batch scenario per refined interval: its flipping faces against its interior suns
+        gather(centroids + begin, refine.faces, 1, refine_centroids);
+        gather(normals + begin, refine.faces, 1, refine_normals);
+        refined.assign(refine.faces.size(), 0.0f);
+        std::vector<BatchTarget> targets(refine.intervals.size());
+        std::vector<BatchSunSet> sun_sets(refine.intervals.size());
+        std::vector<BatchPair> scenarios(refine.intervals.size());
+        std::vector<float *> outputs(refine.intervals.size());
+        for (size_t k = 0; k < refine.intervals.size(); k++)
+        {
+            const uint32_t first = coarse[refine.intervals[k]] + 1;
+            const size_t offset = refine.offsets[k];
+            targets[k].centroids = refine_centroids.data() + offset;
+            targets[k].normals = refine_normals.data() + offset;
+            targets[k].face_count = refine.offsets[k + 1] - offset;
+            sun_sets[k].directions = sun_directions + first;
+            sun_sets[k].weights = sun_weights ? sun_weights + first : nullptr;
+            sun_sets[k].sun_count = coarse[refine.intervals[k] + 1] - first;
+            scenarios[k] = {static_cast<int>(k), static_cast<int>(k)};
+            outputs[k] = refined.data() + offset;
+            refined_rays += static_cast<unsigned long long>(targets[k].face_count) * sun_sets[k].sun_count;
+        }
+        trace_batch(targets, sun_sets, scenarios, ray_offset, outputs);
+
+        for (size_t i = 0; i < refine.faces.size(); i++)
+            results[begin + refine.faces[i]] += refined[i];
+        refined_pairs += refine.faces.size();
+    }
+
+    const unsigned long long full_rays = static_cast<unsigned long long>(face_count) * sun_count;
+    const unsigned long long traced = static_cast<unsigned long long>(face_count) * coarse.size() + refined_rays;
+    SOBA_LOG(LOG_INFO) << "SolarEngine: adaptive trace, " << coarse.size() << " of " << sun_count
+                       << " suns coarse, " << refined_pairs << " (face, interval) pairs refined, " << traced
+                       << " rays instead of " << full_rays << " (" << 100.0 * traced / full_rays << "%)\n";
+}
+
+/////////// MultiDeviceEngine ///////////
+MultiDeviceEngine::MultiDeviceEngine(const std::vector<int> &devices, bool pinned_staging)
+{
+    if (devices.empty())
+        throw std::runtime_error("MultiDeviceEngine: no devices given");
+    for (int device : devices)
+    {
+        for (const auto &engine : engines_)
+        {
+            if (engine->device() == device)
+                throw std::runtime_error("MultiDeviceEngine: device " + std::to_string(device) + " listed twice");
+        }
+        engines_.push_back(std::make_unique<SolarEngine>(device, pinned_staging));
+    }
+}
+
+std::vector<int> MultiDeviceEngine::devices() const
+{
+    std::vector<int> ids;
+    for (const auto &engine : engines_)
+        ids.push_back(engine->device());
+    return ids;
+}
+
+void MultiDeviceEngine::set_scene(const MeshView &mesh)
+{
+    for (auto &engine : engines_)
+        engine->set_scene(mesh);
+}
+
+void MultiDeviceEngine::clear_scene()
+{
+    for (auto &engine : engines_)
+        engine->clear_scene();
+}
+
+int MultiDeviceEngine::add_mesh(const MeshView &mesh, bool allow_update)
+{
+    int mesh_id = -1;
+    for (auto &engine : engines_)
+    {
+        int id = engine->add_mesh(mesh, allow_update);
+        if (mesh_id >= 0 && id != mesh_id)
+            throw std::logic_error("MultiDeviceEngine: mesh ids diverged between devices");
+        mesh_id = id;
+    }
+    return mesh_id;
+}
+
+void MultiDeviceEngine::update_mesh(int mesh_id, const MeshView &mesh)
+{
+    for (auto &engine : engines_)
+        engine->update_mesh(mesh_id, mesh);
+}
+
+void MultiDeviceEngine::remove_mesh(int mesh_id)
+{
+    for (auto &engine : engines_)
+        engine->remove_mesh(mesh_id);
+}
+
+int MultiDeviceEngine::add_instance(int mesh_id, const float transform[12])
+{
+    int instance_id = -1;
+    for (auto &engine : engines_)
+    {
+        int id = engine->add_instance(mesh_id, transform);
+        if (instance_id >= 0 && id != instance_id)
+            throw std::logic_error("MultiDeviceEngine: instance ids diverged between devices");
+        instance_id = id;
+    }
+    return instance_id;
+}
+
+void MultiDeviceEngine::set_instance_transform(int instance_id, const float transform[12])
+{
+    for (auto &engine : engines_)
+        engine->set_instance_transform(instance_id, transform);
+}
+
+void MultiDeviceEngine::remove_instance(int instance_id)
+{
+    for (auto &engine : engines_)
+        engine->remove_instance(instance_id);
+}
+
+GasCacheStats MultiDeviceEngine::gas_cache_stats() const
+{
+    GasCacheStats total;
+    for (const auto &engine : engines_)
+    {
+        const GasCacheStats s = engine->gas_cache_stats();
+        total.hits += s.hits;
+        total.disk_hits += s.disk_hits;
+        total.misses += s.misses;
+        total.evictions += s.evictions;
+        total.disk_writes += s.disk_writes;
+        total.entries += s.entries;
+        total.bytes += s.bytes;
+        total.budget_bytes += s.budget_bytes;
+    }
+    return total;
+}
+
+// Stage times add up over devices (they run concurrently, so this is GPU time, not wall time)
+EngineMetrics MultiDeviceEngine::metrics() const
+{
+    EngineMetrics total;
+    for (const auto &engine : engines_)
+    {
+        const EngineMetrics m = engine->metrics();
+        total.module_ms += m.module_ms;
+        total.gas_build_ms += m.gas_build_ms;
+        total.upload_ms += m.upload_ms;
+        total.trace_ms += m.trace_ms;
+        total.readback_ms += m.readback_ms;
+        total.rays += m.rays;
+        total.traces += m.traces;
+        total.gas_bytes += m.gas_bytes;
+        total.pool_reserved_bytes += m.pool_reserved_bytes;
+        total.peak_device_bytes = std::max(total.peak_device_bytes, m.peak_device_bytes);
+    }
+    return total;
+}
+
+void MultiDeviceEngine::reset_metrics()
+{
+    for (auto &engine : engines_)
+        engine->reset_metrics();
+}
+
+void MultiDeviceEngine::split_faces(size_t face_count, size_t rays_per_face,
+                                    const std::function<void(SolarEngine &, size_t, size_t)> &fn)
+{
+    const size_t device_count = engines_.size();
+    stats_.assign(device_count, DeviceTraceStats{});
+
+    // Contiguous face ranges, so each device writes straight into its slice of results
+    const size_t per_device = (face_count + device_count - 1) / device_count;
+    std::vector<double> rays(device_count);
+    for (size_t d = 0; d < device_count; d++)
+    {
+        DeviceTraceStats &stat = stats_[d];
+        stat.face_offset = std::min(face_count, d * per_device);
+        stat.face_count = std::min(face_count - stat.face_offset, per_device);
+        rays[d] = static_cast<double>(stat.face_count) * rays_per_face;
+    }
+
+    run_on_devices(rays, [&](SolarEngine &engine, size_t d)
+                   { fn(engine, stats_[d].face_offset, stats_[d].face_count); });
+}
+
+void MultiDeviceEngine::run_on_devices(const std::vector<double> &rays,
+                                       const std::function<void(SolarEngine &, size_t)> &fn)
+{
+    const size_t device_count = engines_.size();
+    std::vector<std::thread> workers;
+    std::vector<std::exception_ptr> errors(device_count);
+
+    for (size_t d = 0; d < device_count; d++)
+    {
+        stats_[d].device = engines_[d]->device();
+        workers.emplace_back([&, d]()
+                             {
+            DeviceTraceStats &st = stats_[d];
+            try
+            {
+                auto start = std::chrono::high_resolution_clock::now();
+                fn(*engines_[d], d);
+                auto end = std::chrono::high_resolution_clock::now();
+                st.trace_ms = std::chrono::duration<double, std::milli>(end - start).count();
+            }
+            catch (...)
+            {
+                errors[d] = std::current_exception();
+            } });
+    }
+    for (auto &worker : workers)
+        worker.join();
+    for (const auto &error : errors)
+    {
+        if (error)
+            std::rethrow_exception(error);
+    }
+
+    // Scaling report: a device that finishes early idles for the rest of the trace
+    double slowest_ms = 0.0;
+    for (const auto &stat : stats_)
+        slowest_ms = std::max(slowest_ms, stat.trace_ms);
+    for (size_t d = 0; d < device_count; d++)
+    {
+        DeviceTraceStats &stat = stats_[d];
+        stat.rays_per_second = stat.trace_ms > 0.0 ? rays[d] / (stat.trace_ms / 1000.0) : 0.0;
+        stat.efficiency = slowest_ms > 0.0 ? stat.trace_ms / slowest_ms : 1.0;
+        SOBA_LOG(LOG_INFO) << "MultiDeviceEngine: device " << stat.device << ": " << stat.face_count << " faces, "
+                  << stat.trace_ms << "ms, " << stat.rays_per_second / 1e6 << " Mrays/s, efficiency "
+                  << stat.efficiency * 100.0 << "%\n";
+    }
+}
+
+void MultiDeviceEngine::trace(const float3 *centroids, const float3 *normals, size_t face_count,
+                              const float3 *sun_directions, size_t sun_count,
+                              float ray_offset, float *results, const TraceOptions &options)
+{
+    const size_t words = visibility_words(sun_count);
+    split_faces(face_count, sun_count * options.samples_per_face,
+                [&](SolarEngine &engine, size_t offset, size_t count)
+                { engine.trace(centroids + offset, normals + offset, count, sun_directions, sun_count,
+                               ray_offset, results + offset, slice_options(options, offset, words)); });
+}
+
+void MultiDeviceEngine::trace_sky(const float3 *centroids, const float3 *normals, size_t face_count,
+                                  const float3 *patch_directions, const float *patch_weights,
+                                  size_t patch_count, float ray_offset, float *results,
+                                  const TraceOptions &options)
+{
+    split_faces(face_count, patch_count * options.samples_per_face,
+                [&](SolarEngine &engine, size_t offset, size_t count)
+                { engine.trace_sky(centroids + offset, normals + offset, count, patch_directions,
+                                   patch_weights, patch_count, ray_offset, results + offset,
+                                   slice_options(options, offset, 0)); });
+}
+
+size_t MultiDeviceEngine::set_sun_path(const SunPathSpec &spec, const float *hourly_dni)
+{
+    size_t sun_count = 0;
+    for (size_t d = 0; d < engines_.size(); d++)
+    {
+        size_t count = engines_[d]->set_sun_path(spec, hourly_dni);
+        if (d > 0 && count != sun_count)
+            throw std::logic_error("MultiDeviceEngine: sun paths diverged between devices");
+        sun_count = count;
+    }
+    return sun_count;
+}
+
+void MultiDeviceEngine::clear_sun_path()
+{
+    for (auto &engine : engines_)
+        engine->clear_sun_path();
+}
+
+void MultiDeviceEngine::trace_sun_path(const float3 *centroids, const float3 *normals, size_t face_count,
+                                       float ray_offset, bool weighted, float *results,
+                                       const TraceOptions &options)
+{
+    const size_t sun_count = sun_path_count();
+    const size_t words = visibility_words(sun_count);
+    split_faces(face_count, sun_count * options.samples_per_face,
+                [&](SolarEngine &engine, size_t offset, size_t count)
+                { engine.trace_sun_path(centroids + offset, normals + offset, count, ray_offset, weighted,
+                                        results + offset, slice_options(options, offset, words)); });
+}
+
+void MultiDeviceEngine::trace_batch(const std::vector<BatchTarget> &targets,
+                                    const std::vector<BatchSunSet> &sun_sets,
+                                    const std::vector<BatchPair> &scenarios, float ray_offset,
+                                    const std::vector<float *> &results)
+{
+    check_batch(targets, sun_sets, scenarios, results);
+    const size_t device_count = engines_.size();
+    stats_.assign(device_count, DeviceTraceStats{});
+
+    // Device d takes the d-th contiguous range of every target; its result
+    // buffers point at the same range of each scenario's results
+    std::vector<std::vector<BatchTarget>> device_targets(device_count, targets);
+    std::vector<std::vector<float *>> device_results(device_count, results);
+    std::vector<std::vector<size_t>> target_offsets(device_count, std::vector<size_t>(targets.size()));
+    std::vector<double> rays(device_count, 0.0);
+    for (size_t d = 0; d < device_count; d++)
+    {
+        // Stats count each target's faces once, however many scenarios trace it
+        for (size_t t = 0; t < targets.size(); t++)
+        {
+            const size_t face_count = targets[t].face_count;
+            const size_t per_device = (face_count + device_count - 1) / device_count;
+            const size_t offset = std::min(face_count, d * per_device);
+            BatchTarget &slice = device_targets[d][t];
+            slice.centroids += offset;
+            slice.normals += offset;
+            slice.face_count = std::min(face_count - offset, per_device);
+            target_offsets[d][t] = offset;
+            stats_[d].face_offset += offset;
+            stats_[d].face_count += slice.face_count;
+        }
+        for (size_t i = 0; i < scenarios.size(); i++)
+        {
+            const BatchTarget &slice = device_targets[d][scenarios[i].target];
+            device_results[d][i] += target_offsets[d][scenarios[i].target];
+            rays[d] += static_cast<double>(slice.face_count) * sun_sets[scenarios[i].sun_set].sun_count;
+        }
+    }
+
+    run_on_devices(rays, [&](SolarEngine &engine, size_t d)
+                   { engine.trace_batch(device_targets[d], sun_sets, scenarios, ray_offset, device_results[d]); });
+}
+
+// Main wrapper function
+void gpu_solar_analysis_series_optix(
+    const std::vector<point3> &face_centroids,
+    const std::vector<vec3> &face_normals,
+    const std::vector<Triangle> &scene_tris,
+    const std::vector<vec3> &sun_directions,
+    std::vector<float> &results,
+    float ray_offset)
+{
+
+    SOBA_LOG(LOG_INFO) << "GPU OptiX: Processing " << face_centroids.size() << " faces...\n";
+
+    const int face_count = static_cast<int>(face_centroids.size());
+    const int scene_tris_count = static_cast<int>(scene_tris.size());
+    const int sun_count = static_cast<int>(sun_directions.size());
+
+    // Convert to GPU format
+    std::vector<Triangle_GPU> gpu_scene_tris(scene_tris_count);
+    for (int i = 0; i < scene_tris_count; i++)
+    {
+        const auto &tri = scene_tris[i];
+        gpu_scene_tris[i] = Triangle_GPU(
+            make_float3(tri.v0.x(), tri.v0.y(), tri.v0.z()),
+            make_float3(tri.v1.x(), tri.v1.y(), tri.v1.z()),
+            make_float3(tri.v2.x(), tri.v2.y(), tri.v2.z()));
+    }
+
+    std::vector<float3> gpu_centroids(face_count), gpu_normals(face_count), gpu_sun_dirs(sun_count);
+
+    for (int i = 0; i < face_count; i++)
+    {
+        gpu_centroids[i] = make_float3(face_centroids[i].x(), face_centroids[i].y(), face_centroids[i].z());
+        gpu_normals[i] = make_float3(face_normals[i].x(), face_normals[i].y(), face_normals[i].z());
+    }
+
+    for (int i = 0; i < sun_count; i++)
+    {
+        gpu_sun_dirs[i] = make_float3(sun_directions[i].x(), sun_directions[i].y(), sun_directions[i].z());
+    }
+
+    SOBA_LOG(LOG_INFO) << "OptiX triangle count: " << gpu_scene_tris.size() << std::endl;
+
+    // One-shot engine: init, build, trace, cleanup
+    auto start = std::chrono::high_resolution_clock::now();
+    SolarEngine engine;
+    engine.set_scene(gpu_scene_tris);
+
+    auto init_end = std::chrono::high_resolution_clock::now();
+    auto init_time = std::chrono::duration_cast<std::chrono::milliseconds>(init_end - start).count();
+    SOBA_LOG(LOG_INFO) << "OptiX init: " << init_time << "ms\n";
+
+    results.resize(face_count);
+    engine.trace(gpu_centroids.data(), gpu_normals.data(), face_count,
+                 gpu_sun_dirs.data(), sun_count, ray_offset, results.data());
+
+    if (soba_log_level >= LOG_DEBUG)
+    {
+        std::cout << "First 5 results: ";
+        for (int i = 0; i < std::min(5, face_count); i++)
+            std::cout << results[i] << " ";
+        std::cout << std::endl;
+    }
+
+    SOBA_LOG(LOG_INFO) << "OptiX complete!\n";
+}
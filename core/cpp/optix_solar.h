@@ -2,7 +2,20 @@
 #include <optix.h>
 #include <cuda_runtime.h>
 #include <vector>
+#include <memory>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <cstdint>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include "device_buffer.h"
+#include "launch_params.h" // LaunchParams / BatchScenario shared with optix_programs.cu
 #include "geometry.h" // For point3, vec3, Triangle types
+#include "sun_position.h"
 
 // Triangle_GPU
 struct Triangle_GPU
@@ -12,36 +25,672 @@ struct Triangle_GPU
     Triangle_GPU(float3 a, float3 b, float3 c) : v0(a), v1(b), v2(c) {}
 };
 
-// Launch parameters that get passed to device
-struct LaunchParams
+// Triangle mesh as raw host arrays. With indices == nullptr the vertices are a
+// de-indexed list (3 per triangle, e.g. a Triangle_GPU array).
+struct MeshView
 {
-    float3 *face_centroids;
-    float3 *face_normals;
-    float3 *sun_directions;
-    float *results;
-    int face_count;
-    int sun_count;
-    OptixTraversableHandle gas_handle;
-    float ray_offset;
+    const float3 *vertices = nullptr;
+    size_t vertex_count = 0;
+    const uint3 *indices = nullptr; // One uint3 triplet per triangle
+    size_t triangle_count = 0;
+
+    MeshView() = default;
+    MeshView(const float3 *v, size_t v_count, const uint3 *i, size_t tri_count)
+        : vertices(v), vertex_count(v_count), indices(i), triangle_count(tri_count) {}
+    // De-indexed view over a triangle array
+    MeshView(const std::vector<Triangle_GPU> &triangles)
+        : vertices(reinterpret_cast<const float3 *>(triangles.data())),
+          vertex_count(triangles.size() * 3), triangle_count(triangles.size()) {}
+};
+
+// Shadow ray extent of every launch
+constexpr float SHADOW_RAY_TMIN = 1e-4f;
+constexpr float SHADOW_RAY_TMAX = 1e16f;
+
+class GasCache;
+struct OptiXSolar;
+
+// One geometry acceleration structure per context mesh
+struct MeshGAS
+{
+    CUdeviceptr d_buffer = 0;
+    size_t buffer_size = 0;      // Compacted size when compaction paid off
+    size_t uncompacted_size = 0; // Output size before optixAccelCompact
+    OptixTraversableHandle handle = 0;
+    size_t vertex_count = 0;
+    size_t triangle_count = 0;
+    bool indexed = false;
+    bool allow_update = false; // Built with OPTIX_BUILD_FLAG_ALLOW_UPDATE (refittable)
+    bool alive = false;
+    // Set when d_buffer is borrowed from a GasCache entry instead of owned
+    GasCache *cache = nullptr;
+    uint64_t cache_key = 0;
+};
+
+// Placement of a mesh in the scene. transform is row-major 3x4 (column vectors,
+// translation in the last column), the layout OptixInstance expects.
+struct SceneInstance
+{
+    int mesh_id = -1;
+    float transform[12];
+    bool alive = false;
+};
+
+// Double-buffered pinned host buffer for uploads from pageable memory (numpy).
+// Chunks are memcpy'd into pinned memory while the previous chunk is in flight.
+class PinnedStaging
+{
+public:
+    explicit PinnedStaging(size_t chunk_bytes = 8u << 20);
+    ~PinnedStaging();
+
+    PinnedStaging(const PinnedStaging &) = delete;
+    PinnedStaging &operator=(const PinnedStaging &) = delete;
+
+    // Synchronous from the caller's point of view (returns after the last chunk lands)
+    void upload(void *d_dst, const void *h_src, size_t bytes, cudaStream_t stream = 0);
+
+private:
+    size_t chunk_bytes_;
+    void *buffers_[2] = {nullptr, nullptr};
+    cudaEvent_t done_[2] = {nullptr, nullptr};
+};
+
+struct GasCacheStats
+{
+    size_t hits = 0;      // Served from VRAM
+    size_t disk_hits = 0; // Loaded from disk and relocated
+    size_t misses = 0;    // Built
+    size_t evictions = 0;
+    size_t disk_writes = 0;
+    size_t entries = 0;
+    size_t bytes = 0; // VRAM held by all entries, in use or not
+    size_t budget_bytes = 0;
+};
+
+// SHA-256 of a mesh's buffers and build flags, the identity of a cached GAS
+struct MeshDigest
+{
+    uint8_t bytes[32] = {};
+
+    // Entry / MeshGAS::cache_key id: the first 8 bytes
+    uint64_t key() const
+    {
+        uint64_t k = 0;
+        for (int i = 0; i < 8; i++)
+            k = (k << 8) | bytes[i];
+        return k;
+    }
+    bool operator==(const MeshDigest &other) const
+    {
+        for (int i = 0; i < 32; i++)
+            if (bytes[i] != other.bytes[i])
+                return false;
+        return true;
+    }
+};
+
+// Compacted GAS buffers of one device keyed by mesh content digest. Live meshes
+// borrow entries (no copy); unused ones stay resident until evicted, least
+// recently used first, once the total exceeds the VRAM budget. With a disk
+// directory every built GAS is also saved with its relocation info as
+// <digest>_<device uuid>.gas, so later engines and processes relocate it
+// instead of building. Hits compare the full digest, never just the 64-bit id.
+// Files are written by a background thread, off the GAS build path.
+class GasCache
+{
+public:
+    GasCache(int device, size_t vram_budget_bytes, const std::string &disk_dir);
+    ~GasCache();
+
+    GasCache(const GasCache &) = delete;
+    GasCache &operator=(const GasCache &) = delete;
+
+    static MeshDigest mesh_digest(const MeshView &mesh, bool allow_update);
+
+    // Point gas at the cached GAS for digest (VRAM, then disk); false on a miss
+    bool acquire(OptiXSolar &optix, const MeshDigest &digest, const MeshView &mesh, bool allow_update,
+                 MeshGAS &gas);
+    // Take over a freshly built gas, which then borrows the new entry
+    void insert(OptiXSolar &optix, const MeshDigest &digest, MeshGAS &gas);
+    // A mesh borrowing key is gone; the entry becomes evictable
+    void release(uint64_t key);
+    // Give gas a private relocated copy of its borrowed buffer, e.g. before a refit
+    void detach(OptiXSolar &optix, MeshGAS &gas);
+
+    void set_budget(size_t vram_budget_bytes);
+    // Free every entry no mesh is using, whatever the budget (out-of-memory
+    // fallback); returns the bytes freed
+    size_t trim();
+    GasCacheStats stats() const;
+
+private:
+    struct Entry
+    {
+        CUdeviceptr d_buffer = 0;
+        size_t buffer_size = 0;
+        size_t uncompacted_size = 0;
+        size_t vertex_count = 0;
+        size_t triangle_count = 0;
+        bool indexed = false;
+        bool allow_update = false;
+        OptixTraversableHandle handle = 0;
+        OptixRelocationInfo relocation = {};
+        MeshDigest digest;
+        int users = 0;
+        uint64_t last_use = 0;
+    };
+
+    void lend(uint64_t key, Entry &entry, MeshGAS &gas);
+    void evict() { evict_to(budget_bytes_); }
+    size_t evict_to(size_t budget_bytes);
+    std::string disk_path(const MeshDigest &digest) const;
+    bool load_from_disk(OptiXSolar &optix, const MeshDigest &digest, Entry &entry);
+    void save_to_disk(const Entry &entry);
+    void write_files();
+
+    int device_;
+    std::string device_uuid_;
+    size_t budget_bytes_;
+    std::string disk_dir_;
+    std::unordered_map<uint64_t, Entry> entries_;
+    uint64_t clock_ = 0;
+    GasCacheStats stats_;
+
+    // GAS files waiting for the writer thread (header and buffer bytes)
+    struct DiskWrite
+    {
+        std::string path;
+        std::vector<char> bytes;
+    };
+    std::mutex write_mutex_;
+    std::condition_variable write_cv_;
+    std::deque<DiskWrite> writes_;
+    size_t pending_write_bytes_ = 0;
+    bool stop_writer_ = false;
+    std::atomic<size_t> disk_writes_{0};
+    std::thread writer_;
+};
+
+// Cache settings picked up by every engine created afterwards (and init_optix).
+// A zero budget without a disk directory disables caching.
+void set_gas_cache_defaults(size_t vram_budget_bytes, const std::string &disk_dir);
+// Give optix a GasCache from the current defaults (no-op when disabled)
+void init_gas_cache(OptiXSolar &optix);
+
+// Device memory pool settings picked up by every engine created afterwards (and
+// init_optix). Idle pooled blocks above release_threshold_bytes go back to the
+// driver at the next synchronization; disabled = plain cudaMalloc per buffer.
+void set_memory_pool_defaults(bool enabled, size_t release_threshold_bytes);
+// Give optix a DevicePool from the current defaults (no-op when disabled or unsupported)
+void init_memory_pool(OptiXSolar &optix);
+
+// Raygen programs linked into the pipeline, selected per launch by SBT record
+enum RaygenMode
+{
+    RAYGEN_SOLAR = 0, // Sun directions, sliced over threads
+    RAYGEN_SKY145,    // Tregenza sky patches, one thread per face
+    RAYGEN_SKY577,    // Reinhart (MF 2) sky patches, one thread per face
+    RAYGEN_BATCH,     // Several target / sun set scenarios, one thread per work item
+    RAYGEN_COUNT
+};
+
+// Sky raygen for a patch count (145 or 577), RAYGEN_COUNT when unsupported
+RaygenMode sky_raygen_mode(size_t patch_count);
+
+// Cumulative stage timings and counters of one engine (SolarEngine::metrics).
+// GPU stages are CUDA-event times summed over every copy / build / launch (tiles
+// on the two streams may overlap); module_ms is host time spent creating the
+// module, program groups and pipeline.
+struct EngineMetrics
+{
+    double module_ms = 0.0;
+    double gas_build_ms = 0.0; // GAS builds, refits and cache loads, plus IAS builds
+    double upload_ms = 0.0;    // Host -> device copies of meshes and trace inputs
+    double trace_ms = 0.0;
+    double readback_ms = 0.0;
+    unsigned long long rays = 0;
+    unsigned long long traces = 0;
+    size_t gas_bytes = 0;         // Filled in by metrics() from the live meshes
+    size_t peak_device_bytes = 0; // Highest device-wide use seen (cudaMemGetInfo)
+    size_t pool_reserved_bytes = 0; // Filled in by metrics(): VRAM held by the memory pool
+
+    double rays_per_second() const { return trace_ms > 0.0 ? rays / (trace_ms * 1e-3) : 0.0; }
 };
 
 // OptiX state container
 struct OptiXSolar
 {
+    int device = 0; // CUDA device everything below lives on
     OptixDeviceContext context = nullptr;
-    OptixTraversableHandle gas_handle = 0;
-    OptixPipeline pipeline = nullptr;
+    OptixModule module = nullptr;
+    OptixPipelineCompileOptions pipeline_options = {}; // Of the module, reused by every pipeline
+    OptixProgramGroup miss_pg = nullptr;
+    OptixProgramGroup hit_pg = nullptr;
+    // Pipeline cache keyed by mode, filled on a mode's first launch: its
+    // specialized raygens (indexed by RaygenFeature bits, null for combinations
+    // the mode has no entry point for), their SBT records and one pipeline
+    // linking them with the miss / hit programs
+    OptixProgramGroup raygen_pgs[RAYGEN_COUNT][RAYGEN_VARIANTS] = {};
+    CUdeviceptr raygen_records[RAYGEN_COUNT][RAYGEN_VARIANTS] = {}; // sbt.raygenRecord points at one of these
+    OptixPipeline pipelines[RAYGEN_COUNT] = {};
     OptixShaderBindingTable sbt = {};
+
+    // One LaunchParams slot per tile of the current trace (grow-only), so
+    // tiles in flight on different streams never share parameters
     CUdeviceptr d_params = 0;
-    CUdeviceptr d_gas_buffer = 0; // Keep reference to free later
+    size_t params_capacity = 0;
+    cudaStream_t streams[2] = {nullptr, nullptr}; // Tiles alternate between these
+
+    // Two-level scene: meshes/instances are indexed by id, removed slots stay dead
+    std::vector<MeshGAS> meshes;
+    std::vector<SceneInstance> instances;
+
+    // Instance acceleration structure over all live instances
+    OptixTraversableHandle ias_handle = 0;
+    CUdeviceptr d_ias_buffer = 0;
+    size_t ias_buffer_size = 0;
+    CUdeviceptr d_instances = 0;
+    size_t ias_instance_count = 0;
+    bool ias_rebuild = false; // Instance set or GAS handles changed
+    bool ias_refit = false;   // Only transforms changed
+
+    // Optional staging for host->device copies (plain cudaMemcpy when null)
+    std::unique_ptr<PinnedStaging> staging;
+
+    // Optional GAS cache consulted by build_mesh_gas (null = always build)
+    std::unique_ptr<GasCache> gas_cache;
+
+    // Optional pool for per-job buffers: trace inputs and results, GAS / IAS
+    // build scratch (null = cudaMalloc / cudaFree each time)
+    std::unique_ptr<DevicePool> pool;
+
+    // Sun path generated on the device (SolarEngine::set_sun_path), kept for
+    // every trace_sun_path until replaced
+    float4 *d_sun_path = nullptr;
+    float *d_sun_path_weights = nullptr; // Null when generated without DNI
+    size_t sun_path_count = 0;
+    // Host copies for culled traces, which reorder the suns per trace
+    std::vector<float3> sun_path_host;
+    std::vector<float> sun_path_weights_host;
+
+    EngineMetrics metrics;
+};
+
+// Lower bound of sun directions traced by one raygen thread
+constexpr int MIN_SUNS_PER_THREAD = 32;
+// Upper bound, keeps a single thread (and launch) short
+constexpr int MAX_SUNS_PER_THREAD = 1024;
+// Thread count above which slices get longer instead of more numerous
+constexpr long long TARGET_LAUNCH_THREADS = 1ll << 21;
+// Faces per launch tile; larger workloads are split into several launches
+constexpr size_t MAX_TILE_FACES = 1u << 20;
+// OptiX launch size limit (width x height x depth); batched work beyond it is split
+constexpr unsigned long long MAX_LAUNCH_ITEMS = 1ull << 30;
+
+// One optixLaunch: a face range against a sun range. Offsets are 64-bit, the
+// counts inside a tile always fit the 32-bit launch dimensions.
+struct TraceTile
+{
+    size_t face_offset;
+    size_t sun_offset;
+    int face_count;
+    int sun_count;
+    int suns_per_thread;
+};
+
+// Culled work items of a solar trace's tiles (plan_trace_tiles order) in one
+// device buffer: tile i launches over items [offsets[i], offsets[i + 1])
+struct TraceWorkItems
+{
+    DeviceBuffer<uint2> items;
+    std::vector<size_t> offsets;
 };
 
+// Device buffers of one trace (suns are the sky patches for the sky raygens),
+// float4 laid out as LaunchParams expects
+struct TraceBuffers
+{
+    const float4 *centroids = nullptr;
+    const float4 *normals = nullptr;
+    const float4 *face_vertices = nullptr; // Optional, 3 corner planes of the trace's face count
+    const float4 *suns = nullptr;
+    const float *sun_weights = nullptr; // Optional
+    float *results = nullptr;           // Zeroed by the caller
+    uint32_t *visibility = nullptr;     // Optional, zeroed by the caller when culling
+    // Optional host copies of the normals and suns above (clustered, see
+    // culling.h): RAYGEN_SOLAR tiles then launch over culled work items
+    const float3 *cull_normals = nullptr;
+    const float3 *cull_suns = nullptr;
+    // Optional: the culled items of this trace's tiles, already built by
+    // build_trace_work_items (the cull arrays are then not read)
+    const TraceWorkItems *work_items = nullptr;
+};
+
+// Optional host inputs / outputs of SolarEngine::trace
+struct TraceOptions
+{
+    // face_count x visibility_words(sun_count) bit matrix of which suns reach each
+    // face (with sampling: at least half of its sample points)
+    uint32_t *visibility = nullptr;
+    // One per sun: results are sum(weight * cos(incidence)) over lit suns
+    // instead of lit-sun counts
+    const float *sun_weights = nullptr;
+    // Triangle corners (3 per face). With samples_per_face = k * k > 1, rays
+    // start from k x k stratified points on the triangle instead of the
+    // centroid and count with the lit fraction (partial shading)
+    const float3 *face_vertices = nullptr;
+    int samples_per_face = 1;
+    // Solar traces: drop suns below the horizon, cluster faces by normal and
+    // suns by direction, and skip face group / sun slice pairs that cannot face
+    // each other (culling.h). Results and visibility keep the caller's order.
+    bool cull = true;
+    // Solar traces over time-ordered suns: radians between coarse suns, traced
+    // first; only faces whose visibility flips between two of them are traced
+    // against the suns in between (adaptive.h). 0 traces every sun. Needs
+    // samples_per_face = 1 and no visibility output. Filled suns keep their
+    // own weight and cos(incidence) and the raygen's facing threshold, so
+    // counts and weighted results match an exact trace except where a shadow
+    // (or a gap in one) narrower than the tolerance falls wholly between two
+    // coarse suns: its suns are filled as the coarse ends see them.
+    float adaptive_tolerance = 0.0f;
+};
+
+// Host inputs of SolarEngine::trace_batch: target faces and sun sets are
+// uploaded once each, scenarios pair them up by index
+struct BatchTarget
+{
+    const float3 *centroids = nullptr;
+    const float3 *normals = nullptr;
+    size_t face_count = 0;
+};
+
+struct BatchSunSet
+{
+    const float3 *directions = nullptr;
+    const float *weights = nullptr; // Optional: sum(weight * cos(incidence)) for scenarios on this set
+    size_t sun_count = 0;
+};
+
+struct BatchPair
+{
+    int target;
+    int sun_set;
+};
+
+// 32-bit words per face in a bit-packed visibility matrix
+inline size_t visibility_words(size_t sun_count) { return (sun_count + 31) / 32; }
+
+// Split face_count x sun_count into launch tiles, face tiles outermost. With
+// whole_sun_set every tile covers all suns in one slice (sky raygens).
+std::vector<TraceTile> plan_trace_tiles(size_t face_count, size_t sun_count, bool whole_sun_set = false);
+
+// The culled work items of tiles from d.cull_normals / d.cull_suns
+// (culling.h), uploaded on the memory pool
+void build_trace_work_items(OptiXSolar &optix, const TraceBuffers &d, const std::vector<TraceTile> &tiles,
+                            TraceWorkItems &out);
+
+// Directory for OptiX's compiled-module disk cache, used by every context
+// created afterwards. Empty keeps OptiX's default location (or OPTIX_CACHE_PATH).
+void set_optix_cache_dir(const std::string &dir);
+
 // Simple interface functions
 bool init_optix(OptiXSolar &optix, const std::vector<Triangle_GPU> &triangles);
-void launch_solar_rays(OptiXSolar &optix, float3 *centroids, float3 *normals,
-                       float3 *suns, float *results, int face_count, int sun_count);
+void create_optix_pipeline(OptiXSolar &optix);
+// Trace all tiles on optix.streams. Each face tile of d.results is copied to
+// h_results (and d.visibility rows to h_visibility, when not null) while the
+// next one is tracing; a null h_results leaves the results on the device.
+// Returns once all are done.
+void launch_solar_rays(OptiXSolar &optix, const TraceBuffers &d, size_t face_count, size_t sun_count,
+                       float ray_offset, int samples_per_face, float *h_results,
+                       uint32_t *h_visibility = nullptr, RaygenMode mode = RAYGEN_SOLAR);
+// Trace every work item of a batch (d_scenarios: scenario_count entries from
+// SolarEngine::trace_batch) in a single launch, more only past
+// MAX_LAUNCH_ITEMS. d.results must be zeroed; returns once done.
+void launch_batch_rays(OptiXSolar &optix, const TraceBuffers &d, BatchScenario *d_scenarios, int scenario_count,
+                       unsigned long long work_count, float ray_offset);
 void cleanup_optix(OptiXSolar &optix);
 
+// Scene management (two-level: one GAS per mesh, one IAS over the instances)
+void build_mesh_gas(OptiXSolar &optix, const MeshView &mesh, bool allow_update, MeshGAS &gas);
+void refit_mesh_gas(OptiXSolar &optix, const MeshView &mesh, MeshGAS &gas);
+void free_mesh_gas(MeshGAS &gas);
+void build_ias(OptiXSolar &optix);
+void free_scene(OptiXSolar &optix);
+
+// Identity transform in OptixInstance layout
+void identity_transform(float transform[12]);
+
+// Host->device copy, through optix.staging when pinned staging is enabled
+void upload_to_device(OptiXSolar &optix, void *d_dst, const void *h_src, size_t bytes);
+
+// Host float3's -> device float4's (the LaunchParams input layout): count rows
+// of planes float3's become planes planes of count float4's, e.g. 3 corner
+// planes of triangle corners. Staged through optix.pool scratch.
+void upload_float4(OptiXSolar &optix, float4 *d_dst, const float3 *h_src, size_t count, int planes = 1);
+
+// Adds the GPU time between construction and destruction (CUDA events on stream)
+// to total; the destructor waits for the work queued in between
+class StageTimer
+{
+public:
+    StageTimer(double &total_ms, cudaStream_t stream = 0);
+    ~StageTimer();
+
+    StageTimer(const StageTimer &) = delete;
+    StageTimer &operator=(const StageTimer &) = delete;
+
+private:
+    double &total_ms_;
+    cudaStream_t stream_;
+    cudaEvent_t start_ = nullptr, stop_ = nullptr;
+};
+
+// Record the device's current memory use into optix.metrics.peak_device_bytes
+void sample_device_memory(OptiXSolar &optix);
+
+// Make optix.device current for the calling thread, restore the previous one on exit
+class DeviceScope
+{
+public:
+    explicit DeviceScope(int device);
+    ~DeviceScope();
+
+    DeviceScope(const DeviceScope &) = delete;
+    DeviceScope &operator=(const DeviceScope &) = delete;
+
+private:
+    int previous_ = 0;
+};
+
+// Number of visible CUDA devices
+int cuda_device_count();
+
+// Long-lived engine: context, module, pipeline and SBT are created once in the
+// constructor. Context geometry is a set of meshes (one GAS each) placed by
+// instances (one IAS), so a moved or edited building only rebuilds what changed.
+// GPU failures throw CudaError / OptixError (error_check.h). Out of device
+// memory, builds and traces first retry after trimming the GAS cache, then
+// traces split their faces into smaller chunks; CudaOutOfMemory only escapes
+// once that fails too.
+class SolarEngine
+{
+public:
+    // Every call switches to device_id for its duration, so one engine per GPU
+    // can be driven from any thread
+    explicit SolarEngine(int device_id = 0, bool pinned_staging = false);
+    ~SolarEngine();
+
+    SolarEngine(const SolarEngine &) = delete;
+    SolarEngine &operator=(const SolarEngine &) = delete;
+
+    // Replace the whole scene with a single identity-placed mesh
+    void set_scene(const MeshView &mesh);
+    void clear_scene();
+
+    // Meshes own a (compacted) GAS; the same mesh may be placed by several instances
+    int add_mesh(const MeshView &mesh, bool allow_update = true);
+    // Refit in place when the mesh is refittable and the vertex/triangle counts are
+    // unchanged (same topology), rebuild otherwise
+    void update_mesh(int mesh_id, const MeshView &mesh);
+    void remove_mesh(int mesh_id);
+
+    int add_instance(int mesh_id, const float transform[12]);
+    void set_instance_transform(int instance_id, const float transform[12]);
+    void remove_instance(int instance_id);
+
+    // Trace every (face, sun) pair against the current scene. Inputs are read
+    // straight from the caller's buffers, results (face_count floats) are written
+    // straight into results. See TraceOptions for visibility, weights and sampling.
+    void trace(const float3 *centroids, const float3 *normals, size_t face_count,
+               const float3 *sun_directions, size_t sun_count,
+               float ray_offset, float *results, const TraceOptions &options = TraceOptions());
+
+    // Diffuse/total radiation against the same scene: patch_count (145 or 577)
+    // sky patch directions (pointing down, like sun vectors) weighted by a
+    // cumulative sky matrix. results = sum of weight * cos(incidence) over
+    // unobstructed patches.
+    void trace_sky(const float3 *centroids, const float3 *normals, size_t face_count,
+                   const float3 *patch_directions, const float *patch_weights, size_t patch_count,
+                   float ray_offset, float *results, const TraceOptions &options = TraceOptions());
+
+    // Generate the daylit suns of a location and period on this device (see
+    // generate_sun_path) and keep them for trace_sun_path. hourly_dni (host,
+    // SUN_PATH_HOURS_PER_YEAR values, may be null) adds direct-normal weights.
+    // Returns the sun count.
+    size_t set_sun_path(const SunPathSpec &spec, const float *hourly_dni = nullptr);
+    void clear_sun_path();
+    size_t sun_path_count() const { return optix_.sun_path_count; }
+
+    // trace() against the resident sun path; no sun vectors are uploaded (a
+    // culled trace uploads their order and gathers them on the device).
+    // weighted uses its DNI weights (radiation) instead of counting lit suns;
+    // options.sun_weights is ignored.
+    void trace_sun_path(const float3 *centroids, const float3 *normals, size_t face_count,
+                        float ray_offset, bool weighted, float *results,
+                        const TraceOptions &options = TraceOptions());
+
+    // Several scenarios (target x sun set pairs, e.g. design options or
+    // analysis periods) in one launch. results[i] receives
+    // targets[scenarios[i].target].face_count values for scenario i: lit-sun
+    // counts, or weighted sums when its sun set has weights.
+    void trace_batch(const std::vector<BatchTarget> &targets, const std::vector<BatchSunSet> &sun_sets,
+                     const std::vector<BatchPair> &scenarios, float ray_offset,
+                     const std::vector<float *> &results);
+
+    bool has_scene() const;
+    size_t triangle_count() const;
+    size_t mesh_count() const;
+    size_t instance_count() const;
+    // Device bytes held by all GAS buffers (after compaction) and before compaction
+    size_t gas_bytes() const;
+    size_t gas_uncompacted_bytes() const;
+    GasCacheStats gas_cache_stats() const;
+    int device() const { return optix_.device; }
+
+    // Stage timings since construction or the last reset_metrics
+    EngineMetrics metrics() const;
+    void reset_metrics();
+
+private:
+    // With d_resident_suns (and optionally d_resident_weights) already on the
+    // device, sun_directions / options.sun_weights are not uploaded
+    void run_trace(RaygenMode mode, const float3 *centroids, const float3 *normals, size_t face_count,
+                   const float3 *sun_directions, size_t sun_count,
+                   float ray_offset, float *results, const TraceOptions &options,
+                   const float4 *d_resident_suns = nullptr, const float *d_resident_weights = nullptr);
+    // Coarse trace plus batched refinement (TraceOptions::adaptive_tolerance)
+    // over host suns in time order
+    void trace_adaptive(const float3 *centroids, const float3 *normals, size_t face_count,
+                        const float3 *sun_directions, const float *sun_weights, size_t sun_count,
+                        float ray_offset, float *results, const TraceOptions &options);
+    MeshGAS &mesh(int mesh_id);
+    SceneInstance &instance(int instance_id);
+
+    OptiXSolar optix_;
+};
+
+// Per-device share of the last MultiDeviceEngine::trace. After trace_batch the
+// faces are summed over the targets, each target once (not per scenario):
+// face_count of them on this device, face_offset on the devices before it.
+struct DeviceTraceStats
+{
+    int device = 0;
+    size_t face_offset = 0;
+    size_t face_count = 0;
+    double trace_ms = 0.0; // Upload + trace + readback on this device
+    double rays_per_second = 0.0;
+    double efficiency = 0.0; // trace_ms / slowest device's trace_ms (1.0 = no idle time)
+};
+
+// One SolarEngine per device. Scene edits are broadcast so every device holds
+// the full GAS/IAS; trace splits the target faces into contiguous ranges, traces
+// them concurrently (one host thread per device) and gathers into one array.
+class MultiDeviceEngine
+{
+public:
+    explicit MultiDeviceEngine(const std::vector<int> &devices, bool pinned_staging = false);
+
+    // Same scene interface as SolarEngine; ids are identical on every device
+    void set_scene(const MeshView &mesh);
+    void clear_scene();
+    int add_mesh(const MeshView &mesh, bool allow_update = true);
+    void update_mesh(int mesh_id, const MeshView &mesh);
+    void remove_mesh(int mesh_id);
+    int add_instance(int mesh_id, const float transform[12]);
+    void set_instance_transform(int instance_id, const float transform[12]);
+    void remove_instance(int instance_id);
+
+    void trace(const float3 *centroids, const float3 *normals, size_t face_count,
+               const float3 *sun_directions, size_t sun_count,
+               float ray_offset, float *results, const TraceOptions &options = TraceOptions());
+    void trace_sky(const float3 *centroids, const float3 *normals, size_t face_count,
+                   const float3 *patch_directions, const float *patch_weights, size_t patch_count,
+                   float ray_offset, float *results, const TraceOptions &options = TraceOptions());
+
+    // Every device generates its own copy of the sun path
+    size_t set_sun_path(const SunPathSpec &spec, const float *hourly_dni = nullptr);
+    void clear_sun_path();
+    size_t sun_path_count() const { return engines_.front()->sun_path_count(); }
+    void trace_sun_path(const float3 *centroids, const float3 *normals, size_t face_count,
+                        float ray_offset, bool weighted, float *results,
+                        const TraceOptions &options = TraceOptions());
+    // Every target's faces are split between the devices, each traces its share
+    // of all scenarios in one launch
+    void trace_batch(const std::vector<BatchTarget> &targets, const std::vector<BatchSunSet> &sun_sets,
+                     const std::vector<BatchPair> &scenarios, float ray_offset,
+                     const std::vector<float *> &results);
+
+    bool has_scene() const { return engines_.front()->has_scene(); }
+    size_t triangle_count() const { return engines_.front()->triangle_count(); }
+    size_t mesh_count() const { return engines_.front()->mesh_count(); }
+    size_t instance_count() const { return engines_.front()->instance_count(); }
+    // Per device (every device holds a copy)
+    size_t gas_bytes() const { return engines_.front()->gas_bytes(); }
+    size_t gas_uncompacted_bytes() const { return engines_.front()->gas_uncompacted_bytes(); }
+    // Summed over devices (budget is per device)
+    GasCacheStats gas_cache_stats() const;
+
+    std::vector<int> devices() const;
+    const std::vector<DeviceTraceStats> &last_trace_stats() const { return stats_; }
+
+    // Summed over devices (GPU time; peak is the highest single device)
+    EngineMetrics metrics() const;
+    void reset_metrics();
+
+private:
+    // Run fn(engine, face_offset, face_count) for each device's face range on
+    // its own thread, then fill stats_ (rays_per_face rays per face)
+    void split_faces(size_t face_count, size_t rays_per_face,
+                     const std::function<void(SolarEngine &, size_t, size_t)> &fn);
+    // Run fn(engine, device index) on one thread per device, then time stats_
+    // (face ranges already filled in) with rays[d] rays traced on device d
+    void run_on_devices(const std::vector<double> &rays, const std::function<void(SolarEngine &, size_t)> &fn);
+
+    std::vector<std::unique_ptr<SolarEngine>> engines_;
+    std::vector<DeviceTraceStats> stats_;
+};
+
 // Main wrapper function
 void gpu_solar_analysis_series_optix(
     const std::vector<point3> &face_centroids,
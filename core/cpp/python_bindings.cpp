@@ -4,161 +4,904 @@
 #include <pybind11/numpy.h>
 #include <vector>
 #include <iostream>
+#include <cstring>
 
 #include "optix_solar.h" // This has your gpu_solar_analysis_series_optix function
+#include "error_check.h"
+#include "lod.h"
+#include "log.h"
 
 namespace py = pybind11;
 
-// Helper function to convert numpy arrays to C++ vectors
-std::vector<point3> numpy_to_point3_vector(py::array_t<float> arr)
+// C-contiguous float32 / uint32 arrays. Inputs that already match are borrowed
+// as-is (no copy); anything else is converted once by numpy.
+using FloatArray = py::array_t<float, py::array::c_style | py::array::forcecast>;
+using IndexArray = py::array_t<uint32_t, py::array::c_style | py::array::forcecast>;
+
+// The Python API takes angles in degrees, the engine radians
+constexpr double DEG_TO_RAD = 3.14159265358979323846 / 180.0;
+
+// Borrow an Nx3 float32 array as float3 (same 12-byte layout)
+const float3 *float3_view(const FloatArray &arr, const char *what, size_t &count)
 {
     if (arr.ndim() != 2 || arr.shape(1) != 3)
     {
-        throw std::runtime_error("Expected a Nx3 array for points");
+        throw std::runtime_error(std::string("Expected a Nx3 array for ") + what);
     }
+    count = static_cast<size_t>(arr.shape(0));
+    return reinterpret_cast<const float3 *>(arr.data());
+}
 
-    auto r = arr.unchecked<2>();
-    std::vector<point3> result;
-    result.reserve(r.shape(0));
+// Borrow a mesh given either as (N, 3, 3) triangles or as (V, 3) points with
+// (M, 3) vertex indices. index_storage keeps the index array alive.
+MeshView numpy_to_mesh_view(const FloatArray &vertices, const py::object &indices,
+                            IndexArray &index_storage)
+{
+    if (indices.is_none())
+    {
+        if (vertices.ndim() != 3 || vertices.shape(1) != 3 || vertices.shape(2) != 3)
+        {
+            throw std::runtime_error("Expected triangles array of shape (N, 3, 3)");
+        }
+        const size_t triangle_count = static_cast<size_t>(vertices.shape(0));
+        return MeshView(reinterpret_cast<const float3 *>(vertices.data()), triangle_count * 3,
+                        nullptr, triangle_count);
+    }
+
+    size_t vertex_count = 0;
+    const float3 *points = float3_view(vertices, "points", vertex_count);
 
-    for (py::ssize_t i = 0; i < r.shape(0); i++)
+    index_storage = IndexArray::ensure(indices);
+    if (!index_storage || index_storage.ndim() != 2 || index_storage.shape(1) != 3)
     {
-        result.emplace_back(r(i, 0), r(i, 1), r(i, 2));
+        throw std::runtime_error("Expected an Mx3 array of vertex indices");
     }
-    return result;
+
+    const uint32_t *idx = index_storage.data();
+    const size_t index_count = static_cast<size_t>(index_storage.size());
+    for (size_t i = 0; i < index_count; i++)
+    {
+        if (idx[i] >= vertex_count)
+        {
+            throw std::runtime_error("Vertex index out of range");
+        }
+    }
+
+    return MeshView(points, vertex_count, reinterpret_cast<const uint3 *>(idx), index_count / 3);
 }
 
-std::vector<vec3> numpy_to_vec3_vector(py::array_t<float> arr)
+// Instance transform from a (3, 4) or (4, 4) array using column vectors
+// (translation in the last column). None gives the identity.
+void numpy_to_transform(py::object obj, float transform[12])
 {
-    if (arr.ndim() != 2 || arr.shape(1) != 3)
+    if (obj.is_none())
+    {
+        identity_transform(transform);
+        return;
+    }
+
+    py::array_t<float> arr = py::array_t<float>::ensure(obj);
+    if (!arr || arr.ndim() != 2 || arr.shape(1) != 4 || (arr.shape(0) != 3 && arr.shape(0) != 4))
     {
-        throw std::runtime_error("Expected a Nx3 array for vectors");
+        throw std::runtime_error("Expected a 3x4 or 4x4 transform");
     }
 
     auto r = arr.unchecked<2>();
-    std::vector<vec3> result;
-    result.reserve(r.shape(0));
+    for (int row = 0; row < 3; row++)
+    {
+        for (int col = 0; col < 4; col++)
+        {
+            transform[row * 4 + col] = r(row, col);
+        }
+    }
+}
 
-    for (py::ssize_t i = 0; i < r.shape(0); i++)
+// Borrow (faces, 3, 3) triangle corners into options for supersampled traces
+void face_vertices_option(const py::object &face_vertices, int samples_per_face, size_t face_count,
+                          FloatArray &storage, TraceOptions &options)
+{
+    options.samples_per_face = samples_per_face;
+    if (face_vertices.is_none())
+        return;
+
+    storage = FloatArray::ensure(face_vertices);
+    if (!storage || storage.ndim() != 3 || static_cast<size_t>(storage.shape(0)) != face_count ||
+        storage.shape(1) != 3 || storage.shape(2) != 3)
     {
-        result.emplace_back(r(i, 0), r(i, 1), r(i, 2));
+        throw std::runtime_error("Expected face vertices of shape (faces, 3, 3)");
     }
-    return result;
+    options.face_vertices = reinterpret_cast<const float3 *>(storage.data());
 }
 
-std::vector<Triangle> numpy_to_triangles_direct(py::array_t<float> triangles)
+// Trace straight from the numpy buffers into a freshly allocated result array.
+// With output_visibility returns (results, visibility) where visibility is a
+// (faces, ceil(suns / 32)) uint32 array, bit s % 32 of word s / 32 set when sun s is seen.
+template <typename Engine>
+py::object trace_numpy(Engine &engine, const FloatArray &face_centroids,
+                       const FloatArray &face_normals, const FloatArray &sun_directions,
+                       float ray_offset, bool output_visibility, const py::object &sun_weights,
+                       const py::object &face_vertices, int samples_per_face, bool cull,
+                       float adaptive_tolerance_deg)
 {
-    // Input: triangles array of shape (num_triangles, 3, 3)
-    // Each triangle is 3 vertices, each vertex is (x, y, z)
+    size_t face_count = 0, normal_count = 0, sun_count = 0;
+    const float3 *centroids = float3_view(face_centroids, "face centroids", face_count);
+    const float3 *normals = float3_view(face_normals, "face normals", normal_count);
+    const float3 *suns = float3_view(sun_directions, "sun directions", sun_count);
+
+    if (face_count != normal_count)
+    {
+        throw std::runtime_error("Face centroid and normal counts differ");
+    }
 
-    if (triangles.ndim() != 3 || triangles.shape(1) != 3 || triangles.shape(2) != 3)
+    TraceOptions options;
+    FloatArray weights, vertices;
+    if (!sun_weights.is_none())
     {
-        throw std::runtime_error("Expected triangles array of shape (N, 3, 3)");
+        weights = FloatArray::ensure(sun_weights);
+        if (!weights || weights.ndim() != 1 || static_cast<size_t>(weights.shape(0)) != sun_count)
+        {
+            throw std::runtime_error("Expected one sun weight per sun direction");
+        }
+        options.sun_weights = weights.data();
     }
+    face_vertices_option(face_vertices, samples_per_face, face_count, vertices, options);
+    options.cull = cull;
+    options.adaptive_tolerance = static_cast<float>(adaptive_tolerance_deg * DEG_TO_RAD);
 
-    auto t = triangles.unchecked<3>();
-    std::vector<Triangle> result;
-    result.reserve(t.shape(0));
+    py::array_t<float> results(static_cast<py::ssize_t>(face_count));
+    float *out = results.mutable_data();
 
-    for (py::ssize_t i = 0; i < t.shape(0); i++)
+    py::array_t<uint32_t> visibility;
+    if (output_visibility)
     {
-        point3 v0(t(i, 0, 0), t(i, 0, 1), t(i, 0, 2));
-        point3 v1(t(i, 1, 0), t(i, 1, 1), t(i, 1, 2));
-        point3 v2(t(i, 2, 0), t(i, 2, 1), t(i, 2, 2));
+        visibility = py::array_t<uint32_t>({static_cast<py::ssize_t>(face_count),
+                                            static_cast<py::ssize_t>(visibility_words(sun_count))});
+        options.visibility = visibility.mutable_data();
+    }
 
-        result.emplace_back(v0, v1, v2);
+    {
+        py::gil_scoped_release release;
+        engine.trace(centroids, normals, face_count, suns, sun_count, ray_offset, out, options);
     }
-    return result;
+
+    if (output_visibility)
+        return py::make_tuple(results, visibility);
+    return results;
 }
 
-// Safe wrapper around your OptiX function
-void safe_gpu_solar_analysis(
-    const std::vector<point3> &centroids,
-    const std::vector<vec3> &normals,
-    const std::vector<Triangle> &triangles,
-    const std::vector<vec3> &sun_dirs,
-    std::vector<float> &results,
-    float ray_offset)
+// Sky-patch trace: patch_directions (P, 3) and patch_weights (P,) from a cumulative sky matrix
+template <typename Engine>
+py::array_t<float> trace_sky_numpy(Engine &engine, const FloatArray &face_centroids,
+                                   const FloatArray &face_normals, const FloatArray &patch_directions,
+                                   const FloatArray &patch_weights, float ray_offset,
+                                   const py::object &face_vertices, int samples_per_face)
 {
-    try
+    size_t face_count = 0, normal_count = 0, patch_count = 0;
+    const float3 *centroids = float3_view(face_centroids, "face centroids", face_count);
+    const float3 *normals = float3_view(face_normals, "face normals", normal_count);
+    const float3 *patches = float3_view(patch_directions, "patch directions", patch_count);
+
+    if (face_count != normal_count)
     {
-        std::cout << "Safe OptiX: Starting with " << centroids.size() << " faces" << std::endl;
+        throw std::runtime_error("Face centroid and normal counts differ");
+    }
+    if (patch_weights.ndim() != 1 || static_cast<size_t>(patch_weights.shape(0)) != patch_count)
+    {
+        throw std::runtime_error("Expected one weight per sky patch");
+    }
 
-        std::cout << "Safe OptiX: Calling gpu_solar_analysis_series_optix..." << std::endl;
-        gpu_solar_analysis_series_optix(centroids, normals, triangles, sun_dirs, results, ray_offset);
-        std::cout << "Safe OptiX: Function returned successfully!" << std::endl;
+    TraceOptions options;
+    FloatArray vertices;
+    face_vertices_option(face_vertices, samples_per_face, face_count, vertices, options);
 
-        std::cout << "Safe OptiX: Function returned successfully!" << std::endl;
-        std::cout << "Safe OptiX: Results vector size: " << results.size() << std::endl;
-        std::cout << "Safe OptiX: First 5 results: ";
-        for (int i = 0; i < std::min(5, (int)results.size()); i++)
+    py::array_t<float> results(static_cast<py::ssize_t>(face_count));
+    float *out = results.mutable_data();
+    {
+        py::gil_scoped_release release;
+        engine.trace_sky(centroids, normals, face_count, patches, patch_weights.data(), patch_count,
+                         ray_offset, out, options);
+    }
+    return results;
+}
+
+// Batched trace: targets are (centroids, normals) pairs, sun sets are (N, 3)
+// direction arrays or (directions, weights) pairs (weights may be None).
+// scenarios are (target, sun_set) index pairs, default every target against
+// every sun set (scenario t * len(sun_sets) + s). Returns one result array per scenario.
+template <typename Engine>
+py::list trace_batch_numpy(Engine &engine, const py::sequence &targets, const py::sequence &sun_sets,
+                           float ray_offset, const py::object &scenarios)
+{
+    // Converted arrays stay alive until the trace has read them
+    std::vector<FloatArray> storage;
+    storage.reserve(2 * (targets.size() + sun_sets.size()));
+
+    std::vector<BatchTarget> batch_targets;
+    for (const py::handle &item : targets)
+    {
+        py::sequence pair = py::reinterpret_borrow<py::sequence>(item);
+        if (pair.size() != 2)
+            throw std::runtime_error("Expected each target as a (face_centroids, face_normals) pair");
+        storage.push_back(FloatArray::ensure(pair[0]));
+        storage.push_back(FloatArray::ensure(pair[1]));
+        if (!storage[storage.size() - 2] || !storage.back())
+            throw std::runtime_error("Target arrays must be float arrays");
+
+        BatchTarget target;
+        size_t normal_count = 0;
+        target.centroids = float3_view(storage[storage.size() - 2], "face centroids", target.face_count);
+        target.normals = float3_view(storage.back(), "face normals", normal_count);
+        if (target.face_count != normal_count)
+            throw std::runtime_error("Face centroid and normal counts differ");
+        batch_targets.push_back(target);
+    }
+
+    std::vector<BatchSunSet> batch_sun_sets;
+    for (const py::handle &item : sun_sets)
+    {
+        py::object directions = py::reinterpret_borrow<py::object>(item);
+        py::object weights = py::none();
+        if (py::isinstance<py::tuple>(item) || py::isinstance<py::list>(item))
         {
-            std::cout << results[i] << " ";
+            py::sequence pair = py::reinterpret_borrow<py::sequence>(item);
+            if (pair.size() != 2)
+                throw std::runtime_error("Expected each sun set as directions or a (directions, weights) pair");
+            directions = pair[0];
+            weights = pair[1];
         }
-        std::cout << std::endl;
+
+        BatchSunSet sun_set;
+        storage.push_back(FloatArray::ensure(directions));
+        if (!storage.back())
+            throw std::runtime_error("Sun directions must be a float array");
+        sun_set.directions = float3_view(storage.back(), "sun directions", sun_set.sun_count);
+        if (!weights.is_none())
+        {
+            storage.push_back(FloatArray::ensure(weights));
+            if (!storage.back() || storage.back().ndim() != 1 ||
+                static_cast<size_t>(storage.back().shape(0)) != sun_set.sun_count)
+                throw std::runtime_error("Expected one sun weight per sun direction");
+            sun_set.weights = storage.back().data();
+        }
+        batch_sun_sets.push_back(sun_set);
     }
-    catch (const std::exception &e)
+
+    std::vector<BatchPair> pairs;
+    if (scenarios.is_none())
     {
-        std::cerr << "Safe OptiX Error: " << e.what() << std::endl;
-        throw;
+        for (size_t t = 0; t < batch_targets.size(); t++)
+            for (size_t sun_set = 0; sun_set < batch_sun_sets.size(); sun_set++)
+                pairs.push_back({static_cast<int>(t), static_cast<int>(sun_set)});
     }
+    else
+    {
+        for (const auto &pair : scenarios.cast<std::vector<std::pair<int, int>>>())
+            pairs.push_back({pair.first, pair.second});
+    }
+
+    // Results are indexed after validation in trace_batch, guard the sizes here
+    py::list py_results;
+    std::vector<float *> outputs;
+    for (const BatchPair &pair : pairs)
+    {
+        if (pair.target < 0 || static_cast<size_t>(pair.target) >= batch_targets.size())
+            throw std::runtime_error("Scenario refers to a missing target");
+        py::array_t<float> results(static_cast<py::ssize_t>(batch_targets[pair.target].face_count));
+        outputs.push_back(results.mutable_data());
+        py_results.append(results);
+    }
+
+    {
+        py::gil_scoped_release release;
+        engine.trace_batch(batch_targets, batch_sun_sets, pairs, ray_offset, outputs);
+    }
+    return py_results;
 }
 
-py::array_t<float> solar_analysis_optix(
-    py::array_t<float> face_centroids,
-    py::array_t<float> face_normals,
-    py::array_t<float> scene_triangles,
-    py::array_t<float> sun_directions,
-    float ray_offset)
+// Location + analysis period, argument order of weather.get_sun_vectors
+SunPathSpec make_sun_path_spec(double latitude, double longitude, double time_zone,
+                               int month_start, int month_end, int day_start, int day_end,
+                               int hour_start, int hour_end, int timestep)
 {
-    try
+    SunPathSpec spec;
+    spec.latitude = latitude;
+    spec.longitude = longitude;
+    spec.time_zone = time_zone;
+    spec.month_start = month_start;
+    spec.month_end = month_end;
+    spec.day_start = day_start;
+    spec.day_end = day_end;
+    spec.hour_start = hour_start;
+    spec.hour_end = hour_end;
+    spec.timestep = timestep;
+    return spec;
+}
+
+// Borrow an optional (8760,) DNI array (W/m2, one per hour of the EPW year)
+const float *hourly_dni_view(const py::object &hourly_dni, FloatArray &storage)
+{
+    if (hourly_dni.is_none())
+        return nullptr;
+    storage = FloatArray::ensure(hourly_dni);
+    if (!storage || storage.ndim() != 1 || storage.shape(0) != SUN_PATH_HOURS_PER_YEAR)
+    {
+        throw std::runtime_error("Expected hourly DNI of shape (8760,)");
+    }
+    return storage.data();
+}
+
+// trace_numpy against the engine-resident sun path
+template <typename Engine>
+py::object trace_sun_path_numpy(Engine &engine, const FloatArray &face_centroids,
+                                const FloatArray &face_normals, float ray_offset, bool weighted,
+                                bool output_visibility, const py::object &face_vertices, int samples_per_face,
+                                bool cull, float adaptive_tolerance_deg)
+{
+    size_t face_count = 0, normal_count = 0;
+    const float3 *centroids = float3_view(face_centroids, "face centroids", face_count);
+    const float3 *normals = float3_view(face_normals, "face normals", normal_count);
+
+    if (face_count != normal_count)
+    {
+        throw std::runtime_error("Face centroid and normal counts differ");
+    }
+
+    TraceOptions options;
+    FloatArray vertices;
+    face_vertices_option(face_vertices, samples_per_face, face_count, vertices, options);
+    options.cull = cull;
+    options.adaptive_tolerance = static_cast<float>(adaptive_tolerance_deg * DEG_TO_RAD);
+
+    py::array_t<float> results(static_cast<py::ssize_t>(face_count));
+    float *out = results.mutable_data();
+
+    py::array_t<uint32_t> visibility;
+    if (output_visibility)
+    {
+        visibility = py::array_t<uint32_t>({static_cast<py::ssize_t>(face_count),
+                                            static_cast<py::ssize_t>(visibility_words(engine.sun_path_count()))});
+        options.visibility = visibility.mutable_data();
+    }
+
+    {
+        py::gil_scoped_release release;
+        engine.trace_sun_path(centroids, normals, face_count, ray_offset, weighted, out, options);
+    }
+
+    if (output_visibility)
+        return py::make_tuple(results, visibility);
+    return results;
+}
+
+// Daylit sun vectors (N, 3) float32, plus (N,) DNI weights when hourly_dni is given
+py::object sun_path_numpy(double latitude, double longitude, double time_zone,
+                          int month_start, int month_end, int day_start, int day_end,
+                          int hour_start, int hour_end, int timestep,
+                          const py::object &hourly_dni, int device)
+{
+    const SunPathSpec spec = make_sun_path_spec(latitude, longitude, time_zone, month_start, month_end,
+                                                day_start, day_end, hour_start, hour_end, timestep);
+    FloatArray dni_storage;
+    const float *dni = hourly_dni_view(hourly_dni, dni_storage);
+
+    std::vector<float3> suns;
+    std::vector<float> weights;
+    {
+        py::gil_scoped_release release;
+        DeviceScope scope(device);
+        compute_sun_path(spec, dni, suns, weights);
+    }
+
+    py::array_t<float> py_suns({static_cast<py::ssize_t>(suns.size()), static_cast<py::ssize_t>(3)});
+    std::memcpy(py_suns.mutable_data(), suns.data(), suns.size() * sizeof(float3));
+    if (!dni)
+        return py::make_tuple(py_suns, py::none());
+
+    py::array_t<float> py_weights(static_cast<py::ssize_t>(weights.size()));
+    std::memcpy(py_weights.mutable_data(), weights.data(), weights.size() * sizeof(float));
+    return py::make_tuple(py_suns, py_weights);
+}
+
+// Target bounds from a (2, 3) array of [min, max] corners
+Aabb numpy_to_bounds(const FloatArray &bounds)
+{
+    if (bounds.ndim() != 2 || bounds.shape(0) != 2 || bounds.shape(1) != 3)
     {
-        std::cout << "C++: Starting solar_analysis_optix..." << std::endl;
+        throw std::runtime_error("Expected a 2x3 array of [min, max] target bounds");
+    }
+    const float *b = bounds.data();
+    Aabb box;
+    box.lo = make_float3(b[0], b[1], b[2]);
+    box.hi = make_float3(b[3], b[4], b[5]);
+    return box;
+}
 
-        // Convert data
-        auto centroids = numpy_to_point3_vector(face_centroids);
-        auto normals = numpy_to_vec3_vector(face_normals);
-        auto sun_dirs = numpy_to_vec3_vector(sun_directions);
-        auto triangles = numpy_to_triangles_direct(scene_triangles);
+LodSettings make_lod_settings(float min_distance, float max_angle_deg)
+{
+    LodSettings settings;
+    settings.min_distance = min_distance;
+    settings.max_angle = static_cast<float>(max_angle_deg * DEG_TO_RAD);
+    return settings;
+}
+
+// (points (V, 3), indices (T, 3), stats) of a simplified mesh
+py::tuple lod_mesh_to_numpy(const LodMesh &mesh, const LodStats &stats)
+{
+    py::array_t<float> points({static_cast<py::ssize_t>(mesh.vertices.size()), static_cast<py::ssize_t>(3)});
+    std::memcpy(points.mutable_data(), mesh.vertices.data(), mesh.vertices.size() * sizeof(float3));
+    py::array_t<uint32_t> indices({static_cast<py::ssize_t>(mesh.indices.size()), static_cast<py::ssize_t>(3)});
+    std::memcpy(indices.mutable_data(), mesh.indices.data(), mesh.indices.size() * sizeof(uint3));
+
+    py::dict d;
+    d["triangles_in"] = stats.triangles_in;
+    d["triangles_out"] = stats.triangles_out;
+    d["max_displacement"] = stats.max_displacement;
+    d["max_angle_deg"] = stats.max_angle / DEG_TO_RAD;
+    return py::make_tuple(points, indices, d);
+}
 
-        std::cout << "C++: Data converted successfully" << std::endl;
+py::dict gas_cache_stats_dict(const GasCacheStats &st)
+{
+    py::dict d;
+    d["hits"] = st.hits;
+    d["disk_hits"] = st.disk_hits;
+    d["misses"] = st.misses;
+    d["evictions"] = st.evictions;
+    d["disk_writes"] = st.disk_writes;
+    d["entries"] = st.entries;
+    d["bytes"] = st.bytes;
+    d["budget_bytes"] = st.budget_bytes;
+    return d;
+}
+
+py::dict engine_metrics_dict(const EngineMetrics &m)
+{
+    py::dict d;
+    d["module_ms"] = m.module_ms;
+    d["gas_build_ms"] = m.gas_build_ms;
+    d["upload_ms"] = m.upload_ms;
+    d["trace_ms"] = m.trace_ms;
+    d["readback_ms"] = m.readback_ms;
+    d["rays"] = m.rays;
+    d["traces"] = m.traces;
+    d["rays_per_second"] = m.rays_per_second();
+    d["gas_bytes"] = m.gas_bytes;
+    d["peak_device_bytes"] = m.peak_device_bytes;
+    d["pool_reserved_bytes"] = m.pool_reserved_bytes;
+    return d;
+}
 
-        std::vector<float> results;
+// One-shot scene + trace on a temporary engine
+template <typename Engine>
+py::object analyze_once(Engine &engine, const MeshView &scene, const FloatArray &face_centroids,
+                        const FloatArray &face_normals, const FloatArray &sun_directions,
+                        float ray_offset, bool output_visibility, const py::object &sun_weights,
+                        bool return_metrics)
+{
+    {
+        py::gil_scoped_release release;
+        engine.set_scene(scene);
+    }
+    py::object traced = trace_numpy(engine, face_centroids, face_normals, sun_directions, ray_offset,
+                                    output_visibility, sun_weights, py::none(), 1, true, 0.0f);
+    if (!return_metrics)
+        return traced;
 
-        // Use safe wrapper instead of direct OptiX call
-        safe_gpu_solar_analysis(centroids, normals, triangles, sun_dirs, results, ray_offset);
+    py::dict d;
+    if (output_visibility)
+    {
+        py::tuple pair = traced.cast<py::tuple>();
+        d["results"] = pair[0];
+        d["visibility"] = pair[1];
+    }
+    else
+    {
+        d["results"] = traced;
+        d["visibility"] = py::none();
+    }
+    d["metrics"] = engine_metrics_dict(engine.metrics());
+    return d;
+}
 
-        // Convert results back to numpy
-        py::array_t<float> py_results({static_cast<py::ssize_t>(results.size())});
-        auto r = py_results.mutable_unchecked<1>();
-        for (size_t i = 0; i < results.size(); i++)
+// One-shot scene + batched trace
+py::list solar_analysis_batch_optix(FloatArray scene_triangles, const py::sequence &targets,
+                                    const py::sequence &sun_sets, float ray_offset,
+                                    const py::object &scenarios, std::vector<int> devices)
+{
+    IndexArray no_indices;
+    MeshView scene = numpy_to_mesh_view(scene_triangles, py::none(), no_indices);
+
+    auto run = [&](auto &engine)
+    {
+        {
+            py::gil_scoped_release release;
+            engine.set_scene(scene);
+        }
+        return trace_batch_numpy(engine, targets, sun_sets, ray_offset, scenarios);
+    };
+
+    if (devices.size() > 1)
+    {
+        MultiDeviceEngine engine(devices);
+        return run(engine);
+    }
+    SolarEngine engine(devices.empty() ? 0 : devices.front());
+    return run(engine);
+}
+
+py::object solar_analysis_optix(
+    FloatArray face_centroids,
+    FloatArray face_normals,
+    FloatArray scene_triangles,
+    FloatArray sun_directions,
+    float ray_offset,
+    std::vector<int> devices,
+    bool output_visibility,
+    py::object sun_weights,
+    bool return_metrics)
+{
+    try
+    {
+        SOBA_LOG(LOG_DEBUG) << "C++: Starting solar_analysis_optix..." << std::endl;
+
+        // One-shot engine over the caller's buffers (no host-side conversion)
+        IndexArray no_indices;
+        MeshView scene = numpy_to_mesh_view(scene_triangles, py::none(), no_indices);
+
+        py::object py_results;
+        if (devices.size() > 1)
+        {
+            MultiDeviceEngine engine(devices);
+            py_results = analyze_once(engine, scene, face_centroids, face_normals, sun_directions, ray_offset,
+                                      output_visibility, sun_weights, return_metrics);
+        }
+        else
         {
-            r(i) = results[i];
+            SolarEngine engine(devices.empty() ? 0 : devices.front());
+            py_results = analyze_once(engine, scene, face_centroids, face_normals, sun_directions, ray_offset,
+                                      output_visibility, sun_weights, return_metrics);
         }
 
-        std::cout << "C++: Analysis complete, returning results" << std::endl;
+        SOBA_LOG(LOG_DEBUG) << "C++: Analysis complete, returning results" << std::endl;
         return py_results;
     }
+    catch (const CudaError &)
+    {
+        throw; // Typed for Python (solar_engine_optix.CudaError / CudaOutOfMemory)
+    }
+    catch (const OptixError &)
+    {
+        throw;
+    }
     catch (const std::exception &e)
     {
-        std::cout << "C++: Exception: " << e.what() << std::endl;
+        std::cerr << "C++: Exception: " << e.what() << std::endl;
         throw py::value_error(std::string("Solar analysis failed: ") + e.what());
     }
 }
 
+// Scene and trace methods shared by SolarEngine and MultiDeviceEngine
+template <typename Engine>
+void bind_scene_api(py::class_<Engine> &cls)
+{
+    cls.def("set_scene", [](Engine &engine, FloatArray scene_vertices, py::object indices)
+             {
+                 IndexArray index_storage;
+                 MeshView mesh = numpy_to_mesh_view(scene_vertices, indices, index_storage);
+                 py::gil_scoped_release release;
+                 engine.set_scene(mesh); },
+             "Build the occluder scene from (N, 3, 3) triangles or (V, 3) points + (M, 3) indices",
+             py::arg("scene_triangles"),
+             py::arg("indices") = py::none())
+        .def("trace", &trace_numpy<Engine>,
+             "Trace target faces against the current scene; output_visibility also "
+             "returns the bit-packed (faces, ceil(suns / 32)) uint32 visibility matrix. "
+             "sun_weights (one per sun) turns counts into sum(weight * cos(incidence)). "
+             "face_vertices (faces, 3, 3) with samples_per_face = k * k traces from k x k "
+             "stratified points per triangle and returns lit fractions. cull drops suns below the "
+             "horizon and skips back-facing face groups / sun slices before the launch. "
+             "adaptive_tolerance_deg > 0 (time-ordered suns) traces suns that far apart first and "
+             "refines only faces whose visibility flips between them",
+             py::arg("face_centroids"),
+             py::arg("face_normals"),
+             py::arg("sun_directions"),
+             py::arg("ray_offset"),
+             py::arg("output_visibility") = false,
+             py::arg("sun_weights") = py::none(),
+             py::arg("face_vertices") = py::none(),
+             py::arg("samples_per_face") = 1,
+             py::arg("cull") = true,
+             py::arg("adaptive_tolerance_deg") = 0.0f)
+        .def("trace_sky", &trace_sky_numpy<Engine>,
+             "Trace target faces against 145 (Tregenza) or 577 (Reinhart) sky patches weighted "
+             "by a cumulative sky matrix; returns sum(weight * cos(incidence)) per face",
+             py::arg("face_centroids"),
+             py::arg("face_normals"),
+             py::arg("patch_directions"),
+             py::arg("patch_weights"),
+             py::arg("ray_offset"),
+             py::arg("face_vertices") = py::none(),
+             py::arg("samples_per_face") = 1)
+        .def("trace_batch", &trace_batch_numpy<Engine>,
+             "Trace several scenarios in one launch: targets are (face_centroids, face_normals) "
+             "pairs, sun_sets are (N, 3) directions or (directions, weights) pairs. scenarios "
+             "lists (target, sun_set) index pairs (default: every target x every sun set, "
+             "target-major). Returns one result array per scenario",
+             py::arg("targets"),
+             py::arg("sun_sets"),
+             py::arg("ray_offset"),
+             py::arg("scenarios") = py::none())
+        .def("set_sun_path", [](Engine &engine, double latitude, double longitude, double time_zone,
+                                int month_start, int month_end, int day_start, int day_end,
+                                int hour_start, int hour_end, int timestep, py::object hourly_dni)
+             {
+                 const SunPathSpec spec = make_sun_path_spec(latitude, longitude, time_zone, month_start,
+                                                             month_end, day_start, day_end, hour_start,
+                                                             hour_end, timestep);
+                 FloatArray dni_storage;
+                 const float *dni = hourly_dni_view(hourly_dni, dni_storage);
+                 py::gil_scoped_release release;
+                 return engine.set_sun_path(spec, dni); },
+             "Generate the daylit sun vectors of a location and analysis period on the GPU and keep "
+             "them for trace_sun_path; hourly_dni (8760,) adds DNI weights. Returns the sun count",
+             py::arg("latitude"),
+             py::arg("longitude"),
+             py::arg("time_zone"),
+             py::arg("month_start") = 1,
+             py::arg("month_end") = 12,
+             py::arg("day_start") = 1,
+             py::arg("day_end") = 31,
+             py::arg("hour_start") = 0,
+             py::arg("hour_end") = 23,
+             py::arg("timestep") = 1,
+             py::arg("hourly_dni") = py::none())
+        .def("clear_sun_path", &Engine::clear_sun_path)
+        .def("trace_sun_path", &trace_sun_path_numpy<Engine>,
+             "trace() against the sun path from set_sun_path; weighted uses its DNI weights "
+             "(direct radiation in kWh/m2) instead of counting lit suns",
+             py::arg("face_centroids"),
+             py::arg("face_normals"),
+             py::arg("ray_offset"),
+             py::arg("weighted") = false,
+             py::arg("output_visibility") = false,
+             py::arg("face_vertices") = py::none(),
+             py::arg("samples_per_face") = 1,
+             py::arg("cull") = true,
+             py::arg("adaptive_tolerance_deg") = 0.0f)
+        .def_property_readonly("sun_path_count", &Engine::sun_path_count)
+        .def("clear_scene", &Engine::clear_scene,
+             "Remove every mesh and instance")
+        .def("add_mesh", [](Engine &engine, FloatArray vertices, py::object indices, bool allow_update)
+             {
+                 IndexArray index_storage;
+                 MeshView mesh = numpy_to_mesh_view(vertices, indices, index_storage);
+                 py::gil_scoped_release release;
+                 return engine.add_mesh(mesh, allow_update); },
+             "Build a compacted GAS from (N, 3, 3) triangles or (V, 3) points + (M, 3) indices, return its mesh id",
+             py::arg("vertices"),
+             py::arg("indices") = py::none(),
+             py::arg("allow_update") = true)
+        .def("update_mesh", [](Engine &engine, int mesh_id, FloatArray vertices, py::object indices)
+             {
+                 IndexArray index_storage;
+                 MeshView mesh = numpy_to_mesh_view(vertices, indices, index_storage);
+                 py::gil_scoped_release release;
+                 engine.update_mesh(mesh_id, mesh); },
+             "Refit (same topology) or rebuild the GAS of an existing mesh",
+             py::arg("mesh_id"),
+             py::arg("vertices"),
+             py::arg("indices") = py::none())
+        .def("remove_mesh", &Engine::remove_mesh,
+             "Free a mesh and every instance that places it",
+             py::arg("mesh_id"))
+        .def("add_instance", [](Engine &engine, int mesh_id, py::object transform)
+             {
+                 float xform[12];
+                 numpy_to_transform(transform, xform);
+                 return engine.add_instance(mesh_id, xform); },
+             "Place a mesh in the scene (3x4 or 4x4 column-vector transform) and return the instance id",
+             py::arg("mesh_id"),
+             py::arg("transform") = py::none())
+        .def("set_instance_transform", [](Engine &engine, int instance_id, py::object transform)
+             {
+                 float xform[12];
+                 numpy_to_transform(transform, xform);
+                 engine.set_instance_transform(instance_id, xform); },
+             "Move an instance (the IAS is refit on the next trace)",
+             py::arg("instance_id"),
+             py::arg("transform"))
+        .def("remove_instance", &Engine::remove_instance,
+             py::arg("instance_id"))
+        .def_property_readonly("has_scene", &Engine::has_scene)
+        .def_property_readonly("triangle_count", &Engine::triangle_count)
+        .def_property_readonly("mesh_count", &Engine::mesh_count)
+        .def_property_readonly("instance_count", &Engine::instance_count)
+        .def_property_readonly("gas_bytes", &Engine::gas_bytes)
+        .def_property_readonly("gas_uncompacted_bytes", &Engine::gas_uncompacted_bytes)
+        .def_property_readonly("gas_cache_stats", [](const Engine &engine)
+                               { return gas_cache_stats_dict(engine.gas_cache_stats()); },
+                               "GAS cache hits / disk_hits / misses / evictions / disk_writes, entries "
+                               "and VRAM bytes held")
+        .def_property_readonly("metrics", [](const Engine &engine)
+                               { return engine_metrics_dict(engine.metrics()); },
+                               "Cumulative GPU time (ms) of module / gas_build / upload / trace / readback, "
+                               "rays and traces, rays_per_second, gas_bytes, peak_device_bytes and pool_reserved_bytes")
+        .def("reset_metrics", &Engine::reset_metrics, "Zero the cumulative metrics");
+}
+
 PYBIND11_MODULE(solar_engine_optix, m)
 {
     m.doc() = "OptiX-accelerated solar analysis engine for architectural visualization";
 
+    // GPU failures raise these instead of ending the process. CudaOutOfMemory
+    // leaves the engine usable; after other errors the CUDA context may not be
+    // (translators registered later are tried first, so the subclass wins)
+    auto &cuda_error = py::register_exception<CudaError>(m, "CudaError", PyExc_RuntimeError);
+    py::register_exception<CudaOutOfMemory>(m, "CudaOutOfMemory", cuda_error);
+    py::register_exception<OptixError>(m, "OptixError", PyExc_RuntimeError);
+
     m.def("analyze", &solar_analysis_optix,
-          "Run solar analysis using OptiX ray tracing",
+          "Run solar analysis using OptiX ray tracing. return_metrics returns a dict of "
+          "results, visibility (or None) and the engine metrics instead",
           py::arg("face_centroids"),
           py::arg("face_normals"),
           py::arg("scene_triangles"),
           py::arg("sun_directions"),
-          py::arg("ray_offset"));
+          py::arg("ray_offset"),
+          py::arg("devices") = std::vector<int>{0},
+          py::arg("output_visibility") = false,
+          py::arg("sun_weights") = py::none(),
+          py::arg("return_metrics") = false);
+
+    m.def("analyze_batch", &solar_analysis_batch_optix,
+          "Build the scene once and trace many target / sun set scenarios in one launch "
+          "(see SolarEngine.trace_batch); returns one result array per scenario",
+          py::arg("scene_triangles"),
+          py::arg("targets"),
+          py::arg("sun_sets"),
+          py::arg("ray_offset"),
+          py::arg("scenarios") = py::none(),
+          py::arg("devices") = std::vector<int>{0});
+
+    m.def("device_count", &cuda_device_count, "Number of visible CUDA devices");
+
+    m.def("set_log_level", &set_log_level,
+          "Engine stdout verbosity: 0 = quiet, 1 = per-call summaries (default), 2 = per-tile / "
+          "per-mesh detail. Errors always go to stderr",
+          py::arg("level"));
+    m.def("log_level", []()
+          { return soba_log_level.load(); }, "Current engine stdout verbosity");
+
+    m.def("configure_optix_cache", &set_optix_cache_dir,
+          "Disk cache directory for compiled OptiX modules of engines created from now on "
+          "(empty = OptiX default location)",
+          py::arg("cache_dir"));
+
+    m.def("configure_gas_cache", &set_gas_cache_defaults,
+          "GAS cache for engines created from now on: VRAM budget (bytes) for compacted GAS kept "
+          "after their meshes are removed, and an optional directory for relocatable copies "
+          "shared across processes. Zero budget and empty directory turn it off",
+          py::arg("vram_budget_bytes"),
+          py::arg("disk_dir") = std::string());
+
+    m.def("configure_memory_pool", &set_memory_pool_defaults,
+          "Device memory pool for engines created from now on: per-job trace buffers and GAS / IAS "
+          "build scratch are reused across jobs, keeping up to release_threshold_bytes of idle VRAM "
+          "reserved. Disabled = cudaMalloc / cudaFree per buffer",
+          py::arg("enabled") = true,
+          py::arg("release_threshold_bytes") = size_t(1) << 30);
+
+    m.def("sun_path", &sun_path_numpy,
+          "Daylit sun vectors of a location and analysis period (NOAA solar position, computed "
+          "on the GPU); returns (suns (N, 3), weights (N,) or None without hourly_dni)",
+          py::arg("latitude"),
+          py::arg("longitude"),
+          py::arg("time_zone"),
+          py::arg("month_start") = 1,
+          py::arg("month_end") = 12,
+          py::arg("day_start") = 1,
+          py::arg("day_end") = 31,
+          py::arg("hour_start") = 0,
+          py::arg("hour_end") = 23,
+          py::arg("timestep") = 1,
+          py::arg("hourly_dni") = py::none(),
+          py::arg("device") = 0);
+
+    // Far-field level of detail (lod.h); angles in degrees
+    m.def("lod_cell", [](FloatArray vertices, py::object transform, FloatArray target_bounds, float min_distance,
+                         float max_angle_deg)
+          {
+              size_t vertex_count = 0;
+              const float3 *points = float3_view(vertices, "points", vertex_count);
+              float xform[12];
+              numpy_to_transform(transform, xform);
+              return lod_instance_cell(MeshView(points, vertex_count, nullptr, 0), xform,
+                                       numpy_to_bounds(target_bounds),
+                                       make_lod_settings(min_distance, max_angle_deg)); },
+          "Local-space clustering cell of a mesh placed by transform, for its distance from the "
+          "target bounds ((2, 3) [min, max]); 0 keeps it at full resolution",
+          py::arg("points"),
+          py::arg("transform"),
+          py::arg("target_bounds"),
+          py::arg("min_distance"),
+          py::arg("max_angle_deg"));
+
+    m.def("lod_cluster_mesh", [](FloatArray vertices, py::object indices, float cell)
+          {
+              IndexArray index_storage;
+              MeshView mesh = numpy_to_mesh_view(vertices, indices, index_storage);
+              LodMesh out;
+              LodStats stats;
+              {
+                  py::gil_scoped_release release;
+                  cluster_mesh(mesh, cell, out, &stats);
+              }
+              return lod_mesh_to_numpy(out, stats); },
+          "Vertex-cluster a mesh at cell (see lod_cell); returns (points, indices, stats)",
+          py::arg("vertices"),
+          py::arg("indices") = py::none(),
+          py::arg("cell"));
+
+    m.def("lod_simplify_scene", [](FloatArray vertices, py::object indices, FloatArray target_bounds,
+                                   float min_distance, float max_angle_deg)
+          {
+              IndexArray index_storage;
+              MeshView mesh = numpy_to_mesh_view(vertices, indices, index_storage);
+              const Aabb target = numpy_to_bounds(target_bounds);
+              const LodSettings settings = make_lod_settings(min_distance, max_angle_deg);
+              LodMesh out;
+              LodStats stats;
+              {
+                  py::gil_scoped_release release;
+                  simplify_far_field(mesh, target, settings, out, &stats);
+              }
+              return lod_mesh_to_numpy(out, stats); },
+          "Proxy of an identity-placed scene: triangles beyond min_distance from the target bounds "
+          "are vertex-clustered so no vertex moves by more than max_angle_deg as seen from the "
+          "target; returns (points, indices, stats)",
+          py::arg("vertices"),
+          py::arg("indices") = py::none(),
+          py::arg("target_bounds"),
+          py::arg("min_distance"),
+          py::arg("max_angle_deg"));
+
+    // Persistent engine: pipeline lives as long as the Python object,
+    // the GAS as long as the scene is unchanged
+    py::class_<SolarEngine> solar_engine(m, "SolarEngine");
+    solar_engine.def(py::init<int, bool>(),
+                     "Create the OptiX context and pipeline on device_id. pinned_staging routes "
+                     "uploads through a double-buffered pinned host buffer",
+                     py::arg("device_id") = 0,
+                     py::arg("pinned_staging") = false)
+        .def_property_readonly("device", &SolarEngine::device);
+    bind_scene_api(solar_engine);
+
+    // Same interface, scene replicated on every device and faces split between them
+    py::class_<MultiDeviceEngine> multi_engine(m, "MultiDeviceEngine");
+    multi_engine.def(py::init<const std::vector<int> &, bool>(),
+                     "Create one engine per CUDA device in devices",
+                     py::arg("devices"),
+                     py::arg("pinned_staging") = false)
+        .def_property_readonly("devices", &MultiDeviceEngine::devices)
+        .def_property_readonly("last_trace_stats", [](const MultiDeviceEngine &engine)
+                               {
+                                   py::list stats;
+                                   for (const auto &st : engine.last_trace_stats())
+                                   {
+                                       py::dict d;
+                                       d["device"] = st.device;
+                                       d["face_offset"] = st.face_offset;
+                                       d["face_count"] = st.face_count;
+                                       d["trace_ms"] = st.trace_ms;
+                                       d["rays_per_second"] = st.rays_per_second;
+                                       d["efficiency"] = st.efficiency;
+                                       stats.append(d);
+                                   }
+                                   return stats; },
+                               "Per-device faces, time, rays/s and efficiency of the last trace");
+    bind_scene_api(multi_engine);
 
     // Version info
     m.attr("__version__") = "1.0.0";
     m.attr("has_optix") = true;
-}
\ No newline at end of file
+}
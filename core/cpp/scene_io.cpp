@@ -0,0 +1,189 @@
+#include "scene_io.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <limits>
+#include <stdexcept>
+
+constexpr uint16_t SCENE_FILE_VERSION = 1;
+constexpr uint16_t SUN_FILE_VERSION = 1;
+constexpr uint16_t SOBR_VERSION = 1;
+
+namespace
+{
+std::vector<char> read_file(const std::string &path)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+        throw std::runtime_error("cannot read " + path);
+    return std::vector<char>(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+// Sequential little-endian reads over a file's bytes, every read bounds checked
+class Reader
+{
+public:
+    Reader(const std::vector<char> &data, const std::string &path) : data_(data), path_(path) {}
+
+    template <typename T>
+    T value()
+    {
+        T v;
+        std::memcpy(&v, take(sizeof(T)), sizeof(T));
+        return v;
+    }
+
+    template <typename T>
+    void array(std::vector<T> &out, uint64_t count)
+    {
+        if (count > (data_.size() - offset_) / sizeof(T))
+            fail("truncated");
+        out.resize(static_cast<size_t>(count));
+        std::memcpy(out.data(), take(out.size() * sizeof(T)), out.size() * sizeof(T));
+    }
+
+    void expect_magic(const char *magic)
+    {
+        if (std::memcmp(take(4), magic, 4) != 0)
+            fail(std::string("not a ") + magic + " file");
+    }
+
+    void expect_end() const
+    {
+        if (offset_ != data_.size())
+            fail("unexpected trailing bytes");
+    }
+
+    [[noreturn]] void fail(const std::string &what) const { throw std::runtime_error(path_ + ": " + what); }
+
+private:
+    const char *take(size_t bytes)
+    {
+        if (bytes > data_.size() - offset_)
+            fail("truncated");
+        const char *p = data_.data() + offset_;
+        offset_ += bytes;
+        return p;
+    }
+
+    const std::vector<char> &data_;
+    const std::string &path_;
+    size_t offset_ = 0;
+};
+
+template <typename T>
+void put(std::vector<char> &out, T v)
+{
+    const char *p = reinterpret_cast<const char *>(&v);
+    out.insert(out.end(), p, p + sizeof(T));
+}
+} // namespace
+
+SceneFile read_scene_file(const std::string &path)
+{
+    const std::vector<char> data = read_file(path);
+    Reader in(data, path);
+    in.expect_magic("SOBS");
+    if (in.value<uint16_t>() != SCENE_FILE_VERSION)
+        in.fail("unsupported SOBS version");
+    const uint16_t flags = in.value<uint16_t>();
+    const uint64_t faces = in.value<uint64_t>();
+    const uint64_t vertices = in.value<uint64_t>();
+    const uint64_t triangles = in.value<uint64_t>();
+
+    SceneFile scene;
+    scene.ray_offset = in.value<float>();
+    in.value<uint32_t>(); // Reserved
+    in.array(scene.centroids, faces);
+    in.array(scene.normals, faces);
+    in.array(scene.vertices, vertices);
+    if (flags & 1)
+    {
+        in.array(scene.indices, triangles);
+        for (const uint3 &t : scene.indices)
+            if (std::max({t.x, t.y, t.z}) >= vertices)
+                in.fail("triangle index out of range");
+    }
+    else if (vertices != triangles * 3)
+    {
+        in.fail("unindexed context needs 3 vertices per triangle");
+    }
+    in.expect_end();
+    return scene;
+}
+
+SunFile read_sun_file(const std::string &path)
+{
+    const std::vector<char> data = read_file(path);
+    Reader in(data, path);
+    in.expect_magic("SOBU");
+    if (in.value<uint16_t>() != SUN_FILE_VERSION)
+        in.fail("unsupported SOBU version");
+
+    SunFile suns;
+    suns.mode = in.value<uint8_t>();
+    const uint8_t flags = in.value<uint8_t>();
+    const uint64_t count = in.value<uint64_t>();
+    if (suns.mode > SUN_FILE_SKY)
+        in.fail("unknown sun file mode " + std::to_string(suns.mode));
+    if (suns.mode != SUN_FILE_HOURS && !(flags & 1))
+        in.fail("radiation and sky sun files need weights");
+    if (suns.mode == SUN_FILE_HOURS && (flags & 1))
+        in.fail("sun hours files take no weights");
+
+    in.array(suns.directions, count);
+    if (flags & 1)
+        in.array(suns.weights, count);
+    in.expect_end();
+    return suns;
+}
+
+const char *sun_file_result_name(int mode)
+{
+    switch (mode)
+    {
+    case SUN_FILE_RADIATION:
+        return "solar:directRadiation";
+    case SUN_FILE_SKY:
+        return "solar:radiation";
+    default:
+        return "solar:sunHours";
+    }
+}
+
+void write_sobr_file(const std::string &path, const float *results, size_t count, const std::string &result_name)
+{
+    if (result_name.size() > std::numeric_limits<uint16_t>::max())
+        throw std::runtime_error("SOBR result name too long");
+
+    float lo = 0.0f, hi = 0.0f;
+    if (count)
+    {
+        lo = *std::min_element(results, results + count);
+        hi = *std::max_element(results, results + count);
+    }
+
+    // Header as results_codec.HEADER: "<4sHBBQIHHff", dtype float32, no compression, no visibility
+    std::vector<char> out;
+    out.reserve(32 + result_name.size());
+    out.insert(out.end(), {'S', 'O', 'B', 'R'});
+    put<uint16_t>(out, SOBR_VERSION);
+    put<uint8_t>(out, 0);
+    put<uint8_t>(out, 0);
+    put<uint64_t>(out, count);
+    put<uint32_t>(out, 0);
+    put<uint16_t>(out, static_cast<uint16_t>(result_name.size()));
+    put<uint16_t>(out, 0);
+    put<float>(out, lo);
+    put<float>(out, hi);
+    out.insert(out.end(), result_name.begin(), result_name.end());
+
+    std::ofstream file(path, std::ios::binary);
+    if (!file)
+        throw std::runtime_error("cannot write " + path);
+    file.write(out.data(), static_cast<std::streamsize>(out.size()));
+    file.write(reinterpret_cast<const char *>(results), static_cast<std::streamsize>(count * sizeof(float)));
+    if (!file)
+        throw std::runtime_error("failed writing " + path);
+}
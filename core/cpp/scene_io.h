@@ -0,0 +1,62 @@
+#pragma once
+#include <cuda_runtime.h>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "optix_solar.h" // MeshView
+
+// Binary job inputs of the soba CLI, written by core/python/scene_files.py,
+// and its SOBR output (core/python/results_codec.py). Little-endian; float32 /
+// uint32 arrays follow the fixed header with no padding.
+//
+// SOBS scene, 40-byte header: magic "SOBS", u16 version, u16 flags (bit 0 =
+// indexed context), u64 face count, u64 context vertex count, u64 context
+// triangle count, f32 ray offset, u32 reserved. Then face centroids and
+// normals (faces x 3 floats each), context vertices (vertices x 3 floats) and,
+// when indexed, triangle indices (triangles x 3 uint32). Unindexed contexts
+// hold 3 vertices per triangle.
+//
+// SOBU suns, 16-byte header: magic "SOBU", u16 version, u8 mode (SunFileMode),
+// u8 flags (bit 0 = weights), u64 count. Then directions (count x 3 floats,
+// pointing down like sun vectors) and, when weighted, count weights. Sun hours
+// files are unweighted, radiation and sky files weighted.
+
+enum SunFileMode
+{
+    SUN_FILE_HOURS = 0,     // Lit-sun counts
+    SUN_FILE_RADIATION = 1, // Sun vectors with DNI weights: direct radiation (kWh/m2)
+    SUN_FILE_SKY = 2        // 145 / 577 sky patches with sky matrix weights (trace_sky)
+};
+
+struct SceneFile
+{
+    std::vector<float3> centroids; // Target faces
+    std::vector<float3> normals;
+    std::vector<float3> vertices; // Context occluders
+    std::vector<uint3> indices;   // Empty: 3 vertices per triangle
+    float ray_offset = 0.0f;
+
+    MeshView context() const
+    {
+        return MeshView(vertices.data(), vertices.size(), indices.empty() ? nullptr : indices.data(),
+                        indices.empty() ? vertices.size() / 3 : indices.size());
+    }
+};
+
+struct SunFile
+{
+    int mode = SUN_FILE_HOURS;
+    std::vector<float3> directions;
+    std::vector<float> weights; // Empty for sun hours
+};
+
+// Both throw std::runtime_error naming the file on a bad magic, version or size
+SceneFile read_scene_file(const std::string &path);
+SunFile read_sun_file(const std::string &path);
+
+// Result primvar of a sun file mode, as pipeline.result_name
+const char *sun_file_result_name(int mode);
+
+// Uncompressed float32 SOBR, readable by results_codec.read
+void write_sobr_file(const std::string &path, const float *results, size_t count, const std::string &result_name);
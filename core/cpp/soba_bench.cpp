@@ -0,0 +1,551 @@
+// soba_bench: repeatable native timings of the solar engine on a synthetic city.
+//
+// Builds a grid of subdivided boxes and a random sun set, then per iteration
+// times pipeline init, GAS/IAS build, input upload, tracing (launches only)
+// and one result readback on their own; with --cull 1 also the host side of a
+// culled trace (face / sun ordering, work items and the scatter back). The
+// summary is written as JSON (stdout, or --out), engine logs go to stderr.
+//
+//   soba_bench --boxes 400 --triangles 1000000 --faces 100000 --suns 4380 --iterations 5
+//
+// With --lod-angle the city is replaced by its far-field proxy (lod.h) around
+// the target faces, and one extra full-resolution pass measures the error.
+
+#include "optix_solar.h"
+#include "error_check.h"
+#include "device_buffer.h"
+#include "culling.h"
+#include "lod.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <exception>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace
+{
+constexpr double PI = 3.14159265358979323846;
+
+struct BenchConfig
+{
+    int boxes = 400;
+    size_t triangles = 1000000; // City size; boxes are subdivided to roughly match
+    size_t faces = 100000;      // Target faces, the first triangles of the city
+    size_t suns = 4380;
+    int samples = 1;
+    int iterations = 5;
+    int warmup = 1;
+    int device = 0;
+    unsigned seed = 1;
+    float ray_offset = 0.01f;
+    bool cull = true; // As a culled SolarEngine trace (TraceOptions::cull)
+    float lod_angle = 0.0f;      // Degrees, far-field LOD of the city (0 = full resolution)
+    float lod_distance = 100.0f; // LOD near field around the target faces
+    std::string out;
+};
+
+struct City
+{
+    std::vector<float3> vertices;
+    std::vector<uint3> indices;
+    int subdivisions = 1;
+};
+
+struct Targets
+{
+    std::vector<float3> centroids;
+    std::vector<float3> normals;
+    std::vector<float3> face_vertices; // 3 per face
+};
+
+void usage()
+{
+    std::cerr << "usage: soba_bench [--boxes N] [--triangles M] [--faces F] [--suns S]\n"
+                 "                  [--samples K] [--iterations I] [--warmup W] [--device D]\n"
+                 "                  [--seed X] [--ray-offset R] [--cull 0|1]\n"
+                 "                  [--lod-angle DEG] [--lod-distance M] [--out FILE]\n";
+}
+
+BenchConfig parse_args(int argc, char **argv)
+{
+    BenchConfig config;
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string arg = argv[i];
+        if (arg == "--help" || arg == "-h")
+        {
+            usage();
+            std::exit(0);
+        }
+        if (i + 1 >= argc)
+            throw std::invalid_argument("missing value for " + arg);
+        const std::string value = argv[++i];
+        if (arg == "--boxes")
+            config.boxes = std::stoi(value);
+        else if (arg == "--triangles")
+            config.triangles = std::stoull(value);
+        else if (arg == "--faces")
+            config.faces = std::stoull(value);
+        else if (arg == "--suns")
+            config.suns = std::stoull(value);
+        else if (arg == "--samples")
+            config.samples = std::stoi(value);
+        else if (arg == "--iterations")
+            config.iterations = std::stoi(value);
+        else if (arg == "--warmup")
+            config.warmup = std::stoi(value);
+        else if (arg == "--device")
+            config.device = std::stoi(value);
+        else if (arg == "--seed")
+            config.seed = static_cast<unsigned>(std::stoul(value));
+        else if (arg == "--ray-offset")
+            config.ray_offset = std::stof(value);
+        else if (arg == "--cull")
+            config.cull = std::stoi(value) != 0;
+        else if (arg == "--lod-angle")
+            config.lod_angle = std::stof(value);
+        else if (arg == "--lod-distance")
+            config.lod_distance = std::stof(value);
+        else if (arg == "--out")
+            config.out = value;
+        else
+            throw std::invalid_argument("unknown option " + arg);
+    }
+    if (config.boxes < 1 || config.iterations < 1 || config.warmup < 0 || config.suns == 0)
+        throw std::invalid_argument("boxes, iterations and suns must be positive");
+    return config;
+}
+
+float3 operator+(float3 a, float3 b) { return make_float3(a.x + b.x, a.y + b.y, a.z + b.z); }
+float3 operator-(float3 a, float3 b) { return make_float3(a.x - b.x, a.y - b.y, a.z - b.z); }
+float3 operator*(float3 a, float s) { return make_float3(a.x * s, a.y * s, a.z * s); }
+
+float3 cross(float3 a, float3 b)
+{
+    return make_float3(a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x);
+}
+
+float3 normalize(float3 v)
+{
+    const float length = std::sqrt(v.x * v.x + v.y * v.y + v.z * v.z);
+    return length > 0.0f ? v * (1.0f / length) : v;
+}
+
+// One box side as a k x k grid of quads (2 triangles each). u x v points out.
+void add_box_side(City &city, float3 origin, float3 u, float3 v)
+{
+    const int k = city.subdivisions;
+    const unsigned base = static_cast<unsigned>(city.vertices.size());
+    for (int j = 0; j <= k; ++j)
+        for (int i = 0; i <= k; ++i)
+            city.vertices.push_back(origin + u * (float(i) / k) + v * (float(j) / k));
+
+    for (int j = 0; j < k; ++j)
+        for (int i = 0; i < k; ++i)
+        {
+            const unsigned a = base + j * (k + 1) + i;
+            const unsigned b = a + 1;
+            const unsigned c = b + (k + 1);
+            const unsigned d = a + (k + 1);
+            city.indices.push_back(make_uint3(a, b, c));
+            city.indices.push_back(make_uint3(a, c, d));
+        }
+}
+
+// Boxes of random footprint and height on a square grid of 30 m lots
+City make_city(const BenchConfig &config, std::mt19937 &rng)
+{
+    City city;
+    const double per_box = double(config.triangles) / config.boxes;
+    city.subdivisions = std::max(1, static_cast<int>(std::lround(std::sqrt(per_box / 12.0))));
+
+    const int columns = static_cast<int>(std::ceil(std::sqrt(double(config.boxes))));
+    std::uniform_real_distribution<float> footprint(10.0f, 20.0f);
+    std::uniform_real_distribution<float> height(10.0f, 100.0f);
+    const size_t box_triangles = 12ull * city.subdivisions * city.subdivisions;
+    city.indices.reserve(box_triangles * config.boxes);
+    city.vertices.reserve(6ull * (city.subdivisions + 1) * (city.subdivisions + 1) * config.boxes);
+
+    for (int box = 0; box < config.boxes; ++box)
+    {
+        const float x = 30.0f * (box % columns);
+        const float y = 30.0f * (box / columns);
+        const float sx = footprint(rng), sy = footprint(rng), h = height(rng);
+        const float3 zero = make_float3(0, 0, 0);
+        const float3 dx = make_float3(sx, 0, 0), dy = make_float3(0, sy, 0), dz = make_float3(0, 0, h);
+        add_box_side(city, make_float3(x, y, h), dx, dy);                      // +z
+        add_box_side(city, make_float3(x, y, 0), dy, dx);                      // -z
+        add_box_side(city, make_float3(x, y, 0), dx, dz);                      // -y
+        add_box_side(city, make_float3(x + sx, y + sy, 0), zero - dx, dz);     // +y
+        add_box_side(city, make_float3(x, y + sy, 0), zero - dy, dz);          // -x
+        add_box_side(city, make_float3(x + sx, y, 0), dy, dz);                 // +x
+    }
+    return city;
+}
+
+Targets make_targets(const City &city, size_t face_count)
+{
+    Targets targets;
+    targets.centroids.reserve(face_count);
+    targets.normals.reserve(face_count);
+    targets.face_vertices.reserve(face_count * 3);
+    for (size_t f = 0; f < face_count; ++f)
+    {
+        const uint3 tri = city.indices[f];
+        const float3 a = city.vertices[tri.x], b = city.vertices[tri.y], c = city.vertices[tri.z];
+        targets.centroids.push_back((a + b + c) * (1.0f / 3.0f));
+        targets.normals.push_back(normalize(cross(b - a, c - a)));
+        targets.face_vertices.push_back(a);
+        targets.face_vertices.push_back(b);
+        targets.face_vertices.push_back(c);
+    }
+    return targets;
+}
+
+// Sun vectors pointing down (sun -> ground), elevations 5..85 degrees
+std::vector<float3> make_suns(size_t count, std::mt19937 &rng)
+{
+    std::uniform_real_distribution<double> azimuth(0.0, 2.0 * PI);
+    std::uniform_real_distribution<double> elevation(5.0 * PI / 180.0, 85.0 * PI / 180.0);
+    std::vector<float3> suns(count);
+    for (float3 &sun : suns)
+    {
+        const double az = azimuth(rng), el = elevation(rng);
+        sun = make_float3(float(-std::cos(el) * std::sin(az)), float(-std::cos(el) * std::cos(az)),
+                          float(-std::sin(el)));
+    }
+    return suns;
+}
+
+double elapsed_ms(std::chrono::high_resolution_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+struct PhaseTimes
+{
+    const char *name;
+    std::vector<double> ms;
+
+    double min() const { return *std::min_element(ms.begin(), ms.end()); }
+    double mean() const
+    {
+        double sum = 0.0;
+        for (double t : ms)
+            sum += t;
+        return sum / ms.size();
+    }
+    double median() const
+    {
+        std::vector<double> sorted = ms;
+        std::sort(sorted.begin(), sorted.end());
+        const size_t mid = sorted.size() / 2;
+        return sorted.size() % 2 ? sorted[mid] : 0.5 * (sorted[mid - 1] + sorted[mid]);
+    }
+};
+
+// Far-field proxy of the city and its error against a full-resolution pass
+struct LodReport
+{
+    LodStats stats;
+    size_t reference_gas_bytes = 0;
+    double reference_gas_build_ms = 0.0;
+    double max_abs_error = 0.0;  // Lit suns (weighted: result units) of the worst face
+    double mean_abs_error = 0.0; // Over all faces
+    size_t faces_changed = 0;
+};
+
+void write_json(std::ostream &out, const BenchConfig &config, const City &city, size_t faces,
+                const char *device_name, const std::vector<PhaseTimes> &phases, size_t gas_bytes,
+                size_t traced_suns, double checksum, const LodReport *lod)
+{
+    // As launched: a culled run traces only the suns above the horizon
+    const unsigned long long rays = static_cast<unsigned long long>(faces) * traced_suns * config.samples;
+    const PhaseTimes &trace = phases[3];
+
+    out << std::fixed << std::setprecision(3);
+    out << "{\n";
+    out << "  \"config\": {\"boxes\": " << config.boxes << ", \"triangles\": " << city.indices.size()
+        << ", \"subdivisions\": " << city.subdivisions << ", \"faces\": " << faces
+        << ", \"suns\": " << config.suns << ", \"traced_suns\": " << traced_suns << ", \"samples\": " << config.samples
+        << ", \"iterations\": " << config.iterations << ", \"warmup\": " << config.warmup
+        << ", \"seed\": " << config.seed << ", \"cull\": " << (config.cull ? "true" : "false") << "},\n";
+    out << "  \"device\": {\"id\": " << config.device << ", \"name\": \"" << device_name << "\"},\n";
+    out << "  \"phases\": {\n";
+    for (size_t i = 0; i < phases.size(); ++i)
+    {
+        const PhaseTimes &phase = phases[i];
+        out << "    \"" << phase.name << "\": {\"min_ms\": " << phase.min() << ", \"median_ms\": "
+            << phase.median() << ", \"mean_ms\": " << phase.mean() << "}"
+            << (i + 1 < phases.size() ? ",\n" : "\n");
+    }
+    out << "  },\n";
+    out << "  \"rays\": " << rays << ",\n";
+    out << "  \"rays_per_sec\": " << std::setprecision(0) << rays / (trace.median() * 1e-3) << ",\n";
+    out << "  \"gas_bytes\": " << gas_bytes << ",\n";
+    out << "  \"tiles\": " << plan_trace_tiles(faces, traced_suns).size() << ",\n";
+    if (lod)
+    {
+        out << std::setprecision(3);
+        out << "  \"lod\": {\"max_angle_deg\": " << config.lod_angle << ", \"min_distance\": " << config.lod_distance
+            << ", \"triangles_in\": " << lod->stats.triangles_in << ", \"triangles_out\": "
+            << lod->stats.triangles_out << ", \"max_displacement\": " << lod->stats.max_displacement
+            << ", \"reference_gas_bytes\": " << lod->reference_gas_bytes << ", \"reference_gas_build_ms\": "
+            << lod->reference_gas_build_ms << std::setprecision(6) << ", \"max_abs_error\": " << lod->max_abs_error
+            << ", \"mean_abs_error\": " << lod->mean_abs_error << ", \"faces_changed\": " << lod->faces_changed
+            << "},\n";
+    }
+    out << "  \"checksum\": " << std::setprecision(3) << checksum << "\n";
+    out << "}\n";
+}
+
+// Phases of one pass, in PhaseTimes order
+constexpr int PHASE_COUNT = 6;
+
+// One pass over mesh: pipeline init, GAS / IAS build, upload, trace, readback
+// and (culled) host reordering and work items, timed into ms; every device
+// resource is released on return. results come back in the caller's face
+// order, traced_suns is the sun count the launches ran with.
+void bench_pass(const BenchConfig &config, const MeshView &mesh, const Targets &targets, size_t faces,
+                const std::vector<float3> &suns, std::vector<float> &results, double ms[PHASE_COUNT],
+                size_t &gas_bytes, size_t &traced_suns)
+{
+    // Pipeline (module from the embedded device code, OptiX disk cache permitting)
+    auto start = std::chrono::high_resolution_clock::now();
+    OptiXSolar optix;
+    optix.device = config.device;
+    create_optix_pipeline(optix);
+    CUDA_CHECK(cudaDeviceSynchronize());
+    ms[0] = elapsed_ms(start);
+
+    // One compacted GAS for the city (no GAS cache) and its IAS
+    start = std::chrono::high_resolution_clock::now();
+    MeshGAS gas;
+    build_mesh_gas(optix, mesh, false, gas);
+    optix.meshes.push_back(gas);
+    SceneInstance instance;
+    instance.mesh_id = 0;
+    instance.alive = true;
+    identity_transform(instance.transform);
+    optix.instances.push_back(instance);
+    optix.ias_rebuild = true;
+    build_ias(optix);
+    CUDA_CHECK(cudaDeviceSynchronize());
+    ms[1] = elapsed_ms(start);
+    gas_bytes = gas.buffer_size;
+
+    // Culled: the host side of trace_culled, faces clustered by normal and suns
+    // above the horizon ordered by direction, on every pass
+    start = std::chrono::high_resolution_clock::now();
+    Targets sorted;
+    std::vector<float3> sorted_suns;
+    std::vector<uint32_t> face_order;
+    const Targets *traced = &targets;
+    const std::vector<float3> *trace_suns = &suns;
+    if (config.cull)
+    {
+        face_order = cluster_directions(targets.normals.data(), faces);
+        const std::vector<uint32_t> sun_order = order_suns(suns.data(), suns.size());
+        gather(targets.centroids.data(), face_order, 1, sorted.centroids);
+        gather(targets.normals.data(), face_order, 1, sorted.normals);
+        if (config.samples > 1)
+            gather(targets.face_vertices.data(), face_order, 3, sorted.face_vertices);
+        gather(suns.data(), sun_order, 1, sorted_suns);
+        traced = &sorted;
+        trace_suns = &sorted_suns;
+    }
+    ms[5] = elapsed_ms(start);
+    const size_t sun_count = trace_suns->size();
+    traced_suns = sun_count;
+
+    start = std::chrono::high_resolution_clock::now();
+    DeviceBuffer<float4> d_centroids(faces), d_normals(faces), d_suns(sun_count);
+    DeviceBuffer<float4> d_face_vertices(config.samples > 1 ? faces * 3 : 0);
+    DeviceBuffer<float> d_results(faces);
+    upload_float4(optix, d_centroids.get(), traced->centroids.data(), faces);
+    upload_float4(optix, d_normals.get(), traced->normals.data(), faces);
+    upload_float4(optix, d_suns.get(), trace_suns->data(), sun_count);
+    if (d_face_vertices)
+        upload_float4(optix, d_face_vertices.get(), traced->face_vertices.data(), faces, 3);
+    CUDA_CHECK(cudaMemset(d_results.get(), 0, d_results.bytes()));
+    CUDA_CHECK(cudaDeviceSynchronize());
+    ms[2] = elapsed_ms(start);
+
+    TraceBuffers buffers;
+    buffers.centroids = d_centroids.get();
+    buffers.normals = d_normals.get();
+    buffers.face_vertices = d_face_vertices.get();
+    buffers.suns = d_suns.get();
+    buffers.results = d_results.get();
+
+    // Culled: the work items of every tile and their upload, before the launches
+    start = std::chrono::high_resolution_clock::now();
+    TraceWorkItems work_items;
+    if (config.cull)
+    {
+        buffers.cull_normals = traced->normals.data();
+        buffers.cull_suns = trace_suns->data();
+        build_trace_work_items(optix, buffers, plan_trace_tiles(faces, sun_count), work_items);
+        buffers.work_items = &work_items;
+    }
+    ms[5] += elapsed_ms(start);
+
+    // All tiles, launches only: no per-tile host copies
+    start = std::chrono::high_resolution_clock::now();
+    if (sun_count)
+        launch_solar_rays(optix, buffers, faces, sun_count, config.ray_offset, config.samples, nullptr);
+    ms[3] = elapsed_ms(start);
+
+    // The full result array, once
+    start = std::chrono::high_resolution_clock::now();
+    std::vector<float> traced_results(faces);
+    CUDA_CHECK(cudaMemcpy(traced_results.data(), d_results.get(), d_results.bytes(), cudaMemcpyDeviceToHost));
+    ms[4] = elapsed_ms(start);
+
+    // Back to the caller's order, as trace_culled does
+    start = std::chrono::high_resolution_clock::now();
+    if (config.cull)
+        for (size_t i = 0; i < faces; i++)
+            results[face_order[i]] = traced_results[i];
+    else
+        results = std::move(traced_results);
+    ms[5] += elapsed_ms(start);
+
+    work_items.items.reset();
+    d_centroids.reset();
+    d_normals.reset();
+    d_suns.reset();
+    d_results.reset();
+    d_face_vertices.reset();
+    cleanup_optix(optix);
+}
+
+int run(const BenchConfig &config, std::ostream &json)
+{
+    if (config.device < 0 || config.device >= cuda_device_count())
+        throw std::out_of_range("invalid CUDA device " + std::to_string(config.device));
+
+    std::mt19937 rng(config.seed);
+    const City city = make_city(config, rng);
+    const size_t faces = std::min(config.faces, city.indices.size());
+    const Targets targets = make_targets(city, faces);
+    const std::vector<float3> suns = make_suns(config.suns, rng);
+    const MeshView mesh(city.vertices.data(), city.vertices.size(), city.indices.data(), city.indices.size());
+    std::cerr << "soba_bench: " << city.indices.size() << " triangles in " << config.boxes << " boxes, "
+              << faces << " faces x " << suns.size() << " suns\n";
+
+    // Far-field proxy around the target faces; the timed passes trace it
+    LodMesh lod_mesh;
+    LodReport lod;
+    MeshView traced_mesh = mesh;
+    if (config.lod_angle > 0.0f)
+    {
+        LodSettings settings;
+        settings.min_distance = config.lod_distance;
+        settings.max_angle = config.lod_angle * 3.14159265358979323846f / 180.0f;
+        const Aabb target = point_bounds(targets.centroids.data(), faces, config.ray_offset);
+        simplify_far_field(mesh, target, settings, lod_mesh, &lod.stats);
+        traced_mesh = lod_mesh.view();
+        std::cerr << "soba_bench: LOD " << lod.stats.triangles_in << " -> " << lod.stats.triangles_out
+                  << " triangles, max displacement " << lod.stats.max_displacement << "\n";
+    }
+
+    DeviceScope scope(config.device);
+    cudaDeviceProp props;
+    CUDA_CHECK(cudaGetDeviceProperties(&props, config.device));
+
+    std::vector<PhaseTimes> phases = {{"init", {}},  {"gas_build", {}}, {"upload", {}},
+                                      {"trace", {}}, {"readback", {}},  {"cull", {}}};
+    std::vector<float> results(faces);
+    size_t gas_bytes = 0, traced_suns = 0;
+    double checksum = 0.0;
+
+    for (int it = 0; it < config.warmup + config.iterations; ++it)
+    {
+        const bool record = it >= config.warmup;
+        double ms[PHASE_COUNT];
+
+        bench_pass(config, traced_mesh, targets, faces, suns, results, ms, gas_bytes, traced_suns);
+
+        checksum = 0.0;
+        for (float r : results)
+            checksum += r;
+
+        std::cerr << "soba_bench: iteration " << it << (record ? "" : " (warmup)") << ": trace " << ms[3]
+                  << " ms\n";
+        if (record)
+            for (int p = 0; p < PHASE_COUNT; ++p)
+                phases[p].ms.push_back(ms[p]);
+    }
+    if (!config.cull)
+        phases.pop_back(); // No host culling work to report
+
+    if (config.lod_angle > 0.0f)
+    {
+        // One untimed full-resolution pass as the reference of the proxy's results
+        std::vector<float> reference(faces);
+        double ms[PHASE_COUNT];
+        size_t reference_suns = 0;
+        bench_pass(config, mesh, targets, faces, suns, reference, ms, lod.reference_gas_bytes, reference_suns);
+        lod.reference_gas_build_ms = ms[1];
+        double total_error = 0.0;
+        for (size_t f = 0; f < faces; f++)
+        {
+            const double error = std::fabs(static_cast<double>(results[f]) - reference[f]);
+            lod.max_abs_error = std::max(lod.max_abs_error, error);
+            total_error += error;
+            lod.faces_changed += error > 0.0;
+        }
+        lod.mean_abs_error = faces ? total_error / faces : 0.0;
+        std::cerr << "soba_bench: LOD error max " << lod.max_abs_error << ", mean " << lod.mean_abs_error << " over "
+                  << lod.faces_changed << " changed faces\n";
+    }
+    const LodReport *lod_report = config.lod_angle > 0.0f ? &lod : nullptr;
+
+    if (config.out.empty())
+        write_json(json, config, city, faces, props.name, phases, gas_bytes, traced_suns, checksum, lod_report);
+    else
+    {
+        std::ofstream file(config.out);
+        if (!file)
+            throw std::runtime_error("cannot write " + config.out);
+        write_json(file, config, city, faces, props.name, phases, gas_bytes, traced_suns, checksum, lod_report);
+    }
+    return 0;
+}
+} // namespace
+
+int main(int argc, char **argv)
+{
+    // Keep stdout for the JSON summary; the engine's progress output goes to stderr
+    std::streambuf *stdout_buf = std::cout.rdbuf(std::cerr.rdbuf());
+    std::ostream json(stdout_buf);
+    int rc = 1;
+    try
+    {
+        rc = run(parse_args(argc, argv), json);
+    }
+    catch (const CudaError &e)
+    {
+        std::cerr << "soba_bench: " << e.what() << std::endl;
+    }
+    catch (const OptixError &e)
+    {
+        std::cerr << "soba_bench: " << e.what() << std::endl;
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "soba_bench: " << e.what() << std::endl;
+        usage();
+    }
+    json.flush();
+    std::cout.rdbuf(stdout_buf);
+    return rc;
+}
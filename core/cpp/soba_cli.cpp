@@ -0,0 +1,328 @@
+// soba: headless batch runs of the solar engine, no Python or server involved.
+//
+// One persistent engine traces every job of a manifest: the pipeline is built
+// once, the scene only when it changes (the GAS cache keeps repeated contexts),
+// and each job's results are written as SOBR. Inputs are the SOBS scene and
+// SOBU sun files of scene_io.h, exported by core/python/scene_files.py.
+//
+//   soba [options] manifest.txt
+//   soba [options] scene.sobs suns.sobu out.sobr
+//
+// A manifest holds one "scene suns out" job per line, "#" starts a comment,
+// paths with spaces are "double quoted" and relative paths are relative to the
+// manifest. A failed job is reported and
+// skipped; the exit code is 1 when any job failed. --quiet leaves only errors.
+
+#include "optix_solar.h"
+#include "error_check.h"
+#include "log.h"
+#include "scene_io.h"
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdlib>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace
+{
+constexpr float DEG_TO_RAD = 3.14159265358979323846f / 180.0f;
+
+struct CliConfig
+{
+    std::vector<int> devices = {0};
+    bool cull = true;
+    float adaptive_deg = 0.0f; // Adaptive sun sampling tolerance (TraceOptions::adaptive_tolerance)
+    size_t gas_cache_mb = 1024;
+    std::string gas_cache_dir;
+    std::string optix_cache_dir;
+    bool quiet = false;
+    std::vector<std::string> inputs; // Manifest, or scene suns out
+};
+
+struct Job
+{
+    std::string scene;
+    std::string suns;
+    std::string out;
+};
+
+void usage()
+{
+    std::cerr << "usage: soba [--devices 0,1] [--adaptive DEG] [--cull 0|1] [--gas-cache-mb MB]\n"
+                 "            [--gas-cache-dir DIR] [--optix-cache DIR] [--quiet]\n"
+                 "            manifest.txt | scene.sobs suns.sobu out.sobr\n";
+}
+
+std::vector<int> parse_devices(const std::string &value)
+{
+    std::vector<int> devices;
+    std::stringstream list(value);
+    std::string item;
+    while (std::getline(list, item, ','))
+        devices.push_back(std::stoi(item));
+    if (devices.empty())
+        throw std::invalid_argument("empty device list");
+    return devices;
+}
+
+CliConfig parse_args(int argc, char **argv)
+{
+    CliConfig config;
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string arg = argv[i];
+        if (arg == "--help" || arg == "-h")
+        {
+            usage();
+            std::exit(0);
+        }
+        if (arg == "--quiet")
+        {
+            config.quiet = true;
+            continue;
+        }
+        if (arg.rfind("--", 0) != 0)
+        {
+            config.inputs.push_back(arg);
+            continue;
+        }
+        if (i + 1 >= argc)
+            throw std::invalid_argument("missing value for " + arg);
+        const std::string value = argv[++i];
+        if (arg == "--devices" || arg == "--device")
+            config.devices = parse_devices(value);
+        else if (arg == "--adaptive")
+            config.adaptive_deg = std::stof(value);
+        else if (arg == "--cull")
+            config.cull = std::stoi(value) != 0;
+        else if (arg == "--gas-cache-mb")
+            config.gas_cache_mb = std::stoull(value);
+        else if (arg == "--gas-cache-dir")
+            config.gas_cache_dir = value;
+        else if (arg == "--optix-cache")
+            config.optix_cache_dir = value;
+        else
+            throw std::invalid_argument("unknown option " + arg);
+    }
+    if (config.inputs.size() != 1 && config.inputs.size() != 3)
+        throw std::invalid_argument("expected a manifest or scene, suns and output paths");
+    if (config.adaptive_deg < 0.0f)
+        throw std::invalid_argument("adaptive tolerance must not be negative");
+    return config;
+}
+
+std::string resolve(const std::string &base, const std::string &path)
+{
+    const bool absolute = !path.empty() && (path[0] == '/' || path[0] == '\\' || path.find(':') == 1);
+    return absolute || base.empty() ? path : base + "/" + path;
+}
+
+// Fields of one manifest line: whitespace separated, "double quoted" when a
+// path holds spaces or "#" (no escapes); "#" outside quotes starts a comment
+std::vector<std::string> split_fields(const std::string &line, const std::string &where)
+{
+    std::vector<std::string> fields;
+    size_t i = 0;
+    while (i < line.size())
+    {
+        const char c = line[i];
+        if (std::isspace(static_cast<unsigned char>(c)))
+        {
+            i++;
+        }
+        else if (c == '#')
+        {
+            break;
+        }
+        else if (c == '"')
+        {
+            const size_t end = line.find('"', i + 1);
+            if (end == std::string::npos)
+                throw std::runtime_error(where + ": unterminated quote");
+            fields.push_back(line.substr(i + 1, end - i - 1));
+            i = end + 1;
+        }
+        else
+        {
+            const size_t end = std::min(line.find_first_of(" \t\r\n\v\f#\"", i), line.size());
+            fields.push_back(line.substr(i, end - i));
+            i = end;
+        }
+    }
+    return fields;
+}
+
+std::vector<Job> read_manifest(const std::string &path)
+{
+    std::ifstream file(path);
+    if (!file)
+        throw std::runtime_error("cannot read " + path);
+    const size_t slash = path.find_last_of("/\\");
+    const std::string base = slash == std::string::npos ? "" : path.substr(0, slash);
+
+    std::vector<Job> jobs;
+    std::string line;
+    for (int number = 1; std::getline(file, line); ++number)
+    {
+        const std::string where = path + ":" + std::to_string(number);
+        const std::vector<std::string> fields = split_fields(line, where);
+        if (fields.empty())
+            continue;
+        if (fields.size() != 3)
+            throw std::runtime_error(where + ": expected scene suns out");
+        jobs.push_back({resolve(base, fields[0]), resolve(base, fields[1]), resolve(base, fields[2])});
+    }
+    return jobs;
+}
+
+double elapsed_ms(std::chrono::high_resolution_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+// Same engine interface on one GPU and several
+template <typename Engine>
+std::unique_ptr<Engine> make_engine(const std::vector<int> &devices);
+
+template <>
+std::unique_ptr<SolarEngine> make_engine<SolarEngine>(const std::vector<int> &devices)
+{
+    return std::make_unique<SolarEngine>(devices.front());
+}
+
+template <>
+std::unique_ptr<MultiDeviceEngine> make_engine<MultiDeviceEngine>(const std::vector<int> &devices)
+{
+    return std::make_unique<MultiDeviceEngine>(devices);
+}
+
+// The engine's current scene: its path (empty when none is set) and parsed file
+struct LoadedScene
+{
+    std::string path;
+    SceneFile file;
+};
+
+template <typename Engine>
+void run_job(Engine &engine, const CliConfig &config, const Job &job, LoadedScene &loaded)
+{
+    const auto start = std::chrono::high_resolution_clock::now();
+    // Consecutive jobs on one scene neither re-read it nor rebuild it (or its GAS)
+    if (job.scene != loaded.path)
+    {
+        loaded.path.clear();
+        loaded.file = read_scene_file(job.scene);
+        engine.set_scene(loaded.file.context());
+        loaded.path = job.scene;
+    }
+    const SceneFile &scene = loaded.file;
+    const SunFile suns = read_sun_file(job.suns);
+    const size_t faces = scene.centroids.size();
+
+    TraceOptions options;
+    options.cull = config.cull;
+    std::vector<float> results(faces, 0.0f);
+    if (suns.mode == SUN_FILE_SKY)
+    {
+        engine.trace_sky(scene.centroids.data(), scene.normals.data(), faces, suns.directions.data(),
+                         suns.weights.data(), suns.directions.size(), scene.ray_offset, results.data(), options);
+    }
+    else
+    {
+        options.sun_weights = suns.weights.empty() ? nullptr : suns.weights.data();
+        options.adaptive_tolerance = config.adaptive_deg * DEG_TO_RAD;
+        engine.trace(scene.centroids.data(), scene.normals.data(), faces, suns.directions.data(),
+                     suns.directions.size(), scene.ray_offset, results.data(), options);
+    }
+    write_sobr_file(job.out, results.data(), faces, sun_file_result_name(suns.mode));
+
+    SOBA_LOG(LOG_INFO) << "soba: " << job.out << ": " << faces << " faces x " << suns.directions.size()
+                       << " suns in " << elapsed_ms(start) << " ms" << std::endl;
+}
+
+template <typename Engine>
+int run_jobs(const CliConfig &config, const std::vector<Job> &jobs)
+{
+    std::unique_ptr<Engine> engine = make_engine<Engine>(config.devices);
+    LoadedScene scene;
+    int failed = 0;
+    for (const Job &job : jobs)
+    {
+        try
+        {
+            run_job(*engine, config, job, scene);
+        }
+        catch (const CudaOutOfMemory &e)
+        {
+            // The engine already retried with less and stays usable
+            std::cerr << "soba: " << job.out << ": " << e.what() << std::endl;
+            failed++;
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << "soba: " << job.out << ": " << e.what() << std::endl;
+            failed++;
+            if (dynamic_cast<const CudaError *>(&e) || dynamic_cast<const OptixError *>(&e))
+            {
+                // The CUDA context may be unusable: start the next job on a fresh engine
+                engine.reset();
+                engine = make_engine<Engine>(config.devices);
+                scene.path.clear();
+            }
+        }
+    }
+    SOBA_LOG(LOG_INFO) << "soba: " << jobs.size() - failed << " of " << jobs.size() << " jobs done" << std::endl;
+    return failed ? 1 : 0;
+}
+
+int run(const CliConfig &config)
+{
+    for (int device : config.devices)
+        if (device < 0 || device >= cuda_device_count())
+            throw std::out_of_range("invalid CUDA device " + std::to_string(device));
+
+    std::vector<Job> jobs;
+    if (config.inputs.size() == 3)
+        jobs.push_back({config.inputs[0], config.inputs[1], config.inputs[2]});
+    else
+        jobs = read_manifest(config.inputs[0]);
+
+    // Before the first engine, as setup_optix_module does for the Python module
+    set_log_level(config.quiet ? LOG_QUIET : LOG_INFO);
+    set_gas_cache_defaults(config.gas_cache_mb << 20, config.gas_cache_dir);
+    set_optix_cache_dir(config.optix_cache_dir);
+
+    if (config.devices.size() > 1)
+        return run_jobs<MultiDeviceEngine>(config, jobs);
+    return run_jobs<SolarEngine>(config, jobs);
+}
+} // namespace
+
+int main(int argc, char **argv)
+{
+    try
+    {
+        return run(parse_args(argc, argv));
+    }
+    catch (const CudaError &e)
+    {
+        std::cerr << "soba: " << e.what() << std::endl;
+    }
+    catch (const OptixError &e)
+    {
+        std::cerr << "soba: " << e.what() << std::endl;
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "soba: " << e.what() << std::endl;
+        usage();
+    }
+    return 1;
+}
@@ -0,0 +1,230 @@
+#include "sun_position.h"
+#include "error_check.h"
+#include "device_buffer.h"
+#include <cub/cub.cuh>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <cmath>
+#include <algorithm>
+
+// Julian day of 2017-01-01 00:00 UTC
+constexpr double JULIAN_DAY_2017 = 2457754.5;
+constexpr int SUN_PATH_BLOCK = 256;
+constexpr double PI = 3.14159265358979323846;
+
+static const int DAYS_BEFORE_MONTH[12] = {0, 31, 59, 90, 120, 151, 181, 212, 243, 273, 304, 334};
+static const int DAYS_IN_MONTH[12] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+
+// Period flattened to day / hour ranges for the kernel
+struct SunPathLaunch
+{
+    double latitude;
+    double longitude;
+    double time_zone;
+    int day_start; // 0-based day of year
+    int day_count;
+    int hour_start;
+    int hour_end;
+    int hour_count;
+    int timestep;
+    long long step_count;
+};
+
+static SunPathLaunch make_launch(const SunPathSpec &spec)
+{
+    auto check = [](bool ok, const std::string &what)
+    {
+        if (!ok)
+            throw std::runtime_error("sun path: invalid " + what);
+    };
+    check(spec.month_start >= 1 && spec.month_start <= 12 && spec.month_end >= 1 && spec.month_end <= 12, "month");
+    check(spec.day_start >= 1 && spec.day_start <= DAYS_IN_MONTH[spec.month_start - 1] &&
+              spec.day_end >= 1 && spec.day_end <= DAYS_IN_MONTH[spec.month_end - 1],
+          "day");
+    check(spec.hour_start >= 0 && spec.hour_start <= 23 && spec.hour_end >= 0 && spec.hour_end <= 23, "hour");
+    // Timesteps ladybug accepts: divisors of 60
+    check(spec.timestep >= 1 && spec.timestep <= 60 && 60 % spec.timestep == 0, "timestep");
+    check(std::abs(spec.latitude) <= 90.0, "latitude");
+
+    SunPathLaunch p;
+    p.latitude = spec.latitude;
+    p.longitude = spec.longitude;
+    p.time_zone = spec.time_zone;
+    p.day_start = DAYS_BEFORE_MONTH[spec.month_start - 1] + spec.day_start - 1;
+    const int day_end = DAYS_BEFORE_MONTH[spec.month_end - 1] + spec.day_end - 1;
+    p.day_count = (day_end - p.day_start + 365) % 365 + 1;
+    p.hour_start = spec.hour_start;
+    p.hour_end = spec.hour_end;
+    p.hour_count = (spec.hour_end - spec.hour_start + 24) % 24 + 1;
+    p.timestep = spec.timestep;
+    p.step_count = static_cast<long long>(p.day_count) * p.hour_count * p.timestep;
+    return p;
+}
+
+size_t sun_path_step_count(const SunPathSpec &spec)
+{
+    return static_cast<size_t>(make_launch(spec).step_count);
+}
+
+static __device__ __forceinline__ double radians(double deg) { return deg * (PI / 180.0); }
+static __device__ __forceinline__ double degrees(double rad) { return rad * (180.0 / PI); }
+static __device__ __forceinline__ double clamp_unit(double x) { return fmin(1.0, fmax(-1.0, x)); }
+
+// NOAA solar position (the equations behind ladybug's Sunpath) for local
+// standard time day / minutes. Altitude includes atmospheric refraction,
+// azimuth is clockwise from north; both in degrees.
+static __device__ void solar_position(const SunPathLaunch &p, int day, double local_minutes,
+                                      double &altitude, double &azimuth)
+{
+    const double julian_day = JULIAN_DAY_2017 + day + local_minutes / 1440.0 - p.time_zone / 24.0;
+    const double jc = (julian_day - 2451545.0) / 36525.0;
+
+    const double mean_long = fmod(280.46646 + jc * (36000.76983 + jc * 0.0003032), 360.0);
+    const double mean_anom = radians(357.52911 + jc * (35999.05029 - 0.0001537 * jc));
+    const double eccent = 0.016708634 - jc * (0.000042037 + 0.0000001267 * jc);
+    const double eq_of_ctr = sin(mean_anom) * (1.914602 - jc * (0.004817 + 0.000014 * jc)) +
+                             sin(2.0 * mean_anom) * (0.019993 - 0.000101 * jc) +
+                             sin(3.0 * mean_anom) * 0.000289;
+    const double omega = radians(125.04 - 1934.136 * jc);
+    const double app_long = mean_long + eq_of_ctr - 0.00569 - 0.00478 * sin(omega);
+    const double mean_obliq = 23.0 + (26.0 + (21.448 - jc * (46.815 + jc * (0.00059 - jc * 0.001813))) / 60.0) / 60.0;
+    const double obliq = radians(mean_obliq + 0.00256 * cos(omega));
+    const double declination = asin(sin(obliq) * sin(radians(app_long)));
+
+    // Equation of time, minutes
+    const double y = tan(obliq / 2.0) * tan(obliq / 2.0);
+    const double l0 = radians(mean_long);
+    const double eq_of_time = 4.0 * degrees(y * sin(2.0 * l0) - 2.0 * eccent * sin(mean_anom) +
+                                            4.0 * eccent * y * sin(mean_anom) * cos(2.0 * l0) -
+                                            0.5 * y * y * sin(4.0 * l0) -
+                                            1.25 * eccent * eccent * sin(2.0 * mean_anom));
+
+    double true_solar = fmod(local_minutes + eq_of_time + 4.0 * p.longitude - 60.0 * p.time_zone, 1440.0);
+    if (true_solar < 0.0)
+        true_solar += 1440.0;
+    const double hour_angle = true_solar / 4.0 - 180.0;
+
+    const double lat = radians(p.latitude);
+    const double zenith = acos(clamp_unit(sin(lat) * sin(declination) +
+                                          cos(lat) * cos(declination) * cos(radians(hour_angle))));
+    altitude = 90.0 - degrees(zenith);
+
+    // Approximate atmospheric refraction, arc seconds
+    double refraction = 0.0;
+    if (altitude <= 85.0)
+    {
+        const double te = tan(radians(altitude));
+        if (altitude > 5.0)
+            refraction = 58.1 / te - 0.07 / (te * te * te) + 0.000086 / (te * te * te * te * te);
+        else if (altitude > -0.575)
+            refraction = 1735.0 + altitude * (-518.2 + altitude * (103.4 + altitude * (-12.79 + altitude * 0.711)));
+        else
+            refraction = -20.772 / te;
+    }
+    altitude += refraction / 3600.0;
+
+    const double denom = cos(lat) * sin(zenith);
+    const double az = fabs(denom) > 1e-12 ? degrees(acos(clamp_unit((sin(lat) * cos(zenith) - sin(declination)) / denom)))
+                                          : 0.0;
+    azimuth = hour_angle > 0.0 ? fmod(az + 180.0, 360.0) : fmod(540.0 - az, 360.0);
+}
+
+// One thread per time step, in time order: day, then hour, then sub-hour step
+__global__ void sun_path_kernel(SunPathLaunch p, const float *hourly_dni,
+                                float3 *all_suns, float *all_weights, unsigned char *daylit)
+{
+    const long long i = static_cast<long long>(blockIdx.x) * blockDim.x + threadIdx.x;
+    if (i >= p.step_count)
+        return;
+
+    const int steps_per_day = p.hour_count * p.timestep;
+    const int day = (p.day_start + static_cast<int>(i / steps_per_day)) % 365;
+    const int in_day = static_cast<int>(i % steps_per_day);
+    const int hour_idx = in_day / p.timestep;
+
+    // Wrapped hour ranges stay in clock order: 0..hour_end, then hour_start..23
+    int hour = p.hour_start + hour_idx;
+    if (p.hour_start > p.hour_end)
+        hour = hour_idx <= p.hour_end ? hour_idx : p.hour_start + hour_idx - p.hour_end - 1;
+    const double minute = (in_day % p.timestep) * (60.0 / p.timestep);
+
+    double altitude, azimuth;
+    solar_position(p, day, hour * 60.0 + minute, altitude, azimuth);
+
+    const double alt = radians(altitude), az = radians(azimuth);
+    all_suns[i] = make_float3(static_cast<float>(-sin(az) * cos(alt)),
+                              static_cast<float>(-cos(az) * cos(alt)),
+                              static_cast<float>(-sin(alt)));
+    daylit[i] = altitude > 0.0 ? 1 : 0;
+    if (all_weights)
+        all_weights[i] = hourly_dni[day * 24 + hour] / (p.timestep * 1000.0f);
+}
+
+size_t generate_sun_path(const SunPathSpec &spec, const float *d_hourly_dni,
+                         float3 *d_suns, float *d_weights, cudaStream_t stream)
+{
+    const SunPathLaunch p = make_launch(spec);
+    const bool weighted = d_hourly_dni && d_weights;
+
+    // Every step is evaluated, then daylit ones are compacted to the front in order
+    DeviceBuffer<float3> all_suns(p.step_count);
+    DeviceBuffer<float> all_weights(weighted ? p.step_count : 0);
+    DeviceBuffer<unsigned char> daylit(p.step_count);
+    DeviceBuffer<int> selected(1);
+    float3 *d_all_suns = all_suns.get();
+    float *d_all_weights = all_weights.get();
+    unsigned char *d_daylit = daylit.get();
+    int *d_selected = selected.get();
+
+    const unsigned blocks = static_cast<unsigned>((p.step_count + SUN_PATH_BLOCK - 1) / SUN_PATH_BLOCK);
+    sun_path_kernel<<<blocks, SUN_PATH_BLOCK, 0, stream>>>(p, d_hourly_dni, d_all_suns, d_all_weights, d_daylit);
+    CUDA_CHECK(cudaGetLastError());
+
+    size_t temp_bytes = 0, weight_temp_bytes = 0;
+    CUDA_CHECK(cub::DeviceSelect::Flagged(nullptr, temp_bytes, d_all_suns, d_daylit, d_suns, d_selected,
+                                          p.step_count, stream));
+    if (weighted)
+        CUDA_CHECK(cub::DeviceSelect::Flagged(nullptr, weight_temp_bytes, d_all_weights, d_daylit, d_weights,
+                                              d_selected, p.step_count, stream));
+    temp_bytes = std::max(temp_bytes, weight_temp_bytes);
+
+    DeviceBuffer<char> temp(temp_bytes);
+    void *d_temp = temp.get();
+    CUDA_CHECK(cub::DeviceSelect::Flagged(d_temp, temp_bytes, d_all_suns, d_daylit, d_suns, d_selected,
+                                          p.step_count, stream));
+    if (weighted)
+        CUDA_CHECK(cub::DeviceSelect::Flagged(d_temp, temp_bytes, d_all_weights, d_daylit, d_weights,
+                                              d_selected, p.step_count, stream));
+
+    int sun_count = 0;
+    CUDA_CHECK(cudaMemcpyAsync(&sun_count, d_selected, sizeof(int), cudaMemcpyDeviceToHost, stream));
+    CUDA_CHECK(cudaStreamSynchronize(stream));
+    return static_cast<size_t>(sun_count);
+}
+
+void compute_sun_path(const SunPathSpec &spec, const float *hourly_dni,
+                      std::vector<float3> &suns, std::vector<float> &weights)
+{
+    const size_t steps = sun_path_step_count(spec);
+
+    DeviceBuffer<float3> d_suns(steps);
+    DeviceBuffer<float> d_weights, d_dni;
+    if (hourly_dni)
+    {
+        d_weights.allocate(steps);
+        d_dni.allocate(SUN_PATH_HOURS_PER_YEAR);
+        CUDA_CHECK(cudaMemcpy(d_dni.get(), hourly_dni, d_dni.bytes(), cudaMemcpyHostToDevice));
+    }
+
+    const size_t sun_count = generate_sun_path(spec, d_dni.get(), d_suns.get(), d_weights.get());
+
+    suns.resize(sun_count);
+    CUDA_CHECK(cudaMemcpy(suns.data(), d_suns.get(), sun_count * sizeof(float3), cudaMemcpyDeviceToHost));
+    weights.clear();
+    if (hourly_dni)
+    {
+        weights.resize(sun_count);
+        CUDA_CHECK(cudaMemcpy(weights.data(), d_weights.get(), sun_count * sizeof(float), cudaMemcpyDeviceToHost));
+    }
+}
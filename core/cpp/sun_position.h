@@ -0,0 +1,43 @@
+#pragma once
+#include <cuda_runtime.h>
+#include <vector>
+
+// Location and analysis period of a sun path, same fields as ladybug's
+// Location / AnalysisPeriod. Periods run over a non-leap year (2017, the
+// AnalysisPeriod default); a start date after the end date wraps over new
+// year, a start hour after the end hour wraps over midnight.
+struct SunPathSpec
+{
+    double latitude = 0.0;  // Degrees, north positive
+    double longitude = 0.0; // Degrees, east positive
+    double time_zone = 0.0; // Hours from UTC
+    int month_start = 1;
+    int month_end = 12;
+    int day_start = 1;
+    int day_end = 31;
+    int hour_start = 0;
+    int hour_end = 23;
+    int timestep = 1; // Steps per hour; every hour of the period is sampled timestep times
+};
+
+// Hours in the EPW year a DNI table covers
+constexpr int SUN_PATH_HOURS_PER_YEAR = 8760;
+
+// Time steps in the period, daylit or not (upper bound of the sun count)
+size_t sun_path_step_count(const SunPathSpec &spec);
+
+// Fill d_suns (and d_weights, when d_hourly_dni is given) with the sun vectors
+// of every daylit step of spec, in time order, on the current device. Vectors
+// point from the sun to the ground (ladybug's sun.sun_vector, +Y north, +X
+// east); a step is daylit when the refraction-corrected altitude is above the
+// horizon. Weights are DNI of the step's hour x step length / 1000 (kWh/m2 per
+// unit cos(incidence)), d_hourly_dni holds SUN_PATH_HOURS_PER_YEAR values in
+// W/m2. Both outputs must hold sun_path_step_count(spec) entries. Returns the
+// number of daylit suns written once stream has finished.
+size_t generate_sun_path(const SunPathSpec &spec, const float *d_hourly_dni,
+                         float3 *d_suns, float *d_weights, cudaStream_t stream = 0);
+
+// Host convenience: generate on device and copy back. hourly_dni (host, may be
+// null) as for generate_sun_path; weights is left empty without it.
+void compute_sun_path(const SunPathSpec &spec, const float *hourly_dni,
+                      std::vector<float3> &suns, std::vector<float> &weights);
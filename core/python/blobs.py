@@ -0,0 +1,124 @@
+"""
+Content-addressed upload store for the analysis server
+
+Blobs are named by the SHA-256 of their uncompressed bytes. Clients ask for
+the hashes the server is missing, stream only those (optionally zstd
+compressed, decoded chunk by chunk straight to disk), then submit a job as a
+manifest of file names -> hashes. A context layer or EPW that did not change
+since the last job is never uploaded again; the scheduler then finds its GAS in
+the engine's geometry cache as well.
+"""
+
+import hashlib
+import os
+import re
+import shutil
+import uuid
+
+try:
+    import zstandard
+except ImportError:  # Only needed for zstd-encoded uploads
+    zstandard = None
+
+ZSTD_ERRORS = (zstandard.ZstdError,) if zstandard else ()
+
+DIGEST_RE = re.compile(r"^[0-9a-f]{64}$")
+
+# Content-Encoding values accepted on PUT /blobs/{digest}
+ENCODINGS = ("identity", "zstd")
+
+
+class BlobError(Exception):
+    """Rejected upload; status is the HTTP code to answer with"""
+
+    def __init__(self, message, status=400):
+        super().__init__(message)
+        self.status = status
+
+
+class BlobStore:
+    def __init__(self, root, max_bytes=None):
+        """
+        Args:
+            root: Directory holding one file per blob, named by its digest
+            max_bytes: Largest decoded blob accepted (None = unlimited)
+        """
+        self.root = root
+        self.max_bytes = max_bytes
+        self.root.mkdir(exist_ok=True, parents=True)
+
+    def path(self, digest):
+        if not DIGEST_RE.match(digest):
+            raise BlobError(f"Invalid blob digest: {digest}")
+        return self.root / digest
+
+    def exists(self, digest):
+        return self.path(digest).exists()
+
+    def missing(self, digests):
+        return [d for d in digests if not self.exists(d)]
+
+    async def receive(self, digest, chunks, encoding="identity"):
+        """
+        Stream an upload to disk, decoding and hashing as it arrives
+
+        The blob only appears under its digest once the hash has been verified,
+        so concurrent uploads of the same content are harmless.
+
+        Args:
+            digest: Expected SHA-256 (hex) of the decoded content
+            chunks: Async iterator of request body chunks
+            encoding: "identity" or "zstd"
+
+        Returns the decoded size in bytes
+        """
+        final_path = self.path(digest)
+        encoding = (encoding or "identity").lower()
+        if encoding not in ENCODINGS:
+            raise BlobError(f"Unsupported Content-Encoding: {encoding}", status=415)
+        decoder = None
+        if encoding == "zstd":
+            if zstandard is None:
+                raise BlobError("zstd uploads need the zstandard package", status=415)
+            decoder = zstandard.ZstdDecompressor().decompressobj()
+
+        hasher = hashlib.sha256()
+        size = 0
+        part_path = self.root / f"{digest}.{uuid.uuid4().hex}.part"
+        try:
+            with open(part_path, "wb") as f:
+                async for chunk in chunks:
+                    data = decoder.decompress(chunk) if decoder else chunk
+                    if not data:
+                        continue
+                    size += len(data)
+                    if self.max_bytes is not None and size > self.max_bytes:
+                        raise BlobError(
+                            f"Blob exceeds the {self.max_bytes} byte upload limit", status=413
+                        )
+                    hasher.update(data)
+                    f.write(data)
+            if hasher.hexdigest() != digest:
+                raise BlobError(f"Content hash {hasher.hexdigest()} does not match {digest}")
+            os.replace(part_path, final_path)
+        except ZSTD_ERRORS as e:
+            raise BlobError(f"Corrupt zstd stream: {e}")
+        finally:
+            if part_path.exists():
+                part_path.unlink()
+        return size
+
+    def materialize(self, digest, dest):
+        """Place a blob at dest: a hard link when possible, else a copy"""
+        src = self.path(digest)
+        try:
+            os.link(src, dest)
+        except OSError:
+            shutil.copyfile(src, dest)
+
+
+def file_name(name):
+    """Manifest names must be plain file names inside the job directory"""
+    if not name or name in (".", "..") or os.path.basename(name) != name or "\\" in name:
+        raise BlobError(f"Invalid file name in manifest: {name!r}")
+    return name
@@ -0,0 +1,114 @@
+"""
+Result colormaps, shared by the server's USD write-back and the Maya client
+
+Only needs numpy, so clients can color results locally from a compact
+results payload (see results_codec).
+"""
+
+import numpy as np
+
+# Ecotect colorset 3 stops, low to high
+ECOTECT_COLORS = [
+    (0 / 255, 0 / 255, 255 / 255),  # Blue (minimum)
+    (53 / 255, 0 / 255, 202 / 255),  # Blue-purple
+    (107 / 255, 0 / 255, 148 / 255),  # Purple
+    (160 / 255, 0 / 255, 95 / 255),  # Purple-red
+    (214 / 255, 0 / 255, 41 / 255),  # Red-purple
+    (255 / 255, 12 / 255, 0 / 255),  # Red
+    (255 / 255, 66 / 255, 0 / 255),  # Red-orange
+    (255 / 255, 119 / 255, 0 / 255),  # Orange
+    (255 / 255, 173 / 255, 0 / 255),  # Orange-yellow
+    (255 / 255, 226 / 255, 0 / 255),  # Light yellow
+    (255 / 255, 255 / 255, 0 / 255),  # Yellow (maximum)
+]
+
+ECOTECT_COLORS_ARRAY = np.array(ECOTECT_COLORS, dtype=np.float32)
+
+
+def ecotect_color(normalized_value):
+    """
+    Convert normalized value (0-1) to Ecotect colorset 3
+    Blue (min) → Purple → Red → Orange → Yellow (max)
+    """
+    val = max(0.0, min(1.0, normalized_value))
+
+    if val <= 0.0:
+        return ECOTECT_COLORS[0]
+    if val >= 1.0:
+        return ECOTECT_COLORS[-1]
+
+    # Find segment and interpolate
+    num_segments = len(ECOTECT_COLORS) - 1
+    segment = val * num_segments
+    segment_index = int(segment)
+
+    if segment_index >= num_segments:
+        return ECOTECT_COLORS[-1]
+
+    t = segment - segment_index
+    color1 = ECOTECT_COLORS[segment_index]
+    color2 = ECOTECT_COLORS[segment_index + 1]
+
+    r = color1[0] + t * (color2[0] - color1[0])
+    g = color1[1] + t * (color2[1] - color1[1])
+    b = color1[2] + t * (color2[2] - color1[2])
+
+    return (r, g, b)
+
+
+def results_to_colors(results, colormap="ecotect"):
+    """
+    Convert sun hours to RGB colors using a colormap
+
+    Args:
+        results: numpy array of sun hours per face
+        colormap: 'ecotect' (default), 'viridis', 'plasma', 'hot', 'cool', or 'custom'
+
+    Returns:
+        numpy array of shape (N, 3) with RGB colors (0-1 range)
+    """
+    # Normalize results to 0-1 range
+    if results.max() > results.min():
+        normalized = (results - results.min()) / (results.max() - results.min())
+    else:
+        normalized = np.ones_like(results) * 0.5
+
+    colors = np.zeros((len(results), 3), dtype=np.float32)
+
+    if colormap == "ecotect":
+        # Ecotect colorset 3, interpolated per channel between evenly spaced stops
+        stops = np.linspace(0.0, 1.0, len(ECOTECT_COLORS))
+        for channel in range(3):
+            colors[:, channel] = np.interp(normalized, stops, ECOTECT_COLORS_ARRAY[:, channel])
+
+    elif colormap == "viridis":
+        # Blue → Green → Yellow (low to high sun)
+        colors[:, 0] = normalized  # Red
+        colors[:, 1] = np.sqrt(normalized)  # Green
+        colors[:, 2] = 1.0 - normalized  # Blue
+
+    elif colormap == "plasma":
+        # Purple → Orange → Yellow
+        colors[:, 0] = normalized  # Red increases
+        colors[:, 1] = normalized**2  # Green increases slower
+        colors[:, 2] = 1.0 - normalized  # Blue decreases
+
+    elif colormap == "hot":
+        # Black → Red → Yellow → White
+        colors[:, 0] = np.minimum(1.0, normalized * 3)
+        colors[:, 1] = np.maximum(0.0, (normalized - 0.33) * 3)
+        colors[:, 2] = np.maximum(0.0, (normalized - 0.66) * 3)
+
+    elif colormap == "cool":
+        # Blue → White → Red
+        colors[:, 0] = normalized  # Red increases
+        colors[:, 1] = 1.0 - np.abs(normalized - 0.5) * 2  # White in middle
+        colors[:, 2] = 1.0 - normalized  # Blue decreases
+
+    else:  # 'custom' or default
+        # Simple blue (low) to red (high)
+        colors[:, 0] = normalized  # Red
+        colors[:, 1] = 0.0
+        colors[:, 2] = 1.0 - normalized  # Blue
+
+    return colors
@@ -9,6 +9,9 @@ from pathlib import Path
 import importlib.util
 import ctypes
 import time
+import hashlib
+import threading
+from collections import OrderedDict
 
 from pxr import Usd, UsdGeom, Sdf, Gf
 
@@ -19,57 +22,61 @@ sys.path.insert(0, str(PROJECT_ROOT))
 import weather as lb
 import config
 
+# Loaded extension module and warm engine, shared by every analysis in this process
+_optix_module = None
+_persistent_engine = None
+_persistent_engine_lock = threading.Lock()
+
+# config logging level -> engine stdout verbosity (anything else is quiet)
+ENGINE_LOG_LEVELS = {"DEBUG": 2, "INFO": 1}
+
+
 def setup_optix_module():
     """
     One-time setup to load OptiX module with all dependencies
     Returns the loaded module
     """
+    global _optix_module
+    if _optix_module is not None:
+        return _optix_module
+
     # Paths 
     BUILD_DIR = str(config.BUILD_DIR)
     CUDA_BIN = str(config.CUDA_BIN)
 
-    # Add CUDA to PATH
-    os.environ["PATH"] = CUDA_BIN + os.pathsep + os.environ.get("PATH", "")
-
-    # Load CUDA DLL explicitly
-    cuda_dlls = ["cudart64_12.dll", "cudart64_129.dll"]
-    cuda_loaded = False
-    for dll_name in cuda_dlls:
-        dll_path = os.path.join(CUDA_BIN, dll_name)
-        if os.path.exists(dll_path):
-            try:
-                ctypes.CDLL(dll_path)
-                print(f" Loaded CUDA: {dll_name}")
-                cuda_loaded = True
-                break
-            except Exception as e:
-                print(f"  Failed to load {dll_name}: {e}")
-
-    if not cuda_loaded:
-        raise RuntimeError("Failed to load CUDA runtime DLL")
+    # Windows resolves cudart through PATH / explicit loads; on Linux the
+    # module finds libcudart through its RPATH or LD_LIBRARY_PATH
+    if os.name == "nt":
+        # Add CUDA to PATH
+        os.environ["PATH"] = CUDA_BIN + os.pathsep + os.environ.get("PATH", "")
 
-    
-    # # Add build directory to path
-    # if BUILD_DIR not in sys.path:
-    #     sys.path.insert(0, BUILD_DIR)
-    # print(f"sys.path[0]: {sys.path[0]}")
+        # Load CUDA DLL explicitly
+        cuda_dlls = ["cudart64_12.dll", "cudart64_129.dll"]
+        cuda_loaded = False
+        for dll_name in cuda_dlls:
+            dll_path = os.path.join(CUDA_BIN, dll_name)
+            if os.path.exists(dll_path):
+                try:
+                    ctypes.CDLL(dll_path)
+                    print(f" Loaded CUDA: {dll_name}")
+                    cuda_loaded = True
+                    break
+                except Exception as e:
+                    print(f"  Failed to load {dll_name}: {e}")
+
+        if not cuda_loaded:
+            raise RuntimeError("Failed to load CUDA runtime DLL")
 
-    # # Change to build directory (for PTX file)
-    # original_cwd = os.getcwd()
-    # os.chdir(BUILD_DIR)
 
-    # Find the .pyd file
-    pyd_files = list(Path(BUILD_DIR).glob("solar_engine_optix*.pyd"))
+    # Find the extension module (.pyd on Windows, .so elsewhere)
+    pattern = "solar_engine_optix*.pyd" if os.name == "nt" else "solar_engine_optix*.so"
+    pyd_files = list(Path(BUILD_DIR).glob(pattern))
     if not pyd_files:
-        raise FileNotFoundError(f"solar_engine_optix.pyd not found in {BUILD_DIR}")
+        raise FileNotFoundError(f"{pattern} not found in {BUILD_DIR}")
     
     pyd_path = pyd_files[0]
 
-    # Change to build directory (for PTX file)
-    original_cwd = os.getcwd()
-    os.chdir(BUILD_DIR)
-
-    # Import module
+    # Import module (device code is embedded in it, no working directory needed)
     try:
         # Load module directly without modifying sys.path
         spec = importlib.util.spec_from_file_location("solar_engine_optix", pyd_path)
@@ -82,31 +89,582 @@ def setup_optix_module():
         spec.loader.exec_module(solar_engine_optix)
         
         print(f"✓ Loaded solar_engine_optix v{solar_engine_optix.__version__}")
+        if hasattr(solar_engine_optix, "configure_gas_cache"):
+            # Before any engine exists, so every engine (warm or one-shot) uses it
+            solar_engine_optix.configure_gas_cache(
+                config.GAS_CACHE_VRAM_BUDGET,
+                str(config.GAS_CACHE_DIR) if config.GAS_CACHE_DIR else "",
+            )
+        if hasattr(solar_engine_optix, "configure_memory_pool"):
+            solar_engine_optix.configure_memory_pool(
+                config.MEMORY_POOL_ENABLED, config.MEMORY_POOL_RELEASE_THRESHOLD
+            )
+        if hasattr(solar_engine_optix, "configure_optix_cache"):
+            solar_engine_optix.configure_optix_cache(
+                str(config.OPTIX_CACHE_DIR) if config.OPTIX_CACHE_DIR else ""
+            )
+        if hasattr(solar_engine_optix, "set_log_level"):
+            solar_engine_optix.set_log_level(ENGINE_LOG_LEVELS.get(config.LOG_LEVEL.upper(), 0))
+        _optix_module = solar_engine_optix
         return solar_engine_optix
     
     except ImportError as e:
         print(f" Failed to import solar_engine_optix: {e}")
         raise
-    finally:
-        # Restore original working directory
-        os.chdir(original_cwd)
 
 
-def run_optix_analysis(scene_data, optix_module):
+class PersistentEngine:
+    """
+    Warm OptiX engine kept alive between analyses
+
+    The C++ SolarEngine creates the context, module, pipeline and SBT once.
+    Context geometry is kept as one GAS per distinct mesh plus an IAS over the
+    prims, so only what changed between two jobs is rebuilt.
+    """
+
+    def __init__(self, optix_module, devices=None):
+        devices = list(devices if devices is not None else config.GPU_DEVICES) or [0]
+        self.devices = devices
+        if len(devices) > 1:
+            # Scene replicated per GPU, target faces split between them
+            self.engine = optix_module.MultiDeviceEngine(devices)
+        else:
+            self.engine = optix_module.SolarEngine(devices[0])
+        self.optix_module = optix_module
+        self.scene_key = None
+        self.lock = threading.Lock()
+        # prim path -> {"key", "instance_id", "transform"}
+        self.prims = {}
+        # geometry key -> {"mesh_id", "refs", "vertex_count", "topology"}
+        self.meshes = {}
+        # (sun path args, DNI key) of the sun vectors resident on the GPU
+        self.sun_path_key = None
+        self.sun_path_count = 0
+        # Engine metrics and GAS cache counters as of the last analysis, readable
+        # without waiting for self.lock (see record_metrics)
+        self.last_metrics = {}
+        # Far-field proxies (config.LOD_*): (geometry key, cell) -> proxy mesh of a
+        # context prim (LRU), and the last simplified flat scene
+        self.lod_meshes = OrderedDict()
+        self.lod_scene = None
+
+    @staticmethod
+    def _scene_key(scene_triangles, indices=None):
+        h = hashlib.blake2b(np.ascontiguousarray(scene_triangles, dtype=np.float32).tobytes(), digest_size=16)
+        if indices is not None:
+            h.update(np.ascontiguousarray(indices, dtype=np.uint32).tobytes())
+        return h.hexdigest()
+
+    def set_scene(self, scene_triangles, indices=None):
+        """Rebuild the GAS only if the context geometry changed"""
+        key = self._scene_key(scene_triangles, indices)
+        if key == self.scene_key:
+            print("  Reusing warm GAS (context unchanged)")
+            return
+        self.engine.set_scene(scene_triangles, indices)
+        self.scene_key = key
+        self.prims.clear()
+        self.meshes.clear()
+        report_gas_cache(self.engine)
+
+    def _acquire_mesh(self, key, mesh):
+        entry = self.meshes.get(key)
+        if entry is None:
+            entry = {
+                "mesh_id": self.engine.add_mesh(mesh["points"], mesh["indices"]),
+                "refs": 0,
+                "vertex_count": len(mesh["points"]),
+                "topology": mesh["topology"],
+            }
+            self.meshes[key] = entry
+        entry["refs"] += 1
+        return entry["mesh_id"]
+
+    def _release_prim(self, path):
+        prim = self.prims.pop(path)
+        self.engine.remove_instance(prim["instance_id"])
+        entry = self.meshes[prim["key"]]
+        entry["refs"] -= 1
+        if entry["refs"] == 0:
+            self.engine.remove_mesh(entry["mesh_id"])
+            del self.meshes[prim["key"]]
+
+    def sync_context(self, context_meshes):
+        """
+        Bring the engine scene in line with per-prim context meshes
+
+        Moved prims only update their instance transform (IAS refit), edited
+        prims refit their own GAS when the topology is unchanged, and
+        prims with identical geometry share one GAS through instancing.
+        """
+        if self.scene_key is not None:
+            # Coming from a flat set_scene(): start over
+            self.engine.clear_scene()
+            self.scene_key = None
+            self.prims.clear()
+            self.meshes.clear()
+
+        stats = {"moved": 0, "refit": 0, "added": 0, "removed": 0}
+        seen = set()
+
+        for mesh in context_meshes:
+            path, key, xform = mesh["path"], mesh["key"], mesh["transform"]
+            seen.add(path)
+            prim = self.prims.get(path)
+
+            if prim is not None and prim["key"] != key:
+                entry = self.meshes[prim["key"]]
+                refittable = (
+                    entry["refs"] == 1
+                    and key not in self.meshes
+                    and entry["topology"] == mesh["topology"]
+                    and entry["vertex_count"] == len(mesh["points"])
+                )
+                if refittable:
+                    self.engine.update_mesh(entry["mesh_id"], mesh["points"], mesh["indices"])
+                    self.meshes[key] = self.meshes.pop(prim["key"])
+                    prim["key"] = key
+                    stats["refit"] += 1
+                else:
+                    self._release_prim(path)
+                    prim = None
+
+            if prim is None:
+                mesh_id = self._acquire_mesh(key, mesh)
+                self.prims[path] = {
+                    "key": key,
+                    "instance_id": self.engine.add_instance(mesh_id, xform),
+                    "transform": xform,
+                }
+                stats["added"] += 1
+            elif not np.array_equal(prim["transform"], xform):
+                self.engine.set_instance_transform(prim["instance_id"], xform)
+                prim["transform"] = xform
+                stats["moved"] += 1
+
+        for path in [p for p in self.prims if p not in seen]:
+            self._release_prim(path)
+            stats["removed"] += 1
+
+        print(
+            f"  Scene sync: {stats['added']} added, {stats['moved']} moved, "
+            f"{stats['refit']} refit, {stats['removed']} removed "
+            f"({len(self.meshes)} unique meshes, {len(self.prims)} instances)"
+        )
+        print(
+            f"  GAS memory: {self.engine.gas_uncompacted_bytes / 2**20:.1f} MB -> "
+            f"{self.engine.gas_bytes / 2**20:.1f} MB compacted"
+        )
+        report_gas_cache(self.engine)
+
+    def analyze(
+        self,
+        face_centers,
+        face_normals,
+        scene,
+        sun_vectors,
+        ray_offset,
+        output_visibility=False,
+        sun_weights=None,
+        face_vertices=None,
+        samples_per_face=1,
+    ):
+        """
+        Same signature as solar_engine_optix.analyze, without the re-init
+
+        scene is either an (N, 3, 3) triangle array or the list of per-prim
+        context meshes from usd_io.read_context_meshes(). With output_visibility
+        returns (results, bit-packed visibility). With sun_weights, results are
+        sum(weight * cos(incidence)) instead of lit-sun counts. With
+        face_vertices (F, 3, 3) and samples_per_face = k * k, each face is
+        sampled at k x k stratified points and results are lit fractions
+        """
+        with self.lock:
+            self._update_scene(scene, [(face_centers, face_vertices)], ray_offset)
+            results = self.engine.trace(
+                face_centers,
+                face_normals,
+                sun_vectors,
+                ray_offset,
+                output_visibility,
+                sun_weights,
+                face_vertices,
+                samples_per_face,
+                adaptive_tolerance_deg=adaptive_tolerance(output_visibility, samples_per_face),
+            )
+            if len(self.devices) > 1:
+                report_device_stats(self.engine.last_trace_stats)
+            self.record_metrics()
+            return results
+
+    def analyze_progressive(
+        self,
+        face_centers,
+        face_normals,
+        scene,
+        sun_vectors,
+        ray_offset,
+        passes,
+        on_pass,
+        sun_weights=None,
+        face_vertices=None,
+        samples_per_face=1,
+    ):
+        """
+        analyze() in passes over interleaved sun subsets (sun i in pass i % passes)
+
+        Every pass spans the whole period, so after each one on_pass(done,
+        passes, preview) gets the results so far scaled up by total / traced
+        suns: an estimate of the final values that the last pass makes exact.
+        Returns the final results.
+        """
+        sun_vectors = np.asarray(sun_vectors, dtype=np.float32)
+        passes = max(1, min(int(passes), len(sun_vectors)))
+        total = np.zeros(len(face_centers), dtype=np.float32)
+        traced = 0
+        with self.lock:
+            self._update_scene(scene, [(face_centers, face_vertices)], ray_offset)
+            for p in range(passes):
+                suns = np.ascontiguousarray(sun_vectors[p::passes])
+                weights = None if sun_weights is None else np.ascontiguousarray(sun_weights[p::passes])
+                total += self.engine.trace(
+                    face_centers,
+                    face_normals,
+                    suns,
+                    ray_offset,
+                    False,
+                    weights,
+                    face_vertices,
+                    samples_per_face,
+                    adaptive_tolerance_deg=adaptive_tolerance(False, samples_per_face),
+                )
+                traced += len(suns)
+                if p + 1 < passes:
+                    on_pass(p + 1, passes, total * np.float32(len(sun_vectors) / traced))
+            if len(self.devices) > 1:
+                report_device_stats(self.engine.last_trace_stats)
+            self.record_metrics()
+        on_pass(passes, passes, total)
+        return total
+
+    def analyze_batch(self, targets, scene, sun_sets, ray_offset, scenarios=None):
+        """
+        Many scenarios against one scene in a single launch
+
+        targets is a list of (face_centers, face_normals) pairs, sun_sets a list
+        of sun vector arrays or (sun_vectors, sun_weights) pairs. scenarios lists
+        (target, sun_set) index pairs, by default every target against every sun
+        set (target-major). Returns one result array per scenario.
+        """
+        targets = [
+            (np.ascontiguousarray(c, dtype=np.float32), np.ascontiguousarray(n, dtype=np.float32))
+            for c, n in targets
+        ]
+        with self.lock:
+            self._update_scene(scene, [(c, None) for c, _ in targets], ray_offset)
+            results = self.engine.trace_batch(targets, sun_sets, ray_offset, scenarios)
+            if len(self.devices) > 1:
+                report_device_stats(self.engine.last_trace_stats)
+            self.record_metrics()
+            return results
+
+    def analyze_sky(
+        self,
+        face_centers,
+        face_normals,
+        scene,
+        patch_directions,
+        patch_weights,
+        ray_offset,
+        face_vertices=None,
+        samples_per_face=1,
+    ):
+        """Radiation from a cumulative sky matrix (weather.get_sky_matrix), same scene handling"""
+        with self.lock:
+            self._update_scene(scene, [(face_centers, face_vertices)], ray_offset)
+            results = self.engine.trace_sky(
+                face_centers,
+                face_normals,
+                patch_directions,
+                patch_weights,
+                ray_offset,
+                face_vertices,
+                samples_per_face,
+            )
+            if len(self.devices) > 1:
+                report_device_stats(self.engine.last_trace_stats)
+            self.record_metrics()
+            return results
+
+    def analyze_sun_path(
+        self,
+        face_centers,
+        face_normals,
+        scene,
+        sun_path,
+        ray_offset,
+        hourly_dni=None,
+        dni_key=None,
+        output_visibility=False,
+        face_vertices=None,
+        samples_per_face=1,
+    ):
+        """
+        analyze() with the sun vectors generated on the GPU
+
+        sun_path is (latitude, longitude, time_zone, month_start, month_end,
+        day_start, day_end, hour_start, hour_end, timestep). The generated suns
+        stay resident, so a job with the same location and period uploads no
+        sun vectors (a culled trace uploads only their order). With hourly_dni (8760 W/m2, identified by dni_key for
+        reuse) results are direct radiation in kWh/m2. The sun count is left in
+        self.sun_path_count.
+        """
+        with self.lock:
+            self._update_scene(scene, [(face_centers, face_vertices)], ray_offset)
+            self._ensure_sun_path(tuple(sun_path), hourly_dni, dni_key)
+            results = self.engine.trace_sun_path(
+                face_centers,
+                face_normals,
+                ray_offset,
+                hourly_dni is not None,
+                output_visibility,
+                face_vertices,
+                samples_per_face,
+                adaptive_tolerance_deg=adaptive_tolerance(output_visibility, samples_per_face),
+            )
+            if len(self.devices) > 1:
+                report_device_stats(self.engine.last_trace_stats)
+            self.record_metrics()
+            return results
+
+    def _ensure_sun_path(self, sun_path, hourly_dni, dni_key):
+        # A weighted path also serves unweighted traces of the same period
+        resident = self.sun_path_key
+        if resident is not None and resident[0] == sun_path and (
+            hourly_dni is None or resident[1] == dni_key
+        ):
+            print(f"  Reusing resident sun path ({self.sun_path_count} suns)")
+            return
+        self.sun_path_count = self.engine.set_sun_path(*sun_path, hourly_dni=hourly_dni)
+        self.sun_path_key = (sun_path, dni_key if hourly_dni is not None else None)
+
+    def record_metrics(self):
+        """Snapshot the engine counters into last_metrics (call with self.lock held)"""
+        snapshot = dict(getattr(self.engine, "metrics", None) or {})
+        cache = getattr(self.engine, "gas_cache_stats", None)
+        if cache:
+            snapshot["gas_cache"] = cache
+        self.last_metrics = snapshot
+
+    def _update_scene(self, scene, targets=(), ray_offset=0.0):
+        """
+        set_scene / sync_context, with far context swapped for its proxies
+        when the far-field LOD is on. targets lists the (face_centers,
+        face_vertices or None) traced against the scene.
+        """
+        bounds = None
+        if config.LOD_ENABLED and targets and hasattr(self.optix_module, "lod_cell"):
+            bounds = lod_target_bounds(targets, ray_offset)
+        if isinstance(scene, np.ndarray):
+            if bounds is None:
+                self.set_scene(scene)
+            else:
+                self.set_scene(*self._far_field_scene(scene, bounds))
+        else:
+            self.sync_context(scene if bounds is None else self._far_field_meshes(scene, bounds))
+
+    def _far_field_scene(self, scene_triangles, bounds):
+        """(points, indices) of a flat scene, each triangle clustered for its own distance"""
+        key = (self._scene_key(scene_triangles), bounds.tobytes(), config.LOD_MIN_DISTANCE, config.LOD_MAX_ANGLE_DEG)
+        if self.lod_scene is None or self.lod_scene[0] != key:
+            points, indices, stats = self.optix_module.lod_simplify_scene(
+                scene_triangles, None, bounds, config.LOD_MIN_DISTANCE, config.LOD_MAX_ANGLE_DEG
+            )
+            report_lod(stats["triangles_in"], stats["triangles_out"], stats["max_angle_deg"])
+            self.lod_scene = (key, points, indices)
+        return self.lod_scene[1], self.lod_scene[2]
+
+    def _far_field_meshes(self, context_meshes, bounds):
+        """
+        context_meshes with every prim beyond config.LOD_MIN_DISTANCE replaced
+        by its proxy. Proxies are cached per (geometry, cell), and cells are
+        powers of two, so a stable scene maps to the same proxies (and GAS)
+        job after job. Prims that collapse entirely (smaller than one cell) drop out.
+        """
+        out = []
+        triangles_in = triangles_out = proxies = 0
+        for mesh in context_meshes:
+            cell = self.optix_module.lod_cell(
+                mesh["points"], mesh["transform"], bounds, config.LOD_MIN_DISTANCE, config.LOD_MAX_ANGLE_DEG
+            )
+            if cell == 0.0:
+                out.append(mesh)
+                continue
+            lod_key = (mesh["key"], cell)
+            proxy = self.lod_meshes.get(lod_key)
+            if proxy is None:
+                points, indices, stats = self.optix_module.lod_cluster_mesh(mesh["points"], mesh["indices"], cell)
+                proxy = {
+                    "points": points,
+                    "indices": indices,
+                    "key": f"{mesh['key']}@{cell:g}",
+                    "topology": hashlib.blake2b(indices.tobytes(), digest_size=16).hexdigest(),
+                    "triangles_in": stats["triangles_in"],
+                }
+                self.lod_meshes[lod_key] = proxy
+                while len(self.lod_meshes) > config.LOD_CACHE_ENTRIES:
+                    self.lod_meshes.popitem(last=False)
+            else:
+                self.lod_meshes.move_to_end(lod_key)
+            triangles_in += proxy["triangles_in"]
+            triangles_out += len(proxy["indices"])
+            proxies += 1
+            if len(proxy["indices"]):
+                out.append(dict(mesh, **{k: proxy[k] for k in ("points", "indices", "key", "topology")}))
+        if proxies:
+            report_lod(triangles_in, triangles_out, config.LOD_MAX_ANGLE_DEG, proxies)
+        return out
+
+
+def is_device_error(optix_module, error):
+    """
+    True for a CUDA / OptiX failure that may have left the engine's CUDA
+    context unusable. Out-of-memory is not one: the engine already retried
+    with less and stays usable.
+    """
+    types = tuple(
+        getattr(optix_module, name) for name in ("CudaError", "OptixError") if hasattr(optix_module, name)
+    )
+    oom = getattr(optix_module, "CudaOutOfMemory", None)
+    return bool(types) and isinstance(error, types) and not (oom is not None and isinstance(error, oom))
+
+
+def adaptive_tolerance(output_visibility, samples_per_face):
+    """config.ADAPTIVE_TOLERANCE_DEG when an adaptive trace applies, 0 = trace every sun"""
+    if not config.ADAPTIVE_ENABLED or output_visibility or samples_per_face > 1:
+        return 0.0
+    return config.ADAPTIVE_TOLERANCE_DEG
+
+
+def lod_target_bounds(targets, ray_offset=0.0):
+    """
+    (2, 3) [min, max] box around the target faces (and corners) of a trace,
+    padded by the ray offset and snapped outward to a min_distance / 2 grid.
+    Growing the box only shortens distances (finer proxies), and small target
+    edits keep the same box, so the same proxies and GAS.
+    """
+    points = [np.asarray(c, dtype=np.float32).reshape(-1, 3) for c, _ in targets]
+    points += [np.asarray(v, dtype=np.float32).reshape(-1, 3) for _, v in targets if v is not None]
+    points = np.concatenate(points)
+    step = max(config.LOD_MIN_DISTANCE / 2, 1.0)
+    lo = np.floor((points.min(axis=0) - ray_offset) / step) * step
+    hi = np.ceil((points.max(axis=0) + ray_offset) / step) * step
+    return np.ascontiguousarray([lo, hi], dtype=np.float32)
+
+
+def report_lod(triangles_in, triangles_out, max_angle_deg, proxies=None):
+    """Print what the far-field LOD replaced and its accuracy bound"""
+    where = f" in {proxies} far prims" if proxies is not None else " beyond the near field"
+    print(
+        f"  LOD: {triangles_in} -> {triangles_out} triangles{where}, "
+        f"vertices move <= {max_angle_deg:.2f} deg as seen from the target"
+    )
+
+
+def report_device_stats(stats):
+    """Print per-device share of a multi-GPU trace and how balanced it was"""
+    print("  Per-device trace:")
+    for st in stats:
+        print(
+            f"    GPU {st['device']}: {st['face_count']} faces, {st['trace_ms']:.1f} ms, "
+            f"{st['rays_per_second'] / 1e6:.1f} Mrays/s, efficiency {st['efficiency'] * 100:.0f}%"
+        )
+
+
+def report_gas_cache(engine):
+    """Print GAS cache counters (no-op when the module has no cache)"""
+    stats = getattr(engine, "gas_cache_stats", None)
+    if not stats or not (stats["hits"] or stats["disk_hits"] or stats["misses"]):
+        return
+    print(
+        f"  GAS cache: {stats['hits']} hits, {stats['disk_hits']} disk hits, "
+        f"{stats['misses']} misses, {stats['evictions']} evictions, "
+        f"{stats['entries']} entries ({stats['bytes'] / 2**20:.1f} / "
+        f"{stats['budget_bytes'] / 2**20:.0f} MB)"
+    )
+
+
+def aggregate_triangles(triangle_results, triangle_face, triangle_areas, face_count):
+    """Area-weighted mean of per-triangle results for each face"""
+    weights = np.bincount(triangle_face, weights=triangle_areas, minlength=face_count)
+    totals = np.bincount(
+        triangle_face, weights=triangle_results * triangle_areas, minlength=face_count
+    )
+    out = np.zeros(face_count, dtype=np.float32)
+    np.divide(totals, weights, out=out, where=weights > 0, casting="unsafe")
+    return out
+
+
+def get_persistent_engine(devices=None):
+    """Return the process-wide warm engine, creating it on first use"""
+    global _persistent_engine
+    with _persistent_engine_lock:
+        if _persistent_engine is None:
+            _persistent_engine = PersistentEngine(setup_optix_module(), devices)
+        return _persistent_engine
+
+
+def run_optix_analysis(
+    scene_data,
+    optix_module,
+    engine=None,
+    devices=None,
+    output_visibility=False,
+    mode=None,
+    samples_per_face=None,
+):
     """
     Run OptiX analysis on USD scene data
 
     Args:
         scene_data: Dict from read_solar_usd() containing target, context, params
         optix_module: Loaded solar_engine_optix module
+        engine: Optional PersistentEngine; when given, the pipeline and GAS are reused
+        devices: CUDA devices for the one-shot path (default config.GPU_DEVICES)
+        output_visibility: Also record which suns reach each face
+        mode: "sunHours" (lit-sun counts), "radiation" (direct kWh/m2 from the
+            EPW's DNI) or "sky" (direct + diffuse kWh/m2 from a cumulative sky
+            matrix over scene_data["sky_patches"] patches); defaults to
+            scene_data["mode"]
+        samples_per_face: Stratified points per target triangle (k * k); above 1
+            the target is traced per triangle and averaged back per face by area.
+            Defaults to scene_data["samples_per_face"]
 
     Returns:
-        numpy array of sun hours per face
+        numpy array of sun hours (or kWh/m2) per face, or (results, visibility) with
+        output_visibility (bit-packed, see usd_io.unpack_visibility; the sun
+        count is stored in scene_data["sun_count"])
+    """
+    prepared = prepare_analysis(scene_data, optix_module, output_visibility, mode, samples_per_face)
+    results = run_prepared(prepared, optix_module, engine, devices)
+    scene_data["sun_count"] = prepared["sun_count"]
+    return results
+
+
+def prepare_analysis(scene_data, optix_module, output_visibility=False, mode=None, samples_per_face=None):
+    """
+    CPU half of run_optix_analysis: sun vectors, validation and target layout
+
+    Returns a dict for run_prepared(). Nothing touches the GPU, so the
+    scheduler prepares the next job while the previous one traces. Jobs whose
+    "batch_key" match trace the same scene with the same suns and settings and
+    can be merged with merge_prepared().
     """
 
     # Extract data
-    face_centers = scene_data["target"]["face_centers"]
-    face_normals = scene_data["target"]["face_normals"]
+    # float32 C-contiguous so the bindings borrow the buffers instead of converting
+    face_centers = np.ascontiguousarray(scene_data["target"]["face_centers"], dtype=np.float32)
+    face_normals = np.ascontiguousarray(scene_data["target"]["face_normals"], dtype=np.float32)
     scene_triangles = scene_data["context"]
     params = scene_data["lb_params"]
 
@@ -116,7 +674,9 @@ def run_optix_analysis(scene_data, optix_module):
     if not os.path.exists(epw_path):
         raise ValueError("Missing or invalid epw file path")
 
-    sun_vectors = lb.get_sun_vectors(
+    mode = mode or scene_data.get("mode", "sunHours")
+    samples_per_face = int(samples_per_face or scene_data.get("samples_per_face", 1))
+    period = (
         epw_path,
         params["month_start"],
         params["month_end"],
@@ -126,16 +686,54 @@ def run_optix_analysis(scene_data, optix_module):
         params["hour_end"],
         params["timestep"],
     )
+    if mode == "sky" and output_visibility:
+        raise ValueError("Visibility output is not available for sky analysis")
+
+    # Uploaded EPWs land at a new path per job; key the weather by content
+    with open(epw_path, "rb") as f:
+        weather_key = hashlib.blake2b(f.read(), digest_size=16).hexdigest()
+
+    # Sun and radiation modes compute the sun path on the GPU at run time:
+    # resident in the engine when there is one, otherwise handed to the one-shot analyze
+    native_suns = (
+        config.NATIVE_SUN_PATH and mode in ("sunHours", "radiation") and hasattr(optix_module, "sun_path")
+    )
+    sun_path = None
+    hourly_dni = None
+    sun_vectors = None
+    sun_weights = None
+    if native_suns:
+        sun_path = lb.read_epw_location(epw_path) + period[1:]
+        if mode == "radiation":
+            # Weights are DNI x step length / 1000, so the sum is kWh/m2
+            hourly_dni = lb.get_hourly_dni(epw_path)
+    elif mode == "radiation":
+        # Each sun carries its DNI x step energy; one pass gives kWh/m2
+        sun_vectors, sun_weights = lb.get_weighted_sun_vectors(*period)
+        sun_weights = np.asarray(sun_weights, dtype=np.float32)
+    elif mode == "sunHours":
+        sun_vectors = lb.get_sun_vectors(*period)
+    elif mode == "sky":
+        # Sky patches stand in for the suns: already (P, 3) arrays
+        sun_vectors, sun_weights = lb.get_sky_matrix(
+            *period, patch_count=int(scene_data.get("sky_patches", 145))
+        )
+    else:
+        raise ValueError(f"Unknown analysis mode: {mode}")
 
     # Convert sun vectors to numpy array
-    sun_vectors = np.array([(v.x, v.y, v.z) for v in sun_vectors], dtype=np.float32)
+    if sun_vectors is not None and not isinstance(sun_vectors, np.ndarray):
+        sun_vectors = np.array([(v.x, v.y, v.z) for v in sun_vectors], dtype=np.float32)
 
     # Validate inputs
     print("\n=== Analysis Input ===")
     print(f"  Face centers: {face_centers.shape}")
     print(f"  Face normals: {face_normals.shape}")
     print(f"  Scene triangles: {scene_triangles.shape}")
-    print(f"  Sun vectors: {sun_vectors.shape}")
+    if sun_vectors is not None:
+        print(f"  Sun vectors: {sun_vectors.shape}")
+    else:
+        print(f"  Sun path: {sun_path} (generated on the GPU)")
     print(f"  Ray offset: {params['offset']}")
 
     # Data validation
@@ -145,29 +743,236 @@ def run_optix_analysis(scene_data, optix_module):
         raise ValueError("Invalid face_normals: contains NaN or Inf")
     if np.isnan(scene_triangles).any() or np.isinf(scene_triangles).any():
         raise ValueError("Invalid scene_triangles: contains NaN or Inf")
-    if np.isnan(sun_vectors).any() or np.isinf(sun_vectors).any():
+    if sun_vectors is not None and (np.isnan(sun_vectors).any() or np.isinf(sun_vectors).any()):
         raise ValueError("Invalid sun_vectors: contains NaN or Inf")
 
+    # Supersampling traces the target per triangle from its corners
+    target = scene_data["target"]
+    face_count = len(face_centers)
+    face_vertices = None
+    triangle_face = None
+    triangle_areas = None
+    if samples_per_face > 1:
+        if output_visibility:
+            raise ValueError("Visibility output is not available with samples_per_face > 1")
+        face_vertices = np.ascontiguousarray(target["triangle_vertices"], dtype=np.float32)
+        triangle_face = target["triangle_face"]
+        triangle_areas = target["triangle_areas"]
+        face_normals = np.ascontiguousarray(face_normals[triangle_face])
+        face_centers = np.ascontiguousarray(face_vertices.mean(axis=1), dtype=np.float32)
+        print(f"  Supersampling: {len(face_vertices)} triangles x {samples_per_face} samples")
+
+    context_key = PersistentEngine._scene_key(scene_triangles)
+    return {
+        "face_centers": face_centers,
+        "face_normals": face_normals,
+        "face_vertices": face_vertices,
+        "triangle_face": triangle_face,
+        "triangle_areas": triangle_areas,
+        "face_count": face_count,
+        "scene_triangles": scene_triangles,
+        "context_meshes": scene_data.get("context_meshes"),
+        "context_key": context_key,
+        "mode": mode,
+        "samples_per_face": samples_per_face,
+        "output_visibility": output_visibility,
+        "offset": float(params["offset"]),
+        "sun_path": sun_path,
+        "hourly_dni": hourly_dni,
+        "dni_key": weather_key,
+        "sun_vectors": sun_vectors,
+        "sun_weights": sun_weights,
+        "sun_count": len(sun_vectors) if sun_vectors is not None else None,
+        # Same scene, same suns, same settings: one launch can serve both jobs
+        "batch_key": (
+            context_key,
+            weather_key,
+            mode,
+            tuple(period[1:]),
+            int(scene_data.get("sky_patches", 145)) if mode == "sky" else None,
+            float(params["offset"]),
+            samples_per_face,
+            output_visibility,
+        ),
+    }
+
+
+def merge_prepared(batch):
+    """
+    Concatenate the targets of prepared jobs sharing a batch_key into one
+
+    Returns the merged job; split its results back with split_results() and
+    the per-job face counts.
+    """
+    if len(batch) == 1:
+        return batch[0]
+    merged = dict(batch[0])
+    for name in ("face_centers", "face_normals", "face_vertices", "triangle_areas"):
+        if merged[name] is not None:
+            merged[name] = np.ascontiguousarray(np.concatenate([p[name] for p in batch]))
+    if merged["triangle_face"] is not None:
+        # Triangle -> face indices continue where the previous job's faces end
+        offsets = np.cumsum([0] + [p["face_count"] for p in batch[:-1]])
+        merged["triangle_face"] = np.concatenate(
+            [p["triangle_face"] + off for p, off in zip(batch, offsets)]
+        )
+    merged["face_count"] = sum(p["face_count"] for p in batch)
+    return merged
+
+
+def split_results(results, face_counts):
+    """Per-job slices of a merged run_prepared() result (results or (results, visibility))"""
+    bounds = np.cumsum(face_counts)[:-1]
+    if isinstance(results, tuple):
+        values, visibility = results
+        return list(zip(np.split(values, bounds), np.split(visibility, bounds)))
+    return np.split(results, bounds)
+
+
+def run_prepared(prepared, optix_module, engine=None, devices=None, progress=None):
+    """
+    GPU half of run_optix_analysis on a prepare_analysis() (or merged) job
+
+    Returns results as run_optix_analysis does and leaves the sun count in
+    prepared["sun_count"]. With progress, large sun-hour / radiation jobs on a
+    warm engine trace in config.PROGRESSIVE_PASSES passes and call
+    progress(done, passes, preview) after each (per-face values, as results).
+    """
+    devices = list(devices if devices is not None else config.GPU_DEVICES)
+    mode = prepared["mode"]
+    samples_per_face = prepared["samples_per_face"]
+    output_visibility = prepared["output_visibility"]
+    face_centers = prepared["face_centers"]
+    face_normals = prepared["face_normals"]
+    face_vertices = prepared["face_vertices"]
+    scene_triangles = prepared["scene_triangles"]
+    sun_vectors = prepared["sun_vectors"]
+    sun_weights = prepared["sun_weights"]
+    offset = prepared["offset"]
+
+    # Sky and supersampling only exist on the engine; a one-shot engine when no warm one is given
+    if engine is None and (mode == "sky" or samples_per_face > 1):
+        run_engine = PersistentEngine(optix_module, devices)
+    else:
+        run_engine = engine
+
+    # Progressive passes take explicit sun subsets, so a native sun path is fetched to the host
+    progressive = (
+        progress is not None
+        and run_engine is not None
+        and config.PROGRESSIVE_PASSES > 1
+        and mode in ("sunHours", "radiation")
+        and not output_visibility
+    )
+    if sun_vectors is None and (run_engine is None or progressive):
+        device = run_engine.devices[0] if run_engine is not None else devices[0]
+        sun_vectors, sun_weights = optix_module.sun_path(
+            *prepared["sun_path"], hourly_dni=prepared["hourly_dni"], device=device
+        )
+        prepared["sun_count"] = len(sun_vectors)
+    if progressive:
+        progressive = len(face_centers) * len(sun_vectors) >= config.PROGRESSIVE_MIN_RAYS
+
     # Run analysis
     print("\n Running OptiX analysis...")
     start_time = time.time()
 
-    results = optix_module.analyze(
-        face_centers,
-        face_normals,
-        scene_triangles,
-        sun_vectors,
-        float(params["offset"]),
-    )
+    if run_engine is not None:
+        # Per-prim meshes let the warm engine refit/instance instead of rebuilding
+        scene = scene_triangles
+        if engine is not None and prepared["context_meshes"] is not None:
+            scene = prepared["context_meshes"]
+        if progressive:
+
+            def on_pass(done, passes, preview):
+                if samples_per_face > 1:
+                    preview = aggregate_triangles(
+                        preview, prepared["triangle_face"], prepared["triangle_areas"], prepared["face_count"]
+                    )
+                progress(done, passes, preview)
+
+            results = run_engine.analyze_progressive(
+                face_centers,
+                face_normals,
+                scene,
+                sun_vectors,
+                offset,
+                config.PROGRESSIVE_PASSES,
+                on_pass,
+                sun_weights,
+                face_vertices,
+                samples_per_face,
+            )
+        elif mode == "sky":
+            results = run_engine.analyze_sky(
+                face_centers,
+                face_normals,
+                scene,
+                sun_vectors,
+                sun_weights,
+                offset,
+                face_vertices,
+                samples_per_face,
+            )
+        elif sun_vectors is None:
+            results = run_engine.analyze_sun_path(
+                face_centers,
+                face_normals,
+                scene,
+                prepared["sun_path"],
+                offset,
+                prepared["hourly_dni"],
+                prepared["dni_key"],
+                output_visibility,
+                face_vertices,
+                samples_per_face,
+            )
+            prepared["sun_count"] = run_engine.sun_path_count
+        else:
+            results = run_engine.analyze(
+                face_centers,
+                face_normals,
+                scene,
+                sun_vectors,
+                offset,
+                output_visibility,
+                sun_weights,
+                face_vertices,
+                samples_per_face,
+            )
+    else:
+        results = optix_module.analyze(
+            face_centers,
+            face_normals,
+            scene_triangles,
+            sun_vectors,
+            offset,
+            devices=devices,
+            output_visibility=output_visibility,
+            sun_weights=sun_weights,
+        )
+
+    if samples_per_face > 1:
+        results = aggregate_triangles(
+            results, prepared["triangle_face"], prepared["triangle_areas"], prepared["face_count"]
+        )
+
+    visibility = None
+    if output_visibility:
+        results, visibility = results
 
     elapsed = time.time() - start_time
 
+    unit = "sun hours" if mode == "sunHours" else "kWh/m2"
     print(f"\n Analysis complete in {elapsed:.3f}s")
-    print(f"   Total sun hours: {results.sum():.1f}")
+    print(f"   Total {unit}: {results.sum():.1f}")
     print(f"   Average per face: {results.mean():.1f}")
-    print(f"   Max sun hours: {results.max():.1f}")
+    print(f"   Max {unit}: {results.max():.1f}")
     print(f"   Faces with sun: {np.count_nonzero(results)}/{len(results)}")
 
+    if output_visibility:
+        print(f"   Visibility matrix: {visibility.shape} words ({visibility.nbytes / 2**20:.1f} MB)")
+        return results, visibility
     return results
 
 
@@ -175,4 +980,7 @@ if __name__ == "__main__":
     
     optix_module = setup_optix_module()
     print(optix_module)
+    if len(sys.argv) > 1:
+        # python engine.py weather.epw: check the GPU sun path against ladybug
+        lb.validate_native_sun_path(sys.argv[1], optix_module)
     #results = run_optix_analysis(usd_path, optix_module)
@@ -0,0 +1,123 @@
+"""
+Prometheus text exposition of the analysis server's counters
+
+Renders the per-GPU engine metrics (CUDA-event stage timings, rays, GAS, pool and
+device memory, GAS cache counters) kept by each worker's PersistentEngine,
+plus job and scheduler gauges, for GET /metrics. No client library needed.
+"""
+
+# Engine metrics key -> stage label of soba_stage_seconds_total
+STAGES = {
+    "module_ms": "module",
+    "gas_build_ms": "gas_build",
+    "upload_ms": "upload",
+    "trace_ms": "trace",
+    "readback_ms": "readback",
+}
+
+JOB_STATUSES = ("queued", "processing", "complete", "error")
+
+CONTENT_TYPE = "text/plain; version=0.0.4; charset=utf-8"
+
+
+class _Writer:
+    def __init__(self):
+        self.lines = []
+
+    def metric(self, name, kind, help_text, samples):
+        """samples: list of (labels dict, value)"""
+        self.lines.append(f"# HELP {name} {help_text}")
+        self.lines.append(f"# TYPE {name} {kind}")
+        for labels, value in samples:
+            label_text = ",".join(f'{k}="{v}"' for k, v in labels.items())
+            self.lines.append(f"{name}{{{label_text}}} {value}" if label_text else f"{name} {value}")
+
+    def text(self):
+        return "\n".join(self.lines) + "\n"
+
+
+def render(engine_metrics, jobs, scheduler_stats):
+    """
+    Args:
+        engine_metrics: device -> PersistentEngine.last_metrics
+        jobs: The server's job_id -> job dict
+        scheduler_stats: GpuScheduler.stats()
+
+    Returns the exposition text
+    """
+    w = _Writer()
+    devices = sorted(engine_metrics.items())
+
+    def per_device(key, scale=1):
+        return [({"device": d}, m[key] * scale) for d, m in devices if key in m]
+
+    w.metric(
+        "soba_stage_seconds_total",
+        "counter",
+        "GPU time per engine stage (CUDA events; module is host time)",
+        [
+            ({"device": d, "stage": stage}, m[key] / 1000.0)
+            for d, m in devices
+            for key, stage in STAGES.items()
+            if key in m
+        ],
+    )
+    w.metric("soba_rays_total", "counter", "Rays traced", per_device("rays"))
+    w.metric("soba_traces_total", "counter", "Trace calls", per_device("traces"))
+    w.metric(
+        "soba_rays_per_second",
+        "gauge",
+        "Rays over cumulative trace time",
+        per_device("rays_per_second"),
+    )
+    w.metric("soba_gas_bytes", "gauge", "Device bytes of the live GAS", per_device("gas_bytes"))
+    w.metric(
+        "soba_peak_device_memory_bytes",
+        "gauge",
+        "Highest device memory use seen at trace time",
+        per_device("peak_device_bytes"),
+    )
+    w.metric(
+        "soba_memory_pool_bytes",
+        "gauge",
+        "VRAM reserved by the per-job buffer pool",
+        per_device("pool_reserved_bytes"),
+    )
+
+    cache = [(d, m["gas_cache"]) for d, m in devices if m.get("gas_cache")]
+    for key in ("hits", "disk_hits", "misses", "evictions", "disk_writes"):
+        w.metric(
+            f"soba_gas_cache_{key}_total",
+            "counter",
+            f"GAS cache {key.replace('_', ' ')}",
+            [({"device": d}, c[key]) for d, c in cache],
+        )
+    w.metric(
+        "soba_gas_cache_bytes",
+        "gauge",
+        "VRAM held by the GAS cache",
+        [({"device": d}, c["bytes"]) for d, c in cache],
+    )
+
+    statuses = [j.get("status") for j in list(jobs.values())]
+    w.metric(
+        "soba_jobs",
+        "gauge",
+        "Jobs by status",
+        [({"status": s}, statuses.count(s)) for s in JOB_STATUSES],
+    )
+    w.metric(
+        "soba_queue_depth",
+        "gauge",
+        "Jobs waiting for prep (pending) or a GPU (ready)",
+        [({"queue": q}, scheduler_stats[q]) for q in ("pending", "ready")],
+    )
+    w.metric("soba_workers_busy", "gauge", "GPU workers tracing", [({}, scheduler_stats["busy"])])
+    w.metric("soba_launches_total", "counter", "Scheduler launches", [({}, scheduler_stats["launches"])])
+    w.metric(
+        "soba_merged_jobs_total",
+        "counter",
+        "Jobs that shared a launch",
+        [({}, scheduler_stats["merged_jobs"])],
+    )
+    return w.text()
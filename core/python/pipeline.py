@@ -1,14 +1,90 @@
 import os
-import usd_io, engine
+import usd_io, engine, results_codec
 
 
-def analyze_solar_scene(usd_path, output_path=None):
+def read_scene(usd_path, epw_path=None):
+    """
+    Step 1 of the pipeline: read the analysis USD into a scene_data dict
+
+    epw_path overrides the solar:epwFile stored in the USD (the server's uploaded copy).
+    """
+    scene_data = usd_io.read_solar_usd(usd_path)
+    scene_data["usd_path"] = usd_path  # Store for EPW path resolution
+    if epw_path is not None:
+        scene_data["epw_file"] = epw_path
+    print(f"  Loaded {len(scene_data['target']['face_centers'])} faces")
+    print(f"  Loaded {len(scene_data['context'])} triangles")
+    return scene_data
+
+
+def result_name(mode):
+    """Primvar / SOBR name of a mode's results"""
+    return {
+        "radiation": "solar:directRadiation",
+        "sky": "solar:radiation",
+    }.get(mode, "solar:sunHours")
+
+
+def write_results(
+    usd_path,
+    scene_data,
+    results,
+    visibility=None,
+    output_path=None,
+    write_usd=True,
+    write_csv=True,
+):
+    """
+    Step 3 of the pipeline: results next to usd_path
+
+    Always writes {base}_results.sobr (results_codec, uncompressed float32);
+    the colored results USD and the CSV are optional.
+
+    Returns {"sobr": path, "usd": path or None, "csv": path or None}
+    """
+    base, ext = os.path.splitext(usd_path)
+    paths = {"sobr": f"{base}_results.sobr", "usd": None, "csv": None}
+
+    sun_count = scene_data.get("sun_count")
+    name = result_name(scene_data.get("mode"))
+    results_codec.write(
+        paths["sobr"],
+        results,
+        result_name=name,
+        compression="none",
+        visibility=visibility,
+        sun_count=sun_count,
+    )
+    print(f"    Saved results to: {paths['sobr']}")
+
+    if write_usd:
+        # Same format as the input (a binary .usdc job gets a .usdc result)
+        paths["usd"] = output_path or f"{base}_results{ext or '.usda'}"
+        usd_io.write_results_to_usd(
+            usd_path,
+            results,
+            output_usd_path=paths["usd"],
+            visibility=visibility,
+            sun_count=sun_count,
+            result_name=name,
+        )
+        print(f"    Saved USD to: {paths['usd']}")
+    if write_csv:
+        paths["csv"] = f"{base}_results.csv"
+        usd_io.write_results_csv(paths["csv"], results, visibility=visibility, sun_count=sun_count)
+        print(f"    Saved CSV to: {paths['csv']}")
+    return paths
+
+
+def analyze_solar_scene(usd_path, output_path=None, solar_engine=None, output_visibility=False):
     """
     Complete solar analysis pipeline
 
     Args:
         usd_path: Path to input USD file
-        output_path: Path for output USD (optional, defaults to input_results.usda)
+        output_path: Path for output USD (optional, defaults to input_results.<input extension>)
+        solar_engine: Optional engine.PersistentEngine to reuse between calls
+        output_visibility: Also store per-sun visibility (solar:visibility primvar, CSV column)
 
     Returns:
         numpy array of results
@@ -22,10 +98,7 @@ def analyze_solar_scene(usd_path, output_path=None):
     print(f"\nStep 1: Reading USD file {usd_path}")
 
     try:
-        scene_data = usd_io.read_solar_usd(usd_path)
-        scene_data["usd_path"] = usd_path  # Store for EPW path resolution
-        print(f"  Loaded {len(scene_data['target']['face_centers'])} faces")
-        print(f"  Loaded {len(scene_data['context'])} triangles")
+        scene_data = read_scene(usd_path)
     except Exception as e:
         print(f" Failed to read USD: {e}")
         import traceback
@@ -37,7 +110,12 @@ def analyze_solar_scene(usd_path, output_path=None):
     print("\nStep 2: Running analysis...")
     try:
         optix_module = engine.setup_optix_module()
-        results = engine.run_optix_analysis(scene_data, optix_module)
+        visibility = None
+        results = engine.run_optix_analysis(
+            scene_data, optix_module, solar_engine, output_visibility=output_visibility
+        )
+        if output_visibility:
+            results, visibility = results
     except Exception as e:
         print(f" Analysis failed: {e}")
         import traceback
@@ -47,15 +125,7 @@ def analyze_solar_scene(usd_path, output_path=None):
 
     # Step 3: Write results (TODO)
     print("\nStep 3: Writing results to USD...")
-    if output_path is None:
-        base = os.path.splitext(usd_path)[0]
-        output_path = f"{base}_results.usda"
-        csv_path = f"{base}_results.csv"
-
-    usd_io.write_results_to_usd(usd_path, results, output_usd_path=None)
-    usd_io.write_results_csv(csv_path, results)
-    print(f"    Saved USD to: {output_path}")
-    print(f"    Saved CSV to: {output_path}")
+    output_path = write_results(usd_path, scene_data, results, visibility, output_path)["usd"]
 
     print("\n" + "=" * 70)
     print("🎉 PIPELINE COMPLETE!")
@@ -0,0 +1,171 @@
+"""
+SOBR: compact binary per-face results
+
+A 32-byte little-endian header, the result primvar name, then the payload:
+one float32 or float16 per face, optionally followed by the bit-packed
+(faces, ceil(suns / 32)) uint32 visibility matrix, compressed as a whole with
+zlib or zstd. Replaces shipping the colored results .usda back to clients,
+which color the values themselves (colormap.results_to_colors).
+
+Only needs numpy (zstd additionally the zstandard package), so the Maya
+client can decode it.
+"""
+
+import struct
+import zlib
+
+import numpy as np
+
+try:
+    import zstandard
+except ImportError:
+    zstandard = None
+
+MAGIC = b"SOBR"
+VERSION = 1
+
+# magic, version, dtype, compression, face_count, sun_count (0 = no visibility),
+# name length, reserved, results min, results max
+HEADER = struct.Struct("<4sHBBQIHHff")
+
+DTYPES = {"float32": 0, "float16": 1}
+COMPRESSIONS = {"none": 0, "zlib": 1, "zstd": 2}
+
+FLOAT16_MAX = float(np.finfo(np.float16).max)
+
+
+def available_compressions():
+    """Compressions this interpreter can encode and decode"""
+    return [c for c in COMPRESSIONS if c != "zstd" or zstandard is not None]
+
+
+def encode(
+    results,
+    result_name="solar:sunHours",
+    dtype="float32",
+    compression="zlib",
+    visibility=None,
+    sun_count=None,
+):
+    """
+    Pack per-face results into SOBR bytes
+
+    Args:
+        results: (faces,) per-face values
+        result_name: Primvar the values belong to (tells the client the units)
+        dtype: "float32" or "float16"; float16 falls back to float32 when the
+            values exceed its range
+        compression: "none", "zlib" or "zstd"
+        visibility: Optional bit-packed (faces, words) uint32 visibility matrix
+        sun_count: Number of suns packed in visibility; defaults to 32 per word
+    """
+    if dtype not in DTYPES:
+        raise ValueError(f"Unknown SOBR dtype: {dtype}")
+    if compression not in COMPRESSIONS:
+        raise ValueError(f"Unknown SOBR compression: {compression}")
+    if compression == "zstd" and zstandard is None:
+        raise ValueError("zstd compression needs the zstandard package")
+
+    results = np.asarray(results, dtype=np.float32).ravel()
+    vmin = float(results.min()) if len(results) else 0.0
+    vmax = float(results.max()) if len(results) else 0.0
+    if dtype == "float16" and max(abs(vmin), abs(vmax)) > FLOAT16_MAX:
+        dtype = "float32"
+
+    payload = results.astype("<f2" if dtype == "float16" else "<f4").tobytes()
+    if visibility is not None:
+        visibility = np.ascontiguousarray(visibility, dtype="<u4").reshape(len(results), -1)
+        words = visibility.shape[1]
+        if not sun_count:
+            # Every packed bit counts as a sun
+            sun_count = words * 32
+        if words == 0 or (sun_count + 31) // 32 != words:
+            raise ValueError(f"visibility has {words} words per face, {sun_count} suns need {(sun_count + 31) // 32}")
+        payload += visibility.tobytes()
+    else:
+        sun_count = 0
+
+    if compression == "zlib":
+        payload = zlib.compress(payload, 6)
+    elif compression == "zstd":
+        payload = zstandard.ZstdCompressor(level=3).compress(payload)
+
+    name = result_name.encode()
+    header = HEADER.pack(
+        MAGIC,
+        VERSION,
+        DTYPES[dtype],
+        COMPRESSIONS[compression],
+        len(results),
+        int(sun_count),
+        len(name),
+        0,
+        vmin,
+        vmax,
+    )
+    return header + name + payload
+
+
+def decode(data):
+    """
+    Unpack SOBR bytes
+
+    Returns a dict with results (float32), visibility (uint32 or None),
+    sun_count, result_name, min and max
+    """
+    if len(data) < HEADER.size:
+        raise ValueError("Truncated SOBR header")
+    magic, version, dtype, compression, face_count, sun_count, name_len, _, vmin, vmax = (
+        HEADER.unpack_from(data)
+    )
+    if magic != MAGIC:
+        raise ValueError("Not a SOBR results file")
+    if version != VERSION:
+        raise ValueError(f"Unsupported SOBR version {version}")
+    if dtype not in DTYPES.values():
+        raise ValueError(f"Unknown SOBR dtype id {dtype}")
+
+    offset = HEADER.size
+    result_name = bytes(data[offset:offset + name_len]).decode()
+    payload = bytes(data[offset + name_len:])
+    if compression == COMPRESSIONS["zlib"]:
+        payload = zlib.decompress(payload)
+    elif compression == COMPRESSIONS["zstd"]:
+        if zstandard is None:
+            raise ValueError("SOBR payload is zstd compressed; install zstandard")
+        payload = zstandard.ZstdDecompressor().decompress(payload)
+    elif compression != COMPRESSIONS["none"]:
+        raise ValueError(f"Unknown SOBR compression id {compression}")
+
+    value_type = "<f2" if dtype == DTYPES["float16"] else "<f4"
+    value_bytes = face_count * np.dtype(value_type).itemsize
+    words = (sun_count + 31) // 32
+    if len(payload) != value_bytes + face_count * words * 4:
+        raise ValueError("SOBR payload size does not match its header")
+
+    results = np.frombuffer(payload, dtype=value_type, count=face_count).astype(np.float32)
+    visibility = None
+    if sun_count:
+        visibility = np.frombuffer(payload, dtype="<u4", offset=value_bytes).reshape(
+            face_count, words
+        )
+    return {
+        "results": results,
+        "visibility": visibility,
+        "sun_count": sun_count,
+        "result_name": result_name,
+        "min": vmin,
+        "max": vmax,
+    }
+
+
+def write(path, results, **kwargs):
+    """encode() to a file; returns path"""
+    with open(path, "wb") as f:
+        f.write(encode(results, **kwargs))
+    return path
+
+
+def read(path):
+    with open(path, "rb") as f:
+        return decode(f.read())
@@ -0,0 +1,163 @@
+"""
+SOBS / SOBU: binary scene and sun files of the native soba command line
+
+Exports an analysis USD once, so render-farm nodes trace it with the soba
+executable (core/cpp/soba_cli.cpp) without Python, USD or the server. The
+layouts are documented in core/cpp/scene_io.h; results come back as SOBR
+(results_codec).
+
+    python scene_files.py scene.usda out_dir [weather.epw]
+    soba out_dir/jobs.txt
+"""
+
+import os
+import struct
+import sys
+
+import numpy as np
+
+SCENE_MAGIC = b"SOBS"
+SUN_MAGIC = b"SOBU"
+VERSION = 1
+
+# magic, version, flags (1 = indexed), face_count, vertex_count,
+# triangle_count, ray offset, reserved
+SCENE_HEADER = struct.Struct("<4sHHQQQfI")
+# magic, version, mode, flags (1 = weights), sun_count
+SUN_HEADER = struct.Struct("<4sHBBQ")
+
+# Same modes as prepare_analysis; sky traces its patches with trace_sky
+MODES = {"sunHours": 0, "radiation": 1, "sky": 2}
+
+
+def _floats(values, columns):
+    return np.ascontiguousarray(values, dtype="<f4").reshape(-1, columns)
+
+
+def write_scene(path, face_centers, face_normals, vertices, indices=None, ray_offset=0.0):
+    """
+    Write a SOBS scene; returns path
+
+    Args:
+        face_centers, face_normals: (faces, 3) target faces
+        vertices: Context vertices, (V, 3) with indices or (T, 3, 3) triangles without
+        indices: Optional (T, 3) triangle indices into vertices
+        ray_offset: Ray origin offset along the face normal
+    """
+    centers = _floats(face_centers, 3)
+    normals = _floats(face_normals, 3)
+    vertices = _floats(vertices, 3)
+    if len(centers) != len(normals):
+        raise ValueError("face_centers and face_normals differ in length")
+    if indices is not None:
+        indices = np.ascontiguousarray(indices, dtype="<u4").reshape(-1, 3)
+        triangles = len(indices)
+    elif len(vertices) % 3:
+        raise ValueError("Unindexed context needs 3 vertices per triangle")
+    else:
+        triangles = len(vertices) // 3
+
+    header = SCENE_HEADER.pack(
+        SCENE_MAGIC,
+        VERSION,
+        1 if indices is not None else 0,
+        len(centers),
+        len(vertices),
+        triangles,
+        float(ray_offset),
+        0,
+    )
+    with open(path, "wb") as f:
+        f.write(header)
+        f.write(centers.tobytes())
+        f.write(normals.tobytes())
+        f.write(vertices.tobytes())
+        if indices is not None:
+            f.write(indices.tobytes())
+    return path
+
+
+def write_suns(path, sun_vectors, sun_weights=None, mode="sunHours"):
+    """
+    Write a SOBU sun set (sun vectors or sky patches, pointing down); returns path
+
+    Radiation and sky modes need sun_weights; sunHours takes none.
+    """
+    if mode not in MODES:
+        raise ValueError(f"Unknown analysis mode: {mode}")
+    directions = _floats(sun_vectors, 3)
+    if sun_weights is None and mode != "sunHours":
+        raise ValueError(f"{mode} sun files need weights")
+    if sun_weights is not None and mode == "sunHours":
+        raise ValueError("sunHours sun files take no weights")
+    weights = None
+    if sun_weights is not None:
+        weights = np.ascontiguousarray(sun_weights, dtype="<f4").ravel()
+        if len(weights) != len(directions):
+            raise ValueError("sun_weights and sun_vectors differ in length")
+
+    header = SUN_HEADER.pack(SUN_MAGIC, VERSION, MODES[mode], 1 if weights is not None else 0, len(directions))
+    with open(path, "wb") as f:
+        f.write(header)
+        f.write(directions.tobytes())
+        if weights is not None:
+            f.write(weights.tobytes())
+    return path
+
+
+def _manifest_field(path):
+    # soba splits on whitespace and strips "#" comments; quotes hold either (no escapes)
+    if '"' in path or "\n" in path or "\r" in path:
+        raise ValueError(f"soba manifests cannot hold the path {path!r}")
+    if not path or "#" in path or any(c.isspace() for c in path):
+        return f'"{path}"'
+    return path
+
+
+def write_manifest(path, jobs):
+    """soba job list: (scene, suns, out) paths, written relative to the manifest"""
+    base = os.path.dirname(os.path.abspath(path))
+    with open(path, "w") as f:
+        for job in jobs:
+            f.write(" ".join(_manifest_field(os.path.relpath(os.path.abspath(p), base)) for p in job) + "\n")
+    return path
+
+
+def export_job(usd_path, out_dir, epw_path=None, mode=None):
+    """
+    Export an analysis USD as one soba job (scene, suns, manifest)
+
+    Sun vectors are computed here, on the CPU, as prepare_analysis does without
+    the native sun path. Returns the manifest path.
+    """
+    import pipeline, engine
+
+    os.makedirs(out_dir, exist_ok=True)
+    scene_data = pipeline.read_scene(usd_path, epw_path)
+    prepared = engine.prepare_analysis(scene_data, None, mode=mode, samples_per_face=1)
+
+    name = os.path.splitext(os.path.basename(usd_path))[0]
+    scene_path = write_scene(
+        os.path.join(out_dir, name + ".sobs"),
+        prepared["face_centers"],
+        prepared["face_normals"],
+        prepared["scene_triangles"],
+        ray_offset=prepared["offset"],
+    )
+    suns_path = write_suns(
+        os.path.join(out_dir, name + ".sobu"),
+        prepared["sun_vectors"],
+        prepared["sun_weights"],
+        prepared["mode"],
+    )
+    out_path = os.path.join(out_dir, name + ".sobr")
+    manifest = write_manifest(os.path.join(out_dir, "jobs.txt"), [(scene_path, suns_path, out_path)])
+    print(f"  soba job: {manifest}")
+    return manifest
+
+
+if __name__ == "__main__":
+    if len(sys.argv) not in (3, 4):
+        print("usage: python scene_files.py scene.usda out_dir [weather.epw]")
+        sys.exit(1)
+    export_job(sys.argv[1], sys.argv[2], sys.argv[3] if len(sys.argv) > 3 else None)
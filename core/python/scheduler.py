@@ -0,0 +1,306 @@
+"""
+GPU job scheduler for the analysis server
+
+One worker thread per CUDA device, each owning a warm single-device
+PersistentEngine. A prep thread parses the USD and builds the analysis inputs
+(sun vectors, contiguous target arrays) of upcoming jobs while the workers
+trace, and a writer thread stores the results, so a GPU only waits on its own
+launches. Ready jobs that trace the same context scene with the same suns and
+settings are merged into a single launch. Large jobs trace in progressive
+passes, and each pass leaves a preview of the results in the job dict.
+"""
+
+import queue
+import threading
+import time
+import traceback
+from datetime import datetime
+
+import config
+import engine
+import pipeline
+
+
+class QueueFull(Exception):
+    """Raised by GpuScheduler.submit() when the job queue is at capacity"""
+
+
+class GpuScheduler:
+    def __init__(
+        self,
+        jobs,
+        devices=None,
+        queue_size=None,
+        prefetch=None,
+        merge_max_faces=None,
+    ):
+        """
+        Args:
+            jobs: The server's job_id -> job dict; status, timestamps,
+                result paths, errors and progressive previews ("progress",
+                "preview" as a (version, values, progress) snapshot,
+                "preview_version", "result_name") are written into it
+                (write_usd is read from it)
+            devices: CUDA devices, one worker each (default config.GPU_DEVICES)
+            queue_size: Submitted jobs waiting for prep before submit() refuses
+            prefetch: Prepared jobs held ready per worker (2 = double buffered)
+            merge_max_faces: Face budget of one merged launch
+        """
+        self.jobs = jobs
+        self.devices = list(devices if devices is not None else config.GPU_DEVICES) or [0]
+        self.pending = queue.Queue(maxsize=queue_size or config.SCHEDULER_QUEUE_SIZE)
+        self.ready_capacity = (prefetch or config.SCHEDULER_PREFETCH) * len(self.devices)
+        self.merge_max_faces = merge_max_faces or config.SCHEDULER_MERGE_MAX_FACES
+        # Prepared jobs in submission order, guarded by ready_cond
+        self.ready = []
+        self.ready_cond = threading.Condition()
+        self.finished = queue.Queue()
+        self.threads = []
+        self.stopping = False
+        self.stats_lock = threading.Lock()
+        self.busy = 0
+        self.launches = 0
+        self.merged_jobs = 0
+        # device -> the worker's PersistentEngine, for engine_metrics()
+        self.engines = {}
+
+    def start(self):
+        """Load the OptiX module and start prep, worker and writer threads"""
+        self.optix_module = engine.setup_optix_module()
+        self._spawn(self._prep_loop, "soba-prep")
+        for device in self.devices:
+            self._spawn(self._worker_loop, f"soba-gpu{device}", device)
+        self._spawn(self._writer_loop, "soba-writer")
+        print(f" Scheduler: {len(self.devices)} GPU worker(s) on devices {self.devices}")
+
+    def stop(self):
+        """Let the threads finish their current job and exit"""
+        # Wake the prep thread first: it may be waiting for ready capacity that
+        # exiting workers never free
+        with self.ready_cond:
+            self.stopping = True
+            self.ready_cond.notify_all()
+        # Never block on a full pending queue: queued jobs are dropped on
+        # shutdown anyway, so make room for the sentinel
+        while True:
+            try:
+                self.pending.put_nowait(None)
+                break
+            except queue.Full:
+                try:
+                    self.pending.get_nowait()
+                except queue.Empty:
+                    pass
+        self.finished.put(None)
+        for thread in self.threads:
+            thread.join(timeout=30)
+
+    def submit(self, job_id, usd_path, epw_path):
+        """Queue a job; raises QueueFull instead of waiting when at capacity"""
+        try:
+            self.pending.put_nowait((job_id, usd_path, epw_path))
+        except queue.Full:
+            raise QueueFull(f"{self.pending.maxsize} jobs already queued")
+
+    def stats(self):
+        """Queue depths and launch counters for the health endpoint"""
+        return {
+            "workers": len(self.devices),
+            "busy": self.busy,
+            "pending": self.pending.qsize(),
+            "ready": len(self.ready),
+            "launches": self.launches,
+            "merged_jobs": self.merged_jobs,
+        }
+
+    def engine_metrics(self):
+        """device -> metrics snapshot of its worker's engine as of its last launch"""
+        return {device: e.last_metrics for device, e in list(self.engines.items())}
+
+    def _replace_engine(self, device):
+        """Warm a fresh engine after a GPU error; None disables the worker"""
+        print(f"[GPU {device}] GPU error, recreating the engine")
+        self.engines.pop(device, None)
+        try:
+            solar_engine = engine.PersistentEngine(self.optix_module, [device])
+        except Exception as e:
+            print(f"[GPU {device}] Engine re-creation failed, worker disabled: {e}")
+            return None
+        self.engines[device] = solar_engine
+        return solar_engine
+
+    def _spawn(self, target, name, *args):
+        thread = threading.Thread(target=target, args=args, name=name, daemon=True)
+        thread.start()
+        self.threads.append(thread)
+
+    def _update(self, job_id, **fields):
+        # Jobs can be deleted through the API at any point
+        job = self.jobs.get(job_id)
+        if job is not None:
+            job.update(fields)
+
+    def _fail(self, job_id, error):
+        print(f"[{job_id}]  Error: {error}")
+        self._update(job_id, status="error", error=str(error), traceback=traceback.format_exc())
+
+    def _publisher(self, device, batch, mode):
+        """progress callback of run_prepared: each job's share of the preview into its dict"""
+        counts = [p["face_count"] for *_, p in batch]
+        name = pipeline.result_name(mode)
+
+        def publish(done, passes, preview):
+            for (job_id, *_), part in zip(batch, engine.split_results(preview, counts)):
+                job = self.jobs.get(job_id)
+                if job is None:
+                    continue
+                # One snapshot: a reader of "preview" gets values and version together;
+                # the version is published last, so whoever sees it finds its values
+                version = job.get("preview_version", 0) + 1
+                progress = done / passes
+                job.update(preview=(version, part, progress), result_name=name, progress=progress, passes=passes)
+                job["preview_version"] = version
+            print(f"[GPU {device}] Pass {done}/{passes} published for {len(batch)} job(s)")
+
+        return publish
+
+    def _prep_loop(self):
+        while not self.stopping:
+            item = self.pending.get()
+            if item is None:
+                break
+            job_id, usd_path, epw_path = item
+            if job_id not in self.jobs:
+                continue  # Deleted while queued
+            try:
+                print(f"[{job_id}] Preparing...")
+                scene_data = pipeline.read_scene(usd_path, epw_path)
+                prepared = engine.prepare_analysis(scene_data, self.optix_module)
+            except Exception as e:
+                self._fail(job_id, e)
+                continue
+
+            with self.ready_cond:
+                while len(self.ready) >= self.ready_capacity and not self.stopping:
+                    self.ready_cond.wait()
+                if self.stopping:
+                    break
+                self.ready.append((job_id, usd_path, scene_data, prepared))
+                self.ready_cond.notify_all()
+
+    def _take_batch(self):
+        """Oldest ready job plus later ones it can share a launch with"""
+        with self.ready_cond:
+            while not self.ready and not self.stopping:
+                self.ready_cond.wait()
+            if self.stopping:
+                return None
+            batch = [self.ready.pop(0)]
+            key = batch[0][3]["batch_key"]
+            faces = batch[0][3]["face_count"]
+            i = 0
+            while i < len(self.ready):
+                prepared = self.ready[i][3]
+                if prepared["batch_key"] == key and faces + prepared["face_count"] <= self.merge_max_faces:
+                    batch.append(self.ready.pop(i))
+                    faces += prepared["face_count"]
+                else:
+                    i += 1
+            self.ready_cond.notify_all()
+            return batch
+
+    def _worker_loop(self, device):
+        try:
+            solar_engine = engine.PersistentEngine(self.optix_module, [device])
+        except Exception as e:
+            print(f"[GPU {device}] Engine creation failed, worker disabled: {e}")
+            return
+        self.engines[device] = solar_engine
+        while not self.stopping:
+            batch = self._take_batch()
+            if batch is None:
+                break
+
+            started = datetime.now().isoformat()
+            for job_id, *_ in batch:
+                self._update(job_id, status="processing", started_at=started, device=device)
+            ids = ", ".join(job_id for job_id, *_ in batch)
+            print(f"[GPU {device}] Tracing {len(batch)} job(s): {ids}")
+
+            with self.stats_lock:
+                self.busy += 1
+            start_time = time.time()
+            failed = device_error = False
+            try:
+                prepared = engine.merge_prepared([p for *_, p in batch])
+                results = engine.run_prepared(
+                    prepared,
+                    self.optix_module,
+                    solar_engine,
+                    progress=self._publisher(device, batch, prepared["mode"]),
+                )
+                parts = engine.split_results(results, [p["face_count"] for *_, p in batch])
+            except Exception as e:
+                for job_id, *_ in batch:
+                    self._fail(job_id, e)
+                failed = True
+                device_error = engine.is_device_error(self.optix_module, e)
+            finally:
+                with self.stats_lock:
+                    self.busy -= 1
+
+            if failed:
+                if device_error:
+                    # Past the handler, so the exception's traceback no longer holds
+                    # the old engine: its context is freed before a new one warms up
+                    solar_engine = None
+                    solar_engine = self._replace_engine(device)
+                    if solar_engine is None:
+                        break
+                continue
+
+            with self.stats_lock:
+                self.launches += 1
+                if len(batch) > 1:
+                    self.merged_jobs += len(batch)
+            print(f"[GPU {device}] {len(batch)} job(s) traced in {time.time() - start_time:.3f}s")
+
+            for (job_id, usd_path, scene_data, _), part in zip(batch, parts):
+                scene_data["sun_count"] = prepared["sun_count"]
+                self.finished.put((job_id, usd_path, scene_data, part))
+
+    def _writer_loop(self):
+        while True:
+            item = self.finished.get()
+            if item is None:
+                break
+            job_id, usd_path, scene_data, results = item
+            if job_id not in self.jobs:
+                continue
+            job = self.jobs.get(job_id, {})
+            try:
+                visibility = None
+                if isinstance(results, tuple):
+                    results, visibility = results
+                paths = pipeline.write_results(
+                    usd_path,
+                    scene_data,
+                    results,
+                    visibility,
+                    write_usd=job.get("write_usd", config.RESULTS_WRITE_USD),
+                    write_csv=config.RESULTS_WRITE_CSV,
+                )
+            except Exception as e:
+                self._fail(job_id, e)
+                continue
+
+            self._update(
+                job_id,
+                status="complete",
+                result_path=paths["usd"],
+                results_path=paths["sobr"],
+                completed_at=datetime.now().isoformat(),
+                progress=1.0,
+                preview=None,
+            )
+            print(f"[{job_id}]  Complete!")
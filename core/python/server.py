@@ -3,16 +3,19 @@ FastAPI server for solar analysis with job queue
 Run with: python server.py
 """
 
-from fastapi import FastAPI, UploadFile, File, BackgroundTasks
-from fastapi.responses import FileResponse, JSONResponse
+from fastapi import FastAPI, UploadFile, File, Form, Request
+from fastapi.responses import FileResponse, JSONResponse, Response, StreamingResponse
+from pydantic import BaseModel
 import uvicorn
+import asyncio
+import json
 import uuid
 import os
 from pathlib import Path
-from typing import Dict
+from typing import Dict, Optional
 import shutil
 from datetime import datetime
-import importlib.util
+from contextlib import asynccontextmanager
 
 import sys
 from pathlib import Path
@@ -23,14 +26,12 @@ sys.path.insert(0, str(PROJECT_ROOT))
 
 import config
 
-# Import pipeline using importlib (same as weather fix)
-pipeline_path = Path(__file__).parent / "pipeline.py"
-spec = importlib.util.spec_from_file_location("pipeline", pipeline_path)
-pipeline = importlib.util.module_from_spec(spec)
-spec.loader.exec_module(pipeline)
-
-
-app = FastAPI(title="Solar Analysis Server")
+# Pipeline modules (pipeline, engine, usd_io) live next to this file
+sys.path.insert(0, str(Path(__file__).parent))
+import scheduler as gpu_scheduler
+import blobs
+import results_codec
+import metrics
 
 # Job storage
 JOBS_DIR = config.JOBS_DIR
@@ -38,47 +39,33 @@ JOBS_DIR.mkdir(exist_ok=True)
 
 jobs: Dict[str, dict] = {}
 
+# Layer formats accepted as uploads; results keep the upload's format
+USD_EXTENSIONS = (".usda", ".usdc", ".usd")
 
-def process_job(job_id: str, usd_path: str, epw_path: str):
-    """Background task to run OptiX analysis"""
-    try:
-        print(f"[{job_id}] Starting analysis...")
-        jobs[job_id]["status"] = "processing"
-        jobs[job_id]["started_at"] = datetime.now().isoformat()
-
-        # Fix EPW path in USD to point to uploaded EPW
-        from pxr import Usd
-
-        stage = Usd.Stage.Open(usd_path)
-        root = stage.GetDefaultPrim()
-        root.SetCustomDataByKey("solar:epwFile", epw_path)
-        stage.Save()
-        print(f"[{job_id}] Updated EPW path in USD to: {epw_path}")
-
-        # Import and run pipeline
-        import sys
+# Uploads are copied to disk in chunks of this size, never held whole in memory
+UPLOAD_CHUNK = 1 << 20
 
-        sys.path.insert(0, str(Path(__file__).parent))
+# /events checks its job this often (seconds), and sends a keep-alive comment
+# when nothing changed for EVENTS_KEEPALIVE seconds
+EVENTS_POLL = 0.25
+EVENTS_KEEPALIVE = 15.0
 
-        from pipeline import analyze_solar_scene
+# Scene layers, context layers and EPWs by content hash, shared across jobs
+blob_store = blobs.BlobStore(config.BLOBS_DIR, config.UPLOAD_MAX_BYTES)
 
-        # Run analysis (this will create {usd_path}_results.usda)
-        result_path = analyze_solar_scene(usd_path)
+# One worker per GPU with a warm engine; USD parsing overlaps tracing, and
+# ready jobs on the same context scene share a launch
+scheduler = gpu_scheduler.GpuScheduler(jobs)
 
-        jobs[job_id]["status"] = "complete"
-        jobs[job_id]["result_path"] = result_path
-        jobs[job_id]["completed_at"] = datetime.now().isoformat()
 
-        print(f"[{job_id}]  Complete!")
+@asynccontextmanager
+async def lifespan(app):
+    scheduler.start()
+    yield
+    scheduler.stop()
 
-    except Exception as e:
-        print(f"[{job_id}]  Error: {e}")
-        jobs[job_id]["status"] = "error"
-        jobs[job_id]["error"] = str(e)
 
-        import traceback
-
-        jobs[job_id]["traceback"] = traceback.format_exc()
+app = FastAPI(title="Solar Analysis Server", lifespan=lifespan)
 
 
 @app.get("/")
@@ -93,51 +80,161 @@ async def root():
             "complete": sum(1 for j in jobs.values() if j["status"] == "complete"),
             "error": sum(1 for j in jobs.values() if j["status"] == "error"),
         },
+        "scheduler": scheduler.stats(),
+    }
+
+
+@app.get("/metrics")
+async def get_metrics():
+    """Prometheus scrape: per-GPU stage timings, rays, memory, cache and queue counters"""
+    text = metrics.render(scheduler.engine_metrics(), jobs, scheduler.stats())
+    return Response(text, media_type=metrics.CONTENT_TYPE)
+
+
+async def save_upload(upload, path):
+    """Copy an UploadFile to disk chunk by chunk"""
+    with open(path, "wb") as f:
+        while chunk := await upload.read(UPLOAD_CHUNK):
+            f.write(chunk)
+
+
+def queue_job(job_id, job_dir, usd_path, epw_path, write_usd=None):
+    """Register a job and hand it to the scheduler (503 while the queue is full)"""
+    jobs[job_id] = {
+        "status": "queued",
+        "result_path": None,
+        "results_path": None,
+        "write_usd": config.RESULTS_WRITE_USD if write_usd is None else write_usd,
+        "error": None,
+        "submitted_at": datetime.now().isoformat(),
+    }
+
+    # Queue for processing; the EPW path is handed over, the USD stays untouched
+    try:
+        scheduler.submit(job_id, str(usd_path), str(epw_path))
+    except gpu_scheduler.QueueFull as e:
+        del jobs[job_id]
+        shutil.rmtree(job_dir)
+        print(f"[{job_id}] Rejected: {e}")
+        return JSONResponse(
+            {"error": "Server busy", "message": str(e)},
+            status_code=503,
+            headers={"Retry-After": "5"},
+        )
+
+    return {
+        "job_id": job_id,
+        "status": "queued",
+        "message": "Job submitted successfully",
     }
 
 
 @app.post("/submit")
 async def submit_job(
-    background_tasks: BackgroundTasks,
     usd_file: UploadFile = File(...),
     epw_file: UploadFile = File(...),
+    write_usd: Optional[bool] = Form(None),
 ):
-    """Submit a new solar analysis job"""
+    """
+    Submit a new solar analysis job (503 while the queue is full)
+
+    write_usd: Also write the colored results USD (default results.write_usd)
+    """
     job_id = str(uuid.uuid4())
     job_dir = JOBS_DIR / job_id
     job_dir.mkdir()
 
     print(f"[{job_id}] New job submitted")
 
-    # Save uploaded files
-    usd_path = job_dir / "scene.usda"
+    # Save uploaded files, keeping the USD format (binary .usdc parses much faster)
+    usd_ext = os.path.splitext(usd_file.filename or "")[1].lower()
+    if usd_ext not in USD_EXTENSIONS:
+        usd_ext = ".usda"
+    usd_path = job_dir / f"scene{usd_ext}"
     epw_path = job_dir / "weather.epw"
 
-    with open(usd_path, "wb") as f:
-        f.write(await usd_file.read())
-    with open(epw_path, "wb") as f:
-        f.write(await epw_file.read())
+    await save_upload(usd_file, usd_path)
+    await save_upload(epw_file, epw_path)
 
     print(
         f"[{job_id}] Files saved: {usd_path.stat().st_size} bytes (USD), {epw_path.stat().st_size} bytes (EPW)"
     )
 
-    # Initialize job
-    jobs[job_id] = {
-        "status": "queued",
-        "result_path": None,
-        "error": None,
-        "submitted_at": datetime.now().isoformat(),
-    }
+    return queue_job(job_id, job_dir, usd_path, epw_path, write_usd)
 
-    # Queue for processing
-    background_tasks.add_task(process_job, job_id, str(usd_path), str(epw_path))
 
-    return {
-        "job_id": job_id,
-        "status": "queued",
-        "message": "Job submitted successfully",
-    }
+@app.head("/blobs/{digest}")
+async def has_blob(digest: str):
+    """200 if the blob is stored, 404 if it still has to be uploaded"""
+    try:
+        found = blob_store.exists(digest)
+    except blobs.BlobError as e:
+        return Response(status_code=e.status)
+    return Response(status_code=200 if found else 404)
+
+
+@app.put("/blobs/{digest}")
+async def put_blob(digest: str, request: Request):
+    """
+    Upload one blob named by the SHA-256 of its decoded content
+
+    The body may be chunked and zstd compressed (Content-Encoding: zstd); it is
+    decoded and hashed as it streams to disk, and rejected if the hash differs.
+    """
+    try:
+        if blob_store.exists(digest):
+            return {"digest": digest, "stored": False}
+        size = await blob_store.receive(
+            digest, request.stream(), request.headers.get("content-encoding")
+        )
+    except blobs.BlobError as e:
+        return JSONResponse({"error": str(e), "digest": digest}, status_code=e.status)
+
+    print(f"Blob {digest[:12]} stored: {size} bytes")
+    return {"digest": digest, "stored": True, "size": size}
+
+
+class BlobJob(BaseModel):
+    """A job assembled from stored blobs: job file name -> digest"""
+
+    files: Dict[str, str]
+    scene: str
+    weather: str
+    write_usd: Optional[bool] = None
+
+
+@app.post("/submit_blobs")
+async def submit_blob_job(manifest: BlobJob):
+    """
+    Submit a job whose files were uploaded to /blobs
+
+    The scene may reference other manifest entries (e.g. a context layer) by
+    relative path. Answers 409 with the missing digests if any are not stored.
+    """
+    try:
+        names = {blobs.file_name(name): digest for name, digest in manifest.files.items()}
+        missing = blob_store.missing(sorted(set(names.values())))
+    except blobs.BlobError as e:
+        return JSONResponse({"error": str(e)}, status_code=e.status)
+    if missing:
+        return JSONResponse({"error": "Blobs not uploaded", "missing": missing}, status_code=409)
+    if manifest.scene not in names or manifest.weather not in names:
+        return JSONResponse(
+            {"error": "scene and weather must name files in the manifest"}, status_code=400
+        )
+    if os.path.splitext(manifest.scene)[1].lower() not in USD_EXTENSIONS:
+        return JSONResponse({"error": f"Not a USD layer: {manifest.scene}"}, status_code=400)
+
+    job_id = str(uuid.uuid4())
+    job_dir = JOBS_DIR / job_id
+    job_dir.mkdir()
+    for name, digest in names.items():
+        blob_store.materialize(digest, job_dir / name)
+
+    print(f"[{job_id}] New job submitted from {len(names)} blob(s)")
+    return queue_job(
+        job_id, job_dir, job_dir / manifest.scene, job_dir / manifest.weather, manifest.write_usd
+    )
 
 
 @app.get("/status/{job_id}")
@@ -157,6 +254,8 @@ async def get_status(job_id: str):
 
     if job["status"] == "processing":
         response["started_at"] = job.get("started_at")
+        response["progress"] = job.get("progress", 0.0)
+        response["preview"] = job.get("preview_version")
 
     if job["status"] == "complete":
         response["completed_at"] = job.get("completed_at")
@@ -168,9 +267,109 @@ async def get_status(job_id: str):
     return response
 
 
+def job_event(job_id, job):
+    """Server-sent event for the job's current state"""
+    data = {
+        "job_id": job_id,
+        "status": job["status"],
+        "progress": job.get("progress", 0.0),
+        "passes": job.get("passes"),
+        # Version of the preview at /preview/{job_id}, None until the first pass
+        "preview": job.get("preview_version"),
+    }
+    if job["status"] == "error":
+        data["error"] = job.get("error")
+    return f"event: {job['status']}\ndata: {json.dumps(data)}\n\n"
+
+
+@app.get("/events/{job_id}")
+async def job_events(job_id: str):
+    """
+    Stream the job's status and progress as server-sent events
+
+    One event per change (status or new preview), named after the status;
+    the stream ends after "complete" or "error". Previews are fetched from
+    /preview/{job_id}.
+    """
+    if job_id not in jobs:
+        return JSONResponse({"error": "Job not found", "job_id": job_id}, status_code=404)
+
+    async def stream():
+        last = None
+        idle = 0.0
+        while True:
+            job = jobs.get(job_id)
+            if job is None:
+                yield f"event: deleted\ndata: {json.dumps({'job_id': job_id})}\n\n"
+                return
+            state = (job["status"], job.get("preview_version"))
+            if state != last:
+                last = state
+                idle = 0.0
+                yield job_event(job_id, job)
+                if job["status"] in ("complete", "error"):
+                    return
+            elif idle >= EVENTS_KEEPALIVE:
+                idle = 0.0
+                yield ": keep-alive\n\n"
+            await asyncio.sleep(EVENTS_POLL)
+            idle += EVENTS_POLL
+
+    return StreamingResponse(
+        stream(),
+        media_type="text/event-stream",
+        headers={"Cache-Control": "no-cache", "X-Accel-Buffering": "no"},
+    )
+
+
+@app.get("/preview/{job_id}")
+async def get_preview(job_id: str, dtype: str = "float16", compression: str = "zlib"):
+    """
+    Latest progressive preview of a processing job as SOBR
+
+    Values are the results so far scaled to the whole sun set, an estimate
+    until the last pass. X-Soba-Progress / X-Soba-Preview give the traced
+    fraction and the preview version. 404 until the first pass is done.
+    """
+    if job_id not in jobs:
+        return JSONResponse({"error": "Job not found"}, status_code=404)
+
+    job = jobs[job_id]
+    # Values, version and progress of one pass, read at once
+    snapshot = job.get("preview")
+    if snapshot is None:
+        return JSONResponse({"error": "No preview", "status": job["status"]}, status_code=404)
+    version, preview, progress = snapshot
+    try:
+        payload = results_codec.encode(
+            preview, result_name=job.get("result_name", "solar:sunHours"), dtype=dtype, compression=compression
+        )
+    except ValueError as e:
+        return JSONResponse({"error": str(e)}, status_code=400)
+    return Response(
+        payload,
+        media_type="application/octet-stream",
+        headers={
+            "X-Soba-Progress": f"{progress:.4f}",
+            "X-Soba-Preview": str(version),
+        },
+    )
+
+
 @app.get("/result/{job_id}")
-async def get_result(job_id: str):
-    """Download completed result file"""
+async def get_result(
+    job_id: str,
+    format: Optional[str] = None,
+    dtype: str = "float32",
+    compression: str = "zlib",
+):
+    """
+    Download completed results
+
+    format: "sobr" (compact per-face values, see results_codec; encoded with
+        dtype and compression) or "usd" (the colored results layer, only if
+        the job wrote one). Defaults to usd when written, else sobr.
+    """
     if job_id not in jobs:
         return JSONResponse({"error": "Job not found"}, status_code=404)
 
@@ -186,14 +385,49 @@ async def get_result(job_id: str):
             status_code=400,
         )
 
+    if format is None:
+        format = "usd" if job.get("result_path") else "sobr"
+
+    if format == "sobr":
+        results_path = job.get("results_path")
+        if not results_path or not os.path.exists(results_path):
+            return JSONResponse({"error": "Result file not found"}, status_code=500)
+        try:
+            stored = results_codec.read(results_path)
+            payload = results_codec.encode(
+                stored["results"],
+                result_name=stored["result_name"],
+                dtype=dtype,
+                compression=compression,
+                visibility=stored["visibility"],
+                sun_count=stored["sun_count"],
+            )
+        except ValueError as e:
+            return JSONResponse({"error": str(e)}, status_code=400)
+        return Response(
+            payload,
+            media_type="application/octet-stream",
+            headers={
+                "Content-Disposition": f'attachment; filename="solar_results_{job_id}.sobr"'
+            },
+        )
+
+    if format != "usd":
+        return JSONResponse({"error": f"Unknown result format: {format}"}, status_code=400)
+
     result_path = job["result_path"]
+    if not result_path:
+        return JSONResponse(
+            {"error": "Job did not write a results USD", "message": "Use format=sobr"},
+            status_code=404,
+        )
 
     if not os.path.exists(result_path):
         return JSONResponse({"error": "Result file not found"}, status_code=500)
 
     return FileResponse(
         result_path,
-        filename=f"solar_results_{job_id}.usda",
+        filename=f"solar_results_{job_id}{os.path.splitext(result_path)[1]}",
         media_type="application/octet-stream",
     )
 
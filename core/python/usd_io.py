@@ -1,10 +1,11 @@
-from pxr import Usd, UsdGeom, Sdf, Gf
+from pxr import Usd, UsdGeom, Sdf, Gf, Vt
 import os
 import shutil
 import csv
+import hashlib
 import numpy as np
 
-import weather as lb
+from colormap import results_to_colors
 
 
 def parse_solar_params(params_str):
@@ -22,6 +23,21 @@ def parse_solar_params(params_str):
     }
 
 
+def vt_to_numpy(values, dtype, width=None):
+    """
+    Vt array (points, indices, primvars) as a C-contiguous numpy array
+
+    Goes through the Vt buffer protocol, a single bulk copy (none when the
+    dtype already matches) instead of a Python loop over Gf values.
+    """
+    if values is None:
+        return np.zeros((0, width) if width else 0, dtype=dtype)
+    arr = np.asarray(values, dtype=dtype)
+    if width:
+        arr = arr.reshape(-1, width)
+    return np.ascontiguousarray(arr)
+
+
 def read_target_mesh(stage):
     """Extract target mesh face centers and normals as np arrays"""
     target_prim = stage.GetPrimAtPath("/Root/TargetMesh")
@@ -32,49 +48,158 @@ def read_target_mesh(stage):
     normals = primvars.GetPrimvar("face_normals").Get()
 
     return {
-        "face_centers": np.array([(p[0], p[1], p[2]) for p in centers]),
-        "face_normals": np.array([(v[0], v[1], v[2]) for v in normals]),
+        # float32 C-contiguous: the engine binds these buffers without copying
+        "face_centers": vt_to_numpy(centers, np.float32, 3),
+        "face_normals": vt_to_numpy(normals, np.float32, 3),
     }
 
 
-def read_context_mesh(stage):
-    """Extract context mesh and convert to triangle array"""
-    context_prim = stage.GetPrimAtPath("/Root/ContextGeometry/Combined")
-    mesh = UsdGeom.Mesh(context_prim)
+def fan_triangulate(face_vertex_counts, face_vertex_indices):
+    """
+    Fan-triangulate polygons: (T, 3) vertex indices plus the face each
+    triangle comes from
+    """
+    counts = np.asarray(face_vertex_counts, dtype=np.int64)
+    indices = np.asarray(face_vertex_indices, dtype=np.int64)
+    starts = np.concatenate([[0], np.cumsum(counts)[:-1]])
+
+    tris_per_face = np.maximum(counts - 2, 0)
+    triangle_face = np.repeat(np.arange(len(counts)), tris_per_face)
+    # Fan corner k = 1 .. n-2 of each triangle within its face
+    first = np.repeat(np.cumsum(tris_per_face) - tris_per_face, tris_per_face)
+    k = np.arange(len(triangle_face)) - first + 1
+
+    base = starts[triangle_face]
+    triangles = np.stack(
+        [indices[base], indices[base + k], indices[base + k + 1]], axis=1
+    )
+    return triangles.astype(np.uint32), triangle_face
+
+
+def read_target_triangles(stage):
+    """
+    Target faces as triangles for supersampled analysis
+
+    Returns triangle corners (T, 3, 3) float32, the face each triangle belongs
+    to and the triangle areas (results are averaged back per face by area)
+    """
+    mesh = UsdGeom.Mesh(stage.GetPrimAtPath("/Root/TargetMesh"))
+    points = vt_to_numpy(mesh.GetPointsAttr().Get(), np.float32, 3)
+    triangles, triangle_face = fan_triangulate(
+        vt_to_numpy(mesh.GetFaceVertexCountsAttr().Get(), np.int64),
+        vt_to_numpy(mesh.GetFaceVertexIndicesAttr().Get(), np.int64),
+    )
+
+    corners = points[triangles]
+    areas = 0.5 * np.linalg.norm(
+        np.cross(corners[:, 1] - corners[:, 0], corners[:, 2] - corners[:, 0]), axis=1
+    )
+    return {
+        "triangle_vertices": np.ascontiguousarray(corners, dtype=np.float32),
+        "triangle_face": triangle_face,
+        "triangle_areas": areas.astype(np.float64),
+    }
+
+
+def mesh_indexed(mesh):
+    """
+    Indexed triangles of a triangulated UsdGeom.Mesh in its local space
 
-    points = mesh.GetPointsAttr().Get()
-    face_vertex_counts = mesh.GetFaceVertexCountsAttr().Get()
-    face_indices = mesh.GetFaceVertexIndicesAttr().Get()
+    Returns:
+        (points, indices): (V, 3) float32 and (M, 3) uint32 arrays
+    """
+    vertices = vt_to_numpy(mesh.GetPointsAttr().Get(), np.float32, 3)
+    face_vertex_counts = vt_to_numpy(mesh.GetFaceVertexCountsAttr().Get(), np.int32)
+    face_indices = vt_to_numpy(mesh.GetFaceVertexIndicesAttr().Get(), np.uint32)
+
+    # Should all be 3 (triangulated), but check just in case
+    bad = face_vertex_counts != 3
+    if bad.any():
+        raise RuntimeError(
+            f"Expected triangles, found face with {face_vertex_counts[bad][0]} vertices"
+        )
 
-    # Convert points to numpy
-    vertices = np.array([(p[0], p[1], p[2]) for p in points], dtype=np.float32)
+    indices = face_indices.reshape(-1, 3)
+    if len(indices) and indices.max() >= len(vertices):
+        raise RuntimeError("Face vertex index out of range")
+    return vertices, indices
 
-    # Build triangles array
-    triangles = []
-    idx = 0
 
-    for count in face_vertex_counts:
-        # Should all be 3 (triangulated), but check just in case
-        if count != 3:
-            raise RuntimeError(f"Expected triangles, found face with {count} vertices")
+def mesh_triangles(mesh):
+    """Convert a triangulated UsdGeom.Mesh to an (N, 3, 3) array in its local space"""
+    vertices, indices = mesh_indexed(mesh)
+    return vertices[indices]
 
-        # Get the 3 vertex indices
-        i0 = face_indices[idx]
-        i1 = face_indices[idx + 1]
-        i2 = face_indices[idx + 2]
 
-        # Get actual vertex coordinates
-        v0 = vertices[i0]
-        v1 = vertices[i1]
-        v2 = vertices[i2]
+def world_transform(prim):
+    """
+    Local-to-world matrix of a prim as a (3, 4) float32 array
+
+    USD matrices act on row vectors (translation in the last row), OptiX
+    instances on column vectors, so the matrix is transposed here.
+    """
+    matrix = UsdGeom.Xformable(prim).ComputeLocalToWorldTransform(Usd.TimeCode.Default())
+    m = np.array(matrix, dtype=np.float64).reshape(4, 4).T
+    return m[:3, :].astype(np.float32)
+
+
+def geometry_key(*arrays):
+    """Content hash of local-space mesh arrays, identical meshes share one GAS"""
+    h = hashlib.blake2b(digest_size=16)
+    for arr in arrays:
+        h.update(np.ascontiguousarray(arr).tobytes())
+    return h.hexdigest()
+
+
+def read_context_meshes(stage):
+    """
+    Extract every mesh prim under /Root/ContextGeometry
 
-        # Store as [v0, v1, v2]
-        triangles.append([v0, v1, v2])
+    Returns:
+        list of dicts with prim path, local-space points and triangle indices,
+        (3, 4) world transform, a geometry key for instancing and a topology
+        key (index buffer hash) deciding whether an edit can be refit
+    """
+    context_root = stage.GetPrimAtPath("/Root/ContextGeometry")
+    if not context_root:
+        raise RuntimeError("Context geometry not found at /Root/ContextGeometry")
+
+    meshes = []
+    for prim in Usd.PrimRange(context_root):
+        if not prim.IsA(UsdGeom.Mesh):
+            continue
+        points, indices = mesh_indexed(UsdGeom.Mesh(prim))
+        if len(indices) == 0:
+            continue
+        meshes.append(
+            {
+                "path": str(prim.GetPath()),
+                "points": points,
+                "indices": indices,
+                "transform": world_transform(prim),
+                "key": geometry_key(points, indices),
+                "topology": geometry_key(indices),
+            }
+        )
+    return meshes
+
+
+def flatten_context_meshes(context_meshes):
+    """Transform every context mesh to world space and concatenate (N, 3, 3)"""
+    if not context_meshes:
+        return np.zeros((0, 3, 3), dtype=np.float32)
+
+    world = []
+    for mesh in context_meshes:
+        xform = mesh["transform"]
+        points = mesh["points"] @ xform[:, :3].T + xform[:, 3]
+        world.append(points[mesh["indices"]])
+    return np.concatenate(world).astype(np.float32)
 
-        idx += 3
 
-    # Convert to numpy array: shape (num_triangles, 3, 3)
-    return np.array(triangles, dtype=np.float32)
+def read_context_mesh(stage):
+    """Extract context mesh and convert to triangle array (world space)"""
+    return flatten_context_meshes(read_context_meshes(stage))
 
 
 def read_solar_usd(usd_path):
@@ -87,120 +212,45 @@ def read_solar_usd(usd_path):
     epw_file = root.GetCustomDataByKey("solar:epwFile")
 
     target_data = read_target_mesh(stage)
-    context_data = read_context_mesh(stage)
+    context_meshes = read_context_meshes(stage)
+
+    # Stratified sample points per target triangle (1 = face centroid only)
+    samples_per_face = int(root.GetCustomDataByKey("solar:samplesPerFace") or 1)
+    if samples_per_face > 1:
+        target_data.update(read_target_triangles(stage))
 
     return {
         "lb_params": params,
         "epw_file": epw_file,
+        # "sunHours" (lit-sun counts), "radiation" (direct kWh/m2) or "sky" (total kWh/m2)
+        "mode": root.GetCustomDataByKey("solar:resultMode") or "sunHours",
+        # Sky-matrix resolution for "sky" mode: 145 (Tregenza) or 577 (Reinhart)
+        "sky_patches": root.GetCustomDataByKey("solar:skyPatches") or 145,
+        "samples_per_face": samples_per_face,
         "target": target_data,
-        "context": context_data,
+        "context": flatten_context_meshes(context_meshes),
+        "context_meshes": context_meshes,
     }
 
 
-def ecotect_color(normalized_value):
-    """
-    Convert normalized value (0-1) to Ecotect colorset 3
-    Blue (min) → Purple → Red → Orange → Yellow (max)
-    """
-    ecotect_colors = [
-        (0 / 255, 0 / 255, 255 / 255),  # Blue (minimum)
-        (53 / 255, 0 / 255, 202 / 255),  # Blue-purple
-        (107 / 255, 0 / 255, 148 / 255),  # Purple
-        (160 / 255, 0 / 255, 95 / 255),  # Purple-red
-        (214 / 255, 0 / 255, 41 / 255),  # Red-purple
-        (255 / 255, 12 / 255, 0 / 255),  # Red
-        (255 / 255, 66 / 255, 0 / 255),  # Red-orange
-        (255 / 255, 119 / 255, 0 / 255),  # Orange
-        (255 / 255, 173 / 255, 0 / 255),  # Orange-yellow
-        (255 / 255, 226 / 255, 0 / 255),  # Light yellow
-        (255 / 255, 255 / 255, 0 / 255),  # Yellow (maximum)
-    ]
-
-    val = max(0.0, min(1.0, normalized_value))
-
-    if val <= 0.0:
-        return ecotect_colors[0]
-    if val >= 1.0:
-        return ecotect_colors[-1]
-
-    # Find segment and interpolate
-    num_segments = len(ecotect_colors) - 1
-    segment = val * num_segments
-    segment_index = int(segment)
-
-    if segment_index >= num_segments:
-        return ecotect_colors[-1]
-
-    t = segment - segment_index
-    color1 = ecotect_colors[segment_index]
-    color2 = ecotect_colors[segment_index + 1]
-
-    r = color1[0] + t * (color2[0] - color1[0])
-    g = color1[1] + t * (color2[1] - color1[1])
-    b = color1[2] + t * (color2[2] - color1[2])
-
-    return (r, g, b)
-
-
-def results_to_colors(results, colormap="ecotect"):
+def unpack_visibility(visibility, sun_count):
     """
-    Convert sun hours to RGB colors using a colormap
-
-    Args:
-        results: numpy array of sun hours per face
-        colormap: 'ecotect' (default), 'viridis', 'plasma', 'hot', 'cool', or 'custom'
-
-    Returns:
-        numpy array of shape (N, 3) with RGB colors (0-1 range)
+    Expand a bit-packed (faces, ceil(suns / 32)) uint32 visibility matrix
+    into a (faces, suns) bool array
     """
-    # Normalize results to 0-1 range
-    if results.max() > results.min():
-        normalized = (results - results.min()) / (results.max() - results.min())
-    else:
-        normalized = np.ones_like(results) * 0.5
-
-    colors = np.zeros((len(results), 3), dtype=np.float32)
-
-    if colormap == "ecotect":
-        # Use Ecotect colorset 3
-        for i, val in enumerate(normalized):
-            colors[i] = ecotect_color(val)
-
-    elif colormap == "viridis":
-        # Blue → Green → Yellow (low to high sun)
-        colors[:, 0] = normalized  # Red
-        colors[:, 1] = np.sqrt(normalized)  # Green
-        colors[:, 2] = 1.0 - normalized  # Blue
-
-    elif colormap == "plasma":
-        # Purple → Orange → Yellow
-        colors[:, 0] = normalized  # Red increases
-        colors[:, 1] = normalized**2  # Green increases slower
-        colors[:, 2] = 1.0 - normalized  # Blue decreases
-
-    elif colormap == "hot":
-        # Black → Red → Yellow → White
-        colors[:, 0] = np.minimum(1.0, normalized * 3)
-        colors[:, 1] = np.maximum(0.0, (normalized - 0.33) * 3)
-        colors[:, 2] = np.maximum(0.0, (normalized - 0.66) * 3)
-
-    elif colormap == "cool":
-        # Blue → White → Red
-        colors[:, 0] = normalized  # Red increases
-        colors[:, 1] = 1.0 - np.abs(normalized - 0.5) * 2  # White in middle
-        colors[:, 2] = 1.0 - normalized  # Blue decreases
-
-    else:  # 'custom' or default
-        # Simple blue (low) to red (high)
-        colors[:, 0] = normalized  # Red
-        colors[:, 1] = 0.0
-        colors[:, 2] = 1.0 - normalized  # Blue
-
-    return colors
+    words = np.ascontiguousarray(visibility, dtype="<u4")
+    bits = np.unpackbits(words.view(np.uint8), axis=1, bitorder="little")
+    return bits[:, :sun_count].astype(bool)
 
 
 def write_results_to_usd(
-    input_usd_path, results, output_usd_path=None, colormap="ecotect"
+    input_usd_path,
+    results,
+    output_usd_path=None,
+    colormap="ecotect",
+    visibility=None,
+    sun_count=None,
+    result_name="solar:sunHours",
 ):
     """
     Write analysis results to USD file
@@ -208,12 +258,16 @@ def write_results_to_usd(
     Args:
         input_usd_path: Path to original USD file
         results: numpy array of sun hours per face
-        output_usd_path: Output path (defaults to input_results.usda)
+        output_usd_path: Output path (defaults to input_results with the input's
+            extension, so a .usdc job stays binary)
         colormap: Color mapping scheme
+        visibility: Optional bit-packed (faces, words) uint32 visibility matrix
+        sun_count: Number of suns packed in visibility
+        result_name: Primvar for the per-face results (solar:directRadiation for kWh/m2)
     """
     if output_usd_path is None:
-        base = os.path.splitext(input_usd_path)[0]
-        output_usd_path = f"{base}_results.usda"
+        base, ext = os.path.splitext(input_usd_path)
+        output_usd_path = f"{base}_results{ext or '.usda'}"
 
     print(f"\nWriting results to USD...")
     print(f"  Input: {input_usd_path}")
@@ -241,12 +295,25 @@ def write_results_to_usd(
 
     # 3. Add sun hours as primvar
     sun_hours_primvar = primvars_api.CreatePrimvar(
-        "solar:sunHours",
+        result_name,
         Sdf.ValueTypeNames.FloatArray,
         UsdGeom.Tokens.uniform,  # One value per face
     )
-    sun_hours_primvar.Set(results.tolist())
-    print(f"  ✅ Added solar:sunHours primvar")
+    sun_hours_primvar.Set(Vt.FloatArray.FromNumpy(np.ascontiguousarray(results, dtype=np.float32)))
+    print(f"  ✅ Added {result_name} primvar")
+
+    # 3b. Optional per-sun visibility, kept bit-packed (elementSize words per face)
+    if visibility is not None:
+        visibility = np.ascontiguousarray(visibility, dtype=np.uint32)
+        visibility_primvar = primvars_api.CreatePrimvar(
+            "solar:visibility",
+            Sdf.ValueTypeNames.UIntArray,
+            UsdGeom.Tokens.uniform,
+            visibility.shape[1],
+        )
+        visibility_primvar.Set(Vt.UIntArray.FromNumpy(visibility.ravel()))
+        target_prim.SetCustomDataByKey("solar:visibilitySunCount", int(sun_count))
+        print(f"  ✅ Added solar:visibility primvar ({sun_count} suns)")
 
     # 4. Convert results to colors
     colors = results_to_colors(results, colormap)
@@ -258,9 +325,7 @@ def write_results_to_usd(
         UsdGeom.Tokens.uniform,  # One color per face
     )
 
-    # Convert to Gf.Vec3f for USD
-    usd_colors = [Gf.Vec3f(float(c[0]), float(c[1]), float(c[2])) for c in colors]
-    display_color_primvar.Set(usd_colors)
+    display_color_primvar.Set(Vt.Vec3fArray.FromNumpy(np.ascontiguousarray(colors, dtype=np.float32)))
     print(f"  ✅ Added displayColor primvar ({colormap} colormap)")
 
     # 6. Add metadata about the analysis
@@ -284,14 +349,19 @@ def write_results_to_usd(
     return output_usd_path
 
 
-def write_results_csv(csv_path, results):
+def write_results_csv(csv_path, results, visibility=None, sun_count=None):
+    # With visibility, each row also gets a 0/1 string, one character per sun
+    lit = unpack_visibility(visibility, sun_count) if visibility is not None else None
     with open(csv_path, "w", newline="") as csvfile:
         writer = csv.writer(csvfile)
         # Write a header for clarity
         # writer.writerow(["FaceIndex", "SunHours"])
         # Write each value with its index (assuming one sun hour value per face)
         for i, hours in enumerate(results):
-            writer.writerow([hours])
+            if lit is None:
+                writer.writerow([hours])
+            else:
+                writer.writerow([hours, "".join("1" if b else "0" for b in lit[i])])
 
 
 if __name__ == "__main__":
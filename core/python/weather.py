@@ -3,50 +3,241 @@ from ladybug.epw import EPW
 from ladybug.location import Location
 from ladybug.sunpath import Sunpath
 import ladybug.analysisperiod as ap
+import math
+import numpy as np
 
-def get_sun_vectors(
-    epw_file, month_start, month_end, day_start, day_end, hour_start, hour_end, timestep
-):
-    epw_data = EPW(epw_file)
-
-    # Create HOYs
-    start_month = month_start
-    start_day = day_start
-    start_hour = hour_start
-    end_month = month_end
-    end_day = day_end
-    end_hour = hour_end
-    timestep = timestep
+# Patches per 12 degree altitude row of the Tregenza sky (plus one zenith cap
+# above 84 degrees). Reinhart MF 2 splits each row in two bands and doubles the
+# patches per band: 2 * 2 * 144 + 1 = 577.
+TREGENZA_ROWS = [30, 30, 24, 24, 18, 12, 6]
 
+def _daylight_suns(
+    epw_data, month_start, month_end, day_start, day_end, hour_start, hour_end, timestep
+):
+    """Suns above the horizon for every step of the analysis period"""
     anp = ap.AnalysisPeriod(
-        start_month, start_day, start_hour, end_month, end_day, end_hour, timestep
+        month_start, day_start, hour_start, month_end, day_end, hour_end, timestep
     )
 
     # Initiate sunpath
     sp = Sunpath.from_location(epw_data.location)
     solar_time = False
 
-    altitudes, azimuths, datetimes, moys, hoys, vectors, suns = (
-        [],
-        [],
-        [],
-        [],
-        [],
-        [],
-        [],
-    )
+    suns = []
     for hoy in anp.hoys:
         sun = sp.calculate_sun_from_hoy(hoy, solar_time)
         if sun.is_during_day:
-            altitudes.append(sun.altitude)
-            azimuths.append(sun.azimuth)
-            datetimes.append(sun.datetime)
-            moys.append(sun.datetime.moy)
-            hoys.append(sun.datetime.hoy)
-            vectors.append(sun.sun_vector)
             suns.append(sun)
+    return suns
+
+
+def get_sun_vectors(
+    epw_file, month_start, month_end, day_start, day_end, hour_start, hour_end, timestep
+):
+    epw_data = EPW(epw_file)
+    suns = _daylight_suns(
+        epw_data, month_start, month_end, day_start, day_end, hour_start, hour_end, timestep
+    )
+    return [sun.sun_vector for sun in suns]
+
+
+def get_weighted_sun_vectors(
+    epw_file, month_start, month_end, day_start, day_end, hour_start, hour_end, timestep
+):
+    """
+    Sun vectors plus the direct-normal energy each one carries
+
+    The weight is DNI (W/m2) x step length (1 / timestep hours) / 1000, so the
+    engine's sum of weight * cos(incidence) is direct radiation in kWh/m2.
+    DNI is taken from the EPW hour the step falls in.
+    """
+    epw_data = EPW(epw_file)
+    suns = _daylight_suns(
+        epw_data, month_start, month_end, day_start, day_end, hour_start, hour_end, timestep
+    )
+
+    dni = epw_data.direct_normal_radiation.values
+    step_hours = 1.0 / timestep
+    vectors, weights = [], []
+    for sun in suns:
+        hour = int(sun.datetime.hoy) % len(dni)
+        vectors.append(sun.sun_vector)
+        weights.append(dni[hour] * step_hours / 1000.0)
+
+    return vectors, weights
+
+
+def read_epw_location(epw_file):
+    """(latitude, longitude, time_zone) from the EPW LOCATION header, without parsing the data"""
+    with open(epw_file, "r", encoding="utf-8", errors="replace") as f:
+        fields = f.readline().strip().split(",")
+    if len(fields) < 9 or fields[0].strip().upper() != "LOCATION":
+        raise ValueError(f"Missing LOCATION header in {epw_file}")
+    return float(fields[6]), float(fields[7]), float(fields[8])
+
+
+def get_hourly_dni(epw_file):
+    """Direct normal radiation (W/m2) for the 8760 hours of the EPW year, float32"""
+    dni = np.asarray(EPW(epw_file).direct_normal_radiation.values, dtype=np.float32)
+    if len(dni) != 8760:
+        raise ValueError(f"Expected 8760 hourly DNI values, got {len(dni)} (leap-year EPW?)")
+    return dni
+
+
+def validate_native_sun_path(epw_file, optix_module, hour_start=0, hour_end=23):
+    """
+    Compare solar_engine_optix.sun_path against ladybug's Sunpath for a full year
+
+    Hourly steps only: an hour-of-year table passed as DNI tags each native sun
+    with its hour (weight = hoy / 1000) so the two sets can be matched. Returns
+    counts, the max angle between matched vectors (degrees) and the hours
+    daylit in only one of them (sunrise / sunset, where refraction decides).
+    """
+    period = (1, 12, 1, 31, hour_start, hour_end, 1)
+    location = read_epw_location(epw_file)
+
+    reference = {
+        int(round(sun.datetime.hoy)): sun.sun_vector
+        for sun in _daylight_suns(EPW(epw_file), *period)
+    }
+    hour_table = np.arange(8760, dtype=np.float32)
+    suns, tags = optix_module.sun_path(*location, *period, hourly_dni=hour_table)
+    native = {int(round(t * 1000.0)): v for t, v in zip(tags, suns)}
+
+    matched = sorted(set(reference) & set(native))
+    max_angle = 0.0
+    for hoy in matched:
+        ref = reference[hoy]
+        dot = float(np.dot(native[hoy], (ref.x, ref.y, ref.z)))
+        max_angle = max(max_angle, math.degrees(math.acos(min(1.0, max(-1.0, dot)))))
+
+    report = {
+        "ladybug": len(reference),
+        "native": len(native),
+        "matched": len(matched),
+        "max_angle_deg": max_angle,
+        "only_ladybug": sorted(set(reference) - set(native)),
+        "only_native": sorted(set(native) - set(reference)),
+    }
+    print(
+        f"Sun path check: {report['matched']} matched of {report['ladybug']} ladybug / "
+        f"{report['native']} native suns, max deviation {max_angle:.4f} deg, "
+        f"{len(report['only_ladybug'])} + {len(report['only_native'])} horizon mismatches"
+    )
+    return report
+
+
+def _sky_subdivision(patch_count):
+    if patch_count == 145:
+        return 1
+    if patch_count == 577:
+        return 2
+    raise ValueError(f"Unsupported sky patch count {patch_count} (expected 145 or 577)")
+
+
+def sky_patches(patch_count=145):
+    """
+    Tregenza (145) / Reinhart (577) patch geometry
+
+    Returns (directions, altitudes, solid_angles). Directions are unit vectors
+    pointing from the patch down to the ground (same convention as
+    sun.sun_vector, +Y north, +X east); patch 0 of each band is centred on north
+    and patches run clockwise. Altitudes are the patch centres in degrees.
+    """
+    mf = _sky_subdivision(patch_count)
+    band_height = 12.0 / mf
+    directions, altitudes, solid_angles = [], [], []
+    for row, count in enumerate(TREGENZA_ROWS):
+        for sub in range(mf):
+            alt0 = (row * mf + sub) * band_height
+            alt1 = alt0 + band_height
+            alt = math.radians((alt0 + alt1) / 2.0)
+            n = count * mf
+            omega = 2.0 * math.pi / n * (math.sin(math.radians(alt1)) - math.sin(math.radians(alt0)))
+            for i in range(n):
+                az = math.radians(i * 360.0 / n)
+                directions.append(
+                    (-math.sin(az) * math.cos(alt), -math.cos(az) * math.cos(alt), -math.sin(alt))
+                )
+                altitudes.append(math.degrees(alt))
+                solid_angles.append(omega)
+
+    # Zenith cap
+    directions.append((0.0, 0.0, -1.0))
+    altitudes.append(90.0)
+    solid_angles.append(2.0 * math.pi * (1.0 - math.sin(math.radians(84.0))))
+
+    return (
+        np.asarray(directions, dtype=np.float32),
+        np.asarray(altitudes, dtype=np.float64),
+        np.asarray(solid_angles, dtype=np.float64),
+    )
+
+
+def sky_patch_index(altitude, azimuth, patch_count=145):
+    """Patch containing a direction given by altitude / azimuth (degrees, clockwise from north)"""
+    mf = _sky_subdivision(patch_count)
+    if altitude >= 84.0:
+        return patch_count - 1
+    band_height = 12.0 / mf
+    band = int(max(altitude, 0.0) // band_height)
+    offset = sum(TREGENZA_ROWS[b // mf] * mf for b in range(band))
+    n = TREGENZA_ROWS[band // mf] * mf
+    return offset + int(round((azimuth % 360.0) / (360.0 / n))) % n
+
+
+def get_sky_matrix(
+    epw_file,
+    month_start,
+    month_end,
+    day_start,
+    day_end,
+    hour_start,
+    hour_end,
+    timestep,
+    patch_count=145,
+    include_direct=True,
+):
+    """
+    Cumulative sky matrix over the analysis period
+
+    Returns (directions, weights): patch directions from sky_patches() and the
+    radiation each patch delivers to a surface facing it, in kWh/m2, so the
+    engine's sum of weight * cos(incidence) is incident radiation.
+
+    Simplified model: the period's diffuse horizontal radiation is spread with the
+    CIE overcast luminance distribution (1 + 2 sin(alt)) / 3, normalised so the
+    sky reproduces DHI on the horizontal. With include_direct each step's DNI
+    goes to the patch containing the sun (total radiation in one pass).
+    """
+    epw_data = EPW(epw_file)
+    directions, altitudes, solid_angles = sky_patches(patch_count)
+
+    anp = ap.AnalysisPeriod(
+        month_start, day_start, hour_start, month_end, day_end, hour_end, timestep
+    )
+    sp = Sunpath.from_location(epw_data.location)
+    dni = epw_data.direct_normal_radiation.values
+    dhi = epw_data.diffuse_horizontal_radiation.values
+    step_hours = 1.0 / timestep
+
+    sin_alt = np.sin(np.radians(altitudes))
+    luminance = (1.0 + 2.0 * sin_alt) / 3.0
+    diffuse_share = luminance * solid_angles / np.sum(luminance * solid_angles * sin_alt)
+
+    weights = np.zeros(patch_count, dtype=np.float64)
+    diffuse_total = 0.0
+    for hoy in anp.hoys:
+        hour = int(hoy) % len(dhi)
+        diffuse_total += dhi[hour] * step_hours
+        if include_direct and dni[hour] > 0:
+            sun = sp.calculate_sun_from_hoy(hoy, False)
+            if sun.is_during_day:
+                patch = sky_patch_index(sun.altitude, sun.azimuth, patch_count)
+                weights[patch] += dni[hour] * step_hours
 
-    return vectors
+    weights += diffuse_total * diffuse_share
+    return directions, (weights / 1000.0).astype(np.float32)
 
 
 if __name__ == "__main__":
@@ -1,15 +1,63 @@
 """
 Maya client for solar analysis server using urllib (Maya-safe)
-Non-blocking with worker threads and Maya scriptJob polling
+Non-blocking with worker threads: follows the job's server-sent events,
+falling back to Maya scriptJob polling
 """
 
+import urllib.error
 import urllib.request
 import urllib.parse
+import hashlib
 import json
 import os
+import sys
 import threading
 from maya import cmds
 
+# results_codec, usd_io and colormap are shared with the server
+sys.path.insert(
+    0, os.path.abspath(os.path.join(os.path.dirname(__file__), "..", "..", "..", "core", "python"))
+)
+import results_codec
+import usd_io
+
+try:
+    import zstandard
+except ImportError:  # Maya's Python may not ship it; uploads then go uncompressed
+    zstandard = None
+
+# Files are hashed and uploaded in chunks of this size
+UPLOAD_CHUNK = 1 << 20
+
+# Read timeout of the event stream; the server sends a keep-alive every 15 s
+EVENTS_TIMEOUT = 60.0
+
+
+def read_events(stream):
+    """(event, data dict) pairs of a text/event-stream response, as they arrive"""
+    event, data = "message", []
+    for raw in stream:
+        line = raw.decode("utf-8").rstrip("\r\n")
+        if not line:
+            if data:
+                yield event, json.loads("\n".join(data))
+            event, data = "message", []
+        elif line.startswith(":"):
+            continue  # Keep-alive comment
+        elif line.startswith("event:"):
+            event = line[6:].strip()
+        elif line.startswith("data:"):
+            data.append(line[5:].strip())
+
+
+def file_sha256(path):
+    """SHA-256 (hex) of a file's content, the name the server stores it under"""
+    hasher = hashlib.sha256()
+    with open(path, "rb") as f:
+        for chunk in iter(lambda: f.read(UPLOAD_CHUNK), b""):
+            hasher.update(chunk)
+    return hasher.hexdigest()
+
 
 class SolarAnalysisClient:
     """
@@ -19,7 +67,11 @@ class SolarAnalysisClient:
     """
 
     def __init__(
-        self, server_url="http://localhost:8000", timeout=30.0, status_callback=None
+        self,
+        server_url="http://localhost:8000",
+        timeout=30.0,
+        status_callback=None,
+        preview_callback=None,
     ):
         self.server_url = server_url
         self.timeout = timeout
@@ -27,50 +79,73 @@ class SolarAnalysisClient:
         self.timer_id = None
         self.result_callback = None
         self.status_callback = status_callback  # NEW: For progress updates
+        # Called with (preview layer path, traced fraction) for each progressive pass
+        self.preview_callback = preview_callback
+        self.preview_version = None
         self.worker_thread = None
+        self.scene_path = None  # Local scene the downloaded results are applied to
+        self.result_dtype = "float32"  # "float16" halves the download
 
-    def _http_post_multipart(self, url, files_dict):
-        """
-        POST multipart/form-data using urllib
+    def _http_post_json(self, url, payload):
+        """POST a JSON body, returning the response JSON"""
+        req = urllib.request.Request(
+            url,
+            data=json.dumps(payload).encode(),
+            headers={"Content-Type": "application/json"},
+        )
+        with urllib.request.urlopen(req, timeout=self.timeout) as response:
+            return json.loads(response.read().decode())
 
-        Args:
-            url: Full URL to POST to
-            files_dict: Dict of {field_name: (filename, file_bytes, content_type)}
+    def _blob_exists(self, digest):
+        """HEAD /blobs/{digest}: True if the server already stores it"""
+        req = urllib.request.Request(f"{self.server_url}/blobs/{digest}", method="HEAD")
+        try:
+            with urllib.request.urlopen(req, timeout=self.timeout):
+                return True
+        except urllib.error.HTTPError as e:
+            if e.code == 404:
+                return False
+            raise
+
+    def _put_blob(self, path, digest):
+        """
+        Stream a file to PUT /blobs/{digest}
 
-        Returns:
-            Response JSON dict
+        The body is sent with chunked transfer encoding, zstd compressed when
+        the zstandard package is available, so neither side holds the whole
+        file in memory.
         """
-        boundary = "----WebKitFormBoundary" + os.urandom(16).hex()
-
-        # Build multipart body
-        body = []
-        for field_name, (filename, file_bytes, content_type) in files_dict.items():
-            body.append(f"--{boundary}".encode())
-            body.append(
-                f'Content-Disposition: form-data; name="{field_name}"; filename="{filename}"'.encode()
+        headers = {"Content-Type": "application/octet-stream"}
+        with open(path, "rb") as f:
+            if zstandard is not None:
+                body = zstandard.ZstdCompressor(level=3).read_to_iter(f, read_size=UPLOAD_CHUNK)
+                headers["Content-Encoding"] = "zstd"
+            else:
+                body = iter(lambda: f.read(UPLOAD_CHUNK), b"")
+            # No Content-Length on an iterable body: urllib sends it chunked
+            req = urllib.request.Request(
+                f"{self.server_url}/blobs/{digest}", data=body, headers=headers, method="PUT"
             )
-            body.append(f"Content-Type: {content_type}".encode())
-            body.append(b"")
-            body.append(file_bytes)
-
-        body.append(f"--{boundary}--".encode())
-        body.append(b"")
-
-        body_bytes = b"\r\n".join(body)
+            with urllib.request.urlopen(req, timeout=self.timeout) as response:
+                return json.loads(response.read().decode())
 
-        # Create request
-        req = urllib.request.Request(
-            url,
-            data=body_bytes,
-            headers={
-                "Content-Type": f"multipart/form-data; boundary={boundary}",
-                "Content-Length": str(len(body_bytes)),
-            },
-        )
+    def _upload_files(self, files):
+        """
+        Make sure the server stores every file; returns {job file name: digest}
 
-        # Send request
-        with urllib.request.urlopen(req, timeout=self.timeout) as response:
-            return json.loads(response.read().decode())
+        Files the server already has (an unchanged context layer, the same
+        EPW) are only hashed, not sent.
+        """
+        manifest = {}
+        for name, path in files.items():
+            digest = file_sha256(path)
+            manifest[name] = digest
+            if self._blob_exists(digest):
+                print(f"   {name}: unchanged on server")
+                continue
+            print(f"   {name}: uploading {os.path.getsize(path)} bytes")
+            self._put_blob(path, digest)
+        return manifest
 
     def _http_get_json(self, url):
         """GET request returning JSON"""
@@ -82,7 +157,7 @@ class SolarAnalysisClient:
         with urllib.request.urlopen(url, timeout=self.timeout) as response:
             return response.read()
 
-    def submit_job(self, usd_path, epw_path, callback=None):
+    def submit_job(self, usd_path, epw_path, callback=None, layers=None):
         """
         Submit analysis job to server (non-blocking)
 
@@ -90,6 +165,8 @@ class SolarAnalysisClient:
             usd_path: Path to USD scene file
             epw_path: Path to EPW weather file
             callback: Function to call when complete, receives (success, result_path_or_error)
+            layers: Layers usd_path references by relative path (e.g. the
+                context layer); each keeps its file name on the server
         """
         self.result_callback = callback
 
@@ -98,30 +175,36 @@ class SolarAnalysisClient:
             try:
                 print("Submitting job to server...")
 
-                # Read files
-                with open(usd_path, "rb") as f:
-                    usd_bytes = f.read()
-                with open(epw_path, "rb") as f:
-                    epw_bytes = f.read()
-
-                # Prepare multipart data
-                files_dict = {
-                    "usd_file": ("scene.usda", usd_bytes, "application/octet-stream"),
-                    "epw_file": ("weather.epw", epw_bytes, "application/octet-stream"),
-                }
-
-                # Submit (happens in worker thread)
-                url = f"{self.server_url}/submit"
-                data = self._http_post_multipart(url, files_dict)
+                # The server keeps the layer format (.usda / .usdc) and file names
+                self.scene_path = usd_path
+                scene_name = os.path.basename(usd_path)
+                files = {scene_name: usd_path, "weather.epw": epw_path}
+                for layer in layers or []:
+                    files[os.path.basename(layer)] = layer
+
+                # Upload what the server is missing, then submit by hash
+                manifest = self._upload_files(files)
+                url = f"{self.server_url}/submit_blobs"
+                # Only values come back; colors are applied here (download_result)
+                data = self._http_post_json(
+                    url,
+                    {
+                        "files": manifest,
+                        "scene": scene_name,
+                        "weather": "weather.epw",
+                        "write_usd": False,
+                    },
+                )
 
                 self.current_job_id = data["job_id"]
+                self.preview_version = None
 
                 print(f"Job submitted!")
                 print(f"   Job ID: {self.current_job_id}")
                 print(f"   Status: {data['status']}")
 
-                # Start polling (back in main thread)
-                cmds.evalDeferred(lambda: self.start_polling())
+                # Follow the job's events (polling if the server has none)
+                self.watch_events()
 
             except Exception as e:
                 error_msg = str(e)
@@ -135,6 +218,95 @@ class SolarAnalysisClient:
         self.worker_thread = threading.Thread(target=worker, daemon=True)
         self.worker_thread.start()
 
+    def _on_status(self, status, data):
+        """
+        React to one status report (event or poll, runs in a worker thread)
+        Returns True while the job is still running
+        """
+        if status == "queued":
+            print("⏳ Job queued...")
+            # NEW: Send status update to UI
+            if self.status_callback:
+                cb = self.status_callback
+                cmds.evalDeferred(lambda callback=cb: callback("queued", 0))
+
+        elif status == "processing":
+            # Traced fraction of progressive jobs, 0 for single-pass ones
+            progress = float(data.get("progress") or 0.0)
+            print(f"Processing... {progress:.0%}")
+            if self.status_callback:
+                cb = self.status_callback
+                percent = 5 + int(65 * progress)
+                cmds.evalDeferred(lambda callback=cb, p=percent: callback("processing", p))
+            preview = data.get("preview")
+            if preview is not None and preview != self.preview_version and self.preview_callback:
+                self.preview_version = preview
+                self.download_preview(progress)
+
+        elif status == "complete":
+            print("Analysis complete! Downloading results...")
+            # NEW: Send status update to UI
+            if self.status_callback:
+                cb = self.status_callback
+                cmds.evalDeferred(
+                    lambda callback=cb: callback("downloading", 75)
+                )
+
+            # Download in worker thread
+            self.download_result()
+            return False
+
+        elif status in ("error", "deleted"):
+            error_msg = data.get("error") or ("Job deleted" if status == "deleted" else "Unknown error")
+            print(f"Analysis failed: {error_msg}")
+
+            # NEW: Send error to UI
+            if self.status_callback:
+                cb = self.status_callback
+                cmds.evalDeferred(
+                    lambda callback=cb, msg=error_msg: callback("error", 0, msg)
+                )
+
+            # FIX: Capture variables as default arguments
+            callback = self.result_callback
+            if callback:
+                cmds.evalDeferred(
+                    lambda msg=error_msg, cb=callback: cb(False, msg)
+                )
+            return False
+
+        return True
+
+    def watch_events(self):
+        """
+        Follow the job over GET /events/{job_id} in a worker thread
+
+        Every event goes through _on_status, so progress updates the UI and
+        each new progressive preview is downloaded as it is published. A server
+        without the endpoint, or a dropped stream, falls back to polling.
+        """
+        job_id = self.current_job_id
+
+        def worker():
+            try:
+                req = urllib.request.Request(
+                    f"{self.server_url}/events/{job_id}", headers={"Accept": "text/event-stream"}
+                )
+                with urllib.request.urlopen(req, timeout=EVENTS_TIMEOUT) as stream:
+                    for event, data in read_events(stream):
+                        if job_id != self.current_job_id:
+                            return  # Superseded by a newer job
+                        if not self._on_status(event, data):
+                            return
+            except Exception as e:
+                print(f"Event stream unavailable ({e}), polling for status instead")
+
+            if job_id == self.current_job_id:
+                cmds.evalDeferred(lambda: self.start_polling())
+
+        self.worker_thread = threading.Thread(target=worker, daemon=True)
+        self.worker_thread.start()
+
     def check_status(self):
         """
         Check job status (called by Maya timer)
@@ -148,56 +320,8 @@ class SolarAnalysisClient:
             try:
                 url = f"{self.server_url}/status/{self.current_job_id}"
                 status_data = self._http_get_json(url)
-                status = status_data["status"]
-
-                if status == "queued":
-                    print("⏳ Job queued...")
-                    # NEW: Send status update to UI
-                    if self.status_callback:
-                        cb = self.status_callback
-                        cmds.evalDeferred(lambda callback=cb: callback("queued", 0))
-
-                elif status == "processing":
-                    print("Processing...")
-                    # NEW: Send status update to UI (50% progress for processing)
-                    if self.status_callback:
-                        cb = self.status_callback
-                        cmds.evalDeferred(
-                            lambda callback=cb: callback("processing", 50)
-                        )
-
-                elif status == "complete":
-                    print("Analysis complete! Downloading results...")
-                    # NEW: Send status update to UI
-                    if self.status_callback:
-                        cb = self.status_callback
-                        cmds.evalDeferred(
-                            lambda callback=cb: callback("downloading", 75)
-                        )
-
-                    # Download in worker thread, then stop polling
-                    self.download_result()
-                    return False  # Stop polling
-
-                elif status == "error":
-                    error_msg = status_data.get("error", "Unknown error")
-                    print(f"Analysis failed: {error_msg}")
-
-                    # NEW: Send error to UI
-                    if self.status_callback:
-                        cb = self.status_callback
-                        cmds.evalDeferred(
-                            lambda callback=cb, msg=error_msg: callback("error", 0, msg)
-                        )
-
-                    # FIX: Capture variables as default arguments
-                    callback = self.result_callback
-                    if callback:
-                        cmds.evalDeferred(
-                            lambda msg=error_msg, cb=callback: cb(False, msg)
-                        )
-
-                    return False  # Stop polling
+                if not self._on_status(status_data["status"], status_data):
+                    return  # Stop polling
 
                 # Continue polling
                 cmds.evalDeferred(lambda: self._schedule_next_poll())
@@ -217,39 +341,36 @@ class SolarAnalysisClient:
         cmds.scriptJob(runOnce=True, event=["idle", lambda: self.check_status()])
 
     def download_result(self):
-        """Download completed result file (runs in worker thread)"""
+        """
+        Download completed results (runs in worker thread)
+
+        Fetches the compact SOBR values and writes the colored results layer
+        locally from the exported scene, instead of downloading a full USD.
+        """
 
         def worker():
             try:
-                url = f"{self.server_url}/result/{self.current_job_id}"
-                result_bytes = self._http_get_bytes(url)
-
-                # Save result to temp location - use workspace instead of temp dir
-                result_dir = cmds.workspace(query=True, rootDirectory=True)
-                if not result_dir:
-                    # Fallback to temp dir if workspace not set
-                    result_dir = cmds.internalVar(userTmpDir=True)
-
-                result_filename = f"solar_result_{self.current_job_id}.usda"
-                result_path = os.path.join(result_dir, result_filename)
-
-                # Ensure we have write permissions
-                if os.path.exists(result_path):
-                    try:
-                        os.remove(result_path)
-                    except:
-                        # If can't remove, use temp dir with timestamp
-                        import time
-
-                        result_filename = f"solar_result_{int(time.time())}.usda"
-                        result_path = os.path.join(
-                            cmds.internalVar(userTmpDir=True), result_filename
-                        )
-
-                with open(result_path, "wb") as f:
-                    f.write(result_bytes)
-
-                print(f"Results saved to: {result_path}")
+                compression = "zstd" if "zstd" in results_codec.available_compressions() else "zlib"
+                query = urllib.parse.urlencode(
+                    {"format": "sobr", "dtype": self.result_dtype, "compression": compression}
+                )
+                url = f"{self.server_url}/result/{self.current_job_id}?{query}"
+                result = results_codec.decode(self._http_get_bytes(url))
+                print(f"Downloaded {len(result['results'])} face results ({compression})")
+
+                # Results layer next to the scene, so its context reference resolves
+                base, ext = os.path.splitext(self.scene_path)
+                result_path = f"{base}_results_{self.current_job_id}{ext}"
+                usd_io.write_results_to_usd(
+                    self.scene_path,
+                    result["results"],
+                    output_usd_path=result_path,
+                    visibility=result["visibility"],
+                    sun_count=result["sun_count"],
+                    result_name=result["result_name"],
+                )
+
+                print(f"Results written to: {result_path}")
 
                 # NEW: Send completion update to UI
                 if self.status_callback:
@@ -275,6 +396,36 @@ class SolarAnalysisClient:
         thread = threading.Thread(target=worker, daemon=True)
         thread.start()
 
+    def download_preview(self, progress):
+        """
+        Download the latest progressive preview and color it into a preview
+        layer next to the scene (runs in the calling worker thread)
+
+        The layer path stays the same for every pass, so the UI can load it
+        once and reload it afterwards.
+        """
+        try:
+            query = urllib.parse.urlencode({"dtype": "float16", "compression": "zlib"})
+            url = f"{self.server_url}/preview/{self.current_job_id}?{query}"
+            result = results_codec.decode(self._http_get_bytes(url))
+
+            base, ext = os.path.splitext(self.scene_path)
+            preview_path = f"{base}_preview{ext}"
+            usd_io.write_results_to_usd(
+                self.scene_path,
+                result["results"],
+                output_usd_path=preview_path,
+                result_name=result["result_name"],
+            )
+            print(f"Preview at {progress:.0%} of the suns: {preview_path}")
+
+            cb = self.preview_callback
+            if cb:
+                cmds.evalDeferred(lambda path=preview_path, p=progress, callback=cb: callback(path, p))
+        except Exception as e:
+            # A missed preview is not fatal, the final results still follow
+            print(f"Error downloading preview: {e}")
+
     def start_polling(self):
         """Start Maya scriptJob to poll status"""
         if self.timer_id is not None:
@@ -70,9 +70,11 @@ class SolarMayaUI(QtWidgets.QWidget):
         self.context_meshes = []
         self.epw_path = None
         self.solar_params = None
+        self.preview_shape = None  # USD proxy shape showing progressive previews
         self.analysis_client = client.SolarAnalysisClient(
             server_url=(f"http://{config.SERVER_HOST}:{config.SERVER_PORT}"),
             status_callback=self.on_status_update,
+            preview_callback=self.on_preview,
         )
 
         # locate UI widgets
@@ -159,6 +161,39 @@ class SolarMayaUI(QtWidgets.QWidget):
         elif status in ["complete", "error"]:
             self.btn_run.setEnabled(True)  # Re-enable when done
 
+    def on_preview(self, preview_path, progress):
+        """
+        Show a progressive preview layer in a USD proxy shape
+
+        The first pass creates the proxy shape, later passes rewrite the same
+        layer and only reload it.
+        """
+        try:
+            if self.preview_shape and cmds.objExists(self.preview_shape):
+                from pxr import Sdf
+
+                layer = Sdf.Layer.Find(preview_path)
+                if layer:
+                    layer.Reload()
+            else:
+                self.preview_shape = cmds.createNode("mayaUsdProxyShape", name="solarPreviewShape")
+                cmds.setAttr(f"{self.preview_shape}.filePath", preview_path, type="string")
+                cmds.connectAttr("time1.outTime", f"{self.preview_shape}.time")
+
+            if hasattr(self, "status_label") and self.status_label:
+                self.status_label.setText(f" Preview: {progress:.0%} of the suns traced")
+            cmds.refresh()
+
+        except Exception as e:
+            print(f" Error showing preview: {e}")
+
+    def clearPreview(self):
+        """Remove the preview proxy shape (and its transform)"""
+        if self.preview_shape and cmds.objExists(self.preview_shape):
+            parents = cmds.listRelatives(self.preview_shape, parent=True) or []
+            cmds.delete(parents or self.preview_shape)
+        self.preview_shape = None
+
     def resizeEvent(self, event):
         """
         Called on automatically generated resize event
@@ -241,7 +276,8 @@ class SolarMayaUI(QtWidgets.QWidget):
             target = self.target_meshes
             context = self.context_meshes
 
-            usd_path = os.path.join(self._tempPath, "solar_analysis.usda")
+            # Binary crate: several times smaller and faster to parse than .usda
+            usd_path = os.path.join(self._tempPath, "solar_analysis.usdc")
             usde.export_solar_scene(
                 target, context, usd_path, self.solar_params, self.epw_path
             )
@@ -249,8 +285,12 @@ class SolarMayaUI(QtWidgets.QWidget):
             print(" Submitting job to analysis server...")
 
             # Submit to server (non-blocking!)
+            # The context layer is only re-sent when the context geometry changed
             self.analysis_client.submit_job(
-                usd_path, self.epw_path, callback=self.on_analysis_complete
+                usd_path,
+                self.epw_path,
+                callback=self.on_analysis_complete,
+                layers=[usde.context_layer_path(usd_path)],
             )
 
             print(" Job submitted! Maya remains responsive while processing...")
@@ -263,6 +303,7 @@ class SolarMayaUI(QtWidgets.QWidget):
 
     def on_analysis_complete(self, success, result):
         """Callback when analysis finishes"""
+        self.clearPreview()
         if success:
             print(f" Analysis complete!")
             print(f"   Result file: {result}")
@@ -1,10 +1,26 @@
 import maya.cmds as cmds
 import maya.api.OpenMaya as om
-from pxr import Usd, UsdGeom, Sdf, Gf
+from pxr import Usd, UsdGeom, Sdf, Gf, Tf, Vt
 import os
 import numpy as np
 
 
+def as_float3(values):
+    """(N, 3) C-contiguous float32, the layout Vt.Vec3fArray.FromNumpy takes"""
+    return np.ascontiguousarray(values, dtype=np.float32).reshape(-1, 3)
+
+
+def as_int(values):
+    """C-contiguous int32, the layout Vt.IntArray.FromNumpy takes"""
+    return np.ascontiguousarray(values, dtype=np.int32).ravel()
+
+
+def context_layer_path(output_path):
+    """Where export_solar_analysis_scene writes the referenced context layer"""
+    base, ext = os.path.splitext(output_path)
+    return f"{base}_context{ext or '.usdc'}"
+
+
 class USDSolarExporter:
     def __init__(self):
         self.stage = None
@@ -12,26 +28,32 @@ class USDSolarExporter:
 
     def create_stage(self, file_path):
         """Create a new USD stage"""
-        directory = os.path.dirname(file_path)
-        if directory and not os.path.exists(directory):
-            os.makedirs(directory)
-
-        self.stage = Usd.Stage.CreateNew(file_path)
-        UsdGeom.SetStageMetersPerUnit(self.stage, 1.0)
-        UsdGeom.SetStageUpAxis(self.stage, UsdGeom.Tokens.z)
+        self.stage = self.new_stage(file_path)
 
         self.root_prim = self.stage.DefinePrim("/Root", "Xform")
         self.stage.SetDefaultPrim(self.root_prim)
 
         return self.stage
 
-    def get_mesh_data(self, mesh_name, apply_smooth=False):
+    def new_stage(self, file_path):
+        """Empty Z-up, meter stage at file_path (replaces an earlier export)"""
+        directory = os.path.dirname(file_path)
+        if directory and not os.path.exists(directory):
+            os.makedirs(directory)
+
+        stage = Usd.Stage.CreateNew(file_path)
+        UsdGeom.SetStageMetersPerUnit(stage, 1.0)
+        UsdGeom.SetStageUpAxis(stage, UsdGeom.Tokens.z)
+        return stage
+
+    def get_mesh_data(self, mesh_name, apply_smooth=False, space=om.MSpace.kWorld):
         """
         Extract mesh data from Maya mesh
 
         Args:
             mesh_name: Name of the mesh transform
             apply_smooth: If True, apply smooth mesh preview subdivision
+            space: om.MSpace.kWorld (default) or om.MSpace.kObject for local points
         """
         shapes = cmds.listRelatives(mesh_name, shapes=True, type="mesh")
         if not shapes:
@@ -69,14 +91,14 @@ class USDSolarExporter:
         dag_path = selection_list.getDagPath(0)
         mesh_fn = om.MFnMesh(dag_path)
 
-        # Get vertices
-        points = mesh_fn.getPoints(om.MSpace.kWorld)
-        vertices = [(p.x, p.y, p.z) for p in points]
+        # Get vertices (MPoints are homogeneous x, y, z, w)
+        points = mesh_fn.getPoints(space)
+        vertices = np.array(points, dtype=np.float32).reshape(-1, 4)[:, :3]
 
         # Get face data
         face_counts, face_indices = mesh_fn.getVertices()
-        face_vertex_counts = list(face_counts)
-        face_vertex_indices = list(face_indices)
+        face_vertex_counts = np.array(face_counts, dtype=np.int32)
+        face_vertex_indices = np.array(face_indices, dtype=np.int32)
 
         # Extract face centers and normals
         face_centers, face_normals = self._extract_face_data(mesh_fn, dag_path)
@@ -213,6 +235,23 @@ class USDSolarExporter:
 
         return mesh_data
 
+    def process_context_mesh(self, mesh):
+        """
+        Triangulate a single context mesh, keeping its points in object space
+
+        Returns mesh data plus the mesh's world matrix (Maya/USD row-vector
+        layout), so identical buildings export identical points and can share
+        one acceleration structure on the server.
+        """
+        dup = cmds.duplicate(mesh, returnRootsOnly=True)[0]
+        cmds.polyTriangulate(dup, ch=False)
+
+        mesh_data = self.get_mesh_data(dup, apply_smooth=False, space=om.MSpace.kObject)
+        mesh_data["world_matrix"] = cmds.xform(mesh, query=True, matrix=True, worldSpace=True)
+
+        cmds.delete(dup)
+        return mesh_data
+
     def process_target_meshes(self, target_mesh_list):
         """
         Process target meshes: subdivide each, then combine
@@ -268,22 +307,25 @@ class USDSolarExporter:
 
         return mesh_data
 
-    def create_mesh_prim(self, mesh_data, prim_path, include_face_data=False):
-        """Create USD mesh primitive from mesh data"""
-        mesh_prim = UsdGeom.Mesh.Define(self.stage, prim_path)
+    def create_mesh_prim(self, mesh_data, prim_path, include_face_data=False, stage=None):
+        """Create USD mesh primitive from mesh data (on self.stage by default)"""
+        mesh_prim = UsdGeom.Mesh.Define(stage or self.stage, prim_path)
 
-        # Set points
+        # Object-space meshes carry their placement as a transform op
+        if "world_matrix" in mesh_data:
+            mesh_prim.AddTransformOp().Set(Gf.Matrix4d(*mesh_data["world_matrix"]))
+
+        # Set points (numpy -> Vt in one copy, no per-point Gf objects)
         points_attr = mesh_prim.CreatePointsAttr()
-        usd_points = [Gf.Vec3f(p[0], p[1], p[2]) for p in mesh_data["vertices"]]
-        points_attr.Set(usd_points)
+        points_attr.Set(Vt.Vec3fArray.FromNumpy(as_float3(mesh_data["vertices"])))
 
         # Set face vertex counts
         face_counts_attr = mesh_prim.CreateFaceVertexCountsAttr()
-        face_counts_attr.Set(mesh_data["face_vertex_counts"])
+        face_counts_attr.Set(Vt.IntArray.FromNumpy(as_int(mesh_data["face_vertex_counts"])))
 
         # Set face vertex indices
         face_indices_attr = mesh_prim.CreateFaceVertexIndicesAttr()
-        face_indices_attr.Set(mesh_data["face_vertex_indices"])
+        face_indices_attr.Set(Vt.IntArray.FromNumpy(as_int(mesh_data["face_vertex_indices"])))
 
         # Add face centers and normals as primvars if requested
         if include_face_data and "face_centers" in mesh_data:
@@ -293,21 +335,13 @@ class USDSolarExporter:
             centers_primvar = primvars_api.CreatePrimvar(
                 "face_centers", Sdf.ValueTypeNames.Point3fArray, UsdGeom.Tokens.uniform
             )
-            usd_centers = [
-                Gf.Vec3f(float(c[0]), float(c[1]), float(c[2]))
-                for c in mesh_data["face_centers"]
-            ]
-            centers_primvar.Set(usd_centers)
+            centers_primvar.Set(Vt.Vec3fArray.FromNumpy(as_float3(mesh_data["face_centers"])))
 
             # Face normals as uniform primvar
             normals_primvar = primvars_api.CreatePrimvar(
                 "face_normals", Sdf.ValueTypeNames.Normal3fArray, UsdGeom.Tokens.uniform
             )
-            usd_normals = [
-                Gf.Vec3f(float(n[0]), float(n[1]), float(n[2]))
-                for n in mesh_data["face_normals"]
-            ]
-            normals_primvar.Set(usd_normals)
+            normals_primvar.Set(Vt.Vec3fArray.FromNumpy(as_float3(mesh_data["face_normals"])))
 
         return mesh_prim
 
@@ -329,8 +363,39 @@ class USDSolarExporter:
             self.root_prim.SetCustomDataByKey("solar:epwFile", epw_path)
             print(f"EPW copied to: {epw_path}")
 
+    def export_context_prims(self, mesh_list, root="/Root/ContextGeometry", stage=None):
+        """
+        Write one triangulated prim per context mesh under root
+
+        Returns the total triangle count
+        """
+        used_names = set()
+        triangle_count = 0
+        for mesh in mesh_list:
+            name = Tf.MakeValidIdentifier(mesh.split("|")[-1])
+            unique = name
+            suffix = 1
+            while unique in used_names:
+                unique = f"{name}_{suffix}"
+                suffix += 1
+            used_names.add(unique)
+
+            mesh_data = self.process_context_mesh(mesh)
+            self.create_mesh_prim(
+                mesh_data, f"{root}/{unique}", include_face_data=False, stage=stage
+            )
+            triangle_count += len(mesh_data["face_vertex_counts"])
+        return triangle_count
+
     def export_solar_analysis_scene(
-        self, target_meshes, context_meshes, output_path, solar_params, epw_path
+        self,
+        target_meshes,
+        context_meshes,
+        output_path,
+        solar_params,
+        epw_path,
+        split_context=True,
+        context_layer=True,
     ):
         """
         Export solar analysis scene to USD
@@ -338,7 +403,14 @@ class USDSolarExporter:
         Args:
             target_meshes: List of mesh names to analyze (will be subdivided & combined)
             context_meshes: List of mesh names for context (used as-is)
-            output_path: Path to output USD file
+            output_path: Path to output USD file; the extension picks the format
+                (.usdc binary crate, the UI default, or .usda text)
+            split_context: One prim per context mesh (lets the server refit or
+                instance individual buildings) instead of a single Combined mesh
+            context_layer: Write the context into its own layer (see
+                context_layer_path) referenced from /Root/ContextGeometry. An
+                unchanged context then exports byte-identical, so the client
+                only uploads it once.
         """
         print("\n=== USD Solar Analysis Export ===")
         print(f"Target meshes: {target_meshes}")
@@ -359,13 +431,34 @@ class USDSolarExporter:
         # Process context geometry (all meshes combined and triangulated)
         print("\n3. Processing context geometry...")
         all_meshes = target_meshes + context_meshes
-        context_data = self.combine_and_process_meshes(all_meshes, triangulate=True)
-
-        # Create ContextGeometry prim
         print("\n4. Creating ContextGeometry in USD...")
-        self.create_mesh_prim(
-            context_data, "/Root/ContextGeometry/Combined", include_face_data=False
-        )
+        context_stage = self.stage
+        context_root = "/Root/ContextGeometry"
+        if context_layer:
+            layer_path = context_layer_path(output_path)
+            context_stage = self.new_stage(layer_path)
+            context_root = "/ContextGeometry"
+            context_stage.SetDefaultPrim(context_stage.DefinePrim(context_root))
+        if split_context:
+            context_triangles = self.export_context_prims(
+                all_meshes, root=context_root, stage=context_stage
+            )
+        else:
+            context_data = self.combine_and_process_meshes(all_meshes, triangulate=True)
+            self.create_mesh_prim(
+                context_data,
+                f"{context_root}/Combined",
+                include_face_data=False,
+                stage=context_stage,
+            )
+            context_triangles = len(context_data["face_vertex_counts"])
+        if context_layer:
+            context_stage.GetRootLayer().Save()
+            # Relative, so the layer pair can be moved (the server rebuilds it in a job dir)
+            self.stage.DefinePrim("/Root/ContextGeometry").GetReferences().AddReference(
+                f"./{os.path.basename(layer_path)}"
+            )
+            print(f"  Context layer: {layer_path}")
 
         # Create sun parameters attribute
         print("\n5. Adding analysis parameters to USD...")
@@ -376,14 +469,14 @@ class USDSolarExporter:
         self.stage.GetRootLayer().Save()
         print(f"\nSuccessfully exported to: {output_path}")
         print(f"  TargetMesh: {len(target_data['face_centers'])} faces")
-        print(f"  ContextGeometry: {len(context_data['face_vertex_counts'])} triangles")
+        print(f"  ContextGeometry: {context_triangles} triangles")
 
         return True
 
 
 # Convenience function
 def export_solar_scene(
-    target_meshes, context_meshes, output_path, solar_params, epw_path
+    target_meshes, context_meshes, output_path, solar_params, epw_path, context_layer=True
 ):
     """
     Export solar analysis scene
@@ -392,10 +485,16 @@ def export_solar_scene(
         target_meshes: List of mesh names to analyze
         context_meshes: List of context mesh names
         output_path: Output USD file path
+        context_layer: Context in its own layer at context_layer_path(output_path)
     """
     exporter = USDSolarExporter()
     return exporter.export_solar_analysis_scene(
-        target_meshes, context_meshes, output_path, solar_params, epw_path
+        target_meshes,
+        context_meshes,
+        output_path,
+        solar_params,
+        epw_path,
+        context_layer=context_layer,
     )
 
 